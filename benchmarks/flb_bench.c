@@ -0,0 +1,887 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Fluent Bit
+ *  ==========
+ *  Copyright (C) 2015-2016 Treasure Data Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+/*
+ * flb-bench: pipeline benchmark harness. It runs the engine in library
+ * mode with one input and one output, pushes a fixed number of records
+ * of a given shape and measures how they get out the other side:
+ *
+ *   input : lib     - producer threads, flb_lib_record_begin()
+ *           forward - producer threads sending Forward messages over TCP
+ *           random  - in_random samples, no latency information
+ *   output: lib     - records are counted in the out_lib chunk callback
+ *           forward - records are counted by a local Forward sink
+ *           null    - discarded, only the producers rate is known
+ *
+ * Every record carries a 'bench_ts' key with the monotonic time it was
+ * packed, so the end-to-end latency is known when it is delivered. The
+ * results are printed as a table and, with -j, appended as a JSON line
+ * to a file ('-' for stdout) to compare them across commits:
+ *
+ *   $ flb-bench -i lib -o forward -s nginx -n 2000000 -p 4 -l $(git rev-parse --short HEAD) -j results.json
+ *
+ * CPU time is the one of the whole process, producers and sinks included.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <msgpack.h>
+#include <fluent-bit.h>
+#include <fluent-bit/flb_pack.h>
+#include <fluent-bit/flb_version.h>
+
+#include "../tests/data/json_es.h"
+#include "../tests/data/json_small.h"
+#include "flb_bench_data.h"
+
+#define BENCH_RECORDS      1000000
+#define BENCH_BATCH        256
+#define BENCH_TIMEOUT      60
+#define BENCH_SAMPLES      1000000     /* latency samples kept */
+#define BENCH_SINK_CONNS   64
+
+#define BENCH_TS_KEY       "bench_ts"
+#define BENCH_TS_LEN       8
+
+struct bench_shape {
+    char *name;
+    char *json;
+};
+
+static struct bench_shape shapes[] = {
+    {"es",      JSON_ES},
+    {"small",   JSON_SMALL},
+    {"nginx",   JSON_NGINX},
+    {"escaped", JSON_ESCAPED},
+    {NULL, NULL}
+};
+
+struct bench {
+    /* options */
+    char *input;
+    char *output;
+    char *shape;
+    char *label;
+    char *json_file;
+    int records;
+    int producers;
+    int batch;
+    int flush;
+    int timeout;
+
+    /* record shape, the map of the packed JSON sample */
+    msgpack_unpacked sample;
+    msgpack_object *map;
+    char *sample_buf;
+    int sample_len;
+
+    /* pipeline */
+    flb_ctx_t *ctx;
+    flb_input_t *in;
+    int in_port;
+    int sink_fd;
+    int sink_port;
+    int sink_stop;
+    pthread_t sink_tid;
+
+    /* results, updated from the engine and the sink threads */
+    int sent;
+    int delivered;
+    uint64_t bytes;
+    uint64_t *lat;
+    int lat_count;
+    int lat_every;
+    struct timespec start;
+    struct timespec pushed;
+    struct timespec end;
+};
+
+struct producer {
+    int id;
+    int records;
+    pthread_t tid;
+    struct bench *b;
+};
+
+static uint64_t now_ns()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static double time_diff(struct timespec *start, struct timespec *end)
+{
+    return (end->tv_sec - start->tv_sec) +
+        (end->tv_nsec - start->tv_nsec) / 1000000000.0;
+}
+
+static int sample_load(struct bench *b)
+{
+    int i;
+    int ret;
+    int len;
+    size_t off = 0;
+    msgpack_object *root;
+
+    for (i = 0; shapes[i].name; i++) {
+        if (strcmp(shapes[i].name, b->shape) == 0) {
+            break;
+        }
+    }
+    if (!shapes[i].name) {
+        fprintf(stderr, "unknown shape '%s'\n", b->shape);
+        return -1;
+    }
+
+    ret = flb_pack_json(shapes[i].json, strlen(shapes[i].json),
+                        &b->sample_buf, &len);
+    if (ret != 0) {
+        fprintf(stderr, "could not pack shape '%s'\n", b->shape);
+        return -1;
+    }
+    b->sample_len = len;
+
+    msgpack_unpacked_init(&b->sample);
+    msgpack_unpack_next(&b->sample, b->sample_buf, len, &off);
+    root = &b->sample.data;
+    b->map = &root->via.array.ptr[1];
+
+    return 0;
+}
+
+/* Pack the map of the sample plus the timestamp key */
+static void record_pack_map(struct bench *b, msgpack_packer *pck)
+{
+    uint32_t i;
+    msgpack_object_kv *kv;
+
+    for (i = 0; i < b->map->via.map.size; i++) {
+        kv = &b->map->via.map.ptr[i];
+        msgpack_pack_object(pck, kv->key);
+        msgpack_pack_object(pck, kv->val);
+    }
+    msgpack_pack_str(pck, BENCH_TS_LEN);
+    msgpack_pack_str_body(pck, BENCH_TS_KEY, BENCH_TS_LEN);
+    msgpack_pack_uint64(pck, now_ns());
+}
+
+/*
+ * Account a delivered record: [time, map], the timestamp is the last key
+ * unless the shape was replaced by the input (random).
+ */
+static void record_delivered(struct bench *b, msgpack_object *rec,
+                             uint64_t now)
+{
+    int n;
+    int idx;
+    msgpack_object *map;
+    msgpack_object_kv *kv;
+
+    n = __atomic_add_fetch(&b->delivered, 1, __ATOMIC_RELAXED);
+    if (rec->type != MSGPACK_OBJECT_ARRAY || rec->via.array.size != 2) {
+        return;
+    }
+
+    map = &rec->via.array.ptr[1];
+    if (map->type != MSGPACK_OBJECT_MAP || map->via.map.size == 0) {
+        return;
+    }
+
+    kv = &map->via.map.ptr[map->via.map.size - 1];
+    if (kv->key.type != MSGPACK_OBJECT_STR ||
+        kv->key.via.str.size != BENCH_TS_LEN ||
+        strncmp(kv->key.via.str.ptr, BENCH_TS_KEY, BENCH_TS_LEN) != 0) {
+        return;
+    }
+
+    if (n % b->lat_every != 0) {
+        return;
+    }
+    idx = __atomic_fetch_add(&b->lat_count, 1, __ATOMIC_RELAXED);
+    if (idx < BENCH_SAMPLES) {
+        b->lat[idx] = now - kv->val.via.u64;
+    }
+}
+
+static void *producer_lib(void *data)
+{
+    int i;
+    msgpack_packer *pck;
+    struct flb_time tm;
+    struct producer *p = data;
+    struct bench *b = p->b;
+
+    for (i = 0; i < p->records; i++) {
+        flb_time_get(&tm);
+        pck = flb_lib_record_begin(b->in, &tm,
+                                   b->map->via.map.size + 1);
+        if (!pck) {
+            break;
+        }
+        record_pack_map(b, pck);
+        flb_lib_record_end(b->in);
+
+        if ((i + 1) % b->batch == 0) {
+            flb_lib_record_flush(b->in);
+        }
+    }
+    flb_lib_record_flush(b->in);
+    __atomic_add_fetch(&b->sent, i, __ATOMIC_RELAXED);
+
+    return NULL;
+}
+
+static int tcp_connect(int port)
+{
+    int i;
+    int fd;
+    struct sockaddr_in addr;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+
+    /* the listener may still be starting */
+    for (i = 0; i < 50; i++) {
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd == -1) {
+            perror("socket");
+            return -1;
+        }
+        if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) == 0) {
+            return fd;
+        }
+        close(fd);
+        usleep(100000);
+    }
+
+    fprintf(stderr, "could not connect to port %i\n", port);
+    return -1;
+}
+
+/* Send batches as Forward messages: [tag, [[time, map], ...]] */
+static void *producer_forward(void *data)
+{
+    int i;
+    int n;
+    int fd;
+    ssize_t ret;
+    size_t off;
+    msgpack_sbuffer sbuf;
+    msgpack_packer pck;
+    struct producer *p = data;
+    struct bench *b = p->b;
+
+    fd = tcp_connect(b->in_port);
+    if (fd == -1) {
+        return NULL;
+    }
+
+    msgpack_sbuffer_init(&sbuf);
+    msgpack_packer_init(&pck, &sbuf, msgpack_sbuffer_write);
+
+    for (i = 0; i < p->records; i += n) {
+        n = b->batch;
+        if (i + n > p->records) {
+            n = p->records - i;
+        }
+
+        msgpack_pack_array(&pck, 2);
+        msgpack_pack_str(&pck, 5);
+        msgpack_pack_str_body(&pck, "bench", 5);
+        msgpack_pack_array(&pck, n);
+        while (n-- > 0) {
+            msgpack_pack_array(&pck, 2);
+            msgpack_pack_uint64(&pck, time(NULL));
+            msgpack_pack_map(&pck, b->map->via.map.size + 1);
+            record_pack_map(b, &pck);
+        }
+        n = i + b->batch > p->records ? p->records - i : b->batch;
+
+        for (off = 0; off < sbuf.size; off += ret) {
+            ret = write(fd, sbuf.data + off, sbuf.size - off);
+            if (ret <= 0) {
+                perror("write");
+                goto out;
+            }
+        }
+        msgpack_sbuffer_clear(&sbuf);
+        __atomic_add_fetch(&b->sent, n, __ATOMIC_RELAXED);
+    }
+
+ out:
+    msgpack_sbuffer_destroy(&sbuf);
+    close(fd);
+    return NULL;
+}
+
+static int cb_lib(char *tag, void *buf, size_t size, void *data)
+{
+    uint64_t now;
+    void *record;
+    size_t len;
+    struct flb_lib_iter it;
+    struct bench *b = data;
+    (void) tag;
+
+    now = now_ns();
+    flb_lib_iter_init(&it, buf, size);
+    while (flb_lib_iter_next(&it, &record, &len)) {
+        record_delivered(b, &it.result.data, now);
+    }
+    flb_lib_iter_destroy(&it);
+
+    __atomic_add_fetch(&b->bytes, size, __ATOMIC_RELAXED);
+    clock_gettime(CLOCK_MONOTONIC, &b->end);
+
+    return FLB_LIB_OK;
+}
+
+/* Account the entries of a Forward message from out_forward */
+static void sink_message(struct bench *b, msgpack_object *msg, uint64_t now)
+{
+    uint32_t i;
+    msgpack_object *entries;
+
+    if (msg->type != MSGPACK_OBJECT_ARRAY || msg->via.array.size < 2) {
+        return;
+    }
+
+    entries = &msg->via.array.ptr[1];
+    if (entries->type == MSGPACK_OBJECT_ARRAY) {
+        for (i = 0; i < entries->via.array.size; i++) {
+            record_delivered(b, &entries->via.array.ptr[i], now);
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &b->end);
+}
+
+/* A local Forward server receiving the records from out_forward */
+static void *sink_run(void *data)
+{
+    int i;
+    int fd;
+    int nfds = 1;
+    ssize_t bytes;
+    uint64_t now;
+    struct pollfd pfd[BENCH_SINK_CONNS];
+    msgpack_unpacker *unp[BENCH_SINK_CONNS];
+    msgpack_unpacked result;
+    struct bench *b = data;
+
+    pfd[0].fd = b->sink_fd;
+    pfd[0].events = POLLIN;
+    msgpack_unpacked_init(&result);
+
+    while (!__atomic_load_n(&b->sink_stop, __ATOMIC_RELAXED)) {
+        if (poll(pfd, nfds, 100) <= 0) {
+            continue;
+        }
+
+        if ((pfd[0].revents & POLLIN) && nfds < BENCH_SINK_CONNS) {
+            fd = accept(b->sink_fd, NULL, NULL);
+            if (fd >= 0) {
+                pfd[nfds].fd = fd;
+                pfd[nfds].events = POLLIN;
+                pfd[nfds].revents = 0;
+                unp[nfds] = msgpack_unpacker_new(BENCH_BATCH * 1024);
+                nfds++;
+            }
+        }
+
+        for (i = 1; i < nfds; i++) {
+            if (!(pfd[i].revents & (POLLIN | POLLHUP))) {
+                continue;
+            }
+
+            msgpack_unpacker_reserve_buffer(unp[i], 65536);
+            bytes = read(pfd[i].fd, msgpack_unpacker_buffer(unp[i]),
+                         msgpack_unpacker_buffer_capacity(unp[i]));
+            if (bytes <= 0) {
+                close(pfd[i].fd);
+                msgpack_unpacker_free(unp[i]);
+                pfd[i] = pfd[nfds - 1];
+                unp[i] = unp[nfds - 1];
+                nfds--;
+                i--;
+                continue;
+            }
+            msgpack_unpacker_buffer_consumed(unp[i], bytes);
+            __atomic_add_fetch(&b->bytes, bytes, __ATOMIC_RELAXED);
+
+            now = now_ns();
+            while (msgpack_unpacker_next(unp[i], &result)) {
+                sink_message(b, &result.data, now);
+            }
+        }
+    }
+
+    for (i = 1; i < nfds; i++) {
+        close(pfd[i].fd);
+        msgpack_unpacker_free(unp[i]);
+    }
+    msgpack_unpacked_destroy(&result);
+
+    return NULL;
+}
+
+/* Listen on a random local port */
+static int tcp_listen(int *port)
+{
+    int fd;
+    int on = 1;
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd == -1) {
+        perror("socket");
+        return -1;
+    }
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) == -1 ||
+        listen(fd, 128) == -1) {
+        perror("bind");
+        close(fd);
+        return -1;
+    }
+    getsockname(fd, (struct sockaddr *) &addr, &len);
+    *port = ntohs(addr.sin_port);
+
+    return fd;
+}
+
+static int pipeline_create(struct bench *b, struct flb_lib_out_cb *cb)
+{
+    int fd;
+    char tmp[64];
+    flb_output_t *out;
+
+    b->ctx = flb_create();
+    if (!b->ctx) {
+        return -1;
+    }
+    snprintf(tmp, sizeof(tmp) - 1, "%i", b->flush);
+    flb_service_set(b->ctx, "Flush", tmp, NULL);
+
+    /* Input */
+    if (strcmp(b->input, "lib") == 0) {
+        b->in = flb_input(b->ctx, "lib", NULL);
+    }
+    else if (strcmp(b->input, "forward") == 0) {
+        /* a free port for in_forward */
+        fd = tcp_listen(&b->in_port);
+        if (fd == -1) {
+            return -1;
+        }
+        close(fd);
+        snprintf(tmp, sizeof(tmp) - 1, "forward://127.0.0.1:%i", b->in_port);
+        b->in = flb_input(b->ctx, tmp, NULL);
+
+        /* a whole message must fit in the connection buffer */
+        if (b->in) {
+            snprintf(tmp, sizeof(tmp) - 1, "%i",
+                     (b->batch * (b->sample_len + 32)) / 1024 + 32);
+            flb_input_set(b->in, "buffer_size", tmp, NULL);
+        }
+    }
+    else if (strcmp(b->input, "random") == 0) {
+        b->in = flb_input(b->ctx, "random", NULL);
+        if (b->in) {
+            snprintf(tmp, sizeof(tmp) - 1, "%i", b->records);
+            flb_input_set(b->in, "samples", tmp,
+                          "interval_sec", "0", "interval_nsec", "1000",
+                          NULL);
+        }
+    }
+    if (!b->in) {
+        fprintf(stderr, "invalid input '%s'\n", b->input);
+        return -1;
+    }
+    flb_input_set(b->in, "tag", "bench", NULL);
+
+    /* Output */
+    if (strcmp(b->output, "lib") == 0) {
+        cb->cb = cb_lib;
+        cb->data = b;
+        out = flb_output(b->ctx, "lib", cb);
+        if (out) {
+            flb_output_set(out, "mode", "chunk", NULL);
+        }
+    }
+    else if (strcmp(b->output, "forward") == 0) {
+        b->sink_fd = tcp_listen(&b->sink_port);
+        if (b->sink_fd == -1) {
+            return -1;
+        }
+        snprintf(tmp, sizeof(tmp) - 1, "forward://127.0.0.1:%i",
+                 b->sink_port);
+        out = flb_output(b->ctx, tmp, NULL);
+        pthread_create(&b->sink_tid, NULL, sink_run, b);
+    }
+    else if (strcmp(b->output, "null") == 0) {
+        out = flb_output(b->ctx, "null", NULL);
+    }
+    else {
+        out = NULL;
+    }
+    if (!out) {
+        fprintf(stderr, "invalid output '%s'\n", b->output);
+        return -1;
+    }
+    flb_output_set(out, "match", "bench", NULL);
+
+    return flb_start(b->ctx);
+}
+
+static void pipeline_run(struct bench *b)
+{
+    int i;
+    struct producer *p;
+    void *(*run)(void *) = NULL;
+
+    if (strcmp(b->input, "lib") == 0) {
+        run = producer_lib;
+    }
+    else if (strcmp(b->input, "forward") == 0) {
+        run = producer_forward;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &b->start);
+    b->end = b->start;
+
+    if (!run) {
+        /* in_random generates the records by itself */
+        b->sent = b->records;
+        b->pushed = b->start;
+        return;
+    }
+
+    p = calloc(b->producers, sizeof(struct producer));
+    if (!p) {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+
+    for (i = 0; i < b->producers; i++) {
+        p[i].id = i;
+        p[i].b = b;
+        p[i].records = b->records / b->producers;
+        if (i == 0) {
+            p[i].records += b->records % b->producers;
+        }
+        pthread_create(&p[i].tid, NULL, run, &p[i]);
+    }
+    for (i = 0; i < b->producers; i++) {
+        pthread_join(p[i].tid, NULL);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &b->pushed);
+    free(p);
+}
+
+/* Wait until every record was delivered, null output can't tell */
+static void pipeline_wait(struct bench *b)
+{
+    int i;
+
+    if (strcmp(b->output, "null") == 0) {
+        b->end = b->pushed;
+        return;
+    }
+
+    for (i = 0; i < b->timeout * 100; i++) {
+        if (__atomic_load_n(&b->delivered, __ATOMIC_RELAXED) >= b->sent) {
+            break;
+        }
+        usleep(10000);
+    }
+}
+
+static void pipeline_destroy(struct bench *b)
+{
+    flb_stop(b->ctx);
+    flb_destroy(b->ctx);
+
+    if (b->sink_tid) {
+        __atomic_store_n(&b->sink_stop, 1, __ATOMIC_RELAXED);
+        pthread_join(b->sink_tid, NULL);
+        close(b->sink_fd);
+    }
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(uint64_t *) a;
+    uint64_t y = *(uint64_t *) b;
+
+    return (x > y) - (x < y);
+}
+
+/* Latency percentile in milliseconds, -1 if unknown */
+static double latency_pct(struct bench *b, double pct)
+{
+    int n;
+    int idx;
+
+    n = b->lat_count < BENCH_SAMPLES ? b->lat_count : BENCH_SAMPLES;
+    if (n == 0) {
+        return -1;
+    }
+
+    idx = (int) (pct / 100.0 * (n - 1));
+    return b->lat[idx] / 1000000.0;
+}
+
+static void report(struct bench *b, struct rusage *r0, struct rusage *r1)
+{
+    int n;
+    int records;
+    double elapsed;
+    double cpu;
+    double p50;
+    double p99;
+    FILE *f;
+
+    n = b->lat_count < BENCH_SAMPLES ? b->lat_count : BENCH_SAMPLES;
+    qsort(b->lat, n, sizeof(uint64_t), cmp_u64);
+    p50 = latency_pct(b, 50);
+    p99 = latency_pct(b, 99);
+
+    records = strcmp(b->output, "null") == 0 ? b->sent : b->delivered;
+    elapsed = time_diff(&b->start, &b->end);
+    if (elapsed <= 0) {
+        elapsed = time_diff(&b->start, &b->pushed);
+    }
+
+    cpu = (r1->ru_utime.tv_sec - r0->ru_utime.tv_sec) +
+        (r1->ru_utime.tv_usec - r0->ru_utime.tv_usec) / 1000000.0 +
+        (r1->ru_stime.tv_sec - r0->ru_stime.tv_sec) +
+        (r1->ru_stime.tv_usec - r0->ru_stime.tv_usec) / 1000000.0;
+
+    printf("\n%s -> %s, shape %s, %i producers, flush %is\n",
+           b->input, b->output, b->shape, b->producers, b->flush);
+    printf("  records     : %i sent, %i delivered%s\n", b->sent, records,
+           records < b->sent ? " (timed out)" : "");
+    printf("  elapsed     : %.3f s (push %.3f s)\n", elapsed,
+           time_diff(&b->start, &b->pushed));
+    printf("  throughput  : %.0f records/s, %.2f MB/s\n",
+           records / elapsed, b->bytes / elapsed / (1024 * 1024));
+    if (p50 >= 0) {
+        printf("  latency     : p50 %.2f ms, p99 %.2f ms\n", p50, p99);
+    }
+    else {
+        printf("  latency     : n/a\n");
+    }
+    printf("  cpu         : %.3f us/record\n",
+           records ? cpu * 1000000.0 / records : 0);
+    printf("  peak rss    : %li KB\n", r1->ru_maxrss);
+
+    if (!b->json_file) {
+        return;
+    }
+
+    if (strcmp(b->json_file, "-") == 0) {
+        f = stdout;
+    }
+    else {
+        f = fopen(b->json_file, "a");
+        if (!f) {
+            perror("fopen");
+            return;
+        }
+    }
+
+    fprintf(f,
+            "{\"label\": \"%s\", \"version\": \"%s\", "
+            "\"input\": \"%s\", \"output\": \"%s\", \"shape\": \"%s\", "
+            "\"producers\": %i, \"flush\": %i, "
+            "\"sent\": %i, \"delivered\": %i, \"elapsed\": %.6f, "
+            "\"records_per_sec\": %.1f, \"bytes_per_sec\": %.1f, "
+            "\"latency_p50_ms\": %.3f, \"latency_p99_ms\": %.3f, "
+            "\"cpu_us_per_record\": %.4f, \"peak_rss_kb\": %li}\n",
+            b->label ? b->label : "", FLB_VERSION_STR,
+            b->input, b->output, b->shape,
+            b->producers, b->flush,
+            b->sent, records, elapsed,
+            records / elapsed, b->bytes / elapsed,
+            p50, p99,
+            records ? cpu * 1000000.0 / records : 0,
+            r1->ru_maxrss);
+
+    if (f != stdout) {
+        fclose(f);
+    }
+}
+
+static void bench_help(int rc)
+{
+    int i;
+
+    printf("Usage: flb-bench [OPTION]\n\n");
+    printf("  -i, --input=NAME\tlib, forward or random (default: lib)\n");
+    printf("  -o, --output=NAME\tlib, forward or null (default: lib)\n");
+    printf("  -s, --shape=NAME\trecord shape:");
+    for (i = 0; shapes[i].name; i++) {
+        printf(" %s", shapes[i].name);
+    }
+    printf(" (default: nginx)\n");
+    printf("  -n, --records=N\trecords to push (default: %i)\n",
+           BENCH_RECORDS);
+    printf("  -p, --producers=N\tproducer threads (default: 1)\n");
+    printf("  -b, --batch=N\t\trecords per chunk or message (default: %i)\n",
+           BENCH_BATCH);
+    printf("  -f, --flush=SECONDS\tengine flush interval (default: 1)\n");
+    printf("  -t, --timeout=SECONDS\tdelivery timeout (default: %i)\n",
+           BENCH_TIMEOUT);
+    printf("  -l, --label=TEXT\tlabel of the results, e.g. a commit\n");
+    printf("  -j, --json=FILE\tappend the results as JSON, '-' for stdout\n");
+    printf("  -h, --help\t\tprint this help\n");
+    exit(rc);
+}
+
+int main(int argc, char **argv)
+{
+    int opt;
+    struct bench b;
+    struct rusage r0;
+    struct rusage r1;
+    struct flb_lib_out_cb cb;
+
+    static const struct option long_opts[] = {
+        { "input",     required_argument, NULL, 'i' },
+        { "output",    required_argument, NULL, 'o' },
+        { "shape",     required_argument, NULL, 's' },
+        { "records",   required_argument, NULL, 'n' },
+        { "producers", required_argument, NULL, 'p' },
+        { "batch",     required_argument, NULL, 'b' },
+        { "flush",     required_argument, NULL, 'f' },
+        { "timeout",   required_argument, NULL, 't' },
+        { "label",     required_argument, NULL, 'l' },
+        { "json",      required_argument, NULL, 'j' },
+        { "help",      no_argument      , NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+
+    memset(&b, 0, sizeof(b));
+    b.input = "lib";
+    b.output = "lib";
+    b.shape = "nginx";
+    b.records = BENCH_RECORDS;
+    b.producers = 1;
+    b.batch = BENCH_BATCH;
+    b.flush = 1;
+    b.timeout = BENCH_TIMEOUT;
+
+    while ((opt = getopt_long(argc, argv, "i:o:s:n:p:b:f:t:l:j:h",
+                              long_opts, NULL)) != -1) {
+        switch (opt) {
+        case 'i':
+            b.input = optarg;
+            break;
+        case 'o':
+            b.output = optarg;
+            break;
+        case 's':
+            b.shape = optarg;
+            break;
+        case 'n':
+            b.records = atoi(optarg);
+            break;
+        case 'p':
+            b.producers = atoi(optarg);
+            break;
+        case 'b':
+            b.batch = atoi(optarg);
+            break;
+        case 'f':
+            b.flush = atoi(optarg);
+            break;
+        case 't':
+            b.timeout = atoi(optarg);
+            break;
+        case 'l':
+            b.label = optarg;
+            break;
+        case 'j':
+            b.json_file = optarg;
+            break;
+        case 'h':
+            bench_help(EXIT_SUCCESS);
+        default:
+            bench_help(EXIT_FAILURE);
+        }
+    }
+
+    if (b.records <= 0 || b.producers <= 0 || b.batch <= 0 || b.flush <= 0) {
+        bench_help(EXIT_FAILURE);
+    }
+    if (strcmp(b.input, "random") == 0) {
+        b.shape = "random";
+    }
+    else if (sample_load(&b) != 0) {
+        exit(EXIT_FAILURE);
+    }
+
+    b.lat = malloc(sizeof(uint64_t) * BENCH_SAMPLES);
+    if (!b.lat) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    b.lat_every = (b.records / BENCH_SAMPLES) + 1;
+
+    if (pipeline_create(&b, &cb) != 0) {
+        fprintf(stderr, "could not start the pipeline\n");
+        exit(EXIT_FAILURE);
+    }
+
+    getrusage(RUSAGE_SELF, &r0);
+    pipeline_run(&b);
+    pipeline_wait(&b);
+    getrusage(RUSAGE_SELF, &r1);
+
+    pipeline_destroy(&b);
+    report(&b, &r0, &r1);
+
+    if (b.map) {
+        msgpack_unpacked_destroy(&b.sample);
+        free(b.sample_buf);
+    }
+    free(b.lat);
+
+    return 0;
+}
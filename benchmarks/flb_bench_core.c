@@ -0,0 +1,545 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Fluent Bit
+ *  ==========
+ *  Copyright (C) 2015-2016 Treasure Data Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+/*
+ * Micro benchmarks for the core hot paths, every case measures a single
+ * function so a change can be verified in isolation:
+ *
+ * - pack_json     : flb_pack_json()
+ * - router_match  : flb_router_match()
+ * - dyntag_append : flb_input_dyntag_append()
+ * - task          : flb_task_create() + flb_task_destroy()
+ * - sha1          : flb_sha1_encode(), only with FLB_BUFFERING
+ * - thread        : co-routine create/resume/destroy and resume/yield
+ * - es_bulk       : out_es MessagePack to Bulk API JSON (es_bulk_append)
+ * - http_json     : out_http MessagePack to a JSON array
+ *                   (http_msgpack_to_json)
+ *
+ * usage: flb_bench_core [filter] [min seconds]
+ *
+ * Only the cases whose name contains 'filter' run. Like Google Benchmark,
+ * every case doubles its iterations until it runs for at least 'min
+ * seconds' (default 0.5) and reports the time per iteration.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <msgpack.h>
+#include <fluent-bit/flb_info.h>
+#include <fluent-bit/flb_log.h>
+#include <fluent-bit/flb_config.h>
+#include <fluent-bit/flb_input.h>
+#include <fluent-bit/flb_output.h>
+#include <fluent-bit/flb_router.h>
+#include <fluent-bit/flb_task.h>
+#include <fluent-bit/flb_thread.h>
+#include <fluent-bit/flb_pack.h>
+
+#ifdef FLB_HAVE_BUFFERING
+#include <fluent-bit/flb_sha1.h>
+#endif
+
+#ifdef FLB_BENCH_OUT_ES
+#include "../plugins/out_es/es.h"
+#include "../plugins/out_es/es_bulk.h"
+#endif
+
+#ifdef FLB_BENCH_OUT_HTTP
+#include "../plugins/out_http/http.h"
+#include "../plugins/out_http/http_json.h"
+#endif
+
+#include "../tests/data/json_es.h"
+#include "../tests/data/json_small.h"
+#include "flb_bench_data.h"
+
+#define BENCH_MIN_TIME    0.5
+#define BENCH_CHUNK       (64 * 1024)
+
+struct bench_case {
+    char *name;
+    char *arg;                   /* case argument: record, tag, size... */
+    void (*run)(struct bench_case *, long);
+    size_t bytes;                /* bytes processed per iteration       */
+};
+
+static double time_diff(struct timespec *start, struct timespec *end)
+{
+    return (end->tv_sec - start->tv_sec) +
+        (end->tv_nsec - start->tv_nsec) / 1000000000.0;
+}
+
+/* Pack a JSON record, exit on failure: the corpora are known to be valid */
+static char *record_pack(char *json, int *size)
+{
+    int ret;
+    char *buf;
+
+    ret = flb_pack_json(json, strlen(json), &buf, size);
+    if (ret != 0) {
+        fprintf(stderr, "pack failed: %i\n", ret);
+        exit(EXIT_FAILURE);
+    }
+    return buf;
+}
+
+/* Fill a chunk with copies of a packed record, like the engine flushes */
+static char *chunk_create(char *json, size_t size, size_t *out_size)
+{
+    int len;
+    char *buf;
+    char *chunk;
+    size_t off = 0;
+
+    chunk = malloc(size);
+    if (!chunk) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+
+    buf = record_pack(json, &len);
+    while (off + len <= size) {
+        memcpy(chunk + off, buf, len);
+        off += len;
+    }
+    free(buf);
+
+    *out_size = off;
+    return chunk;
+}
+
+/* flb_pack_json() */
+static void run_pack_json(struct bench_case *c, long iterations)
+{
+    int len;
+    long i;
+    char *buf;
+    size_t size = strlen(c->arg);
+
+    c->bytes = size;
+    for (i = 0; i < iterations; i++) {
+        if (flb_pack_json(c->arg, size, &buf, &len) == 0) {
+            free(buf);
+        }
+    }
+}
+
+/* flb_router_match(), the argument is 'tag match' */
+static void run_router_match(struct bench_case *c, long iterations)
+{
+    long i;
+    int n = 0;
+    char tag[128];
+    char *match;
+
+    strncpy(tag, c->arg, sizeof(tag) - 1);
+    tag[sizeof(tag) - 1] = '\0';
+    match = strchr(tag, ' ');
+    *match++ = '\0';
+
+    for (i = 0; i < iterations; i++) {
+        n += flb_router_match(tag, match);
+    }
+
+    /* keep the result alive */
+    if (n == -1) {
+        printf("%i\n", n);
+    }
+}
+
+/*
+ * flb_input_dyntag_append(), the buffers are released every 1024 records
+ * so the numbers don't depend on the sbuffer growth.
+ */
+static void run_dyntag_append(struct bench_case *c, long iterations)
+{
+    int len;
+    long i;
+    char *buf;
+    size_t off = 0;
+    msgpack_unpacked result;
+    struct flb_input_instance in;
+
+    memset(&in, '\0', sizeof(in));
+    strcpy(in.name, "bench.0");
+    mk_list_init(&in.dyntags);
+
+    buf = record_pack(c->arg, &len);
+    msgpack_unpacked_init(&result);
+    msgpack_unpack_next(&result, buf, len, &off);
+
+    c->bytes = len;
+    for (i = 0; i < iterations; i++) {
+        flb_input_dyntag_append(&in, "bench", 5, result.data);
+        if ((i & 1023) == 1023) {
+            flb_input_dyntag_exit(&in);
+        }
+    }
+    flb_input_dyntag_exit(&in);
+
+    msgpack_unpacked_destroy(&result);
+    free(buf);
+}
+
+/*
+ * Engine context for the task and thread cases: a configuration with an
+ * input instance routed to one output instance.
+ */
+struct bench_engine {
+    struct flb_config *config;
+    struct flb_input_instance in;
+    struct flb_output_instance out;
+    struct flb_router_path path;
+};
+
+static void engine_init(struct bench_engine *e)
+{
+    e->config = calloc(1, sizeof(struct flb_config));
+    if (!e->config) {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+    mk_list_init(&e->config->outputs);
+
+    memset(&e->in, '\0', sizeof(e->in));
+    strcpy(e->in.name, "bench.0");
+    mk_list_init(&e->in.routes);
+    mk_list_init(&e->in.tasks);
+    mk_list_init(&e->in.dyntags);
+
+    memset(&e->out, '\0', sizeof(e->out));
+    e->out.match = "*";
+    e->out.mask_id = 1;
+    mk_list_add(&e->out._head, &e->config->outputs);
+
+    e->path.ins = &e->out;
+    mk_list_add(&e->path._head, &e->in.routes);
+}
+
+/* flb_task_create() + flb_task_destroy(), static routes */
+static void run_task(struct bench_case *c, long iterations)
+{
+    int len;
+    long i;
+    char *buf;
+    char *record;
+    struct flb_task *task;
+    struct bench_engine e;
+
+    engine_init(&e);
+    record = record_pack(c->arg, &len);
+
+    for (i = 0; i < iterations; i++) {
+        /* the task owns the buffer */
+        buf = malloc(len);
+        if (!buf) {
+            perror("malloc");
+            exit(EXIT_FAILURE);
+        }
+        memcpy(buf, record, len);
+
+        task = flb_task_create(buf, len, &e.in, NULL, "bench", e.config);
+        if (!task) {
+            fprintf(stderr, "task create failed\n");
+            exit(EXIT_FAILURE);
+        }
+        flb_task_destroy(task);
+    }
+
+    free(record);
+    free(e.config);
+}
+
+#ifdef FLB_HAVE_BUFFERING
+/* flb_sha1_encode(), the argument is the data size */
+static void run_sha1(struct bench_case *c, long iterations)
+{
+    long i;
+    char *data;
+    size_t size;
+    unsigned char hash[20];
+
+    size = atoi(c->arg);
+    data = malloc(size);
+    if (!data) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    memset(data, 'x', size);
+
+    c->bytes = size;
+    for (i = 0; i < iterations; i++) {
+        flb_sha1_encode(data, size, hash);
+    }
+    free(data);
+}
+#endif
+
+#ifdef FLB_HAVE_FLUSH_UCONTEXT
+void flb_task_add_thread(struct flb_thread *thread,
+                         struct flb_task *task);
+
+static long th_switches;
+
+static void th_return()
+{
+}
+
+static void th_yield()
+{
+    long i;
+    struct flb_thread *th = pthread_getspecific(flb_thread_key);
+
+    for (i = 0; i < th_switches; i++) {
+        flb_thread_yield(th, FLB_FALSE);
+    }
+}
+
+/*
+ * Co-routines of a task as the engine handles them, 'create' runs one
+ * co-routine per iteration to the end, 'yield' resumes the same one.
+ */
+static void run_thread(struct bench_case *c, long iterations)
+{
+    int len;
+    long i;
+    char *buf;
+    struct flb_task *task;
+    struct flb_thread *th;
+    struct bench_engine e;
+
+    engine_init(&e);
+    flb_thread_prepare();
+
+    buf = record_pack(JSON_NGINX, &len);
+    task = flb_task_create(buf, len, &e.in, NULL, "bench", e.config);
+    if (!task) {
+        fprintf(stderr, "task create failed\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (strcmp(c->arg, "create") == 0) {
+        for (i = 0; i < iterations; i++) {
+            th = flb_thread_new();
+            if (!th) {
+                exit(EXIT_FAILURE);
+            }
+            th->task = task;
+            makecontext(&th->callee, th_return, 0);
+            flb_task_add_thread(th, task);
+            flb_thread_resume(th);
+            flb_thread_destroy(th);
+        }
+    }
+    else {
+        th_switches = iterations;
+        th = flb_thread_new();
+        if (!th) {
+            exit(EXIT_FAILURE);
+        }
+        th->task = task;
+        makecontext(&th->callee, th_yield, 0);
+        flb_task_add_thread(th, task);
+        for (i = 0; i <= iterations; i++) {
+            flb_thread_resume(th);
+        }
+        flb_thread_destroy(th);
+    }
+
+    flb_task_destroy(task);
+    free(e.config);
+}
+#endif
+
+#ifdef FLB_BENCH_OUT_ES
+/* es_format(): every record of a chunk to the Bulk API */
+static void run_es_bulk(struct bench_case *c, long iterations)
+{
+    long i;
+    char *chunk;
+    size_t off;
+    size_t size;
+    msgpack_unpacked result;
+    msgpack_object *root;
+    struct flb_time tm;
+    struct es_bulk *bulk;
+    struct flb_out_es_config ctx;
+
+    memset(&ctx, '\0', sizeof(ctx));
+    ctx.index = "fluentbit";
+    ctx.type  = "test";
+
+    chunk = chunk_create(c->arg, BENCH_CHUNK, &size);
+    c->bytes = size;
+
+    msgpack_unpacked_init(&result);
+    for (i = 0; i < iterations; i++) {
+        bulk = es_bulk_create(&ctx, size * 2);
+        if (!bulk) {
+            exit(EXIT_FAILURE);
+        }
+
+        off = 0;
+        while (msgpack_unpack_next(&result, chunk, size, &off)) {
+            root = &result.data;
+            flb_time_pop_from_msgpack(&tm, &root->via.array.ptr[0]);
+            es_bulk_append(bulk, &tm, &root->via.array.ptr[1]);
+        }
+        es_bulk_destroy(bulk);
+    }
+    msgpack_unpacked_destroy(&result);
+    free(chunk);
+}
+#endif
+
+#ifdef FLB_BENCH_OUT_HTTP
+/* out_http http_msgpack_to_json(): a chunk to a JSON array of records */
+static void run_http_json(struct bench_case *c, long iterations)
+{
+    long i;
+    char *chunk;
+    char *json;
+    size_t size;
+    uint64_t json_size;
+    struct flb_out_http_config ctx;
+
+    memset(&ctx, '\0', sizeof(ctx));
+    ctx.out_format = FLB_HTTP_OUT_JSON;
+
+    chunk = chunk_create(c->arg, BENCH_CHUNK, &size);
+    c->bytes = size;
+
+    for (i = 0; i < iterations; i++) {
+        json = http_msgpack_to_json(chunk, size, &json_size, &ctx);
+        if (!json) {
+            exit(EXIT_FAILURE);
+        }
+        free(json);
+    }
+    free(chunk);
+}
+#endif
+
+static struct bench_case cases[] = {
+    {"pack_json/es",          JSON_ES,      run_pack_json,     0},
+    {"pack_json/small",       JSON_SMALL,   run_pack_json,     0},
+    {"pack_json/nginx",       JSON_NGINX,   run_pack_json,     0},
+    {"pack_json/escaped",     JSON_ESCAPED, run_pack_json,     0},
+
+    {"router_match/exact",    "app.web.access app.web.access",
+     run_router_match, 0},
+    {"router_match/wildcard", "app.web.access app.*",
+     run_router_match, 0},
+    {"router_match/infix",    "app.web.access app.*.access",
+     run_router_match, 0},
+    {"router_match/miss",     "app.web.access kube.*.error",
+     run_router_match, 0},
+
+    {"dyntag_append/small",   JSON_SMALL,   run_dyntag_append, 0},
+    {"dyntag_append/nginx",   JSON_NGINX,   run_dyntag_append, 0},
+
+    {"task/create_destroy",   JSON_NGINX,   run_task,          0},
+
+#ifdef FLB_HAVE_BUFFERING
+    {"sha1/4k",               "4096",       run_sha1,          0},
+    {"sha1/64k",              "65536",      run_sha1,          0},
+#endif
+
+#ifdef FLB_HAVE_FLUSH_UCONTEXT
+    {"thread/create_resume_destroy", "create", run_thread,     0},
+    {"thread/resume_yield",   "yield",      run_thread,        0},
+#endif
+
+#ifdef FLB_BENCH_OUT_ES
+    {"es_bulk/es",            JSON_ES,      run_es_bulk,       0},
+    {"es_bulk/nginx",         JSON_NGINX,   run_es_bulk,       0},
+    {"es_bulk/escaped",       JSON_ESCAPED, run_es_bulk,       0},
+#endif
+
+#ifdef FLB_BENCH_OUT_HTTP
+    {"http_json/es",          JSON_ES,      run_http_json,     0},
+    {"http_json/nginx",       JSON_NGINX,   run_http_json,     0},
+    {"http_json/escaped",     JSON_ESCAPED, run_http_json,     0},
+#endif
+    {NULL, NULL, NULL, 0}
+};
+
+static void bench_run(struct bench_case *c, double min_time)
+{
+    long iterations = 1;
+    double elapsed;
+    double ns;
+    struct timespec start;
+    struct timespec end;
+
+    /* warm up, then grow the iterations until the case is long enough */
+    c->run(c, 1);
+    while (1) {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        c->run(c, iterations);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        elapsed = time_diff(&start, &end);
+        if (elapsed >= min_time || iterations >= (1L << 40)) {
+            break;
+        }
+        iterations *= 2;
+    }
+
+    ns = (elapsed * 1000000000.0) / iterations;
+    printf("%-30s %12.1f %12li", c->name, ns, iterations);
+    if (c->bytes > 0) {
+        printf(" %12.2f MB/s",
+               (c->bytes * (double) iterations) / elapsed / (1024 * 1024));
+    }
+    printf("\n");
+    fflush(stdout);
+}
+
+int main(int argc, char **argv)
+{
+    char *filter = NULL;
+    double min_time = BENCH_MIN_TIME;
+    struct bench_case *c;
+
+    if (argc > 1) {
+        filter = argv[1];
+    }
+    if (argc > 2) {
+        min_time = atof(argv[2]);
+    }
+
+    /* the core functions log through the engine context */
+    flb_log_init(FLB_LOG_STDERR, FLB_LOG_ERROR, NULL);
+
+    printf("%-30s %12s %12s %17s\n",
+           "benchmark", "ns/op", "iterations", "throughput");
+
+    for (c = cases; c->name; c++) {
+        if (filter && !strstr(c->name, filter)) {
+            continue;
+        }
+        bench_run(c, min_time);
+    }
+
+    return 0;
+}
@@ -0,0 +1,39 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Fluent Bit
+ *  ==========
+ *  Copyright (C) 2015-2016 Treasure Data Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef FLB_BENCH_DATA_H
+#define FLB_BENCH_DATA_H
+
+/* Log lines like the ones received by in_stdin or in_lib */
+#define JSON_NGINX                                                      \
+    "[1448403340, {\"remote\": \"192.168.1.10\", \"host\": \"-\", "     \
+    "\"user\": \"-\", \"method\": \"GET\", "                            \
+    "\"path\": \"/api/v1/items?page=2&sort=desc\", \"code\": 200, "     \
+    "\"size\": 5316, \"referer\": \"https://example.com/index.html\", " \
+    "\"agent\": \"Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 "  \
+    "(KHTML, like Gecko) Chrome/52.0.2743.116 Safari/537.36\", "        \
+    "\"request_time\": 0.003}]"
+
+#define JSON_ESCAPED                                                    \
+    "[1448403340, {\"log\": \"2016-08-24 10:31:02 ERROR \\\"worker\\\" " \
+    "failed\\n\\tat com.example.Worker.run(Worker.java:42)\\n\\tat "    \
+    "java.lang.Thread.run(Thread.java:745)\\n\", \"stream\": \"stderr\", " \
+    "\"pid\": 4321, \"unicode\": \"caf\\u00e9 \\ud83d\\ude00\"}]"
+
+#endif
@@ -0,0 +1,201 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Fluent Bit
+ *  ==========
+ *  Copyright (C) 2015-2016 Treasure Data Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+/*
+ * Gzip benchmark: compresses a chunk of MessagePack records with
+ * flb_gzip_compress() on every level and reports the throughput and the
+ * compression ratio. The 'init' column is the previous approach used by
+ * out_td, a new deflate stream for every chunk.
+ *
+ * usage: flb_bench_gzip [megabytes] [chunk kilobytes]
+ *
+ * Every level compresses the chunk repeatedly until the given amount of
+ * data (default 256MB) was processed, the default chunk is 64KB.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <zlib.h>
+
+#include <fluent-bit/flb_pack.h>
+#include <fluent-bit/flb_gzip.h>
+
+#include "../tests/data/json_es.h"
+#include "../tests/data/json_small.h"
+#include "flb_bench_data.h"
+
+#define BENCH_MEGABYTES   256
+#define BENCH_CHUNK_KB     64
+
+static char *records[] = {
+    JSON_NGINX,
+    JSON_ESCAPED,
+    JSON_SMALL,
+    JSON_ES,
+    NULL
+};
+
+/* Fill a chunk with packed records, like the ones the engine flushes */
+static char *chunk_create(size_t size, size_t *out_size)
+{
+    int i = 0;
+    int ret;
+    int len;
+    char *buf;
+    char *chunk;
+    size_t off = 0;
+
+    chunk = malloc(size);
+    if (!chunk) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+
+    while (1) {
+        ret = flb_pack_json(records[i], strlen(records[i]), &buf, &len);
+        if (ret != 0) {
+            fprintf(stderr, "pack failed: %i\n", ret);
+            exit(EXIT_FAILURE);
+        }
+        if (off + len > size) {
+            free(buf);
+            break;
+        }
+        memcpy(chunk + off, buf, len);
+        off += len;
+        free(buf);
+
+        if (!records[++i]) {
+            i = 0;
+        }
+    }
+
+    *out_size = off;
+    return chunk;
+}
+
+/* The previous out_td implementation, used as the baseline */
+static int gzip_init(void *data, size_t len, int level,
+                     void **out_data, size_t *out_len)
+{
+    int ret;
+    void *buf;
+    size_t size;
+    z_stream strm;
+
+    size = deflateBound(NULL, len) + 32;
+    buf = malloc(size);
+    if (!buf) {
+        return -1;
+    }
+
+    memset(&strm, 0, sizeof(strm));
+    deflateInit2(&strm, level, Z_DEFLATED, 31, 8, Z_DEFAULT_STRATEGY);
+    strm.next_in   = data;
+    strm.avail_in  = len;
+    strm.next_out  = buf;
+    strm.avail_out = size;
+    ret = deflate(&strm, Z_FINISH);
+    deflateEnd(&strm);
+    if (ret != Z_STREAM_END) {
+        free(buf);
+        return -1;
+    }
+
+    *out_data = buf;
+    *out_len = strm.total_out;
+    return 0;
+}
+
+static double time_diff(struct timespec *start, struct timespec *end)
+{
+    return (end->tv_sec - start->tv_sec) +
+        (end->tv_nsec - start->tv_nsec) / 1000000000.0;
+}
+
+static double bench_run(int (*compress)(void *, size_t, int, void **, size_t *),
+                        char *data, size_t len, int level, int iterations,
+                        size_t *out_len)
+{
+    int i;
+    int ret;
+    void *buf;
+    struct timespec start;
+    struct timespec end;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < iterations; i++) {
+        ret = compress(data, len, level, &buf, out_len);
+        if (ret != 0) {
+            fprintf(stderr, "compress failed: %i\n", ret);
+            exit(EXIT_FAILURE);
+        }
+        free(buf);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    return time_diff(&start, &end);
+}
+
+int main(int argc, char **argv)
+{
+    int level;
+    int iterations;
+    char *chunk;
+    size_t len;
+    size_t gz_len;
+    size_t total = BENCH_MEGABYTES;
+    size_t chunk_size = BENCH_CHUNK_KB;
+    double t_init;
+    double t_gzip;
+
+    if (argc > 1) {
+        total = atoi(argv[1]);
+    }
+    if (argc > 2) {
+        chunk_size = atoi(argv[2]);
+    }
+    total *= (1024 * 1024);
+    chunk_size *= 1024;
+
+    chunk = chunk_create(chunk_size, &len);
+    iterations = (total / len) + 1;
+
+    printf("chunk: %zu bytes\n", len);
+    printf("%-6s %10s %8s %14s %14s %8s\n",
+           "level", "gz bytes", "ratio", "init MB/s", "gzip MB/s", "speedup");
+
+    for (level = FLB_GZIP_LEVEL_MIN; level <= FLB_GZIP_LEVEL_MAX; level++) {
+        t_init = bench_run(gzip_init, chunk, len, level, iterations, &gz_len);
+        t_gzip = bench_run(flb_gzip_compress, chunk, len, level, iterations,
+                           &gz_len);
+
+        printf("%-6i %10zu %7.2fx %14.2f %14.2f %7.2fx\n",
+               level, gz_len, (double) len / gz_len,
+               (len * (double) iterations) / t_init / (1024 * 1024),
+               (len * (double) iterations) / t_gzip / (1024 * 1024),
+               t_init / t_gzip);
+        fflush(stdout);
+    }
+
+    free(chunk);
+    return 0;
+}
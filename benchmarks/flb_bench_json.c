@@ -0,0 +1,232 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Fluent Bit
+ *  ==========
+ *  Copyright (C) 2015-2016 Treasure Data Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+/*
+ * MessagePack to JSON benchmark: it compares flb_msgpack_record_to_json()
+ * against the cJSON based conversion previously used by the outputs.
+ *
+ * usage: flb_bench_json [megabytes]
+ *
+ * Every case is a chunk of 1000 records, it's converted repeatedly until
+ * the given amount of MessagePack data (default 256MB) was processed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <msgpack.h>
+#include <cjson/cjson.h>
+#include <fluent-bit/flb_pack.h>
+
+#include "../tests/data/json_es.h"
+#include "../tests/data/json_small.h"
+#include "flb_bench_data.h"
+
+#define BENCH_MEGABYTES   256
+#define BENCH_RECORDS     1000
+
+struct bench_case {
+    char *name;
+    char *json;
+};
+
+static struct bench_case cases[] = {
+    {"es",      JSON_ES},
+    {"small",   JSON_SMALL},
+    {"nginx",   JSON_NGINX},
+    {"escaped", JSON_ESCAPED},
+    {NULL, NULL}
+};
+
+/* The previous cJSON based implementation, used as the baseline */
+static char *cjson_format(char *data, size_t bytes, size_t *out_size)
+{
+    int i;
+    size_t off = 0;
+    char *key;
+    char *val;
+    char *out;
+    msgpack_unpacked result;
+    msgpack_object root;
+    msgpack_object map;
+    msgpack_object *k;
+    msgpack_object *v;
+    json_t *j_arr;
+    json_t *j_map;
+
+    msgpack_unpacked_init(&result);
+    j_arr = json_create_array();
+    while (msgpack_unpack_next(&result, data, bytes, &off)) {
+        root = result.data;
+        j_map = json_create_object();
+        map = root.via.array.ptr[1];
+
+        json_add_to_object(j_map, "date",
+                           json_create_number(root.via.array.ptr[0].via.u64));
+        for (i = 0; i < (int) map.via.map.size; i++) {
+            k = &map.via.map.ptr[i].key;
+            v = &map.via.map.ptr[i].val;
+
+            key = strndup(k->via.bin.ptr, k->via.bin.size);
+            if (v->type == MSGPACK_OBJECT_NIL) {
+                json_add_to_object(j_map, key, json_create_null());
+            }
+            else if (v->type == MSGPACK_OBJECT_BOOLEAN) {
+                json_add_to_object(j_map, key,
+                                   json_create_bool(v->via.boolean));
+            }
+            else if (v->type == MSGPACK_OBJECT_POSITIVE_INTEGER) {
+                json_add_to_object(j_map, key,
+                                   json_create_number(v->via.u64));
+            }
+            else if (v->type == MSGPACK_OBJECT_NEGATIVE_INTEGER) {
+                json_add_to_object(j_map, key,
+                                   json_create_number(v->via.i64));
+            }
+            else if (v->type == MSGPACK_OBJECT_FLOAT) {
+                json_add_to_object(j_map, key,
+                                   json_create_number(v->via.f64));
+            }
+            else if (v->type == MSGPACK_OBJECT_BIN ||
+                     v->type == MSGPACK_OBJECT_STR) {
+                val = strndup(v->via.bin.ptr, v->via.bin.size);
+                json_add_to_object(j_map, key, json_create_string(val));
+                free(val);
+            }
+            free(key);
+        }
+        json_add_to_array(j_arr, j_map);
+    }
+    msgpack_unpacked_destroy(&result);
+
+    out = json_print_unformatted(j_arr);
+    json_delete(j_arr);
+    *out_size = strlen(out);
+
+    return out;
+}
+
+static char *flb_format(char *data, size_t bytes, size_t *out_size)
+{
+    int n = 0;
+    size_t off = 0;
+    msgpack_unpacked result;
+    msgpack_object root;
+    msgpack_sbuffer out;
+    struct flb_time tm;
+    struct flb_pack_json_fmt fmt;
+
+    flb_pack_json_fmt_init(&fmt);
+    msgpack_sbuffer_init(&out);
+    msgpack_sbuffer_write(&out, "[", 1);
+
+    msgpack_unpacked_init(&result);
+    while (msgpack_unpack_next(&result, data, bytes, &off)) {
+        root = result.data;
+        if (n++ > 0) {
+            msgpack_sbuffer_write(&out, ",", 1);
+        }
+        flb_time_pop_from_msgpack(&tm, &root.via.array.ptr[0]);
+        flb_msgpack_record_to_json(&out, &tm, &root.via.array.ptr[1], &fmt);
+    }
+    msgpack_unpacked_destroy(&result);
+    msgpack_sbuffer_write(&out, "]", 1);
+
+    *out_size = out.size;
+    return out.data;
+}
+
+static double time_diff(struct timespec *start, struct timespec *end)
+{
+    return (end->tv_sec - start->tv_sec) +
+        (end->tv_nsec - start->tv_nsec) / 1000000000.0;
+}
+
+static double bench_run(char *(*format)(char *, size_t, size_t *),
+                        char *data, size_t bytes, int iterations)
+{
+    int i;
+    char *buf;
+    size_t size;
+    struct timespec start;
+    struct timespec end;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < iterations; i++) {
+        buf = format(data, bytes, &size);
+        free(buf);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    return time_diff(&start, &end);
+}
+
+int main(int argc, char **argv)
+{
+    int i;
+    int ret;
+    int size;
+    int iterations;
+    char *rec;
+    size_t total = BENCH_MEGABYTES;
+    double t_cjson;
+    double t_flb;
+    msgpack_sbuffer chunk;
+    struct bench_case *c;
+
+    if (argc > 1) {
+        total = atoi(argv[1]);
+    }
+    total *= (1024 * 1024);
+
+    printf("%-10s %8s %14s %14s %14s %8s\n",
+           "case", "bytes", "cjson MB/s", "flb MB/s", "flb rec/s", "speedup");
+
+    for (c = cases; c->name; c++) {
+        ret = flb_pack_json(c->json, strlen(c->json), &rec, &size);
+        if (ret != 0) {
+            fprintf(stderr, "could not pack '%s'\n", c->name);
+            exit(EXIT_FAILURE);
+        }
+
+        /* Compose a chunk of records */
+        msgpack_sbuffer_init(&chunk);
+        for (i = 0; i < BENCH_RECORDS; i++) {
+            msgpack_sbuffer_write(&chunk, rec, size);
+        }
+        free(rec);
+
+        iterations = (total / chunk.size) + 1;
+        t_cjson = bench_run(cjson_format, chunk.data, chunk.size, iterations);
+        t_flb = bench_run(flb_format, chunk.data, chunk.size, iterations);
+
+        printf("%-10s %8zu %14.2f %14.2f %14.0f %7.2fx\n",
+               c->name, chunk.size / BENCH_RECORDS,
+               (chunk.size * (double) iterations) / t_cjson / (1024 * 1024),
+               (chunk.size * (double) iterations) / t_flb / (1024 * 1024),
+               (BENCH_RECORDS * (double) iterations) / t_flb,
+               t_cjson / t_flb);
+        fflush(stdout);
+        msgpack_sbuffer_destroy(&chunk);
+    }
+
+    return 0;
+}
@@ -0,0 +1,273 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Fluent Bit
+ *  ==========
+ *  Copyright (C) 2015-2016 Treasure Data Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+/*
+ * Library mode ingestion benchmark: application threads push events into
+ * the 'lib' input with the three available interfaces:
+ *
+ * - json   : flb_lib_push(), one JSON record per call through the channel
+ * - msgpack: flb_lib_push_msgpack(), batches of packed records
+ * - record : flb_lib_record_begin() / flb_lib_record_end()
+ *
+ * usage: flb_bench_lib [events] [max threads]
+ *
+ * Every interface runs with 1, 2, 4... up to 'max threads' (default 16)
+ * producers pushing 'events' in total (default 2000000). The 'push' column
+ * is the rate seen by the producers, 'delivered' the rate until the last
+ * event reached the 'lib' output, it includes the flush interval.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include <fluent-bit.h>
+#include <fluent-bit/flb_pack.h>
+
+#include "flb_bench_data.h"
+
+#define BENCH_EVENTS      2000000
+#define BENCH_THREADS     16
+#define BENCH_BATCH       64
+
+#define MODE_JSON         0
+#define MODE_MSGPACK      1
+#define MODE_RECORD       2
+
+static char *modes[] = {"json", "msgpack", "record"};
+
+/* The record in every format */
+static char *json = JSON_NGINX;
+static size_t json_len;
+static char *mp_record;
+static char *mp_batch;
+static size_t mp_batch_size;
+static msgpack_object mp_map;
+static msgpack_unpacked mp_result;
+
+static int delivered;
+
+struct producer {
+    int mode;
+    int events;
+    flb_input_t *in;
+    pthread_t tid;
+};
+
+static double time_diff(struct timespec *start, struct timespec *end)
+{
+    return (end->tv_sec - start->tv_sec) +
+        (end->tv_nsec - start->tv_nsec) / 1000000000.0;
+}
+
+static int cb_chunk(char *tag, void *buf, size_t size, void *data)
+{
+    int n = 0;
+    void *record;
+    size_t len;
+    struct flb_lib_iter it;
+    (void) tag;
+    (void) data;
+
+    flb_lib_iter_init(&it, buf, size);
+    while (flb_lib_iter_next(&it, &record, &len)) {
+        n++;
+    }
+    flb_lib_iter_destroy(&it);
+
+    __atomic_add_fetch(&delivered, n, __ATOMIC_RELAXED);
+    return FLB_LIB_OK;
+}
+
+/* Pack the JSON record once, the msgpack mode pushes batches of it */
+static void records_create()
+{
+    int i;
+    int ret;
+    int len;
+    char *buf;
+    size_t off = 0;
+
+    json_len = strlen(json);
+
+    ret = flb_pack_json(json, json_len, &buf, &len);
+    if (ret != 0) {
+        fprintf(stderr, "pack failed: %i\n", ret);
+        exit(EXIT_FAILURE);
+    }
+
+    mp_batch_size = len * BENCH_BATCH;
+    mp_batch = malloc(mp_batch_size);
+    if (!mp_batch) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    for (i = 0; i < BENCH_BATCH; i++) {
+        memcpy(mp_batch + (i * len), buf, len);
+    }
+
+    /* The map of the record for the builder, it references 'buf' */
+    msgpack_unpacked_init(&mp_result);
+    msgpack_unpack_next(&mp_result, buf, len, &off);
+    mp_map = mp_result.data.via.array.ptr[1];
+    mp_record = buf;
+}
+
+static void *producer_run(void *data)
+{
+    int i;
+    int n;
+    msgpack_packer *pck;
+    struct flb_time tm;
+    struct producer *p = data;
+
+    if (p->mode == MODE_JSON) {
+        for (n = 0; n < p->events; n++) {
+            flb_lib_push(p->in, json, json_len);
+        }
+    }
+    else if (p->mode == MODE_MSGPACK) {
+        for (n = 0; n < p->events; n += BENCH_BATCH) {
+            flb_lib_push_msgpack(p->in, mp_batch, mp_batch_size);
+        }
+    }
+    else {
+        flb_time_set(&tm, 1448403340, 0);
+        for (n = 0; n < p->events; n++) {
+            pck = flb_lib_record_begin(p->in, &tm, mp_map.via.map.size);
+            for (i = 0; i < mp_map.via.map.size; i++) {
+                msgpack_pack_object(pck, mp_map.via.map.ptr[i].key);
+                msgpack_pack_object(pck, mp_map.via.map.ptr[i].val);
+            }
+            flb_lib_record_end(p->in);
+        }
+        flb_lib_record_flush(p->in);
+    }
+
+    return NULL;
+}
+
+static void bench_run(int mode, int threads, int events)
+{
+    int i;
+    int total;
+    flb_ctx_t *ctx;
+    flb_input_t *in;
+    flb_output_t *out;
+    struct flb_lib_out_cb cb = {cb_chunk, NULL};
+    struct producer *p;
+    struct timespec start;
+    struct timespec pushed;
+    struct timespec end;
+
+    ctx = flb_create();
+    flb_service_set(ctx, "Flush", "1", NULL);
+    in = flb_input(ctx, "lib", NULL);
+    flb_input_set(in, "tag", "bench", NULL);
+    out = flb_output(ctx, "lib", &cb);
+    flb_output_set(out, "match", "bench", "mode", "chunk", NULL);
+    if (flb_start(ctx) != 0) {
+        fprintf(stderr, "could not start the engine\n");
+        exit(EXIT_FAILURE);
+    }
+
+    p = calloc(threads, sizeof(struct producer));
+    if (!p) {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+
+    /* msgpack batches are not split, round the events per thread */
+    total = 0;
+    for (i = 0; i < threads; i++) {
+        p[i].mode = mode;
+        p[i].in = in;
+        p[i].events = events / threads;
+        if (mode == MODE_MSGPACK) {
+            p[i].events = ((p[i].events + BENCH_BATCH - 1) / BENCH_BATCH) *
+                BENCH_BATCH;
+        }
+        total += p[i].events;
+    }
+
+    __atomic_store_n(&delivered, 0, __ATOMIC_RELAXED);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < threads; i++) {
+        pthread_create(&p[i].tid, NULL, producer_run, &p[i]);
+    }
+    for (i = 0; i < threads; i++) {
+        pthread_join(p[i].tid, NULL);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &pushed);
+
+    /* Wait for the engine to deliver everything (or give up after 60s) */
+    for (i = 0; i < 60000; i++) {
+        if (__atomic_load_n(&delivered, __ATOMIC_RELAXED) >= total) {
+            break;
+        }
+        usleep(1000);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    printf("%-8s %7i %14.0f %14.0f %10s\n",
+           modes[mode], threads,
+           total / time_diff(&start, &pushed),
+           total / time_diff(&start, &end),
+           delivered == total ? "ok" : "missing");
+    fflush(stdout);
+
+    flb_stop(ctx);
+    flb_destroy(ctx);
+    free(p);
+}
+
+int main(int argc, char **argv)
+{
+    int mode;
+    int threads;
+    int events = BENCH_EVENTS;
+    int max_threads = BENCH_THREADS;
+
+    if (argc > 1) {
+        events = atoi(argv[1]);
+    }
+    if (argc > 2) {
+        max_threads = atoi(argv[2]);
+    }
+
+    records_create();
+
+    printf("events: %i, record: %zu bytes JSON\n", events, json_len);
+    printf("%-8s %7s %14s %14s %10s\n",
+           "mode", "threads", "push ev/s", "delivered ev/s", "check");
+
+    for (mode = MODE_JSON; mode <= MODE_RECORD; mode++) {
+        for (threads = 1; threads <= max_threads; threads *= 2) {
+            bench_run(mode, threads, events);
+        }
+    }
+
+    msgpack_unpacked_destroy(&mp_result);
+    free(mp_record);
+    free(mp_batch);
+    return 0;
+}
@@ -0,0 +1,203 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Fluent Bit
+ *  ==========
+ *  Copyright (C) 2015-2016 Treasure Data Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+/*
+ * JSON to MessagePack benchmark: it compares flb_pack_json() against the
+ * previous jsmn based tokenizer + packer using representative log lines.
+ *
+ * usage: flb_bench_pack [megabytes]
+ *
+ * Every case is packed repeatedly until the given amount of JSON data
+ * (default 256MB) was processed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <msgpack.h>
+#include <jsmn/jsmn.h>
+#include <fluent-bit/flb_pack.h>
+
+#include "../tests/data/json_es.h"
+#include "../tests/data/json_long.h"
+#include "../tests/data/json_small.h"
+#include "flb_bench_data.h"
+
+#define BENCH_MEGABYTES   256
+
+struct bench_case {
+    char *name;
+    char *json;
+};
+
+static struct bench_case cases[] = {
+    {"es",      JSON_ES},
+    {"small",   JSON_SMALL},
+    {"long",    JSON_LONG},
+    {"nginx",   JSON_NGINX},
+    {"escaped", JSON_ESCAPED},
+    {NULL, NULL}
+};
+
+/* The previous jsmn based implementation, used as the baseline */
+static int jsmn_pack(char *js, size_t len, char **buffer, int *size)
+{
+    int i;
+    int n;
+    int ret;
+    int flen;
+    int tokens_size = 256;
+    char *p;
+    void *tmp;
+    jsmn_parser parser;
+    jsmntok_t *tokens;
+    jsmntok_t *t;
+    msgpack_packer pck;
+    msgpack_sbuffer sbuf;
+
+    tokens = calloc(1, sizeof(jsmntok_t) * tokens_size);
+    jsmn_init(&parser);
+    ret = jsmn_parse(&parser, js, len, tokens, tokens_size);
+    while (ret == JSMN_ERROR_NOMEM) {
+        n = tokens_size += 256;
+        tmp = realloc(tokens, sizeof(jsmntok_t) * n);
+        tokens = tmp;
+        ret = jsmn_parse(&parser, js, len, tokens, tokens_size);
+    }
+    if (ret < 0) {
+        free(tokens);
+        return -1;
+    }
+
+    msgpack_sbuffer_init(&sbuf);
+    msgpack_packer_init(&pck, &sbuf, msgpack_sbuffer_write);
+
+    for (i = 0; i < ret; i++) {
+        t = &tokens[i];
+        flen = (t->end - t->start);
+
+        switch (t->type) {
+        case JSMN_OBJECT:
+            msgpack_pack_map(&pck, t->size);
+            break;
+        case JSMN_ARRAY:
+            msgpack_pack_array(&pck, t->size);
+            break;
+        case JSMN_STRING:
+            msgpack_pack_bin(&pck, flen);
+            msgpack_pack_bin_body(&pck, js + t->start, flen);
+            break;
+        case JSMN_PRIMITIVE:
+            p = js + t->start;
+            if (*p == 'f') {
+                msgpack_pack_false(&pck);
+            }
+            else if (*p == 't') {
+                msgpack_pack_true(&pck);
+            }
+            else if (*p == 'n') {
+                msgpack_pack_nil(&pck);
+            }
+            else if (memchr(p, '.', flen)) {
+                msgpack_pack_double(&pck, atof(p));
+            }
+            else {
+                msgpack_pack_int64(&pck, atol(p));
+            }
+            break;
+        default:
+            break;
+        }
+    }
+    free(tokens);
+
+    *size = sbuf.size;
+    *buffer = malloc(sbuf.size);
+    memcpy(*buffer, sbuf.data, sbuf.size);
+    msgpack_sbuffer_destroy(&sbuf);
+
+    return 0;
+}
+
+static double time_diff(struct timespec *start, struct timespec *end)
+{
+    return (end->tv_sec - start->tv_sec) +
+        (end->tv_nsec - start->tv_nsec) / 1000000000.0;
+}
+
+static double bench_run(int (*pack)(char *, size_t, char **, int *),
+                        char *json, size_t len, int iterations)
+{
+    int i;
+    int ret;
+    int size;
+    char *buf;
+    struct timespec start;
+    struct timespec end;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < iterations; i++) {
+        ret = pack(json, len, &buf, &size);
+        if (ret != 0) {
+            fprintf(stderr, "pack failed: %i\n", ret);
+            exit(EXIT_FAILURE);
+        }
+        free(buf);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    return time_diff(&start, &end);
+}
+
+int main(int argc, char **argv)
+{
+    int iterations;
+    size_t len;
+    size_t total = BENCH_MEGABYTES;
+    double t_jsmn;
+    double t_pack;
+    struct bench_case *c;
+
+    if (argc > 1) {
+        total = atoi(argv[1]);
+    }
+    total *= (1024 * 1024);
+
+    printf("%-10s %8s %14s %14s %14s %8s\n",
+           "case", "bytes", "jsmn MB/s", "pack MB/s", "pack rec/s", "speedup");
+
+    for (c = cases; c->name; c++) {
+        len = strlen(c->json);
+        iterations = (total / len) + 1;
+        t_jsmn = bench_run(jsmn_pack, c->json, len, iterations);
+        t_pack = bench_run(flb_pack_json, c->json, len, iterations);
+
+        printf("%-10s %8zu %14.2f %14.2f %14.0f %7.2fx\n",
+               c->name, len,
+               (len * (double) iterations) / t_jsmn / (1024 * 1024),
+               (len * (double) iterations) / t_pack / (1024 * 1024),
+               iterations / t_pack,
+               t_jsmn / t_pack);
+        fflush(stdout);
+    }
+
+    return 0;
+}
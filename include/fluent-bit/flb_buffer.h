@@ -60,6 +60,9 @@ struct flb_buffer_worker {
     /* event loop */
     struct mk_event_loop *evl;
 
+    /* push and pop requests sent by the engine, not handled yet */
+    int pending;
+
     struct mk_list _head;
     struct mk_list requests;
     struct flb_buffer *parent;
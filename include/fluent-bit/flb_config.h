@@ -25,6 +25,7 @@
 
 #include <fluent-bit/flb_info.h>
 #include <fluent-bit/flb_log.h>
+#include <fluent-bit/flb_time.h>
 #include <fluent-bit/flb_task_map.h>
 
 #ifdef FLB_HAVE_TLS
@@ -56,8 +57,18 @@ struct flb_config {
     int daemon;         /* Run as a daemon ?              */
     int shutdown_fd;    /* Shutdown FD, 5 seconds         */
 
+    /* Latency tracing: trace 1 of every N tasks, 0 disables it */
+    int latency_sampling;
+    unsigned int latency_count;
+
+    /*
+     * Engine clock: refreshed once per event loop iteration so collectors
+     * timestamp their records without a clock call per record. It's only
+     * valid from the engine thread.
+     */
+    struct flb_time clock;
+
 #ifdef FLB_HAVE_STATS
-    int stats_fd;       /* Stats FD, 1 second             */
     struct flb_stats *stats_ctx;
 #endif
 
@@ -114,7 +125,7 @@ struct flb_config {
 #endif
 
     struct mk_list sched_requests;
-    struct flb_task_map tasks_map[2048];
+    struct flb_task_map tasks_map[FLB_TASK_MAP_SIZE];
 };
 
 struct flb_config *flb_config_init();
@@ -138,6 +149,7 @@ enum conf_type {
 #define FLB_CONF_STR_FLUSH    "Flush"
 #define FLB_CONF_STR_DAEMON   "Daemon"
 #define FLB_CONF_STR_LOGLEVEL "Log_Level"
+#define FLB_CONF_STR_LAT_SAMPLING "Latency_Sampling"
 #ifdef FLB_HAVE_HTTP
 #define FLB_CONF_STR_HTTP_MONITOR "HTTP_Monitor"
 #define FLB_CONF_STR_HTTP_PORT    "HTTP_Port"
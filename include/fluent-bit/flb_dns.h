@@ -0,0 +1,90 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Fluent Bit
+ *  ==========
+ *  Copyright (C) 2015-2016 Treasure Data Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef FLB_DNS_H
+#define FLB_DNS_H
+
+#include <time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <fluent-bit/flb_log.h>
+
+/* Max number of addresses kept for a host */
+#define FLB_DNS_MAX_ADDRS       8
+
+/*
+ * TTL (seconds) for results without one: entries from /etc/hosts or
+ * getaddrinfo(3). A TTL of -1 means the entry never expires (numeric
+ * addresses).
+ */
+#define FLB_DNS_TTL_DEFAULT    30
+#define FLB_DNS_TTL_MIN         1
+
+/* Resolved addresses for a host */
+struct flb_dns_addrs {
+    int count;
+    int ttl;
+    struct sockaddr_storage addr[FLB_DNS_MAX_ADDRS];
+    socklen_t addr_len[FLB_DNS_MAX_ADDRS];
+};
+
+/*
+ * Per upstream cache: the addresses are used in round-robin, every new
+ * connection starts with the address following the one used last time.
+ */
+struct flb_dns_cache {
+    int index;
+    time_t expire;
+    struct flb_dns_addrs addrs;
+};
+
+/*
+ * Asynchronous request: the lookup runs in a helper thread which closes
+ * the write end of the 'ch' pipe once it's done, so any number of callers
+ * can wait for the read end to become readable (EOF) from the event loop.
+ * The request is reference counted, the thread holds one reference.
+ */
+struct flb_dns_request {
+    char *host;
+    int port;
+    int ch[2];
+    int ret;
+    int refs;
+    struct flb_log *log;          /* caller log context for the thread */
+    struct flb_dns_addrs addrs;
+};
+
+int flb_dns_numeric(char *host, int port, struct flb_dns_addrs *out);
+int flb_dns_resolve(char *host, int port, struct flb_dns_addrs *out);
+int flb_dns_servers_set(struct sockaddr_in *servers, int count);
+
+struct flb_dns_request *flb_dns_request_create(char *host, int port);
+int flb_dns_request_wait(struct flb_dns_request *req);
+void flb_dns_request_get(struct flb_dns_request *req);
+void flb_dns_request_put(struct flb_dns_request *req);
+
+void flb_dns_cache_init(struct flb_dns_cache *cache);
+int flb_dns_cache_valid(struct flb_dns_cache *cache, time_t now);
+void flb_dns_cache_set(struct flb_dns_cache *cache,
+                       struct flb_dns_addrs *addrs, time_t now);
+void flb_dns_cache_invalidate(struct flb_dns_cache *cache);
+struct sockaddr *flb_dns_cache_next(struct flb_dns_cache *cache,
+                                    socklen_t *len);
+
+#endif
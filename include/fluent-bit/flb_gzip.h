@@ -0,0 +1,37 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Fluent Bit
+ *  ==========
+ *  Copyright (C) 2015-2016 Treasure Data Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef FLB_GZIP_H
+#define FLB_GZIP_H
+
+#include <stddef.h>
+#include <sys/uio.h>
+
+/* Compression levels: 1 (fast) to 9 (best), -1 is the zlib default (6) */
+#define FLB_GZIP_LEVEL_DEFAULT   -1
+#define FLB_GZIP_LEVEL_MIN        1
+#define FLB_GZIP_LEVEL_MAX        9
+
+int flb_gzip_level(char *str);
+int flb_gzip_compress(void *data, size_t len, int level,
+                      void **out_data, size_t *out_len);
+int flb_gzip_compressv(struct iovec *iov, int iovcnt, int level,
+                       void **out_data, size_t *out_len);
+
+#endif
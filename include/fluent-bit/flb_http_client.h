@@ -26,6 +26,10 @@
 /* Buffer size */
 #define FLB_HTTP_BUF_SIZE 2048
 
+/* Response buffer: initial size, default limit and max size kept per conn */
+#define FLB_HTTP_DATA_SIZE        4096
+#define FLB_HTTP_DATA_SIZE_MAX    (4 * 1024 * 1024)
+
 /* HTTP Methods */
 #define FLB_HTTP_GET         0
 #define FLB_HTTP_POST        1
@@ -37,11 +41,42 @@
 #define FLB_HTTP_PROXY_HTTP       1
 #define FLB_HTTP_PROXY_HTTPS      2
 
+/* Response parser return values */
+#define FLB_HTTP_MORE             0   /* need more data    */
+#define FLB_HTTP_OK               1   /* response complete */
+#define FLB_HTTP_ERROR           -1   /* invalid response  */
+
+/* Response body framing */
+#define FLB_HTTP_BODY_NONE        0   /* HEAD, 1xx, 204 and 304 */
+#define FLB_HTTP_BODY_LENGTH      1   /* Content-Length          */
+#define FLB_HTTP_BODY_CHUNKED     2   /* chunked encoding        */
+#define FLB_HTTP_BODY_EOF         3   /* until the peer closes   */
+
 struct flb_http_response {
     int status;
-    int content_length;
-    char  data[1024 * 4];   /* 4 KB */
+    int content_length;     /* -1 if not set                      */
+    int body_type;          /* FLB_HTTP_BODY_*                    */
+    int keepalive;          /* the connection can be reused       */
+    int complete;           /* the whole response was read        */
+
+    /*
+     * Raw response. For chunked encoding the body is decoded in place, so
+     * 'payload' always points to the plain body, it's NULL terminated
+     * once the response is complete.
+     */
+    char *data;
     size_t data_len;
+    size_t data_size;
+    size_t data_size_max;   /* growth limit, see flb_http_buffer_size() */
+
+    size_t headers_len;     /* status line, headers and ending CRLF */
+    char *payload;
+    size_t payload_size;
+
+    /* Parser state */
+    int state;
+    size_t parse_off;
+    size_t chunk_left;
 };
 
 /* It hold information about a possible HTTP proxy set by the caller */
@@ -81,6 +116,7 @@ struct flb_http_client *flb_http_client(struct flb_upstream_conn *u_conn,
 int flb_http_add_header(struct flb_http_client *c,
                         char *key, size_t key_len,
                         char *val, size_t val_len);
+int flb_http_buffer_size(struct flb_http_client *c, size_t size);
 int flb_http_do(struct flb_http_client *c, size_t *bytes);
 void flb_http_client_destroy(struct flb_http_client *c);
 
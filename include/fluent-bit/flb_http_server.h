@@ -10,6 +10,9 @@
   "  \"version\": \"v" FLB_VERSION_STR "\",\n" \
   "  \"build_flags\": \"" FLB_INFO_FLAGS "\"\n}"
 
+#define FLB_HTTP_PROMETHEUS_TYPE  "text/plain; version=0.0.4"
+
 int flb_http_server_start(struct flb_config *config);
+int flb_http_server_stop();
 
 #endif
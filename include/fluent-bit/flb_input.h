@@ -24,6 +24,8 @@
 #include <msgpack.h>
 #include <fluent-bit/flb_config.h>
 #include <fluent-bit/flb_network.h>
+#include <fluent-bit/flb_mpsc.h>
+#include <fluent-bit/flb_metrics.h>
 
 #define FLB_COLLECT_TIME        1
 #define FLB_COLLECT_FD_EVENT    2
@@ -76,12 +78,28 @@ struct flb_input_plugin {
      */
     int (*cb_ingest) (void *in_context, void *, size_t);
 
+    /*
+     * Optional: the engine is stopping, move the records the plugin still
+     * holds into the instance buffers so the last flush delivers them.
+     */
+    int (*cb_pre_exit) (void *, struct flb_config *);
+
     /* Exit */
     int (*cb_exit) (void *, struct flb_config *);
 
     struct mk_list _head;
 };
 
+/*
+ * A chunk of MessagePack records enqueued by an application thread in
+ * library mode, see flb_lib_push_msgpack().
+ */
+struct flb_lib_chunk {
+    char *buf;
+    size_t size;
+    struct flb_mpsc_node _node;
+};
+
 /*
  * For input plugins which adds FLB_INPUT_DYN_TAG to the registration flag,
  * they usually report a set of new records under a dynamic Tags. Internally
@@ -148,9 +166,19 @@ struct flb_input_instance {
      */
     void *data;
 
-#ifdef FLB_HAVE_STATS
-    int stats_fd;
-#endif
+    /*
+     * Library mode: sealed chunks pushed by application threads, the
+     * 'lib' input plugin consumes them on every flush.
+     */
+    struct flb_mpsc_queue lib_chunks;
+    size_t lib_queued;                   /* bytes in lib_chunks (atomic) */
+    size_t lib_queue_limit;              /* EAGAIN above it, 0: no limit */
+
+    /* Records and bytes ingested */
+    struct flb_metrics metrics;
+
+    /* First collection since the last dispatch (latency tracing) */
+    uint64_t t_collect;
 
     struct mk_list _head;                /* link to config->inputs     */
     struct mk_list routes;               /* flb_router_path's list     */
@@ -210,6 +238,7 @@ int flb_input_set_collector_socket(struct flb_input_instance *in,
                                    struct flb_config *config);
 void flb_input_initialize_all(struct flb_config *config);
 void flb_input_pre_run_all(struct flb_config *config);
+void flb_input_pre_exit_all(struct flb_config *config);
 void flb_input_exit_all(struct flb_config *config);
 
 /* Dyntag handlers */
@@ -219,6 +248,9 @@ int flb_input_dyntag_destroy(struct flb_input_dyntag *dt);
 int flb_input_dyntag_append(struct flb_input_instance *in,
                             char *tag, size_t tag_len,
                             msgpack_object data);
+int flb_input_dyntag_append_raw(struct flb_input_instance *in,
+                                char *tag, size_t tag_len,
+                                void *buf, size_t size);
 void *flb_input_dyntag_flush(struct flb_input_dyntag *dt, size_t *size);
 void flb_input_dyntag_exit(struct flb_input_instance *in);
 
@@ -20,6 +20,7 @@
 #ifndef FLB_IO_H
 #define FLB_IO_H
 
+#include <sys/uio.h>
 #include <mk_core.h>
 
 #include <fluent-bit/flb_info.h>
@@ -39,9 +40,13 @@
 
 int flb_io_net_connect(struct flb_upstream_conn *u_conn,
                        struct flb_thread *th);
+int flb_io_net_wait(struct flb_thread *th, struct flb_upstream_conn *u_conn,
+                    int timeout);
 
 int flb_io_net_write(struct flb_upstream_conn *u, void *data,
                      size_t len, size_t *out_len);
+int flb_io_net_writev(struct flb_upstream_conn *u, struct iovec *iov,
+                      int iovcnt, size_t *out_len);
 ssize_t flb_io_net_read(struct flb_upstream_conn *u, void *buf, size_t len);
 
 #endif
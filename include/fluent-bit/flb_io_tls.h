@@ -26,27 +26,35 @@
 #include <mbedtls/ssl.h>
 #include <mbedtls/entropy.h>
 #include <mbedtls/ctr_drbg.h>
+#include <monkey/mk_core.h>
 
 #define FLB_TLS_CA_ROOT          1
 #define FLB_TLS_CERT             2
 #define FLB_TLS_PRIV_KEY         4
 
-/* mbedTLS library context */
+/*
+ * mbedTLS library context: certificates, keys and the client configuration
+ * are loaded once and shared by every output instance using the same
+ * files, the context is released when its last user is gone.
+ */
 struct flb_tls_context {
     int verify;                    /* FLB_TRUE | FLB_FALSE      */
     uint16_t    certs_set;         /* CA_ROOT | CERT | PRIV_KEY */
+    int users;                     /* output instances using it */
+    char *id;                      /* verify mode and file names */
     mbedtls_x509_crt ca_cert;      /* CA Root      */
     mbedtls_x509_crt cert;         /* Certificate  */
     mbedtls_pk_context priv_key;   /* Private key  */
     mbedtls_dhm_context dhm;
     mbedtls_entropy_context entropy;
     mbedtls_ctr_drbg_context ctr_drbg;
+    mbedtls_ssl_config conf;       /* client configuration     */
+    struct mk_list _head;
 };
 
 /* TLS connected session */
 struct flb_tls_session {
     struct mbedtls_ssl_context ssl;
-    struct mbedtls_ssl_config conf;
 };
 
 /* TLS instance, library context + active sessions */
@@ -54,8 +62,12 @@ struct flb_tls {
     struct flb_tls_context *context;
 };
 
-struct flb_tls_context *flb_tls_context_new();
+struct flb_tls_context *flb_tls_context_new(int verify,
+                                            char *ca_file, char *crt_file,
+                                            char *key_file, char *key_passwd);
 void flb_tls_context_destroy(struct flb_tls_context *ctx);
+int tls_session_destroy(struct flb_tls_session *session);
+void flb_tls_resume_destroy(mbedtls_ssl_session *resume);
 int net_io_tls_handshake(void *u_conn, void *th);
 
 #endif /* FLB_HAVE_TLS */
@@ -20,8 +20,11 @@
 #ifndef FLB_LIB_H
 #define FLB_LIB_H
 
+#include <time.h>
+#include <msgpack.h>
 #include <fluent-bit/flb_macros.h>
 #include <fluent-bit/flb_config.h>
+#include <fluent-bit/flb_time.h>
 
 /* Library mode context data */
 struct flb_lib_ctx {
@@ -35,6 +38,33 @@ typedef struct flb_lib_ctx         flb_ctx_t;
 typedef struct flb_input_instance  flb_input_t;
 typedef struct flb_output_instance flb_output_t;
 
+/*
+ * Output 'lib' in chunk mode ('Mode chunk'): flb_output() takes a
+ * 'struct flb_lib_out_cb' and the callback receives every chunk once,
+ * records are MessagePack [time, map] arrays (see flb_lib_iter_next()).
+ *
+ * The buffer is borrowed until the callback returns. With
+ * 'Chunk_Ownership transfer' a callback returning FLB_LIB_OK owns the
+ * buffer and must release it with free(), it's only copied if other
+ * outputs share the chunk.
+ */
+#define FLB_LIB_RETRY   -2       /* flush the chunk again later */
+#define FLB_LIB_ERROR   -1       /* discard the chunk           */
+#define FLB_LIB_OK       0
+
+struct flb_lib_out_cb {
+    int (*cb)(char *tag, void *buf, size_t size, void *data);
+    void *data;
+};
+
+/* Iterate the records of a chunk without copying them */
+struct flb_lib_iter {
+    char *buf;
+    size_t size;
+    size_t off;
+    msgpack_unpacked result;     /* the last record, unpacked */
+};
+
 FLB_EXPORT flb_ctx_t *flb_create();
 FLB_EXPORT void flb_destroy(flb_ctx_t *ctx);
 FLB_EXPORT flb_input_t *flb_input(flb_ctx_t *ctx, char *input, void *data);
@@ -50,6 +80,51 @@ FLB_EXPORT int flb_stop(flb_ctx_t *ctx);
 /* data ingestion for "lib" input instance */
 FLB_EXPORT int flb_lib_push(flb_input_t *input, void *data, size_t len);
 
+/*
+ * MessagePack ingestion for "lib" input instance, it can be called from
+ * any number of application threads: records skip the JSON parser and
+ * reach the engine through a lock-free queue.
+ *
+ * flb_lib_push_msgpack() enqueues a copy of one or more packed
+ * [time, map] records. The record builder packs into a buffer local to
+ * the calling thread, the time is packed as an EventTime:
+ *
+ *   flb_time_get(&tm);
+ *   pck = flb_lib_record_begin(input, &tm, 1);
+ *   msgpack_pack_str(pck, 3);
+ *   msgpack_pack_str_body(pck, "key", 3);
+ *   ...
+ *   flb_lib_record_end(input);
+ *
+ * the buffer is enqueued every FLB_LIB_CHUNK_SIZE bytes, a thread must
+ * call flb_lib_record_flush() when it stops producing, pending records
+ * are discarded when it exits.
+ *
+ * The bytes waiting for the engine are limited by the 'queue_limit'
+ * property of the instance (KB, FLB_LIB_QUEUE_LIMIT by default, 0 for no
+ * limit). Above it flb_lib_push_msgpack() and flb_lib_record_end() return
+ * -1 with errno set to EAGAIN and flb_lib_record_begin() returns NULL: the
+ * data was not enqueued, records already packed by the thread are kept,
+ * the caller should wait for the next flush and try again.
+ */
+#define FLB_LIB_CHUNK_SIZE  65536
+#define FLB_LIB_QUEUE_LIMIT (64 * 1024 * 1024)
+
+FLB_EXPORT int flb_lib_push_msgpack(flb_input_t *input, void *data, size_t len);
+FLB_EXPORT msgpack_packer *flb_lib_record_begin(flb_input_t *input,
+                                                struct flb_time *time,
+                                                int map_size);
+FLB_EXPORT int flb_lib_record_end(flb_input_t *input);
+FLB_EXPORT int flb_lib_record_flush(flb_input_t *input);
+
+/* records of a chunk delivered by the "lib" output */
+FLB_EXPORT void flb_lib_iter_init(struct flb_lib_iter *it,
+                                  void *buf, size_t size);
+FLB_EXPORT int flb_lib_iter_next(struct flb_lib_iter *it,
+                                 void **record, size_t *size);
+FLB_EXPORT void flb_lib_iter_destroy(struct flb_lib_iter *it);
+
 int flb_lib_config_file(struct flb_lib_ctx *ctx, char *path);
+void flb_lib_input_exit(flb_input_t *input);
 
 #endif
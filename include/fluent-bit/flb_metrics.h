@@ -0,0 +1,201 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Fluent Bit
+ *  ==========
+ *  Copyright (C) 2015-2016 Treasure Data Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef FLB_METRICS_H
+#define FLB_METRICS_H
+
+#include <time.h>
+#include <inttypes.h>
+#include <msgpack.h>
+
+/*
+ * Metrics registry: every input and output instance owns a set of
+ * counters, gauges and a flush latency histogram. Writers update them
+ * with relaxed atomic operations (no locks, no syscalls), readers like the
+ * stats server or the HTTP server load the values when they need them, a
+ * snapshot may be slightly inconsistent across metrics but never torn.
+ */
+
+/* Metric types */
+#define FLB_METRIC_COUNTER            0
+#define FLB_METRIC_GAUGE              1
+#define FLB_METRIC_SUMMARY            2
+
+/* Instance types */
+#define FLB_METRICS_INPUT             1
+#define FLB_METRICS_OUTPUT            2
+
+/* Metrics ids */
+#define FLB_METRIC_RECORDS            0  /* records ingested / delivered */
+#define FLB_METRIC_BYTES              1  /* bytes ingested / delivered   */
+#define FLB_METRIC_ERRORS             2  /* flushes failed               */
+#define FLB_METRIC_RETRIES            3  /* flushes retried              */
+#define FLB_METRIC_RETRIES_FAILED     4  /* retries not scheduled        */
+#define FLB_METRIC_DROPPED            5  /* records discarded            */
+#define FLB_METRIC_RETRIES_PENDING    6  /* gauge: retries scheduled     */
+#define FLB_METRICS_SIZE              7
+
+/*
+ * Flush latency histogram: bucket 'i' counts the flushes that took less
+ * than 2^i microseconds (the first one is < 1us), the last bucket counts
+ * everything above ~8 seconds. The count is only set on the copies taken
+ * by flb_metrics_hist_get().
+ */
+#define FLB_METRICS_HIST_SIZE        25
+
+struct flb_metrics_hist {
+    uint64_t count;
+    uint64_t sum;                        /* microseconds */
+    uint64_t buckets[FLB_METRICS_HIST_SIZE];
+};
+
+/*
+ * Latency tracing: when enabled (Latency_Sampling), one of every N tasks
+ * records when its data was collected and dispatched, when the output
+ * coroutine started, wrote its first byte and returned. The intervals
+ * feed the stages below.
+ */
+#define FLB_METRIC_LAT_COLLECT        0  /* collected -> dispatched (inputs) */
+#define FLB_METRIC_LAT_START          1  /* dispatched -> coroutine started  */
+#define FLB_METRIC_LAT_WRITE          2  /* started -> first byte written    */
+#define FLB_METRIC_LAT_RETURN         3  /* first byte -> FLB_OUTPUT_RETURN  */
+#define FLB_METRIC_LAT_TOTAL          4  /* collected -> delivered           */
+#define FLB_METRICS_LAT_SIZE          5
+
+/*
+ * Latency histograms are log-linear (HDR style): every power of two is
+ * split in FLB_METRICS_HDR_SUB linear buckets, the memory is fixed and the
+ * relative error stays under 1/FLB_METRICS_HDR_SUB. Values are recorded in
+ * microseconds, the last bucket holds everything above ~4.7 hours.
+ */
+#define FLB_METRICS_HDR_SUB_BITS      3
+#define FLB_METRICS_HDR_SUB           (1 << FLB_METRICS_HDR_SUB_BITS)
+#define FLB_METRICS_HDR_SIZE          256
+
+struct flb_metrics_hdr {
+    uint64_t sum;                        /* microseconds */
+    uint64_t buckets[FLB_METRICS_HDR_SIZE];
+};
+
+/* Summary of a latency histogram, values in microseconds */
+struct flb_metrics_lat {
+    uint64_t count;
+    uint64_t sum;
+    uint64_t p50;
+    uint64_t p90;
+    uint64_t p99;
+    uint64_t max;
+};
+
+struct flb_metrics {
+    int type;                            /* FLB_METRICS_INPUT or OUTPUT */
+    char *title;                         /* instance name               */
+    uint64_t val[FLB_METRICS_SIZE];
+    struct flb_metrics_hist flush;       /* flush latency (outputs)     */
+    struct flb_metrics_hdr latency[FLB_METRICS_LAT_SIZE];
+};
+
+/* Connection pool metrics, the sum of the upstreams of an output */
+#define FLB_METRIC_UP_CONNECTIONS     0  /* gauge: open connections      */
+#define FLB_METRIC_UP_HITS            1  /* connections reused           */
+#define FLB_METRIC_UP_MISSES          2  /* connections created          */
+#define FLB_METRIC_UP_EVICTIONS       3  /* idle connections dropped     */
+#define FLB_METRIC_UP_WAITS           4  /* waits for a free connection  */
+#define FLB_METRIC_UP_TIMEOUTS        5  /* I/O operations timed out     */
+#define FLB_METRIC_UP_TLS_FULL        6  /* full TLS handshakes          */
+#define FLB_METRIC_UP_TLS_RESUMED     7  /* resumed TLS handshakes       */
+#define FLB_METRICS_UP_SIZE           8
+
+/* Copy of the metrics of one instance */
+struct flb_metrics_snapshot_ins {
+    int type;
+    char *title;
+    int upstreams;                           /* number of upstreams    */
+    uint64_t val[FLB_METRICS_SIZE];
+    uint64_t upstream[FLB_METRICS_UP_SIZE];
+    struct flb_metrics_hist flush;
+    struct flb_metrics_lat latency[FLB_METRICS_LAT_SIZE];
+};
+
+/*
+ * A snapshot copies the registry plus a few engine wide values, it's
+ * taken by the thread serving the metrics without stopping the engine,
+ * then rendered as JSON or in the Prometheus text format.
+ */
+struct flb_metrics_snapshot {
+    int tasks;                               /* tasks in the task map   */
+    int tasks_max;                           /* size of the task map    */
+    int buffer_queue;                        /* buffer requests pending */
+    int latency_sampling;                    /* 1 of N tasks traced     */
+    int n_ins;
+    struct flb_metrics_snapshot_ins *ins;
+};
+
+struct flb_config;
+
+static inline void flb_metrics_add(struct flb_metrics *m, int id,
+                                   uint64_t val)
+{
+    __atomic_add_fetch(&m->val[id], val, __ATOMIC_RELAXED);
+}
+
+static inline void flb_metrics_sub(struct flb_metrics *m, int id,
+                                   uint64_t val)
+{
+    __atomic_sub_fetch(&m->val[id], val, __ATOMIC_RELAXED);
+}
+
+static inline uint64_t flb_metrics_get(struct flb_metrics *m, int id)
+{
+    return __atomic_load_n(&m->val[id], __ATOMIC_RELAXED);
+}
+
+/* Monotonic time in nanoseconds, used to measure the flush latency */
+static inline uint64_t flb_metrics_time()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+}
+
+void flb_metrics_init(struct flb_metrics *m, int type, char *title);
+char *flb_metrics_name(int id);
+int flb_metrics_enabled(struct flb_metrics *m, int id);
+void flb_metrics_hist_add(struct flb_metrics_hist *h, uint64_t ns);
+uint64_t flb_metrics_hist_bound(int bucket);
+void flb_metrics_hist_get(struct flb_metrics_hist *h,
+                          struct flb_metrics_hist *out);
+char *flb_metrics_lat_name(int id);
+int flb_metrics_lat_enabled(struct flb_metrics *m, int id);
+void flb_metrics_hdr_add(struct flb_metrics_hdr *h, uint64_t ns);
+uint64_t flb_metrics_hdr_bound(int bucket);
+void flb_metrics_hdr_get(struct flb_metrics_hdr *h,
+                         struct flb_metrics_lat *out);
+
+int flb_metrics_snapshot_create(struct flb_config *config,
+                                struct flb_metrics_snapshot *s);
+void flb_metrics_snapshot_destroy(struct flb_metrics_snapshot *s);
+int flb_metrics_snapshot_json(struct flb_metrics_snapshot *s,
+                              msgpack_sbuffer *out);
+int flb_metrics_snapshot_prometheus(struct flb_metrics_snapshot *s,
+                                    msgpack_sbuffer *out);
+int flb_metrics_dump_json(struct flb_config *config, msgpack_sbuffer *out);
+
+#endif
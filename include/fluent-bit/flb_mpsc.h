@@ -0,0 +1,49 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Fluent Bit
+ *  ==========
+ *  Copyright (C) 2015-2016 Treasure Data Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef FLB_MPSC_H
+#define FLB_MPSC_H
+
+/*
+ * Lock-free intrusive multiple-producer single-consumer queue. Any number
+ * of threads can push nodes concurrently, a single thread (usually the
+ * engine) pops them. Nodes must be embedded in the caller structure:
+ *
+ *   struct my_item {
+ *       ...
+ *       struct flb_mpsc_node _node;
+ *   };
+ *
+ * and recovered with mk_list_entry(node, struct my_item, _node).
+ */
+struct flb_mpsc_node {
+    struct flb_mpsc_node *next;
+};
+
+struct flb_mpsc_queue {
+    struct flb_mpsc_node *head;   /* producers side */
+    struct flb_mpsc_node *tail;   /* consumer side  */
+    struct flb_mpsc_node stub;
+};
+
+void flb_mpsc_init(struct flb_mpsc_queue *q);
+void flb_mpsc_push(struct flb_mpsc_queue *q, struct flb_mpsc_node *node);
+struct flb_mpsc_node *flb_mpsc_pop(struct flb_mpsc_queue *q);
+
+#endif
@@ -43,6 +43,7 @@ int flb_net_host_set(char *plugin_name, struct flb_net_host *host, char *address
 
 /* TCP options */
 int flb_net_socket_reset(int sockfd);
+int flb_net_socket_reuseport(int sockfd);
 int flb_net_socket_tcp_nodelay(int sockfd);
 int flb_net_socket_nonblocking(int sockfd);
 int flb_net_socket_tcp_fastopen(int sockfd);
@@ -52,6 +53,7 @@ int flb_net_socket_create(int family, int nonblock);
 int flb_net_tcp_connect(char *host, unsigned long port);
 int flb_net_tcp_fd_connect(int fd, char *host, unsigned long port);
 int flb_net_server(char *port, char *listen_addr);
+int flb_net_server_reuseport(char *port, char *listen_addr);
 int flb_net_bind(int socket_fd, const struct sockaddr *addr,
                  socklen_t addrlen, int backlog);
 int flb_net_accept(int server_fd);
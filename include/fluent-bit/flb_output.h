@@ -27,7 +27,8 @@
 #include <fluent-bit/flb_info.h>
 #include <fluent-bit/flb_bits.h>
 #include <fluent-bit/flb_io.h>
-#include <fluent-bit/flb_stats.h>
+#include <fluent-bit/flb_metrics.h>
+#include <fluent-bit/flb_pack.h>
 #include <fluent-bit/flb_config.h>
 #include <fluent-bit/flb_network.h>
 #include <fluent-bit/flb_engine.h>
@@ -107,6 +108,15 @@ struct flb_output_instance {
     int use_tls;                         /* bool, try to use TLS for I/O */
     char *match;                         /* match rule for tag/routing   */
 
+    /* Upstream connections */
+    int keepalive;                       /* bool, reuse connections      */
+    int keepalive_idle_timeout;          /* idle secs before closing     */
+    int keepalive_max_lifetime;          /* max secs a conn is reused    */
+    int max_connections;                 /* max open conns (0: no limit) */
+    int connect_timeout;                 /* connect secs (0: no limit)   */
+    int write_timeout;                   /* write secs (0: no limit)     */
+    int read_timeout;                    /* read secs (0: no limit)      */
+
 #ifdef FLB_HAVE_TLS
     int tls_verify;                      /* Verify certs (default: true) */
     char *tls_ca_file;                   /* CA root cert                 */
@@ -145,7 +155,8 @@ struct flb_output_instance {
     /* IO upstream context, if flags & (FLB_OUTPUT_TCP | FLB_OUTPUT TLS)) */
     struct flb_upstream *upstream;
 
-
+    /* Upstreams set up by the plugin, see flb_output_upstream_set() */
+    struct mk_list upstreams;
 
     /*
      * The threads_queue is the head for the linked list that holds co-routines
@@ -153,9 +164,8 @@ struct flb_output_instance {
      */
     struct mk_list th_queue;
 
-#ifdef FLB_HAVE_STATS
-    int stats_fd;
-#endif
+    /* Records delivered, errors, retries and flush latency */
+    struct flb_metrics metrics;
 
 #ifdef FLB_HAVE_TLS
     struct flb_tls tls;
@@ -187,6 +197,19 @@ struct flb_thread *flb_output_thread(struct flb_task *task,
     th->output_buffer = buf;
     th->task = task;
     th->config = config;
+    th->size = size;
+    th->start = flb_metrics_time();
+    th->trace = task->trace;
+    th->t_start = 0;
+    th->t_write = 0;
+
+    /* A retry may carry only a part of the task records */
+    if (buf == task->buf) {
+        th->records = task->records;
+    }
+    else {
+        th->records = flb_mp_count(buf, size);
+    }
 
     makecontext(&th->callee, (void (*)()) o_ins->p->cb_flush,
                 7,                     /* number of arguments */
@@ -220,6 +243,19 @@ struct flb_thread *flb_output_thread(struct flb_task *task,
     th->output_buffer = buf;
     th->task = task;
     th->config = config;
+    th->size = size;
+    th->start = flb_metrics_time();
+    th->trace = task->trace;
+    th->t_start = 0;
+    th->t_write = 0;
+
+    /* A retry may carry only a part of the task records */
+    if (buf == task->buf) {
+        th->records = task->records;
+    }
+    else {
+        th->records = flb_mp_count(buf, size);
+    }
 
     /* pthread reference data */
     th->pth_cb.buf     = buf;
@@ -292,6 +328,22 @@ static inline int flb_output_return(int ret) {
 #define FLB_OUTPUT_RETURN(x)                                            \
     return flb_output_return(x);
 
+/*
+ * When only some records of the buffer failed, the plugin can set the ones
+ * to retry (MessagePack, allocated with malloc) before returning FLB_RETRY.
+ * The engine takes the buffer and the retry flushes it instead of the
+ * whole task data.
+ */
+static inline void flb_output_retry_data(void *buf, size_t size)
+{
+    struct flb_thread *th;
+
+    th = (struct flb_thread *) pthread_getspecific(flb_thread_key);
+    free(th->retry_buffer);
+    th->retry_buffer = buf;
+    th->retry_size   = size;
+}
+
 struct flb_output_instance *flb_output_new(struct flb_config *config,
                                            char *output, void *data);
 
@@ -301,6 +353,8 @@ char *flb_output_get_property(char *key, struct flb_output_instance *i);
 void flb_output_pre_run(struct flb_config *config);
 void flb_output_exit(struct flb_config *config);
 void flb_output_set_context(struct flb_output_instance *ins, void *context);
+void flb_output_upstream_set(struct flb_upstream *u,
+                             struct flb_output_instance *ins);
 int flb_output_init(struct flb_config *config);
 int flb_output_check(struct flb_config *config);
 #endif
@@ -20,17 +20,30 @@
 #ifndef FLB_PACK_H
 #define FLB_PACK_H
 
-#include <jsmn/jsmn.h>
+#include <stdio.h>
+#include <time.h>
+#include <msgpack.h>
+#include <fluent-bit/flb_time.h>
+
+/* Formats of the 'date' field when converting records to JSON */
+#define FLB_PACK_JSON_DATE_EPOCH    0   /* seconds since Epoch       */
+#define FLB_PACK_JSON_DATE_ISO8601  1   /* "2016-08-24T10:31:02Z"   */
 
 struct flb_pack_state {
-    int multiple;         /* support multiple jsons? */
-    int tokens_count;     /* number of parsed tokens */
-    int tokens_size;      /* array size of tokens    */
-    jsmntok_t *tokens;    /* tokens array            */
-    jsmn_parser parser;   /* parser state            */
+    int multiple;         /* support multiple jsons?      */
+    size_t consumed;      /* bytes of packed messages     */
+
+    /* Scanner state of the incomplete message */
+    size_t offset;        /* bytes already scanned        */
+    int depth;            /* nesting level                */
+    int in_string;        /* inside a string?             */
+    int in_escape;        /* last byte was a backslash    */
+    int in_primitive;     /* inside a top level primitive */
 };
 
 int flb_pack_json(char *js, size_t len, char **buffer, int *size);
+int flb_pack_json_sbuffer(char *js, size_t len, msgpack_sbuffer *sbuf,
+                          size_t *consumed);
 int flb_pack_state_init(struct flb_pack_state *s);
 void flb_pack_state_reset(struct flb_pack_state *s);
 
@@ -38,6 +51,30 @@ int flb_pack_json_state(char *js, size_t len,
                         char **buffer, int *size,
                         struct flb_pack_state *state);
 
+/* Options to convert a record into a JSON map */
+struct flb_pack_json_fmt {
+    int sanitize_keys;    /* replace dots in keys by '_'  */
+    char *date_key;       /* date field name or NULL      */
+    int date_format;      /* FLB_PACK_JSON_DATE_*         */
+    int date_precision;   /* fraction digits: 0, 3, 6, 9  */
+    char *tag_key;        /* tag field name or NULL       */
+    char *tag;            /* tag value                    */
+    int tag_len;
+
+    /* last formatted date, ISO8601 without the fraction */
+    time_t date_cache;
+    int date_len;
+    char date_buf[32];
+};
+
+int flb_msgpack_to_json(msgpack_sbuffer *out, msgpack_object *o);
+void flb_pack_json_fmt_init(struct flb_pack_json_fmt *fmt);
+int flb_msgpack_record_to_json(msgpack_sbuffer *out, struct flb_time *time,
+                               msgpack_object *map,
+                               struct flb_pack_json_fmt *fmt);
+
+int flb_mp_count(const void *data, size_t bytes);
 void flb_pack_print(char *data, size_t bytes);
+void flb_pack_print_entry(FILE *out, msgpack_object *entry);
 
 #endif
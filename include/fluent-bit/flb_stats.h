@@ -25,23 +25,18 @@
 #include <unistd.h>
 #include <fluent-bit/flb_utils.h>
 #include <fluent-bit/flb_config.h>
-#include <fluent-bit/flb_output.h>
-
-#define FLB_STATS_SIZE          60  /* Datapoints buffer size */
 
 #define FLB_STATS_USERVER        1  /* Unix socket server        */
 #define FLB_STATS_USERVER_C      2  /* Unix socket server client */
-#define FLB_STATS_USERVER_PRINT  3  /* Write statistics          */
-#define FLB_STATS_INPUT_PLUGIN   4  /* Input plugin type         */
-#define FLB_STATS_OUTPUT_PLUGIN  5  /* Output plugin type        */
 
 #define FLB_STATS_USERVER_PATH   "/tmp/fluentbit.sock"
 
 /*
  * Unix Socket Server: the Stats interface launch a TCP unix socket
  * domain server, for every connected client the interface will dispatch
- * a summary of statistics in JSON format every five seconds. The following
- * structures holds the server info and the connection references:
+ * a summary of the metrics registry (flb_metrics.h) in JSON format every
+ * five seconds. The following structures holds the server info and the
+ * connection references:
  *
  * struct flb_stats_userver:   linked from flb_stats, represents the userver
  *                             context;
@@ -73,66 +68,21 @@ struct flb_stats_userver {
     struct flb_stats_userver_t *timer;
 };
 
-struct flb_stats_datapoint {
-    time_t  time;
-    ssize_t events;
-    ssize_t bytes;
-};
-
-/* Statistics for input plugins */
-struct flb_stats_in_plugin {
-    struct mk_event event;
-    int pipe[2];
-    int n_data;
-
-    struct flb_stats_datapoint data[FLB_STATS_SIZE];
-    struct flb_input_plugin *plugin;
-    struct mk_list _head;
-};
-
-/* Statistics for output plugins */
-struct flb_stats_out_plugin {
-    struct mk_event event;
-    int pipe[2];
-    int n_data;
-    struct flb_stats_datapoint data[FLB_STATS_SIZE];
-    struct flb_output_plugin *plugin;
-    struct mk_list _head;
-};
-
 struct flb_stats {
     struct mk_event event;
 
     struct mk_event_loop *evl;
     struct flb_config *config;
+    struct flb_log *log;             /* log context of the engine thread */
     pthread_t worker_tid;
 
     /* Unix server */
     int ch_manager[2];
     struct flb_stats_userver *userver;
-
-    /* References to components that can deliver statistics */
-    struct mk_list in_plugins;
-    struct mk_list out_plugins;
 };
 
-/* Simple function to update the stats counters */
-static inline void flb_stats_update(int stats_fd,
-                                    ssize_t bytes, ssize_t events)
-{
-    struct flb_stats_datapoint d;
-
-    d.time   = time(NULL);
-    d.bytes  = bytes;
-    d.events = events;
-
-    write(stats_fd, &d, sizeof(struct flb_stats_datapoint));
-}
-
 int flb_stats_init(struct flb_config *config);
 int flb_stats_exit(struct flb_config *config);
-int flb_stats_collect(struct flb_config *config);
-int flb_stats_register(struct mk_event_loop *evl, struct flb_config *config);
 
 #endif /* FLB_STATS_H */
 #else
@@ -140,8 +90,5 @@ int flb_stats_register(struct mk_event_loop *evl, struct flb_config *config);
 /* A dummy define to avoid some macros conditions into the core */
 #define flb_stats_init(a) do{} while(0)
 #define flb_stats_exit(a) do{} while(0)
-#define flb_stats_update(a, b, c) do {} while(0)
-#define flb_stats_reset(a) do {} while(0)
-#define flb_stats_register(a, b) do{} while(0)
 
 #endif /* FLB_HAVE_STATS  */
@@ -46,7 +46,7 @@
  */
 
 #define FLB_TASK_RET(val)  (val >> 28)
-#define FLB_TASK_ID(val)   (uint16_t) (val & 0xfffc000) >> 14
+#define FLB_TASK_ID(val)   (uint16_t) ((val & 0xfffc000) >> 14)
 #define FLB_TASK_TH(val)   (val & 0x3fff)
 #define FLB_TASK_SET(ret, task_id, th_id)               \
     (uint32_t) ((ret << 28) | (task_id << 14) | th_id)
@@ -59,13 +59,16 @@ struct flb_task_route {
 /*
  * When a Task failed in an output instance plugin and this last one
  * requested a FLB_RETRY, a flb_engine_task_retry entry is created and
- * linked into the parent flb_engine_task->retries lists.
+ * linked into the parent flb_engine_task->retries lists. Next failures of
+ * the same route reuse it and increase the number of attempts.
  *
  * This reference is used later by the scheduler to re-dispatch the
  * task data to the desired output path.
  */
 struct flb_task_retry {
     int attemps;                        /* number of attemps, default 1 */
+    char *buf;                          /* records to retry, or NULL    */
+    size_t size;                        /* to use the whole task buffer */
     struct flb_output_instance *o_ins;  /* route that we are retrying   */
     struct flb_task *parent;            /* parent task reference        */
     struct mk_list _head;               /* link to parent task list     */
@@ -81,6 +84,9 @@ struct flb_task {
     char *tag;                          /* original tag              */
     char *buf;                          /* buffer                    */
     size_t size;                        /* buffer data size          */
+    int records;                        /* number of records in buf  */
+    int trace;                          /* sampled for latency ?     */
+    uint64_t t_collect;                 /* records collected (trace) */
 #ifdef FLB_HAVE_BUFFERING
     int worker_id;                      /* Buffer worker that owns this task */
     unsigned char hash_sha1[20];        /* SHA1(buf)                         */
@@ -106,6 +112,7 @@ struct flb_task *flb_task_create(char *buf,
                                  char *tag,
                                  struct flb_config *config);
 void flb_task_destroy(struct flb_task *task);
+void *flb_task_buffer_take(struct flb_task *task, void *buf);
 
 struct flb_task_retry *
 flb_task_retry_create(struct flb_task *task,
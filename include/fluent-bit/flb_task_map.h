@@ -22,6 +22,9 @@
 
 #include <inttypes.h>
 
+/* Max number of tasks running at the same time */
+#define FLB_TASK_MAP_SIZE    2048
+
 struct flb_task_map {
     void    *task;
 };
@@ -68,6 +68,20 @@ struct flb_thread
      */
     void *output_buffer;
 
+    /* Records to retry set by the output plugin (partial failures) */
+    void *retry_buffer;
+    size_t retry_size;
+
+    /* Records and bytes being flushed, start time of the flush (metrics) */
+    int records;
+    size_t size;
+    uint64_t start;
+
+    /* Latency tracing: coroutine started and first byte written */
+    int trace;
+    uint64_t t_start;
+    uint64_t t_write;
+
     /* Parent flb_engine_task */
     struct flb_task *task;
 
@@ -90,6 +104,8 @@ static struct flb_thread *flb_thread_new()
         perror("malloc");
         return NULL;
     }
+    th->retry_buffer = NULL;
+    th->retry_size   = 0;
 
     return th;
 }
@@ -137,6 +153,7 @@ static FLB_INLINE void flb_thread_destroy(struct flb_thread *th)
      */
 #endif
 
+    free(th->retry_buffer);
     free(th);
 }
 
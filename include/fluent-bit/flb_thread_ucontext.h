@@ -27,6 +27,7 @@
 #include <ucontext.h>
 #include <fluent-bit/flb_info.h>
 #include <fluent-bit/flb_task.h>
+#include <fluent-bit/flb_metrics.h>
 
 struct flb_thread {
     int id;
@@ -53,6 +54,23 @@ struct flb_thread {
      */
     void *output_buffer;
 
+    /*
+     * Records to retry set by the output plugin when only a part of the
+     * buffer failed, on FLB_RETRY the engine moves it to the task retry.
+     */
+    void *retry_buffer;
+    size_t retry_size;
+
+    /* Records and bytes being flushed, start time of the flush (metrics) */
+    int records;
+    size_t size;
+    uint64_t start;
+
+    /* Latency tracing: coroutine started and first byte written */
+    int trace;
+    uint64_t t_start;
+    uint64_t t_write;
+
     /* Parent flb_task */
     struct flb_task *task;
 
@@ -102,6 +120,7 @@ static FLB_INLINE void flb_thread_destroy(struct flb_thread *th)
     flb_trace("[thread] destroy thread_id=%i", th->id);
     th->task->users--;
     mk_list_del(&th->_head);
+    free(th->retry_buffer);
     free(th);
 }
 
@@ -120,6 +139,11 @@ static FLB_INLINE void flb_thread_resume(struct flb_thread *th)
 {
     pthread_setspecific(flb_thread_key, (void *) th);
 
+    /* Latency tracing: first time the coroutine runs */
+    if (th->trace && th->t_start == 0) {
+        th->t_start = flb_metrics_time();
+    }
+
     /*
      * In the past we used to have a flag to mark when a coroutine
      * has finished (th->ended == MK_TRUE), now we let the coroutine
@@ -162,6 +186,8 @@ static struct flb_thread *flb_thread_new()
 
     /* Number of retries */
     th->retries                  = 0;
+    th->retry_buffer             = NULL;
+    th->retry_size               = 0;
 
     /* Thread context */
     th->callee.uc_stack.ss_sp    = FLB_THREAD_STACK(p);
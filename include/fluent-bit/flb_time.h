@@ -0,0 +1,66 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Fluent Bit
+ *  ==========
+ *  Copyright (C) 2015-2016 Treasure Data Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef FLB_TIME_H
+#define FLB_TIME_H
+
+#include <time.h>
+#include <inttypes.h>
+#include <msgpack.h>
+
+/*
+ * Record timestamps. Records are packed as [time, map] where the time is
+ * a Fluentd EventTime: a MessagePack extension of type 0 holding the
+ * seconds and the nanoseconds as two big endian 32 bits integers. Records
+ * with an integer (seconds) or a float time are accepted as well.
+ */
+#define FLB_TIME_EVENTTIME_TYPE    0
+#define FLB_TIME_EVENTTIME_SIZE    8
+
+/* Formats to pack a timestamp */
+#define FLB_TIME_FMT_INT           0   /* integer, seconds only */
+#define FLB_TIME_FMT_EVENTTIME     1   /* EventTime extension   */
+
+struct flb_time {
+    struct timespec tm;
+};
+
+static inline void flb_time_set(struct flb_time *t, time_t sec, long nsec)
+{
+    t->tm.tv_sec  = sec;
+    t->tm.tv_nsec = nsec;
+}
+
+static inline uint64_t flb_time_to_nanosec(struct flb_time *t)
+{
+    return ((uint64_t) t->tm.tv_sec * 1000000000ULL) + t->tm.tv_nsec;
+}
+
+static inline double flb_time_to_double(struct flb_time *t)
+{
+    return (double) t->tm.tv_sec + ((double) t->tm.tv_nsec / 1000000000.0);
+}
+
+int flb_time_get(struct flb_time *t);
+int flb_time_append_to_msgpack(struct flb_time *t, msgpack_packer *pck,
+                               int fmt);
+int flb_time_pop_from_msgpack(struct flb_time *t, msgpack_object *obj);
+int flb_time_precision(char *str);
+
+#endif
@@ -20,8 +20,15 @@
 #ifndef FLB_UPSTREAM_H
 #define FLB_UPSTREAM_H
 
+#include <time.h>
+#include <stdint.h>
 #include <pthread.h>
 #include <fluent-bit/flb_config.h>
+#include <fluent-bit/flb_dns.h>
+
+#ifdef FLB_HAVE_TLS
+#include <mbedtls/ssl.h>
+#endif
 
 /*
  * Upstream creation FLAGS set by Fluent Bit sub-components
@@ -34,6 +41,26 @@
  * ---
  */
 
+/* Keep-alive defaults (seconds) */
+#define FLB_UPSTREAM_KA_IDLE_TIMEOUT   30
+#define FLB_UPSTREAM_KA_MAX_LIFETIME  600
+
+/* I/O timeout defaults (seconds), zero disables them */
+#define FLB_UPSTREAM_CONNECT_TIMEOUT   10
+#define FLB_UPSTREAM_WRITE_TIMEOUT     30
+#define FLB_UPSTREAM_READ_TIMEOUT      30
+
+/* Connection pool statistics */
+struct flb_upstream_stats {
+    uint64_t hits;         /* connection taken from the 'av_queue'        */
+    uint64_t misses;       /* a new connection had to be created          */
+    uint64_t evictions;    /* idle connection dropped (expired or closed) */
+    uint64_t waits;        /* caller queued because max_connections hit   */
+    uint64_t timeouts;     /* connect, write or read operations timed out */
+    uint64_t tls_full;     /* TLS handshakes with a new session           */
+    uint64_t tls_resumed;  /* TLS handshakes resuming a previous session  */
+};
+
 /* Upstream handler */
 struct flb_upstream {
     struct mk_event_loop *evl;
@@ -44,6 +71,10 @@ struct flb_upstream {
 
     int n_connections;
 
+    /* Resolved addresses of 'tcp_host', refreshed when the TTL expires */
+    struct flb_dns_cache dns;
+    struct flb_dns_request *dns_req;       /* lookup in progress */
+
     /*
      * An upstream handler may keep open up to 'max_connections' of
      * TCP connections. A value minor or equal to zero means it will
@@ -65,13 +96,58 @@ struct flb_upstream {
      */
     struct mk_list busy_queue;
 
+    /*
+     * Keep-alive: when enabled, a released connection is moved back to the
+     * 'av_queue' instead of being closed. An idle connection is dropped
+     * once it was not used for 'keepalive_idle_timeout' seconds or it has
+     * been open for more than 'keepalive_max_lifetime' seconds (zero
+     * disables any of both limits).
+     */
+    int keepalive;
+    int keepalive_idle_timeout;
+    int keepalive_max_lifetime;
+
+    /*
+     * Callers waiting for a connection when 'max_connections' has been
+     * reached. A co-routine waiter is resumed from the event loop through
+     * the 'ev_notify' channel when a connection is released.
+     */
+    struct mk_list waiters;
+    int ch_notify[2];
+    struct mk_event ev_notify;
+
+    /*
+     * I/O timeouts: a co-routine waiting on a socket for more than the
+     * timeout of the operation gets the socket shut down, so it's resumed
+     * and fails. The 'ev_timeout' timer checks the connections linked in
+     * 'io_waits' every second.
+     */
+    int connect_timeout;
+    int write_timeout;
+    int read_timeout;
+    int timeout_fd;
+    struct mk_event ev_timeout;
+    struct mk_list io_waits;
+
+    struct flb_upstream_stats stats;
+
+    /* Link to flb_output_instance->upstreams, used by the metrics */
+    struct mk_list _head_ins;
+
 #ifdef FLB_HAVE_TLS
     /* context with mbedTLS data to handle certificates and keys */
     struct flb_tls *tls;
+
+    /*
+     * Last session negotiated with the server (session ID or ticket), new
+     * connections try to resume it with an abbreviated handshake.
+     */
+    mbedtls_ssl_session *tls_resume;
 #endif
 
 #ifdef FLB_HAVE_FLUSH_PTHREADS
     pthread_mutex_t mutex_queue;
+    pthread_cond_t cond_queue;
 #endif
 };
 
@@ -83,6 +159,31 @@ struct flb_upstream_conn {
     int fd;
     int connect_count;
 
+    /*
+     * If set to FLB_FALSE the connection is closed on release even if
+     * keep-alive is enabled, e.g: the peer state is unknown after an
+     * incomplete read.
+     */
+    int recycle;
+
+    /*
+     * Set by the plugin once its protocol handshake was done on this
+     * connection (e.g: NATS CONNECT), so a reused one skips it.
+     */
+    int handshake;
+
+    time_t ts_created;       /* connection established     */
+    time_t ts_available;     /* last time it was released  */
+
+    /* Deadline of the current socket wait, see 'io_waits' */
+    time_t io_deadline;
+    int io_timeout;          /* FLB_TRUE once a deadline expired */
+    struct mk_list _head_io;
+
+    /* Request header buffer kept by the HTTP client for the next request */
+    char *http_buf;
+    size_t http_buf_size;
+
     /* Upstream parent */
     struct flb_upstream *u;
 
@@ -108,4 +209,8 @@ int flb_upstream_destroy(struct flb_upstream *u);
 struct flb_upstream_conn *flb_upstream_conn_get(struct flb_upstream *u);
 int flb_upstream_conn_release(struct flb_upstream_conn *u_conn);
 
+int flb_upstream_conn_timeout_set(struct flb_upstream_conn *u_conn,
+                                  int timeout);
+void flb_upstream_conn_timeout_clear(struct flb_upstream_conn *u_conn);
+
 #endif
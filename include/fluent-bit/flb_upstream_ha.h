@@ -0,0 +1,104 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Fluent Bit
+ *  ==========
+ *  Copyright (C) 2015-2016 Treasure Data Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef FLB_UPSTREAM_HA_H
+#define FLB_UPSTREAM_HA_H
+
+#include <time.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <fluent-bit/flb_config.h>
+#include <fluent-bit/flb_upstream.h>
+
+/* Balancing policies */
+#define FLB_UPSTREAM_HA_ROUND_ROBIN      0
+#define FLB_UPSTREAM_HA_LEAST_INFLIGHT   1
+#define FLB_UPSTREAM_HA_WEIGHTED         2
+
+/* Nodes are tracked on a bitmask while failing over */
+#define FLB_UPSTREAM_HA_MAX_NODES       64
+
+/* Passive health check defaults */
+#define FLB_UPSTREAM_HA_MAX_FAILURES     1
+#define FLB_UPSTREAM_HA_BACKOFF_BASE     1   /* seconds */
+#define FLB_UPSTREAM_HA_BACKOFF_MAX     60   /* seconds */
+
+/* A node of an upstream group */
+struct flb_upstream_node {
+    int id;                      /* position in the group (bit)      */
+    char *name;
+    char *host;
+    int port;
+
+    int weight;
+    int current_weight;          /* smooth weighted round-robin      */
+    int inflight;                /* flushes in progress              */
+
+    /*
+     * Passive health check: after 'max_failures' consecutive connect or
+     * write errors the node is ejected until 'ejected_until', the period
+     * doubles on each new ejection up to the group 'backoff_max'.
+     */
+    int failures;
+    int ejections;
+    time_t ejected_until;
+
+    struct flb_upstream *u;
+    struct mk_list _head;
+};
+
+/* Upstream group, a set of nodes serving the same data */
+struct flb_upstream_ha {
+    char *name;
+    int policy;
+    int count;
+    int index;                   /* round-robin position             */
+
+    int max_failures;
+    int backoff_base;
+    int backoff_max;
+
+    struct mk_list nodes;
+
+#ifdef FLB_HAVE_FLUSH_PTHREADS
+    pthread_mutex_t mutex;
+#endif
+};
+
+struct flb_upstream_ha *flb_upstream_ha_create(char *name);
+void flb_upstream_ha_destroy(struct flb_upstream_ha *ha);
+int flb_upstream_ha_policy(char *str);
+
+struct flb_upstream_node *flb_upstream_node_create(char *name,
+                                                   char *host, int port,
+                                                   int weight,
+                                                   struct flb_config *config,
+                                                   int flags, void *tls);
+int flb_upstream_ha_node_add(struct flb_upstream_ha *ha,
+                             struct flb_upstream_node *node);
+struct flb_upstream_node *flb_upstream_ha_node_get(struct flb_upstream_ha *ha,
+                                                   uint64_t *tried);
+void flb_upstream_ha_node_done(struct flb_upstream_ha *ha,
+                               struct flb_upstream_node *node, int ok);
+
+struct flb_upstream_ha *flb_upstream_ha_from_file(char *file,
+                                                  struct flb_config *config,
+                                                  int flags, void *tls);
+
+#endif
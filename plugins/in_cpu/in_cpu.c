@@ -25,7 +25,6 @@
 #include <msgpack.h>
 #include <fluent-bit/flb_input.h>
 #include <fluent-bit/flb_config.h>
-#include <fluent-bit/flb_stats.h>
 
 #include "in_cpu.h"
 
@@ -289,7 +288,6 @@ int in_cpu_collect(struct flb_config *config, void *in_context)
     struct flb_in_cpu_config *ctx = in_context;
     struct cpu_stats *cstats = &ctx->cstats;
     struct cpu_snapshot *s;
-    (void) config;
 
     /* Get the current CPU usage */
     ret = proc_cpu_load(ctx->n_processors, cstats);
@@ -303,7 +301,8 @@ int in_cpu_collect(struct flb_config *config, void *in_context)
      * Store the new data into the MessagePack buffer,
      */
     msgpack_pack_array(&ctx->mp_pck, 2);
-    msgpack_pack_uint64(&ctx->mp_pck, time(NULL));
+    flb_time_append_to_msgpack(&config->clock, &ctx->mp_pck,
+                               FLB_TIME_FMT_EVENTTIME);
 
     msgpack_pack_map(&ctx->mp_pck, (ctx->n_processors * 3 ) + 3);
 
@@ -334,8 +333,6 @@ int in_cpu_collect(struct flb_config *config, void *in_context)
     snapshots_switch(cstats);
     flb_trace("[in_cpu] CPU %0.2f%%", s->p_cpu);
 
-    flb_stats_update(in_cpu_plugin.stats_fd, 0, 1);
-
     return 0;
 }
 
@@ -17,6 +17,7 @@
  *  limitations under the License.
  */
 
+#include <unistd.h>
 #include <msgpack.h>
 #include <fluent-bit/flb_input.h>
 #include <fluent-bit/flb_utils.h>
@@ -25,6 +26,7 @@
 #include "fw.h"
 #include "fw_conn.h"
 #include "fw_config.h"
+#include "fw_worker.h"
 
 /*
  * For a server event, the collection event means a new client have arrived, we
@@ -45,7 +47,7 @@ static int in_fw_collect(struct flb_config *config, void *in_context)
     }
 
     flb_trace("[in_fw] new TCP connection arrived FD=%i", fd);
-    conn = fw_conn_add(fd, ctx);
+    conn = fw_conn_add(fd, ctx, NULL);
     if (!conn) {
         return -1;
     }
@@ -66,11 +68,39 @@ static int in_fw_init(struct flb_input_instance *in,
         return -1;
     }
     ctx->in = in;
+    ctx->flush = config->flush;
+    ctx->server_fd = -1;
     mk_list_init(&ctx->connections);
+    mk_list_init(&ctx->worker_list);
 
     /* Set the context */
     flb_input_set_context(in, ctx);
 
+    /* Workers mode: listeners and connections are served by threads */
+    if (ctx->workers > 0) {
+        ret = fw_workers_create(ctx);
+        if (ret == 0) {
+            ret = fw_workers_start(ctx);
+        }
+        if (ret == -1) {
+            flb_error("[in_fw] could not initialize workers. Aborting");
+            fw_workers_destroy(ctx);
+            fw_config_destroy(ctx);
+            return -1;
+        }
+
+        /* Sealed chunks notifications from the workers */
+        ret = flb_input_set_collector_event(in,
+                                            fw_workers_collect,
+                                            ctx->ch_chunks[0],
+                                            config);
+        if (ret == -1) {
+            flb_utils_error_c("Could not set collector for IN_FW input plugin");
+        }
+
+        return 0;
+    }
+
     /* Create TCP server */
     ctx->server_fd = flb_net_server(ctx->tcp_port, ctx->listen);
     if (ctx->server_fd > 0) {
@@ -97,6 +127,22 @@ static int in_fw_init(struct flb_input_instance *in,
     return 0;
 }
 
+/*
+ * The engine is stopping: stop the workers and ingest their last chunks,
+ * the final flush delivers them.
+ */
+static int in_fw_pre_exit(void *data, struct flb_config *config)
+{
+    struct flb_in_fw_config *ctx = data;
+
+    if (ctx->workers > 0) {
+        fw_workers_stop(ctx);
+        fw_workers_collect(config, ctx);
+    }
+
+    return 0;
+}
+
 int in_fw_exit(void *data, struct flb_config *config)
 {
     struct mk_list *tmp;
@@ -110,6 +156,14 @@ int in_fw_exit(void *data, struct flb_config *config)
         fw_conn_del(conn);
     }
 
+    if (ctx->workers > 0) {
+        fw_workers_destroy(ctx);
+    }
+
+    if (ctx->server_fd > 0) {
+        close(ctx->server_fd);
+    }
+
     fw_config_destroy(ctx);
     return 0;
 }
@@ -122,6 +176,7 @@ struct flb_input_plugin in_forward_plugin = {
     .cb_pre_run   = NULL,
     .cb_collect   = in_fw_collect,
     .cb_flush_buf = NULL,
+    .cb_pre_exit  = in_fw_pre_exit,
     .cb_exit      = in_fw_exit,
     .flags        = FLB_INPUT_NET | FLB_INPUT_DYN_TAG
 };
@@ -22,6 +22,7 @@
 
 #include <msgpack.h>
 #include <fluent-bit/flb_input.h>
+#include <fluent-bit/flb_mpsc.h>
 
 struct flb_in_fw_config {
     int server_fd;               /* TCP server file descriptor  */
@@ -29,10 +30,22 @@ struct flb_in_fw_config {
     size_t chunk_size;           /* Chunk allocation size       */
     char *listen;                /* Listen interface            */
     char *tcp_port;              /* TCP Port                    */
+    int workers;                 /* Number of listener threads  */
+    int flush;                   /* Workers flush interval      */
 
     struct mk_list connections;  /* List of active connections */
     struct mk_event_loop *evl;      /* Event loop file descriptor */
     struct flb_input_instance *in;  /* Input plugin instace       */
+
+    /*
+     * Workers mode: every worker owns a listener socket, an event loop and
+     * local buffers. Sealed chunks are enqueued in 'chunks' and the engine
+     * is notified through the 'ch_chunks' pipe.
+     */
+    struct mk_list worker_list;     /* List of fw_worker            */
+    struct flb_mpsc_queue chunks;   /* Sealed chunks queue          */
+    size_t chunks_size;             /* Bytes in 'chunks' (atomic)   */
+    int ch_chunks[2];               /* Workers -> engine channel    */
 };
 
 #endif
@@ -30,6 +30,7 @@ struct flb_in_fw_config *fw_config_init(struct flb_input_instance *i_ins)
     char *listen;
     char *buffer_size;
     char *chunk_size;
+    char *workers;
     struct flb_in_fw_config *config;
 
     config = malloc(sizeof(struct flb_in_fw_config));
@@ -46,7 +47,7 @@ struct flb_in_fw_config *fw_config_init(struct flb_input_instance *i_ins)
         }
     }
     else {
-        config->listen = i_ins->host.listen;
+        config->listen = strdup(i_ins->host.listen);
     }
 
     /* Listener TCP Port */
@@ -78,8 +79,17 @@ struct flb_in_fw_config *fw_config_init(struct flb_input_instance *i_ins)
         config->buffer_size  = (atoi(buffer_size) * 1024);
     }
 
-    flb_debug("[in_fw] Listen='%s' TCP_Port=%s",
-              config->listen, config->tcp_port);
+    /* Number of workers, zero means the engine event loop is used */
+    workers = flb_input_get_property("workers", i_ins);
+    if (workers) {
+        config->workers = atoi(workers);
+        if (config->workers < 0) {
+            config->workers = 0;
+        }
+    }
+
+    flb_debug("[in_fw] Listen='%s' TCP_Port=%s Workers=%i",
+              config->listen, config->tcp_port, config->workers);
 
     return config;
 }
@@ -18,6 +18,8 @@
  */
 
 #include <unistd.h>
+#include <errno.h>
+#include <string.h>
 #include <fluent-bit/flb_utils.h>
 #include <fluent-bit/flb_engine.h>
 #include <fluent-bit/flb_network.h>
@@ -25,56 +27,144 @@
 #include "fw.h"
 #include "fw_prot.h"
 #include "fw_conn.h"
+#include "fw_worker.h"
 
-/* Callback invoked every time an event is triggered for a connection */
+/*
+ * Register the events of the connection: it's not read while its worker
+ * is paused and it must be writable while acks are pending.
+ */
+int fw_conn_events(struct fw_conn *conn)
+{
+    int ret;
+    int mask = MK_EVENT_EMPTY;
+    struct mk_event *event = &conn->event;
+
+    if (!conn->worker || conn->worker->paused == FLB_FALSE) {
+        mask |= MK_EVENT_READ;
+    }
+    if (conn->ack.size > 0) {
+        mask |= MK_EVENT_WRITE;
+    }
+    if (event->mask == mask) {
+        return 0;
+    }
+
+    if (mask == MK_EVENT_EMPTY) {
+        ret = mk_event_del(conn->evl, event);
+        event->mask = MK_EVENT_EMPTY;
+        return ret;
+    }
+    return mk_event_add(conn->evl, conn->fd, FLB_ENGINE_EV_CUSTOM, mask, conn);
+}
+
+/* Write the pending acks, the socket is non-blocking: keep what is left */
+static int fw_conn_flush(struct fw_conn *conn)
+{
+    ssize_t bytes;
+
+    while (conn->ack.size > 0) {
+        bytes = write(conn->fd, conn->ack.data, conn->ack.size);
+        if (bytes == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            perror("write");
+            return -1;
+        }
+        memmove(conn->ack.data, conn->ack.data + bytes,
+                conn->ack.size - bytes);
+        conn->ack.size -= bytes;
+    }
+
+    return fw_conn_events(conn);
+}
+
+/*
+ * Queue a reply to the peer and write what the socket takes now, the rest
+ * is written when the socket becomes writable.
+ */
+int fw_conn_write(struct fw_conn *conn, char *buf, size_t len)
+{
+    if (conn->ack.size + len > FW_ACK_PENDING_MAX) {
+        flb_debug("[in_fw] fd=%i peer does not read its acks", conn->fd);
+        return -1;
+    }
+
+    if (msgpack_sbuffer_write(&conn->ack, buf, len) != 0) {
+        return -1;
+    }
+    return fw_conn_flush(conn);
+}
+
+/*
+ * Callback invoked every time an event is triggered for a connection, the
+ * event only tells the registered mask: reads may find nothing.
+ */
 int fw_conn_event(void *data)
 {
     int ret;
     int bytes;
-    int available;
-    int size;
-    char *tmp;
+    size_t size;
+    size_t available;
+    size_t pending;
     struct mk_event *event;
     struct fw_conn *conn = data;
     struct flb_in_fw_config *ctx = conn->ctx;
+    msgpack_unpacker *unp = &conn->unp;
 
     event = &conn->event;
+    if (conn->ack.size > 0 && fw_conn_flush(conn) == -1) {
+        fw_conn_del(conn);
+        return -1;
+    }
+
     if (event->mask & MK_EVENT_READ) {
-        available = (conn->buf_size - conn->buf_len);
+        available = msgpack_unpacker_buffer_capacity(unp);
         if (available < 1) {
-            if (conn->buf_size + ctx->chunk_size > ctx->buffer_size) {
+            /*
+             * The unpacker keeps the incomplete message plus the data not
+             * yet parsed, don't let it grow beyond the configured limit.
+             */
+            pending = msgpack_unpacker_message_size(unp);
+            if (pending >= ctx->buffer_size) {
                 flb_trace("[in_fw] fd=%i incoming data exceed limit (%i KB)",
                           event->fd, (ctx->buffer_size / 1024));
                 fw_conn_del(conn);
                 return -1;
             }
 
-            size = conn->buf_size + ctx->chunk_size;
-            tmp = realloc(conn->buf, size);
-            if (!tmp) {
-                perror("realloc");
-                return -1;
+            size = ctx->chunk_size;
+            if (pending + size > ctx->buffer_size) {
+                size = ctx->buffer_size - pending;
             }
-            flb_trace("[in_fw] fd=%i buffer realloc %i -> %i",
-                      event->fd, conn->buf_size, size);
 
-            conn->buf = tmp;
-            conn->buf_size = size;
-            available = (conn->buf_size - conn->buf_len);
+            if (!msgpack_unpacker_reserve_buffer(unp, size)) {
+                flb_error("[in_fw] fd=%i could not expand buffer", event->fd);
+                fw_conn_del(conn);
+                return -1;
+            }
+            flb_trace("[in_fw] fd=%i buffer reserve pending=%lu size=%lu",
+                      event->fd, pending, size);
+            available = msgpack_unpacker_buffer_capacity(unp);
         }
 
-        bytes = read(conn->fd,
-                     conn->buf + conn->buf_len, available);
+        bytes = read(conn->fd, msgpack_unpacker_buffer(unp), available);
         if (bytes > 0) {
-            flb_trace("[in_fw] read()=%i pre_len=%i now_len=%i",
-                      bytes, conn->buf_len, conn->buf_len + bytes);
-            conn->buf_len += bytes;
+            flb_trace("[in_fw] read()=%i", bytes);
+            msgpack_unpacker_buffer_consumed(unp, bytes);
             ret = fw_prot_process(conn);
             if (ret == -1) {
+                fw_conn_del(conn);
                 return -1;
             }
             return bytes;
         }
+        else if (bytes == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return 0;
+        }
         else {
             flb_trace("[in_fw] fd=%i closed connection", event->fd);
             fw_conn_del(conn);
@@ -90,8 +180,12 @@ int fw_conn_event(void *data)
     return 0;
 }
 
-/* Create a new mqtt request instance */
-struct fw_conn *fw_conn_add(int fd, struct flb_in_fw_config *ctx)
+/*
+ * Create a new connection instance, if a worker is given the connection
+ * is served by the worker event loop, otherwise by the engine.
+ */
+struct fw_conn *fw_conn_add(int fd, struct flb_in_fw_config *ctx,
+                            struct fw_worker *worker)
 {
     int ret;
     struct fw_conn *conn;
@@ -112,32 +206,40 @@ struct fw_conn *fw_conn_add(int fd, struct flb_in_fw_config *ctx)
     /* Connection info */
     conn->fd      = fd;
     conn->ctx     = ctx;
-    conn->buf_len = 0;
-    conn->rest    = 0;
     conn->status  = FW_NEW;
+    conn->in      = ctx->in;
+    conn->worker  = worker;
+    if (worker) {
+        conn->evl = worker->evl;
+    }
+    else {
+        conn->evl = ctx->evl;
+    }
 
-    conn->buf = malloc(ctx->chunk_size);
-    if (!conn->buf) {
-        perror("malloc");
+    msgpack_sbuffer_init(&conn->ack);
+    if (!msgpack_unpacker_init(&conn->unp, ctx->chunk_size)) {
         close(fd);
         flb_error("[in_fw] could not allocate new connection");
         free(conn);
         return NULL;
     }
-    conn->buf_size = ctx->chunk_size;
-    conn->in       = ctx->in;
 
     /* Register instance into the event loop */
-    ret = mk_event_add(ctx->evl, fd, FLB_ENGINE_EV_CUSTOM, MK_EVENT_READ, conn);
+    ret = fw_conn_events(conn);
     if (ret == -1) {
         flb_error("[in_fw] could not register new connection");
         close(fd);
-        free(conn->buf);
+        msgpack_unpacker_destroy(&conn->unp);
         free(conn);
         return NULL;
     }
 
-    mk_list_add(&conn->_head, &ctx->connections);
+    if (worker) {
+        mk_list_add(&conn->_head, &worker->connections);
+    }
+    else {
+        mk_list_add(&conn->_head, &ctx->connections);
+    }
 
     return conn;
 }
@@ -145,12 +247,13 @@ struct fw_conn *fw_conn_add(int fd, struct flb_in_fw_config *ctx)
 int fw_conn_del(struct fw_conn *conn)
 {
     /* Unregister the file descriptior from the event-loop */
-    mk_event_del(conn->ctx->evl, &conn->event);
+    mk_event_del(conn->evl, &conn->event);
 
     /* Release resources */
     mk_list_del(&conn->_head);
     close(conn->fd);
-    free(conn->buf);
+    msgpack_unpacker_destroy(&conn->unp);
+    msgpack_sbuffer_destroy(&conn->ack);
     free(conn);
 
     return 0;
@@ -20,8 +20,13 @@
 #ifndef FLB_IN_FW_CONN_H
 #define FLB_IN_FW_CONN_H
 
+#include <msgpack.h>
+
 #define FLB_IN_FW_CHUNK 32768
 
+/* Ack replies the peer did not read yet, above it the peer is dropped */
+#define FW_ACK_PENDING_MAX 16384
+
 enum {
     FW_NEW        = 1,  /* it's a new connection                */
     FW_CONNECTED  = 2,  /* MQTT connection per protocol spec OK */
@@ -38,19 +43,27 @@ struct fw_conn {
     int fd;                          /* Socket file descriptor            */
     int status;                      /* Connection status                 */
 
-    /* Buffer */
-    char *buf;                       /* Buffer data                       */
-    int  buf_len;                    /* Data length                       */
-    int  buf_size;                   /* Buffer size                       */
-    size_t rest;                     /* Unpacking offset                  */
+    /*
+     * Streaming unpacker: socket data is read straight into the unpacker
+     * buffer and parsing resumes where it stopped on the previous event.
+     */
+    msgpack_unpacker unp;            /* Persistent unpacker               */
+    msgpack_sbuffer ack;             /* Ack replies not written yet       */
 
     struct flb_input_instance *in;   /* Parent plugin instance            */
     struct flb_in_fw_config *ctx;    /* Plugin configuration context      */
+    struct fw_worker *worker;        /* Owner worker (workers mode)       */
+    struct mk_event_loop *evl;       /* Event loop serving the connection */
 
     struct mk_list _head;
 };
 
-struct fw_conn *fw_conn_add(int fd, struct flb_in_fw_config *ctx);
+struct fw_worker;
+
+struct fw_conn *fw_conn_add(int fd, struct flb_in_fw_config *ctx,
+                            struct fw_worker *worker);
 int fw_conn_del(struct fw_conn *conn);
+int fw_conn_write(struct fw_conn *conn, char *buf, size_t len);
+int fw_conn_events(struct fw_conn *conn);
 
 #endif
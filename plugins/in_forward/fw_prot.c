@@ -18,226 +18,445 @@
  */
 
 #include <unistd.h>
+#include <zlib.h>
 #include <msgpack.h>
 
 #include <fluent-bit/flb_input.h>
 #include <fluent-bit/flb_config.h>
 #include <fluent-bit/flb_pack.h>
 #include <fluent-bit/flb_utils.h>
+#include <fluent-bit/flb_time.h>
 
 #include "fw.h"
 #include "fw_prot.h"
 #include "fw_conn.h"
+#include "fw_worker.h"
 
-/* Try parsing rounds up-to 32 bytes */
-#define EACH_RECV_SIZE 32
+/*
+ * Records are appended to the instance tag buffers, or to the worker local
+ * buffers if the connection is served by a worker thread.
+ */
+static inline int fw_append(struct fw_conn *conn, char *tag, int tag_len,
+                            msgpack_object *data)
+{
+    if (conn->worker) {
+        return fw_worker_append(conn->worker, tag, tag_len, data);
+    }
+    return flb_input_dyntag_append(conn->in, tag, tag_len, *data);
+}
+
+static inline int fw_append_raw(struct fw_conn *conn, char *tag, int tag_len,
+                                void *buf, size_t size)
+{
+    if (conn->worker) {
+        return fw_worker_append_raw(conn->worker, tag, tag_len, buf, size);
+    }
+    return flb_input_dyntag_append_raw(conn->in, tag, tag_len, buf, size);
+}
 
-static int fw_process_array(struct flb_input_instance *in,
+static int fw_process_array(struct fw_conn *conn,
                             char *tag, int tag_len,
                             msgpack_object *arr)
 {
     int i;
-    msgpack_object entry;
 
     for (i = 0; i < arr->via.array.size; i++) {
-        entry = arr->via.array.ptr[i];
-        flb_input_dyntag_append(in, tag, tag_len, entry);
+        fw_append(conn, tag, tag_len, &arr->via.array.ptr[i]);
     }
 
     return i;
 }
 
-static size_t receiver_recv(struct fw_conn *conn, char *buf, size_t try_size) {
-    size_t off;
-    size_t actual_size;
+/* Lookup a key in the options map, return NULL if it's not found */
+static msgpack_object *fw_option_get(msgpack_object *options,
+                                     char *key, int key_len)
+{
+    int i;
+    msgpack_object *k;
 
-    off = conn->buf_len - conn->rest;
-    actual_size = try_size;
+    if (!options || options->type != MSGPACK_OBJECT_MAP) {
+        return NULL;
+    }
 
-    if (actual_size > conn->rest) {
-        actual_size = conn->rest;
+    for (i = 0; i < options->via.map.size; i++) {
+        k = &options->via.map.ptr[i].key;
+        if (k->type != MSGPACK_OBJECT_STR) {
+            continue;
+        }
+        if (k->via.str.size == key_len &&
+            strncmp(k->via.str.ptr, key, key_len) == 0) {
+            return &options->via.map.ptr[i].val;
+        }
     }
 
-    memcpy(buf, conn->buf + off, actual_size);
-    conn->rest -= actual_size;
+    return NULL;
+}
 
-    return actual_size;
+/* If the client requested an acknowledgment, reply with {"ack": chunk} */
+static int fw_send_ack(struct fw_conn *conn, msgpack_object *options)
+{
+    int ret;
+    msgpack_object *chunk;
+    msgpack_sbuffer mp_sbuf;
+    msgpack_packer mp_pck;
+
+    chunk = fw_option_get(options, "chunk", 5);
+    if (!chunk) {
+        return 0;
+    }
+
+    msgpack_sbuffer_init(&mp_sbuf);
+    msgpack_packer_init(&mp_pck, &mp_sbuf, msgpack_sbuffer_write);
+    msgpack_pack_map(&mp_pck, 1);
+    msgpack_pack_str(&mp_pck, 3);
+    msgpack_pack_str_body(&mp_pck, "ack", 3);
+    msgpack_pack_object(&mp_pck, *chunk);
+
+    ret = fw_conn_write(conn, mp_sbuf.data, mp_sbuf.size);
+    msgpack_sbuffer_destroy(&mp_sbuf);
+
+    return ret;
 }
 
-static size_t receiver_to_unpacker(struct fw_conn *conn, size_t request_size,
-                                   msgpack_unpacker *unpacker)
+/* Record times are integer seconds or an EventTime extension */
+static inline int fw_is_time(msgpack_object *t)
 {
-    size_t recv_len;
+    if (t->type == MSGPACK_OBJECT_POSITIVE_INTEGER) {
+        return FLB_TRUE;
+    }
+    if (t->type == MSGPACK_OBJECT_EXT &&
+        t->via.ext.type == FLB_TIME_EVENTTIME_TYPE &&
+        t->via.ext.size == FLB_TIME_EVENTTIME_SIZE) {
+        return FLB_TRUE;
+    }
+    return FLB_FALSE;
+}
+
+/*
+ * Packed entries come straight from the network and are appended as they
+ * are, check they are complete [time, map] entries before that. A bad
+ * entry would corrupt the whole tag buffer.
+ */
+static int fw_packed_validate(const char *data, size_t len)
+{
+    int ret = 0;
+    size_t off = 0;
+    msgpack_unpacked result;
 
-    /* make sure there's enough room, or expand the unpacker accordingly */
-    if (msgpack_unpacker_buffer_capacity(unpacker) < request_size) {
-        msgpack_unpacker_reserve_buffer(unpacker, request_size);
-        assert(msgpack_unpacker_buffer_capacity(unpacker) >= request_size);
+    msgpack_unpacked_init(&result);
+    while (off < len) {
+        if (msgpack_unpack_next(&result, data, len, &off) !=
+            MSGPACK_UNPACK_SUCCESS) {
+            ret = -1;
+            break;
+        }
+
+        if (result.data.type != MSGPACK_OBJECT_ARRAY ||
+            result.data.via.array.size != 2 ||
+            result.data.via.array.ptr[1].type != MSGPACK_OBJECT_MAP ||
+            !fw_is_time(&result.data.via.array.ptr[0])) {
+            ret = -1;
+            break;
+        }
     }
-    recv_len = receiver_recv(conn, msgpack_unpacker_buffer(unpacker),
-                             request_size);
-    msgpack_unpacker_buffer_consumed(unpacker, recv_len);
+    msgpack_unpacked_destroy(&result);
 
-    return recv_len;
+    if (ret == -1) {
+        flb_warn("[in_fw] invalid packed entries, message dropped");
+    }
+    return ret;
+}
+
+/*
+ * Decompress a gzip payload of a CompressedPackedForward message. The
+ * buffer may contain more than one gzip member, they are concatenated.
+ * The decompressed entries are limited to 'max_size' bytes, the same
+ * limit (Buffer_Size) applied to uncompressed messages.
+ */
+static void *fw_gunzip(const char *data, size_t len, size_t max_size,
+                       size_t *out_size)
+{
+    int ret;
+    size_t size;
+    size_t grow;
+    char *out;
+    char *tmp;
+    z_stream strm;
+
+    size = len * 4;
+    if (size < 4096) {
+        size = 4096;
+    }
+    if (size > max_size) {
+        size = max_size;
+    }
+
+    out = malloc(size);
+    if (!out) {
+        perror("malloc");
+        return NULL;
+    }
+
+    memset(&strm, '\0', sizeof(z_stream));
+    ret = inflateInit2(&strm, 16 + MAX_WBITS);
+    if (ret != Z_OK) {
+        free(out);
+        return NULL;
+    }
+
+    strm.next_in   = (Bytef *) data;
+    strm.avail_in  = len;
+    strm.next_out  = (Bytef *) out;
+    strm.avail_out = size;
+
+    while (1) {
+        ret = inflate(&strm, Z_NO_FLUSH);
+        if (ret == Z_STREAM_END) {
+            if (strm.avail_in == 0) {
+                break;
+            }
+            /* Next gzip member */
+            inflateReset(&strm);
+            continue;
+        }
+        else if (ret != Z_OK && ret != Z_BUF_ERROR) {
+            goto error;
+        }
+
+        if (strm.avail_out == 0) {
+            if (size >= max_size) {
+                flb_warn("[in_fw] decompressed entries exceed %lu bytes",
+                         max_size);
+                goto error;
+            }
+
+            grow = size;
+            if (size + grow > max_size) {
+                grow = max_size - size;
+            }
+            tmp = realloc(out, size + grow);
+            if (!tmp) {
+                perror("realloc");
+                goto error;
+            }
+            out = tmp;
+            strm.next_out  = (Bytef *) (out + size);
+            strm.avail_out = grow;
+            size += grow;
+        }
+        else if (ret == Z_BUF_ERROR) {
+            /* Truncated input */
+            goto error;
+        }
+    }
+
+    /* total_out is reset on every gzip member, use the buffer position */
+    *out_size = ((char *) strm.next_out - out);
+    inflateEnd(&strm);
+    return out;
+
+ error:
+    flb_debug("[in_fw] could not decompress gzip entries");
+    inflateEnd(&strm);
+    free(out);
+    return NULL;
+}
+
+/*
+ * PackedForward and CompressedPackedForward modes:
+ *
+ *   [tag, <bin or str of concatenated [time, map] entries>, option]
+ *
+ * entries are already serialized as MessagePack so, once validated, they
+ * are appended directly into the tag buffer without repacking them. This
+ * covers the workers mode too (fw_worker_append_raw()).
+ */
+static int fw_process_packed(struct fw_conn *conn,
+                             char *tag, int tag_len,
+                             msgpack_object *entries,
+                             msgpack_object *options)
+{
+    int ret;
+    size_t len;
+    size_t gz_size;
+    const char *data;
+    void *gz_data;
+    msgpack_object *compressed;
+    msgpack_object *size;
+
+    if (entries->type == MSGPACK_OBJECT_BIN) {
+        data = entries->via.bin.ptr;
+        len  = entries->via.bin.size;
+    }
+    else {
+        data = entries->via.str.ptr;
+        len  = entries->via.str.size;
+    }
+
+    if (len == 0) {
+        return 0;
+    }
+
+    size = fw_option_get(options, "size", 4);
+    if (size && size->type == MSGPACK_OBJECT_POSITIVE_INTEGER) {
+        flb_trace("[in_fw] packed forward, %lu entries in %lu bytes",
+                  size->via.u64, len);
+    }
+
+    compressed = fw_option_get(options, "compressed", 10);
+    if (!compressed) {
+        if (fw_packed_validate(data, len) == -1) {
+            return -1;
+        }
+        return fw_append_raw(conn, tag, tag_len, (void *) data, len);
+    }
+
+    if (compressed->type != MSGPACK_OBJECT_STR ||
+        compressed->via.str.size != 4 ||
+        strncmp(compressed->via.str.ptr, "gzip", 4) != 0) {
+        flb_warn("[in_fw] unsupported compression type");
+        return -1;
+    }
+
+    gz_data = fw_gunzip(data, len, conn->ctx->buffer_size, &gz_size);
+    if (!gz_data) {
+        return -1;
+    }
+
+    if (fw_packed_validate(gz_data, gz_size) == -1) {
+        free(gz_data);
+        return -1;
+    }
+
+    ret = fw_append_raw(conn, tag, tag_len, gz_data, gz_size);
+    free(gz_data);
+
+    return ret;
 }
 
 int fw_prot_process(struct fw_conn *conn)
 {
     int ret;
     int stag_len;
-    int c = 0;
     char *stag;
-    size_t buf_off = 0;
-    size_t recv_len;
     msgpack_object tag;
     msgpack_object entry;
     msgpack_object map;
     msgpack_object root;
+    msgpack_object record;
+    msgpack_object fields[2];
+    msgpack_object *options;
     msgpack_unpacked result;
-    msgpack_unpacker *unp;
-    size_t all_used = 0;
+    msgpack_unpacker *unp = &conn->unp;
 
     /*
-     * [tag, time, record]
-     * [tag, [[time,record], [time,record], ...]]
+     * [tag, time, record, option]
+     * [tag, [[time,record], [time,record], ...], option]
+     * [tag, <packed entries>, option]
+     *
+     * the option map is optional for all modes.
+     *
+     * The connection owns a persistent unpacker which already contains the
+     * bytes read from the socket, every call resumes parsing from the last
+     * position so fragmented messages are never copied or parsed twice.
      */
-
-    unp = msgpack_unpacker_new(1024);
     msgpack_unpacked_init(&result);
-    conn->rest = conn->buf_len;
 
-    while (1) {
-        recv_len = receiver_to_unpacker(conn, EACH_RECV_SIZE, unp);
-        if (recv_len == 0) {
-            /* No more data */
-            msgpack_unpacker_free(unp);
+    while ((ret = msgpack_unpacker_next(unp, &result)) ==
+           MSGPACK_UNPACK_SUCCESS) {
+        /* Map the array */
+        root = result.data;
+        if (root.type != MSGPACK_OBJECT_ARRAY) {
+            flb_debug("[in_fw] parser: expecting an array (type=%i), skip.",
+                      root.type);
             msgpack_unpacked_destroy(&result);
+            return -1;
+        }
 
-            /* Adjust buffer data */
-            if (all_used > 0) {
-                memmove(conn->buf, conn->buf + all_used,
-                        conn->buf_len - all_used);
-                conn->buf_len -= all_used;
-            }
-
-            return 0;
+        if (root.via.array.size < 2) {
+            flb_debug("[in_fw] parser: array of invalid size, skip.");
+            msgpack_unpacked_destroy(&result);
+            return -1;
         }
 
-        /* Always summarize the total number of bytes requested to parse */
-        buf_off += recv_len;
+        /* Get the tag */
+        tag = root.via.array.ptr[0];
+        if (tag.type != MSGPACK_OBJECT_STR) {
+            flb_debug("[in_fw] parser: invalid tag format, skip.");
+            msgpack_unpacked_destroy(&result);
+            return -1;
+        }
 
-        ret = msgpack_unpacker_next(unp, &result);
-        while (ret == MSGPACK_UNPACK_SUCCESS) {
-            /*
-             * For buffering optimization we always want to know the total
-             * number of bytes involved on the new object returned. Despites
-             * buf_off always know the given bytes, it's likely we used a bit
-             * less. This 'all_used' field keep a reference per object so
-             * when returning to the caller we can adjust the source buffer
-             * and deprecated consumed data.
-             *
-             * The 'last_parsed' field is Fluent Bit specific and is documented
-             * in:
-             *
-             *  lib/msgpack-c/include/msgpack/unpack.h
-             *
-             * Other references:
-             *
-             *  https://github.com/msgpack/msgpack-c/issues/514
-             */
-            all_used += unp->last_parsed;
+        stag     = (char *) tag.via.str.ptr;
+        stag_len = tag.via.str.size;
 
-            /* Map the array */
-            root = result.data;
-            if (root.type != MSGPACK_OBJECT_ARRAY) {
-                flb_debug("[in_fw] parser: expecting an array (type=%i), skip.",
-                          root.type);
+        options = NULL;
+        entry = root.via.array.ptr[1];
+        if (entry.type == MSGPACK_OBJECT_ARRAY) {
+            /* Forward format 1: [tag, [[time, map], ...]] */
+            fw_process_array(conn, stag, stag_len, &entry);
+            if (root.via.array.size > 2) {
+                options = &root.via.array.ptr[2];
+            }
+        }
+        else if (entry.type == MSGPACK_OBJECT_BIN ||
+                 entry.type == MSGPACK_OBJECT_STR) {
+            /* Forward format 3: [tag, <packed entries>, option] */
+            if (root.via.array.size > 2) {
+                options = &root.via.array.ptr[2];
+            }
+            ret = fw_process_packed(conn, stag, stag_len,
+                                    &entry, options);
+            if (ret == -1) {
                 msgpack_unpacked_destroy(&result);
-                msgpack_unpacker_free(unp);
                 return -1;
             }
-
-            if (root.via.array.size < 2) {
-                flb_debug("[in_fw] parser: array of invalid size, skip.");
+        }
+        else if (fw_is_time(&entry)) {
+            /* Forward format 2: [tag, time, map], time may be an EventTime */
+            if (root.via.array.size < 3) {
+                flb_warn("[in_fw] invalid data format, map expected");
                 msgpack_unpacked_destroy(&result);
-                msgpack_unpacker_free(unp);
                 return -1;
             }
 
-            /* Get the tag */
-            tag = root.via.array.ptr[0];
-            if (tag.type != MSGPACK_OBJECT_STR) {
-                flb_debug("[in_fw] parser: invalid tag format, skip.");
+            map = root.via.array.ptr[2];
+            if (map.type != MSGPACK_OBJECT_MAP) {
+                flb_warn("[in_fw] invalid data format, map expected");
                 msgpack_unpacked_destroy(&result);
-                msgpack_unpacker_free(unp);
                 return -1;
             }
 
-            stag     = (char *) tag.via.str.ptr;
-            stag_len = tag.via.str.size;
-
-            entry = root.via.array.ptr[1];
-            if (entry.type == MSGPACK_OBJECT_ARRAY) {
-                /* Forward format 1: [tag, [[time, map], ...]] */
-                fw_process_array(conn->in, stag, stag_len, &entry);
-            }
-            else if (entry.type == MSGPACK_OBJECT_POSITIVE_INTEGER) {
-                /* Forward format 2: [tag, time, map] */
-                map = root.via.array.ptr[2];
-                if (map.type != MSGPACK_OBJECT_MAP) {
-                    flb_warn("[in_fw] invalid data format, map expected");
-                    msgpack_unpacked_destroy(&result);
-                    msgpack_unpacker_free(unp);
-                    return -1;
-                }
-
-                /* Compose the new array */
-                struct msgpack_sbuffer mp_sbuf;
-                struct msgpack_packer mp_pck;
-                msgpack_unpacked r_out;
-                size_t off = 0;
-
-                msgpack_sbuffer_init(&mp_sbuf);
-                msgpack_packer_init(&mp_pck, &mp_sbuf, msgpack_sbuffer_write);
-
-                msgpack_pack_array(&mp_pck, 2);
-                msgpack_pack_object(&mp_pck, entry);
-                msgpack_pack_object(&mp_pck, map);
-
-                /* sbuffer to msgpack object */
-                msgpack_unpacked_init(&r_out);
-                ret = msgpack_unpack_next(&r_out,
-                                          mp_sbuf.data,
-                                          mp_sbuf.size,
-                                          &off);
-                if (ret != MSGPACK_UNPACK_SUCCESS) {
-                    msgpack_unpacked_destroy(&result);
-                    msgpack_unpacker_free(unp);
-                    return -1;
-                }
-
-                /* Register data object */
-                entry = r_out.data;
-                flb_input_dyntag_append(conn->in,
-                                        stag, stag_len,
-                                        entry);
-
-                msgpack_unpacked_destroy(&r_out);
-                msgpack_sbuffer_destroy(&mp_sbuf);
-                c++;
+            /*
+             * Compose the [time, map] array on the stack, the packer will
+             * serialize it directly into the tag buffer.
+             */
+            fields[0] = entry;
+            fields[1] = map;
+            record.type = MSGPACK_OBJECT_ARRAY;
+            record.via.array.size = 2;
+            record.via.array.ptr = fields;
+
+            fw_append(conn, stag, stag_len, &record);
+            if (root.via.array.size > 3) {
+                options = &root.via.array.ptr[3];
             }
-            else {
-                flb_warn("[in_fw] invalid data format");
+        }
+        else {
+            flb_warn("[in_fw] invalid data format");
+            msgpack_unpacked_destroy(&result);
+            return -1;
+        }
+
+        if (options) {
+            ret = fw_send_ack(conn, options);
+            if (ret == -1) {
                 msgpack_unpacked_destroy(&result);
-                msgpack_unpacker_free(unp);
                 return -1;
             }
-
-            ret = msgpack_unpacker_next(unp, &result);
         }
     }
     msgpack_unpacked_destroy(&result);
-    msgpack_unpacker_free(unp);
 
     switch (ret) {
     case MSGPACK_UNPACK_EXTRA_BYTES:
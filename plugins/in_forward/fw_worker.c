@@ -0,0 +1,524 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Fluent Bit
+ *  ==========
+ *  Copyright (C) 2015-2016 Treasure Data Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include <fluent-bit/flb_input.h>
+#include <fluent-bit/flb_utils.h>
+#include <fluent-bit/flb_engine.h>
+#include <fluent-bit/flb_network.h>
+#include <fluent-bit/flb_mpsc.h>
+
+#include "fw.h"
+#include "fw_conn.h"
+#include "fw_worker.h"
+
+/*
+ * Workers mode
+ * ============
+ * When the 'Workers' property is set, in_forward spawns N threads, each one
+ * with it own listener socket bound with SO_REUSEPORT (so the Kernel balance
+ * new connections across them) and it own event loop. A worker reads and
+ * parses the connections data and appends the records into worker local
+ * buffers. Buffers are sealed when they reach FLB_IN_FW_SEAL_SIZE or when
+ * the flush timer expires, then they are enqueued into a lock-free queue
+ * and the engine is notified through a pipe. The engine only moves the
+ * sealed chunks into the instance tag buffers.
+ *
+ * While more than FLB_IN_FW_QUEUE_MAX bytes wait for the engine, a worker
+ * stops reading its connections, it checks the queue again on every seal
+ * timer. When the engine stops, the workers are stopped and their last
+ * chunks are ingested before the final flush.
+ */
+
+static struct fw_buffer *fw_buffer_get(struct fw_worker *worker,
+                                       char *tag, int tag_len)
+{
+    struct mk_list *head;
+    struct fw_buffer *fb;
+
+    mk_list_foreach(head, &worker->buffers) {
+        fb = mk_list_entry(head, struct fw_buffer, _head);
+        if (fb->tag_len == tag_len && strncmp(fb->tag, tag, tag_len) == 0) {
+            return fb;
+        }
+    }
+
+    fb = malloc(sizeof(struct fw_buffer));
+    if (!fb) {
+        perror("malloc");
+        return NULL;
+    }
+
+    fb->tag = malloc(tag_len + 1);
+    if (!fb->tag) {
+        perror("malloc");
+        free(fb);
+        return NULL;
+    }
+    memcpy(fb->tag, tag, tag_len);
+    fb->tag[tag_len] = '\0';
+    fb->tag_len = tag_len;
+
+    msgpack_sbuffer_init(&fb->mp_sbuf);
+    msgpack_packer_init(&fb->mp_pck, &fb->mp_sbuf, msgpack_sbuffer_write);
+    mk_list_add(&fb->_head, &worker->buffers);
+
+    return fb;
+}
+
+static void fw_buffer_destroy(struct fw_buffer *fb)
+{
+    mk_list_del(&fb->_head);
+    msgpack_sbuffer_destroy(&fb->mp_sbuf);
+    free(fb->tag);
+    free(fb);
+}
+
+/* Notify the engine that sealed chunks are available */
+static inline void fw_worker_notify(struct flb_in_fw_config *ctx)
+{
+    int ret;
+    uint64_t val = 1;
+
+    /* If the pipe is full, the engine already have a pending signal */
+    ret = write(ctx->ch_chunks[1], &val, sizeof(val));
+    if (ret == -1 && errno != EAGAIN) {
+        perror("write");
+    }
+}
+
+/* Move the buffer content into a sealed chunk and enqueue it */
+static int fw_worker_seal(struct fw_worker *worker, struct fw_buffer *fb)
+{
+    struct fw_chunk *chunk;
+
+    if (fb->mp_sbuf.size == 0) {
+        return 0;
+    }
+
+    chunk = malloc(sizeof(struct fw_chunk));
+    if (!chunk) {
+        perror("malloc");
+        return -1;
+    }
+
+    chunk->tag = strdup(fb->tag);
+    if (!chunk->tag) {
+        perror("strdup");
+        free(chunk);
+        return -1;
+    }
+    chunk->tag_len = fb->tag_len;
+
+    /* Take the buffer reference, no copies */
+    chunk->buf  = fb->mp_sbuf.data;
+    chunk->size = fb->mp_sbuf.size;
+    msgpack_sbuffer_init(&fb->mp_sbuf);
+
+    __atomic_add_fetch(&worker->ctx->chunks_size, chunk->size,
+                       __ATOMIC_RELAXED);
+    flb_mpsc_push(&worker->ctx->chunks, &chunk->_node);
+    return 1;
+}
+
+/* Pause or resume reading the connections, depending on the queued bytes */
+static void fw_worker_throttle(struct fw_worker *worker)
+{
+    int paused;
+    size_t queued;
+    struct mk_list *head;
+    struct fw_conn *conn;
+
+    queued = __atomic_load_n(&worker->ctx->chunks_size, __ATOMIC_RELAXED);
+    paused = (queued >= FLB_IN_FW_QUEUE_MAX) ? FLB_TRUE : FLB_FALSE;
+    if (paused == worker->paused) {
+        return;
+    }
+
+    flb_debug("[in_fw] worker #%i %s reading, %zu bytes queued",
+              worker->id, paused ? "pause" : "resume", queued);
+    worker->paused = paused;
+    mk_list_foreach(head, &worker->connections) {
+        conn = mk_list_entry(head, struct fw_conn, _head);
+        fw_conn_events(conn);
+    }
+}
+
+static void fw_worker_seal_all(struct fw_worker *worker)
+{
+    int n = 0;
+    struct mk_list *tmp;
+    struct mk_list *head;
+    struct fw_buffer *fb;
+
+    mk_list_foreach_safe(head, tmp, &worker->buffers) {
+        fb = mk_list_entry(head, struct fw_buffer, _head);
+        if (fb->mp_sbuf.size == 0) {
+            /* Release buffers of tags that are not longer active */
+            fw_buffer_destroy(fb);
+            continue;
+        }
+        if (fw_worker_seal(worker, fb) > 0) {
+            n++;
+        }
+    }
+
+    if (n > 0) {
+        fw_worker_notify(worker->ctx);
+    }
+    fw_worker_throttle(worker);
+}
+
+static inline void fw_worker_check_size(struct fw_worker *worker,
+                                        struct fw_buffer *fb)
+{
+    if (fb->mp_sbuf.size >= FLB_IN_FW_SEAL_SIZE) {
+        if (fw_worker_seal(worker, fb) > 0) {
+            fw_worker_notify(worker->ctx);
+            fw_worker_throttle(worker);
+        }
+    }
+}
+
+/* Append a record into the worker local buffer */
+int fw_worker_append(struct fw_worker *worker, char *tag, int tag_len,
+                     msgpack_object *data)
+{
+    struct fw_buffer *fb;
+
+    fb = fw_buffer_get(worker, tag, tag_len);
+    if (!fb) {
+        return -1;
+    }
+
+    msgpack_pack_object(&fb->mp_pck, *data);
+    fw_worker_check_size(worker, fb);
+
+    return 0;
+}
+
+/* Append serialized records into the worker local buffer */
+int fw_worker_append_raw(struct fw_worker *worker, char *tag, int tag_len,
+                         void *buf, size_t size)
+{
+    int ret;
+    struct fw_buffer *fb;
+
+    fb = fw_buffer_get(worker, tag, tag_len);
+    if (!fb) {
+        return -1;
+    }
+
+    ret = msgpack_sbuffer_write(&fb->mp_sbuf, buf, size);
+    if (ret != 0) {
+        return -1;
+    }
+    fw_worker_check_size(worker, fb);
+
+    return 0;
+}
+
+static void fw_worker_accept(struct fw_worker *worker)
+{
+    int fd;
+    struct fw_conn *conn;
+
+    fd = flb_net_accept(worker->server_fd);
+    if (fd == -1) {
+        return;
+    }
+
+    flb_trace("[in_fw] worker #%i new TCP connection arrived FD=%i",
+              worker->id, fd);
+    conn = fw_conn_add(fd, worker->ctx, worker);
+    if (!conn) {
+        flb_error("[in_fw] worker #%i could not register connection",
+                  worker->id);
+    }
+}
+
+/* Worker thread: serve the listener and the connections event loop */
+static void fw_worker_loop(void *data)
+{
+    int ret;
+    uint64_t val;
+    struct mk_event *event;
+    struct fw_worker *worker = data;
+
+    mk_utils_worker_rename("flb-in-fw");
+    FLB_TLS_SET(flb_log_ctx, worker->log);
+
+    while (1) {
+        mk_event_wait(worker->evl);
+        mk_event_foreach(event, worker->evl) {
+            if (event == &worker->event_server) {
+                fw_worker_accept(worker);
+            }
+            else if (event == &worker->event_timer) {
+                ret = read(event->fd, &val, sizeof(val));
+                if (ret <= 0) {
+                    perror("read");
+                }
+                fw_worker_seal_all(worker);
+            }
+            else if (event == &worker->event_mng) {
+                ret = read(event->fd, &val, sizeof(val));
+                if (ret > 0 && val == FW_WORKER_STOP) {
+                    fw_worker_seal_all(worker);
+                    return;
+                }
+            }
+            else if (event->type == FLB_ENGINE_EV_CUSTOM) {
+                event->handler(event);
+            }
+        }
+    }
+}
+
+static void fw_worker_destroy(struct fw_worker *worker)
+{
+    struct mk_list *tmp;
+    struct mk_list *head;
+    struct fw_conn *conn;
+    struct fw_buffer *fb;
+
+    mk_list_foreach_safe(head, tmp, &worker->connections) {
+        conn = mk_list_entry(head, struct fw_conn, _head);
+        fw_conn_del(conn);
+    }
+
+    mk_list_foreach_safe(head, tmp, &worker->buffers) {
+        fb = mk_list_entry(head, struct fw_buffer, _head);
+        fw_buffer_destroy(fb);
+    }
+
+    if (worker->server_fd > 0) {
+        close(worker->server_fd);
+    }
+    if (worker->event_timer.fd > 0) {
+        mk_event_del(worker->evl, &worker->event_timer);
+        close(worker->event_timer.fd);
+    }
+    if (worker->ch_mng[0] > 0) {
+        mk_event_del(worker->evl, &worker->event_mng);
+        close(worker->ch_mng[0]);
+        close(worker->ch_mng[1]);
+    }
+    if (worker->evl) {
+        mk_event_loop_destroy(worker->evl);
+    }
+
+    mk_list_del(&worker->_head);
+    free(worker);
+}
+
+/* Create the workers contexts, listeners and event loops */
+int fw_workers_create(struct flb_in_fw_config *ctx)
+{
+    int i;
+    int ret;
+    struct fw_worker *worker;
+
+    mk_list_init(&ctx->worker_list);
+    flb_mpsc_init(&ctx->chunks);
+    ctx->chunks_size = 0;
+
+    ret = pipe(ctx->ch_chunks);
+    if (ret == -1) {
+        perror("pipe");
+        ctx->ch_chunks[0] = -1;
+        ctx->ch_chunks[1] = -1;
+        return -1;
+    }
+    flb_net_socket_nonblocking(ctx->ch_chunks[0]);
+    flb_net_socket_nonblocking(ctx->ch_chunks[1]);
+
+    for (i = 0; i < ctx->workers; i++) {
+        worker = calloc(1, sizeof(struct fw_worker));
+        if (!worker) {
+            perror("calloc");
+            goto error;
+        }
+        worker->id  = i;
+        worker->ctx = ctx;
+        worker->paused = FLB_FALSE;
+        worker->event_timer.fd = -1;
+        mk_list_init(&worker->connections);
+        mk_list_init(&worker->buffers);
+        mk_list_add(&worker->_head, &ctx->worker_list);
+
+        worker->evl = mk_event_loop_create(256);
+        if (!worker->evl) {
+            goto error;
+        }
+
+        /* Listener */
+        worker->server_fd = flb_net_server_reuseport(ctx->tcp_port,
+                                                     ctx->listen);
+        if (worker->server_fd <= 0) {
+            flb_error("[in_fw] worker #%i could not bind address %s:%s",
+                      i, ctx->listen, ctx->tcp_port);
+            goto error;
+        }
+        flb_net_socket_nonblocking(worker->server_fd);
+
+        MK_EVENT_NEW(&worker->event_server);
+        ret = mk_event_add(worker->evl, worker->server_fd,
+                           FLB_ENGINE_EV_CORE, MK_EVENT_READ,
+                           &worker->event_server);
+        if (ret == -1) {
+            goto error;
+        }
+
+        /* Seal timer */
+        ret = mk_event_timeout_create(worker->evl, ctx->flush, 0,
+                                      &worker->event_timer);
+        if (ret == -1) {
+            goto error;
+        }
+
+        /* Management channel */
+        ret = mk_event_channel_create(worker->evl,
+                                      &worker->ch_mng[0], &worker->ch_mng[1],
+                                      &worker->event_mng);
+        if (ret != 0) {
+            goto error;
+        }
+    }
+
+    flb_info("[in_fw] binding %s:%s with %i workers",
+             ctx->listen, ctx->tcp_port, ctx->workers);
+    return 0;
+
+ error:
+    fw_workers_destroy(ctx);
+    return -1;
+}
+
+/* Spawn the workers threads */
+int fw_workers_start(struct flb_in_fw_config *ctx)
+{
+    int ret;
+    struct mk_list *head;
+    struct fw_worker *worker;
+
+    mk_list_foreach(head, &ctx->worker_list) {
+        worker = mk_list_entry(head, struct fw_worker, _head);
+        worker->log = FLB_TLS_GET(flb_log_ctx);
+        ret = mk_utils_worker_spawn(fw_worker_loop, worker, &worker->tid);
+        if (ret != 0) {
+            flb_error("[in_fw] could not spawn worker #%i", worker->id);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Engine collector: invoked from the engine event loop when some worker
+ * have enqueued sealed chunks.
+ */
+int fw_workers_collect(struct flb_config *config, void *in_context)
+{
+    int ret;
+    uint64_t val[16];
+    struct flb_mpsc_node *node;
+    struct fw_chunk *chunk;
+    struct flb_in_fw_config *ctx = in_context;
+    (void) config;
+
+    /* Consume the notifications */
+    do {
+        ret = read(ctx->ch_chunks[0], val, sizeof(val));
+    } while (ret == sizeof(val));
+
+    while ((node = flb_mpsc_pop(&ctx->chunks))) {
+        chunk = mk_list_entry(node, struct fw_chunk, _node);
+        __atomic_sub_fetch(&ctx->chunks_size, chunk->size, __ATOMIC_RELAXED);
+        flb_input_dyntag_append_raw(ctx->in, chunk->tag, chunk->tag_len,
+                                    chunk->buf, chunk->size);
+        free(chunk->buf);
+        free(chunk->tag);
+        free(chunk);
+    }
+
+    return 0;
+}
+
+/* Stop the workers threads, their local buffers are sealed */
+void fw_workers_stop(struct flb_in_fw_config *ctx)
+{
+    int ret;
+    uint64_t val;
+    struct mk_list *head;
+    struct fw_worker *worker;
+
+    mk_list_foreach(head, &ctx->worker_list) {
+        worker = mk_list_entry(head, struct fw_worker, _head);
+        if (!worker->tid) {
+            continue;
+        }
+
+        val = FW_WORKER_STOP;
+        ret = write(worker->ch_mng[1], &val, sizeof(val));
+        if (ret > 0) {
+            pthread_join(worker->tid, NULL);
+        }
+        worker->tid = 0;
+    }
+}
+
+/*
+ * Release all resources. The chunks are ingested by the engine before the
+ * last flush (in_fw_pre_exit), only an instance that never ran has some.
+ */
+void fw_workers_destroy(struct flb_in_fw_config *ctx)
+{
+    struct mk_list *tmp;
+    struct mk_list *head;
+    struct flb_mpsc_node *node;
+    struct fw_chunk *chunk;
+    struct fw_worker *worker;
+
+    fw_workers_stop(ctx);
+    mk_list_foreach_safe(head, tmp, &ctx->worker_list) {
+        worker = mk_list_entry(head, struct fw_worker, _head);
+        fw_worker_destroy(worker);
+    }
+
+    while ((node = flb_mpsc_pop(&ctx->chunks))) {
+        chunk = mk_list_entry(node, struct fw_chunk, _node);
+        free(chunk->buf);
+        free(chunk->tag);
+        free(chunk);
+    }
+    ctx->chunks_size = 0;
+
+    if (ctx->ch_chunks[0] > 0) {
+        close(ctx->ch_chunks[0]);
+        close(ctx->ch_chunks[1]);
+        ctx->ch_chunks[0] = -1;
+        ctx->ch_chunks[1] = -1;
+    }
+}
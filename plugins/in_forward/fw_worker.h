@@ -0,0 +1,85 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Fluent Bit
+ *  ==========
+ *  Copyright (C) 2015-2016 Treasure Data Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef FLB_IN_FW_WORKER_H
+#define FLB_IN_FW_WORKER_H
+
+#include <pthread.h>
+#include <msgpack.h>
+#include <fluent-bit/flb_log.h>
+#include <fluent-bit/flb_mpsc.h>
+
+#include "fw.h"
+
+/* Worker local buffers are sealed and handed to the engine at this size */
+#define FLB_IN_FW_SEAL_SIZE  1024000
+
+/* Sealed bytes not ingested by the engine, above it workers stop reading */
+#define FLB_IN_FW_QUEUE_MAX  (16 * FLB_IN_FW_SEAL_SIZE)
+
+/* Management channel signals */
+#define FW_WORKER_STOP       1
+
+/* A sealed chunk ready to be ingested by the engine */
+struct fw_chunk {
+    char *tag;
+    int tag_len;
+    char *buf;
+    size_t size;
+    struct flb_mpsc_node _node;
+};
+
+/* Worker local buffer of records under the same tag */
+struct fw_buffer {
+    char *tag;
+    int tag_len;
+    msgpack_sbuffer mp_sbuf;
+    msgpack_packer mp_pck;
+    struct mk_list _head;
+};
+
+struct fw_worker {
+    int id;
+    int server_fd;                   /* SO_REUSEPORT listener           */
+    int ch_mng[2];                   /* Management channel              */
+    int paused;                      /* Connections not read (queue max) */
+    pthread_t tid;                   /* Thread ID                       */
+    struct mk_event event_server;    /* Listener event                  */
+    struct mk_event event_timer;     /* Periodic seal timer             */
+    struct mk_event event_mng;       /* Management event                */
+    struct mk_event_loop *evl;       /* Worker event loop               */
+    struct mk_list connections;      /* Connections served by the worker */
+    struct mk_list buffers;          /* Local fw_buffer's               */
+    struct flb_log *log;             /* Engine log context              */
+    struct flb_in_fw_config *ctx;
+    struct mk_list _head;
+};
+
+int fw_worker_append(struct fw_worker *worker, char *tag, int tag_len,
+                     msgpack_object *data);
+int fw_worker_append_raw(struct fw_worker *worker, char *tag, int tag_len,
+                         void *buf, size_t size);
+
+int fw_workers_create(struct flb_in_fw_config *ctx);
+int fw_workers_start(struct flb_in_fw_config *ctx);
+int fw_workers_collect(struct flb_config *config, void *in_context);
+void fw_workers_stop(struct flb_in_fw_config *ctx);
+void fw_workers_destroy(struct flb_in_fw_config *ctx);
+
+#endif
@@ -29,7 +29,6 @@
 #include <fluent-bit/flb_config.h>
 #include <fluent-bit/flb_error.h>
 #include <fluent-bit/flb_utils.h>
-#include <fluent-bit/flb_stats.h>
 
 #include "in_head.h"
 
@@ -57,7 +56,8 @@ static int in_head_collect(struct flb_config *config, void *in_context)
     }
 
     msgpack_pack_array(&head_config->mp_pck, 2);
-    msgpack_pack_uint64(&head_config->mp_pck, time(NULL));
+    flb_time_append_to_msgpack(&config->clock, &head_config->mp_pck,
+                               FLB_TIME_FMT_EVENTTIME);
     msgpack_pack_map(&head_config->mp_pck, 1);
 
     msgpack_pack_bin(&head_config->mp_pck, 4);
@@ -68,7 +68,6 @@ static int in_head_collect(struct flb_config *config, void *in_context)
 
     ret = 0;
     head_config->idx++;
-    flb_stats_update(in_head_plugin.stats_fd, 0, 1);
 
  collect_fin:
     close(fd);
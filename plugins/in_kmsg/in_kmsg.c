@@ -33,7 +33,6 @@
 #include <fluent-bit/flb_input.h>
 #include <fluent-bit/flb_utils.h>
 #include <fluent-bit/flb_engine.h>
-#include <fluent-bit/flb_stats.h>
 
 #include "in_kmsg.h"
 struct flb_input_plugin in_kmsg_plugin;
@@ -134,7 +133,7 @@ static inline int process_line(char *line, struct flb_in_kmsg_config *ctx)
 {
     char priority;           /* log priority                */
     uint64_t sequence;       /* sequence number             */
-    time_t ts;               /* unix timestamp              */
+    struct flb_time ts;      /* unix timestamp              */
     struct timeval tv;       /* time value                  */
     int line_len;
     uint64_t val;
@@ -178,7 +177,11 @@ static inline int process_line(char *line, struct flb_in_kmsg_config *ctx)
     tv.tv_sec  = val/1000000;
     tv.tv_usec = val - (tv.tv_sec * 1000000);
 
-    ts = ctx->boot_time.tv_sec + tv.tv_sec;
+    /* Kernel time is relative to the boot time, keep the microseconds */
+    val = ctx->boot_time.tv_usec + tv.tv_usec;
+    flb_time_set(&ts,
+                 ctx->boot_time.tv_sec + tv.tv_sec + (val / KMSG_USEC_PER_SEC),
+                 (val % KMSG_USEC_PER_SEC) * 1000);
 
     /* Now process the human readable message */
     p = strchr(p, ';');
@@ -196,7 +199,7 @@ static inline int process_line(char *line, struct flb_in_kmsg_config *ctx)
      * we handle this as a list of maps.
      */
     msgpack_pack_array(&ctx->mp_pck, 2);
-    msgpack_pack_uint64(&ctx->mp_pck, ts);
+    flb_time_append_to_msgpack(&ts, &ctx->mp_pck, FLB_TIME_FMT_EVENTTIME);
 
     msgpack_pack_map(&ctx->mp_pck, 5);
     msgpack_pack_bin(&ctx->mp_pck, 8);
@@ -264,7 +267,6 @@ int in_kmsg_collect(struct flb_config *config, void *in_context)
     /* Process and enqueue the received line */
     process_line(line, ctx);
 
-    flb_stats_update(in_kmsg_plugin.stats_fd, bytes, 1);
     return 0;
 }
 
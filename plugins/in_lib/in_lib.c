@@ -19,6 +19,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -29,6 +30,7 @@
 #include <fluent-bit/flb_config.h>
 #include <fluent-bit/flb_pack.h>
 #include <fluent-bit/flb_error.h>
+#include <fluent-bit/flb_lib.h>
 #include "in_lib.h"
 
 /* Initialize plugin */
@@ -36,6 +38,7 @@ int in_lib_init(struct flb_input_instance *in,
                 struct flb_config *config, void *data)
 {
     int ret;
+    char *tmp;
     struct flb_in_lib_config *ctx;
     (void) data;
 
@@ -56,6 +59,14 @@ int in_lib_init(struct flb_input_instance *in,
     ctx->msgp_size = LIB_BUF_CHUNK;
     ctx->msgp_data = malloc(LIB_BUF_CHUNK);
     ctx->msgp_len = 0;
+    ctx->in = in;
+
+    /* Bytes enqueued by the application threads, in KB */
+    in->lib_queue_limit = FLB_LIB_QUEUE_LIMIT;
+    tmp = flb_input_get_property("queue_limit", in);
+    if (tmp) {
+        in->lib_queue_limit = strtoul(tmp, NULL, 10) * 1024;
+    }
 
     /* Init communication channel */
     flb_input_channel_init(in);
@@ -84,8 +95,21 @@ int in_lib_init(struct flb_input_instance *in,
 int in_lib_exit(void *data, struct flb_config *config)
 {
     (void) config;
+    struct flb_mpsc_node *node;
+    struct flb_lib_chunk *chunk;
     struct flb_in_lib_config *ctx = data;
-    struct flb_pack_state *s;
+
+    /* Application threads must not append to this instance anymore */
+    flb_lib_input_exit(ctx->in);
+
+    /* Discard chunks enqueued after the last flush */
+    while ((node = flb_mpsc_pop(&ctx->in->lib_chunks))) {
+        chunk = mk_list_entry(node, struct flb_lib_chunk, _node);
+        __atomic_sub_fetch(&ctx->in->lib_queued, chunk->size,
+                           __ATOMIC_RELAXED);
+        free(chunk->buf);
+        free(chunk);
+    }
 
     if (ctx->buf_data) {
         free(ctx->buf_data);
@@ -95,18 +119,58 @@ int in_lib_exit(void *data, struct flb_config *config)
         free(ctx->msgp_data);
     }
 
-    s = &ctx->state;
-    if (s->tokens) {
-        free(s->tokens);
+    flb_pack_state_reset(&ctx->state);
+    free(ctx);
+    return 0;
+}
+
+/* Append packed records to the msgpack buffer */
+static int msgp_append(struct flb_in_lib_config *ctx, char *data, int len)
+{
+    int n;
+    int size;
+    int capacity;
+    char *ptr;
+
+    /* Grow it twice the required size, queued chunks come in bursts */
+    capacity = (ctx->msgp_size - ctx->msgp_len);
+    if (capacity < len) {
+        n = ((len - capacity) / LIB_BUF_CHUNK) + 1;
+        size = ctx->msgp_size + (LIB_BUF_CHUNK * n);
+        if (size < ctx->msgp_size * 2) {
+            size = ctx->msgp_size * 2;
+        }
+        ptr = realloc(ctx->msgp_data, size);
+        if (!ptr) {
+            perror("realloc");
+            return -1;
+        }
+        ctx->msgp_data = ptr;
+        ctx->msgp_size = size;
     }
 
-    free(ctx);
+    memcpy(ctx->msgp_data + ctx->msgp_len, data, len);
+    ctx->msgp_len += len;
+
     return 0;
 }
 
+static void chunk_append(struct flb_in_lib_config *ctx,
+                         struct flb_lib_chunk *chunk)
+{
+    int ret;
+
+    ret = msgp_append(ctx, chunk->buf, chunk->size);
+    if (ret == -1) {
+        flb_error("[in_lib] could not buffer %zu bytes, records dropped",
+                  chunk->size);
+    }
+    free(chunk->buf);
+    free(chunk);
+}
+
 int in_lib_collect(struct flb_config *config, void *in_context)
 {
-    int n;
     int ret;
     int bytes;
     int out_size;
@@ -154,51 +218,75 @@ int in_lib_collect(struct flb_config *config, void *in_context)
     else if (ret == FLB_ERR_JSON_INVAL) {
         flb_warn("lib data invalid");
         flb_pack_state_reset(&ctx->state);
-        flb_pack_state_init(&ctx->state);
+        ctx->buf_len = 0;
         return -1;
     }
-    ctx->buf_len = 0;
 
-    capacity = (ctx->msgp_size - ctx->msgp_len);
-    if (capacity < out_size) {
-        n = ((out_size - capacity) / LIB_BUF_CHUNK) + 1;
-        size = ctx->msgp_size + (LIB_BUF_CHUNK * n);
-        ptr = realloc(ctx->msgp_data, size);
-        if (!ptr) {
-            perror("realloc");
-            free(pack);
-            flb_pack_state_reset(&ctx->state);
-            flb_pack_state_init(&ctx->state);
-            return -1;
-        }
-        ctx->msgp_data = ptr;
-        ctx->msgp_size = size;
+    /* Keep the incomplete message for the next round */
+    if (ctx->state.consumed < ctx->buf_len) {
+        memmove(ctx->buf_data, ctx->buf_data + ctx->state.consumed,
+                ctx->buf_len - ctx->state.consumed);
     }
+    ctx->buf_len -= ctx->state.consumed;
 
-    memcpy(ctx->msgp_data + ctx->msgp_len, pack, out_size);
-    ctx->msgp_len += out_size;
+    ret = msgp_append(ctx, pack, out_size);
     free(pack);
 
-    flb_pack_state_reset(&ctx->state);
-    flb_pack_state_init(&ctx->state);
-
-    return 0;
+    return ret;
 }
 
+/*
+ * Collect the chunks enqueued by flb_lib_push_msgpack() and the record
+ * builder: a single chunk is handed to the engine as is, otherwise they
+ * are appended to the records that came through the channel.
+ */
 void *in_lib_flush(void *in_context, size_t *size)
 {
     char *buf;
+    struct flb_mpsc_node *node;
+    struct flb_lib_chunk *chunk;
+    struct flb_lib_chunk *first = NULL;
     struct flb_in_lib_config *ctx = in_context;
 
+    while ((node = flb_mpsc_pop(&ctx->in->lib_chunks))) {
+        chunk = mk_list_entry(node, struct flb_lib_chunk, _node);
+        __atomic_sub_fetch(&ctx->in->lib_queued, chunk->size,
+                           __ATOMIC_RELAXED);
+        if (ctx->msgp_len == 0 && !first) {
+            first = chunk;
+            continue;
+        }
+
+        if (first) {
+            chunk_append(ctx, first);
+            first = NULL;
+        }
+        chunk_append(ctx, chunk);
+    }
+
+    if (first) {
+        buf = first->buf;
+        *size = first->size;
+        free(first);
+        return buf;
+    }
+
     if (ctx->msgp_len == 0) {
         *size = 0;
         return NULL;
     }
 
-    buf = malloc(ctx->msgp_len);
-    memcpy(buf, ctx->msgp_data, ctx->msgp_len);
+    /* Hand over the buffer and start a new one */
+    buf = ctx->msgp_data;
     *size = ctx->msgp_len;
+
+    ctx->msgp_data = malloc(LIB_BUF_CHUNK);
+    ctx->msgp_size = LIB_BUF_CHUNK;
     ctx->msgp_len = 0;
+    if (!ctx->msgp_data) {
+        perror("malloc");
+        ctx->msgp_size = 0;
+    }
 
     return buf;
 }
@@ -39,6 +39,7 @@ struct flb_in_lib_config {
     char *msgp_data;            /* msgpack static buffer */
 
     struct flb_pack_state state;
+    struct flb_input_instance *in;
 };
 
 int in_lib_collect(struct flb_config *config, void *in_context);
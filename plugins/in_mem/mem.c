@@ -25,7 +25,6 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 
-#include <fluent-bit/flb_stats.h>
 #include <fluent-bit/flb_kernel.h>
 
 #include "mem.h"
@@ -176,7 +175,8 @@ int in_mem_collect(struct flb_config *config, void *in_context)
     }
 
     msgpack_pack_array(&ctx->pckr, 2);
-    msgpack_pack_uint64(&ctx->pckr, time(NULL));
+    flb_time_append_to_msgpack(&config->clock, &ctx->pckr,
+                               FLB_TIME_FMT_EVENTTIME);
     msgpack_pack_map(&ctx->pckr, 2);
 
     msgpack_pack_bin(&ctx->pckr, 5);
@@ -191,7 +191,6 @@ int in_mem_collect(struct flb_config *config, void *in_context)
               total, free);
     ++ctx->idx;
 
-    flb_stats_update(in_mem_plugin.stats_fd, 0, 1);
     return 0;
 }
 
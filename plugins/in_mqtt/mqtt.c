@@ -55,6 +55,7 @@ int in_mqtt_init(struct flb_input_instance *in,
         return -1;
     }
     ctx->evl = config->evl;
+    ctx->config = config;
 
     /* Collect upon data available on the standard input */
     ret = flb_input_set_collector_event(in,
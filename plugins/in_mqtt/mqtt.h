@@ -31,6 +31,7 @@ struct flb_in_mqtt_config {
     int msgp_len;                  /* msgpack data length         */
     char msgp[MQTT_MSGP_BUF_SIZE]; /* msgpack static buffer       */
     struct mk_event_loop *evl;     /* Event loop file descriptor  */
+    struct flb_config *config;     /* Engine clock for timestamps */
 };
 
 int in_mqtt_collect(struct flb_config *config, void *in_context);
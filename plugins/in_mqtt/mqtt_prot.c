@@ -149,7 +149,8 @@ static int mqtt_data_append(char *topic, size_t topic_len,
     root = result.data;
 
     msgpack_pack_array(&mp_pck, 2);
-    msgpack_pack_int32(&mp_pck, time(NULL));
+    flb_time_append_to_msgpack(&ctx->config->clock, &mp_pck,
+                               FLB_TIME_FMT_EVENTTIME);
 
     n_size = root.via.map.size;
     msgpack_pack_map(&mp_pck, n_size + 1);
@@ -29,7 +29,6 @@
 #include <fluent-bit/flb_config.h>
 #include <fluent-bit/flb_error.h>
 #include <fluent-bit/flb_utils.h>
-#include <fluent-bit/flb_stats.h>
 
 #define DEFAULT_INTERVAL_SEC  1
 #define DEFAULT_INTERVAL_NSEC 0
@@ -65,7 +64,8 @@ static int in_random_collect(struct flb_config *config, void *in_context)
     close(fd);
 
     msgpack_pack_array(&ctx->mp_pck, 2);
-    msgpack_pack_uint64(&ctx->mp_pck, time(NULL));
+    flb_time_append_to_msgpack(&config->clock, &ctx->mp_pck,
+                               FLB_TIME_FMT_EVENTTIME);
     msgpack_pack_map(&ctx->mp_pck, 1);
 
     msgpack_pack_bin(&ctx->mp_pck, 10);
@@ -69,7 +69,8 @@ void *in_serial_flush(void *in_context, size_t *size)
 }
 
 static inline int process_line(char *line, int len,
-                               struct flb_in_serial_config *ctx)
+                               struct flb_in_serial_config *ctx,
+                               struct flb_config *config)
 {
     /* Increase buffer position */
     ctx->buffer_id++;
@@ -79,7 +80,8 @@ static inline int process_line(char *line, int len,
      * we handle this as a list of maps.
      */
     msgpack_pack_array(&ctx->mp_pck, 2);
-    msgpack_pack_uint64(&ctx->mp_pck, time(NULL));
+    flb_time_append_to_msgpack(&config->clock, &ctx->mp_pck,
+                               FLB_TIME_FMT_EVENTTIME);
 
     msgpack_pack_map(&ctx->mp_pck, 1);
     msgpack_pack_bin(&ctx->mp_pck, 3);
@@ -94,7 +96,8 @@ static inline int process_line(char *line, int len,
 }
 
 static inline int process_pack(struct flb_in_serial_config *ctx,
-                               char *pack, size_t size)
+                               char *pack, size_t size,
+                               struct flb_config *config)
 {
     size_t off = 0;
     msgpack_unpacked result;
@@ -108,7 +111,8 @@ static inline int process_pack(struct flb_in_serial_config *ctx,
         entry = result.data;
 
         msgpack_pack_array(&ctx->mp_pck, 2);
-        msgpack_pack_uint64(&ctx->mp_pck, time(NULL));
+        flb_time_append_to_msgpack(&config->clock, &ctx->mp_pck,
+                               FLB_TIME_FMT_EVENTTIME);
 
         msgpack_pack_map(&ctx->mp_pck, 1);
         msgpack_pack_bin(&ctx->mp_pck, 3);
@@ -136,7 +140,6 @@ int in_serial_collect(struct flb_config *config, void *in_context)
     int hits;
     char *sep;
     char *buf;
-    jsmntok_t *t;
 
     struct flb_in_serial_config *ctx = in_context;
 
@@ -176,6 +179,7 @@ int in_serial_collect(struct flb_config *config, void *in_context)
         if (ctx->buf_data[0] == '\0') {
             consume_bytes(ctx->buf_data, 1, ctx->buf_len);
             ctx->buf_len--;
+            flb_pack_state_reset(&ctx->pack_state);
         }
 
         /* Strip CR or LF if found at first byte */
@@ -185,6 +189,7 @@ int in_serial_collect(struct flb_config *config, void *in_context)
                       ctx->buf_data[0]);
             consume_bytes(ctx->buf_data, 1, ctx->buf_len);
             ctx->buf_len--;
+            flb_pack_state_reset(&ctx->pack_state);
         }
 
         /* Handle the case when a Separator is set */
@@ -193,7 +198,7 @@ int in_serial_collect(struct flb_config *config, void *in_context)
                 len = (sep - ctx->buf_data);
                 if (len > 0) {
                     /* process the line based in the separator position */
-                    process_line(buf, len, ctx);
+                    process_line(buf, len, ctx, config);
                     consume_bytes(ctx->buf_data, len + ctx->sep_len, ctx->buf_len);
                     ctx->buf_len -= (len + ctx->sep_len);
                     hits++;
@@ -225,30 +230,26 @@ int in_serial_collect(struct flb_config *config, void *in_context)
             else if (ret == FLB_ERR_JSON_INVAL) {
                 flb_debug("[in_serial] invalid JSON message, skipping");
                 flb_pack_state_reset(&ctx->pack_state);
-                flb_pack_state_init(&ctx->pack_state);
                 ctx->pack_state.multiple = FLB_TRUE;
 
                 return -1;
             }
 
             /*
-             * Given the Tokens used for the packaged message, append
-             * the records and then adjust buffer.
+             * Append the records of the complete messages and then
+             * adjust the buffer, the incomplete tail is kept.
              */
-            process_pack(ctx, pack, out_size);
+            process_pack(ctx, pack, out_size, config);
+            free(pack);
 
-            t = &ctx->pack_state.tokens[0];
-            consume_bytes(ctx->buf_data, t->end, ctx->buf_len);
-            ctx->buf_len -= t->end;
+            consume_bytes(ctx->buf_data, ctx->pack_state.consumed,
+                          ctx->buf_len);
+            ctx->buf_len -= ctx->pack_state.consumed;
             ctx->buf_data[ctx->buf_len] = '\0';
-
-            flb_pack_state_reset(&ctx->pack_state);
-            flb_pack_state_init(&ctx->pack_state);
-            ctx->pack_state.multiple = FLB_TRUE;
         }
         else {
             /* Process and enqueue the received line */
-            process_line(ctx->buf_data, ctx->buf_len, ctx);
+            process_line(ctx->buf_data, ctx->buf_len, ctx, config);
             ctx->buf_len = 0;
         }
     }
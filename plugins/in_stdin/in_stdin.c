@@ -19,6 +19,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -28,6 +29,7 @@
 #include <fluent-bit/flb_input.h>
 #include <fluent-bit/flb_config.h>
 #include <fluent-bit/flb_pack.h>
+#include <fluent-bit/flb_error.h>
 
 #include "in_stdin.h"
 
@@ -50,6 +52,8 @@ int in_stdin_init(struct flb_input_instance *in,
     msgpack_sbuffer_init(&ctx->mp_sbuf);
     msgpack_packer_init(&ctx->mp_pck, &ctx->mp_sbuf, msgpack_sbuffer_write);
     ctx->buffer_id = 0;
+    ctx->buf_len = 0;
+    flb_pack_state_init(&ctx->pack_state);
 
     /* Clone the standard input file descriptor */
     fd = dup(STDIN_FILENO);
@@ -94,12 +98,31 @@ int in_stdin_collect(struct flb_config *config, void *in_context)
     ctx->buf_len += bytes;
 
     /* Initially we should support JSON input */
-    ret = flb_pack_json(ctx->buf, ctx->buf_len, &pack, &out_size);
-    if (ret != 0) {
-        flb_warn("STDIN data incomplete, waiting for more data...");
+    ret = flb_pack_json_state(ctx->buf, ctx->buf_len,
+                              &pack, &out_size, &ctx->pack_state);
+    if (ret == FLB_ERR_JSON_PART) {
+        if (ctx->buf_len == sizeof(ctx->buf)) {
+            flb_warn("STDIN message too long, skipping");
+            ctx->buf_len = 0;
+            flb_pack_state_reset(&ctx->pack_state);
+            return 0;
+        }
+        flb_debug("STDIN data incomplete, waiting for more data...");
         return 0;
     }
-    ctx->buf_len = 0;
+    else if (ret != 0) {
+        flb_warn("STDIN data invalid, skipping");
+        ctx->buf_len = 0;
+        flb_pack_state_reset(&ctx->pack_state);
+        return 0;
+    }
+
+    /* Keep the incomplete message for the next round */
+    if (ctx->pack_state.consumed < ctx->buf_len) {
+        memmove(ctx->buf, ctx->buf + ctx->pack_state.consumed,
+                ctx->buf_len - ctx->pack_state.consumed);
+    }
+    ctx->buf_len -= ctx->pack_state.consumed;
 
     /* Queue the data with time field */
     msgpack_unpacked_init(&result);
@@ -108,7 +131,8 @@ int in_stdin_collect(struct flb_config *config, void *in_context)
         if (result.data.type == MSGPACK_OBJECT_MAP) {
             /* { map => val, map => val, map => val } */
             msgpack_pack_array(&ctx->mp_pck, 2);
-            msgpack_pack_uint64(&ctx->mp_pck, time(NULL));
+            flb_time_append_to_msgpack(&config->clock, &ctx->mp_pck,
+                                       FLB_TIME_FMT_EVENTTIME);
             msgpack_pack_bin_body(&ctx->mp_pck, pack + start, off - start);
         } else {
             msgpack_pack_bin_body(&ctx->mp_pck, pack + start, off - start);
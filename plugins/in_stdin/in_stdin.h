@@ -23,12 +23,14 @@
 #include <fluent-bit/flb_config.h>
 #include <fluent-bit/flb_input.h>
 #include <fluent-bit/flb_utils.h>
+#include <fluent-bit/flb_pack.h>
 
 /* STDIN Input configuration & context */
 struct flb_in_stdin_config {
     int fd;                           /* stdin file descriptor */
     int buf_len;                      /* read buffer length    */
     char buf[8192 * 2];               /* read buffer: 16Kb max */
+    struct flb_pack_state pack_state; /* JSON packer state     */
 
     int buffer_id;
     struct msgpack_sbuffer mp_sbuf;  /* msgpack sbuffer        */
@@ -57,6 +57,8 @@ void in_xbee_flush_if_needed(struct flb_in_xbee_config *ctx)
 
 void in_xbee_rx_queue_raw(struct flb_in_xbee_config *ctx, const char *buf ,int len)
 {
+    struct flb_time tm;
+
     /* Increase buffer position */
 
     pthread_mutex_lock(&ctx->mtx_mp);
@@ -65,8 +67,10 @@ void in_xbee_rx_queue_raw(struct flb_in_xbee_config *ctx, const char *buf ,int l
 
     ctx->buffer_id++;
 
+    /* libxbee threads can't use the engine clock */
+    flb_time_get(&tm);
     msgpack_pack_array(&ctx->mp_pck, 2);
-    msgpack_pack_uint64(&ctx->mp_pck, time(NULL));
+    flb_time_append_to_msgpack(&tm, &ctx->mp_pck, FLB_TIME_FMT_EVENTTIME);
     msgpack_pack_map(&ctx->mp_pck, 1);
     msgpack_pack_bin(&ctx->mp_pck, 4);
     msgpack_pack_bin_body(&ctx->mp_pck, "data", 4);
@@ -94,6 +98,7 @@ int in_xbee_rx_queue_msgpack(struct flb_in_xbee_config *ctx, const char *buf ,in
     size_t mp_offset;
     int queued = 0;
     uint64_t t;
+    struct flb_time tm;
 
     pthread_mutex_lock(&ctx->mtx_mp);
 
@@ -133,8 +138,10 @@ int in_xbee_rx_queue_msgpack(struct flb_in_xbee_config *ctx, const char *buf ,in
             in_xbee_flush_if_needed(ctx);
             ctx->buffer_id++;
 
+            flb_time_get(&tm);
             msgpack_pack_array(&ctx->mp_pck, 2);
-            msgpack_pack_uint64(&ctx->mp_pck, time(NULL));
+            flb_time_append_to_msgpack(&tm, &ctx->mp_pck,
+                                       FLB_TIME_FMT_EVENTTIME);
             msgpack_pack_bin_body(&ctx->mp_pck, buf + start, off - start);
 
         } else {
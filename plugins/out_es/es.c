@@ -22,7 +22,8 @@
 #include <fluent-bit/flb_utils.h>
 #include <fluent-bit/flb_network.h>
 #include <fluent-bit/flb_http_client.h>
-#include <cjson/cjson.h>
+#include <fluent-bit/flb_pack.h>
+#include <fluent-bit/flb_gzip.h>
 
 #include "es.h"
 #include "es_bulk.h"
@@ -36,26 +37,15 @@ struct flb_output_plugin out_es_plugin;
  * 'Sadly' this process involves to convert from Msgpack to JSON.
  */
 static char *es_format(void *data, size_t bytes, int *out_size,
-                       struct flb_out_es_config *ctx)
+                       int *out_records, struct flb_out_es_config *ctx)
 {
-    int i;
     int ret;
-    int n_size;
-    int index_len;
-    uint32_t psize;
     size_t off = 0;
-    time_t atime;
     char *buf;
-    char *ptr_key = NULL;
-    char *ptr_val = NULL;
-    char buf_key[256];
-    char buf_val[512];
     msgpack_unpacked result;
     msgpack_object root;
     msgpack_object map;
-    char *j_entry;
-    char j_index[ES_BULK_HEADER];
-    json_t *j_map;
+    struct flb_time tm;
     struct es_bulk *bulk;
 
     /* Iterate the original buffer and perform adjustments */
@@ -81,18 +71,15 @@ static char *es_format(void *data, size_t bytes, int *out_size,
         return NULL;
     }
 
-    /* Create the bulk composer */
-    bulk = es_bulk_create();
+    /*
+     * Create the bulk composer: the JSON records plus the action lines
+     * are usually less than twice the size of the MessagePack data.
+     */
+    bulk = es_bulk_create(ctx, bytes * 2);
     if (!bulk) {
         return NULL;
     }
 
-    /* Format the JSON header required by the ES Bulk API */
-    index_len = snprintf(j_index,
-                         ES_BULK_HEADER,
-                         ES_BULK_INDEX_FMT,
-                         ctx->index, ctx->type);
-
     off = 0;
     msgpack_unpacked_destroy(&result);
     msgpack_unpacked_init(&result);
@@ -107,128 +94,15 @@ static char *es_format(void *data, size_t bytes, int *out_size,
             continue;
         }
 
-        /* Create a map entry */
-        j_map = json_create_object();
-
-        atime = root.via.array.ptr[0].via.u64;
-        map   = root.via.array.ptr[1];
-
-        n_size = map.via.map.size + 1;
-
-        json_add_to_object(j_map, "date", json_create_number(atime));
-        for (i = 0; i < n_size - 1; i++) {
-            msgpack_object *k = &map.via.map.ptr[i].key;
-            msgpack_object *v = &map.via.map.ptr[i].val;
-
-            if (k->type != MSGPACK_OBJECT_BIN && k->type != MSGPACK_OBJECT_STR) {
-                continue;
-            }
-
-            /* Store key */
-            psize = k->via.bin.size;
-            if (psize <= (sizeof(buf_key) - 1)) {
-                memcpy(buf_key, k->via.bin.ptr, psize);
-                buf_key[psize] = '\0';
-                ptr_key = buf_key;
-            }
-            else {
-                /* Long JSON map keys have a performance penalty */
-                ptr_key = malloc(psize + 1);
-                memcpy(ptr_key, k->via.bin.ptr, psize);
-                ptr_key[psize] = '\0';
-            }
-
-            /*
-             * Sanitize key name, Elastic Search 2.x don't allow dots
-             * in field names:
-             *
-             *   https://goo.gl/R5NMTr
-             */
-            char *p   = ptr_key;
-            char *end = ptr_key + psize;
-            while (p != end) {
-                if (*p == '.') *p = '_';
-                p++;
-            }
-
-            /* Store value */
-            if (v->type == MSGPACK_OBJECT_NIL) {
-                json_add_to_object(j_map, ptr_key, json_create_null());
-            }
-            else if (v->type == MSGPACK_OBJECT_BOOLEAN) {
-                json_add_to_object(j_map, ptr_key,
-                                   json_create_bool(v->via.boolean));
-            }
-            else if (v->type == MSGPACK_OBJECT_POSITIVE_INTEGER) {
-                json_add_to_object(j_map, ptr_key,
-                                   json_create_number(v->via.u64));
-            }
-            else if (v->type == MSGPACK_OBJECT_NEGATIVE_INTEGER) {
-                json_add_to_object(j_map, ptr_key,
-                                   json_create_number(v->via.i64));
-            }
-            else if (v->type == MSGPACK_OBJECT_FLOAT) {
-                json_add_to_object(j_map, ptr_key,
-                                   json_create_number(v->via.f64));
-            }
-            else if (v->type == MSGPACK_OBJECT_STR) {
-                /* String value */
-                psize = v->via.str.size;
-                if (psize <= (sizeof(buf_val) - 1)) {
-                    memcpy(buf_val, v->via.str.ptr, psize);
-                    buf_val[psize] = '\0';
-                    ptr_val = buf_val;
-                }
-                else {
-                    ptr_val = malloc(psize + 1);
-                    memcpy(ptr_val, k->via.str.ptr, psize);
-                    ptr_val[psize] = '\0';
-                }
-                json_add_to_object(j_map, ptr_key,
-                                   json_create_string(ptr_val));
-            }
-            else if (v->type == MSGPACK_OBJECT_BIN) {
-                /* Bin value */
-                psize = v->via.bin.size;
-                if (psize <= (sizeof(buf_val) - 1)) {
-                    memcpy(buf_val, v->via.bin.ptr, psize);
-                    buf_val[psize] = '\0';
-                    ptr_val = buf_val;
-                }
-                else {
-                    ptr_val = malloc(psize + 1);
-                    memcpy(ptr_val, k->via.bin.ptr, psize);
-                    ptr_val[psize] = '\0';
-                }
-                json_add_to_object(j_map, ptr_key,
-                                   json_create_string(ptr_val));
-            }
-
-            if (ptr_key && ptr_key != buf_key) {
-                free(ptr_key);
-            }
-            ptr_key = NULL;
-
-            if (ptr_val && ptr_val != buf_val) {
-                free(ptr_val);
-            }
-            ptr_val = NULL;
-        }
+        flb_time_pop_from_msgpack(&tm, &root.via.array.ptr[0]);
+        map = root.via.array.ptr[1];
 
         /*
-         * At this point we have our JSON message, but in order to
-         * ingest this data into Elasticsearch we need to compose the
-         * Bulk API request, sadly it requires to prepend a JSON entry
-         * with details about the target 'index' and 'type' for EVERY
-         * message.
+         * The Bulk API requires to prepend a JSON entry with details
+         * about the target 'index' and 'type' for EVERY message, the
+         * record is written right after it.
          */
-        j_entry = json_print_unformatted(j_map);
-        json_delete(j_map);
-
-        ret = es_bulk_append(bulk,
-                             j_index, index_len,
-                             j_entry, strlen(j_entry));
-        free(j_entry);
+        ret = es_bulk_append(bulk, &tm, &map);
         if (ret == -1) {
             /* We likely ran out of memory, abort here */
             msgpack_unpacked_destroy(&result);
@@ -240,19 +114,109 @@ static char *es_format(void *data, size_t bytes, int *out_size,
 
     msgpack_unpacked_destroy(&result);
 
-    *out_size = bulk->len;
-    buf = bulk->ptr;
+    *out_size = bulk->buf.size;
+    *out_records = bulk->records;
+    buf = bulk->buf.data;
 
     /*
      * Note: we don't destroy the bulk as we need to keep the allocated
      * buffer with the data. Instead we just release the bulk context and
-     * return the bulk->ptr buffer
+     * return the payload buffer
      */
     free(bulk);
 
     return buf;
 }
 
+/*
+ * Copy the records flagged in 'retry' to a new buffer, records are
+ * counted the same way es_format() appends them to the bulk request.
+ */
+static char *es_retry_records(void *data, size_t bytes, char *retry,
+                              int records, size_t *out_size)
+{
+    int i = 0;
+    size_t off = 0;
+    size_t prev = 0;
+    msgpack_object root;
+    msgpack_unpacked result;
+    msgpack_sbuffer sbuf;
+
+    msgpack_sbuffer_init(&sbuf);
+    msgpack_unpacked_init(&result);
+
+    while (i < records && msgpack_unpack_next(&result, data, bytes, &off)) {
+        root = result.data;
+        if (root.type == MSGPACK_OBJECT_ARRAY && root.via.array.size == 2) {
+            if (retry[i] &&
+                msgpack_sbuffer_write(&sbuf, (char *) data + prev,
+                                      off - prev) != 0) {
+                msgpack_sbuffer_destroy(&sbuf);
+                msgpack_unpacked_destroy(&result);
+                return NULL;
+            }
+            i++;
+        }
+        prev = off;
+    }
+    msgpack_unpacked_destroy(&result);
+
+    *out_size = sbuf.size;
+    return sbuf.data;
+}
+
+/*
+ * Check the bulk response, an HTTP 200 can still have rejected items. If
+ * some of them can be retried, only those records are given back to the
+ * engine for the retry.
+ */
+static int es_bulk_check(struct flb_http_client *c, void *data, size_t bytes,
+                         int records)
+{
+    int ret;
+    int failed;
+    char *retry;
+    char *buf;
+    size_t size;
+
+    retry = calloc(1, records);
+    if (!retry) {
+        perror("calloc");
+        return FLB_RETRY;
+    }
+
+    ret = es_bulk_response(c->resp.payload, c->resp.payload_size,
+                           retry, records, &failed);
+    if (ret == -1) {
+        /*
+         * Invalid or truncated response (see FLB_HTTP_DATA_SIZE_MAX), there
+         * is no way to know which records were indexed: retry them all.
+         */
+        flb_warn("[out_es] could not check the bulk response items, "
+                 "retrying");
+        free(retry);
+        return FLB_RETRY;
+    }
+
+    if (failed > ret) {
+        flb_error("[out_es] %i/%i records rejected", failed - ret, records);
+    }
+
+    if (ret == 0) {
+        free(retry);
+        return FLB_OK;
+    }
+
+    flb_warn("[out_es] %i/%i records will be retried", ret, records);
+    buf = es_retry_records(data, bytes, retry, records, &size);
+    free(retry);
+    if (buf) {
+        flb_output_retry_data(buf, size);
+    }
+
+    return FLB_RETRY;
+}
+
 int cb_es_init(struct flb_output_instance *ins,
                struct flb_config *config,
                void *data)
@@ -306,7 +270,7 @@ int cb_es_init(struct flb_output_instance *ins,
         free(ctx);
         return -1;
     }
-
+    flb_output_upstream_set(upstream, ins);
 
     /* Set the context */
     ctx->u = upstream;
@@ -336,6 +300,63 @@ int cb_es_init(struct flb_output_instance *ins,
         }
     }
 
+    /* Logstash_Format */
+    ctx->logstash_format = FLB_FALSE;
+    tmp = flb_output_get_property("logstash_format", ins);
+    if (tmp) {
+        if (strcasecmp(tmp, "true") == 0 || strcasecmp(tmp, "on") == 0) {
+            ctx->logstash_format = FLB_TRUE;
+        }
+    }
+
+    /* Time_Precision */
+    ctx->time_precision = 0;
+    tmp = flb_output_get_property("time_precision", ins);
+    if (tmp) {
+        ctx->time_precision = flb_time_precision(tmp);
+        if (ctx->time_precision == -1) {
+            flb_error("[out_es] invalid Time_Precision '%s' (s, ms, us, ns)",
+                      tmp);
+            flb_upstream_destroy(upstream);
+            free(ctx);
+            return -1;
+        }
+    }
+
+    /* Compress */
+    ctx->compress_gzip = FLB_FALSE;
+    ctx->compress_level = FLB_GZIP_LEVEL_DEFAULT;
+    tmp = flb_output_get_property("compress", ins);
+    if (tmp) {
+        if (strcasecmp(tmp, "gzip") != 0) {
+            flb_error("[out_es] invalid Compress '%s', only gzip is "
+                      "supported", tmp);
+            flb_upstream_destroy(upstream);
+            free(ctx);
+            return -1;
+        }
+        ctx->compress_gzip = FLB_TRUE;
+    }
+
+    tmp = flb_output_get_property("compress_level", ins);
+    if (tmp) {
+        ctx->compress_level = flb_gzip_level(tmp);
+        if (ctx->compress_level == -1) {
+            flb_error("[out_es] invalid Compress_Level '%s' (1-9)", tmp);
+            flb_upstream_destroy(upstream);
+            free(ctx);
+            return -1;
+        }
+    }
+
+    tmp = flb_output_get_property("logstash_prefix", ins);
+    if (tmp) {
+        ctx->logstash_prefix = tmp;
+    }
+    else {
+        ctx->logstash_prefix = "logstash";
+    }
+
     flb_debug("[es] host=%s port=%i index=%s type=%s",
               ins->host.name, ins->host.port,
               ctx->index, ctx->type);
@@ -351,8 +372,12 @@ int cb_es_flush(void *data, size_t bytes,
 {
     int ret;
     int bytes_out;
+    int records;
     char *pack;
+    void *gz;
+    size_t gz_size;
     size_t b_sent;
+    size_t resp_size;
     struct flb_out_es_config *ctx = out_context;
     struct flb_upstream_conn *u_conn;
     struct flb_http_client *c;
@@ -361,11 +386,22 @@ int cb_es_flush(void *data, size_t bytes,
     (void) tag_len;
 
     /* Convert format */
-    pack = es_format(data, bytes, &bytes_out, ctx);
+    pack = es_format(data, bytes, &bytes_out, &records, ctx);
     if (!pack) {
         FLB_OUTPUT_RETURN(FLB_ERROR);
     }
 
+    if (ctx->compress_gzip == FLB_TRUE) {
+        ret = flb_gzip_compress(pack, bytes_out, ctx->compress_level,
+                                &gz, &gz_size);
+        free(pack);
+        if (ret == -1) {
+            FLB_OUTPUT_RETURN(FLB_ERROR);
+        }
+        pack = gz;
+        bytes_out = gz_size;
+    }
+
     /* Get upstream connection */
     u_conn = flb_upstream_conn_get(ctx->u);
     if (!u_conn) {
@@ -374,20 +410,43 @@ int cb_es_flush(void *data, size_t bytes,
     }
 
     /* Compose HTTP Client request */
-    c = flb_http_client(u_conn, FLB_HTTP_POST, "/_bulk",
+    c = flb_http_client(u_conn, FLB_HTTP_POST, FLB_ES_BULK_URI,
                         pack, bytes_out, NULL, 0, NULL);
+    resp_size = (size_t) records * FLB_ES_BULK_ITEM_SIZE;
+    if (resp_size > FLB_HTTP_DATA_SIZE_MAX) {
+        flb_http_buffer_size(c, resp_size);
+    }
     flb_http_add_header(c, "User-Agent", 10, "Fluent-Bit", 10);
     flb_http_add_header(c, "Content-Type", 12, "application/json", 16);
+    if (ctx->compress_gzip == FLB_TRUE) {
+        flb_http_add_header(c, "Content-Encoding", 16, "gzip", 4);
+    }
 
     ret = flb_http_do(c, &b_sent);
-    flb_debug("[out_es] http_do=%i", ret);
-    flb_http_client_destroy(c);
-
+    flb_debug("[out_es] http_do=%i status=%i", ret, c->resp.status);
     free(pack);
 
+    if (ret != 0) {
+        ret = FLB_RETRY;
+    }
+    else if (c->resp.status == 429 || c->resp.status >= 500) {
+        /* the whole request was rejected */
+        flb_warn("[out_es] HTTP status=%i, retrying", c->resp.status);
+        ret = FLB_RETRY;
+    }
+    else if (c->resp.status != 200) {
+        flb_error("[out_es] HTTP status=%i\n%s", c->resp.status,
+                  c->resp.payload ? c->resp.payload : "");
+        ret = FLB_ERROR;
+    }
+    else {
+        ret = es_bulk_check(c, data, bytes, records);
+    }
+    flb_http_client_destroy(c);
+
     /* Release the connection */
     flb_upstream_conn_release(u_conn);
-    FLB_OUTPUT_RETURN(FLB_OK);
+    FLB_OUTPUT_RETURN(ret);
 }
 
 int cb_es_exit(void *data, struct flb_config *config)
@@ -23,11 +23,30 @@
 #define FLB_ES_DEFAULT_HOST   "127.0.0.1"
 #define FLB_ES_DEFAULT_PORT   92000
 
+/*
+ * The bulk response only carries what es_bulk_check() reads, the status of
+ * every item. The response buffer is sized from the number of items, the
+ * default limit of the HTTP client can't hold the items of a large bulk.
+ */
+#define FLB_ES_BULK_URI       "/_bulk?filter_path=errors,items.*.status"
+#define FLB_ES_BULK_ITEM_SIZE 200
+
 struct flb_out_es_config {
     /* Elasticsearch index (database) and type (table) */
     char *index;
     char *type;
 
+    /* Logstash_Format: daily index names <prefix>-YYYY.MM.DD */
+    int logstash_format;
+    char *logstash_prefix;
+
+    /* Time_Precision: fraction digits of the record date (s/ms/us/ns) */
+    int time_precision;
+
+    /* Compress: gzip request bodies (Content-Encoding) */
+    int compress_gzip;
+    int compress_level;
+
     /* Upstream connection to the backend server */
     struct flb_upstream *u;
 };
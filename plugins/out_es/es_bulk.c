@@ -21,67 +21,379 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include <fluent-bit/flb_utils.h>
+
+#include "es.h"
 #include "es_bulk.h"
 
-struct es_bulk *es_bulk_create()
+/*
+ * Create a bulk composer, 'size' is the estimated size of the payload so
+ * the buffer don't need to grow in most of the cases.
+ */
+struct es_bulk *es_bulk_create(struct flb_out_es_config *ctx, size_t size)
 {
     struct es_bulk *b;
 
     b = malloc(sizeof(struct es_bulk));
     if (!b) {
-        perror("calloc");
+        perror("malloc");
         return NULL;
     }
 
-    b->ptr = malloc(ES_BULK_CHUNK);
-    if (!b->ptr) {
+    if (size < ES_BULK_CHUNK) {
+        size = ES_BULK_CHUNK;
+    }
+
+    msgpack_sbuffer_init(&b->buf);
+    b->buf.data = malloc(size);
+    if (!b->buf.data) {
         perror("malloc");
         free(b);
         return NULL;
     }
+    b->buf.alloc = size;
+
+    b->ctx = ctx;
+    b->records = 0;
+    b->header_len = 0;
+    b->header_day = -1;
 
-    b->size = ES_BULK_CHUNK;
-    b->len  = 0;
+    /*
+     * Sanitize key names, Elastic Search 2.x don't allow dots
+     * in field names:
+     *
+     *   https://goo.gl/R5NMTr
+     */
+    flb_pack_json_fmt_init(&b->fmt);
+    b->fmt.sanitize_keys = FLB_TRUE;
+    b->fmt.date_precision = ctx->time_precision;
+    if (ctx->logstash_format == FLB_TRUE) {
+        b->fmt.date_key = "@timestamp";
+        b->fmt.date_format = FLB_PACK_JSON_DATE_ISO8601;
+    }
 
     return b;
 }
 
 void es_bulk_destroy(struct es_bulk *bulk)
 {
-    if (bulk->size > 0) {
-        free(bulk->ptr);
-    }
+    msgpack_sbuffer_destroy(&bulk->buf);
     free(bulk);
 }
 
-int es_bulk_append(struct es_bulk *bulk, char *index, int i_len, char *json, int j_len)
+/*
+ * Compose the action line for the record time. It's the same for every
+ * record unless Logstash_Format is enabled, in that case it changes
+ * once per day.
+ */
+static int es_bulk_header(struct es_bulk *bulk, time_t time)
 {
-    int available;
-    int new_size;
-    int required;
-    char *ptr;
-
-    required = j_len + ES_BULK_HEADER + 1;
-    available = (bulk->size - bulk->len);
-
-    if (available < required) {
-        new_size = bulk->size + (((available + required) / ES_BULK_CHUNK) + ES_BULK_CHUNK);
-        ptr = realloc(bulk->ptr, new_size);
-        if (!ptr) {
-            perror("realloc");
-            return -1;
+    time_t day;
+    struct tm tm;
+    struct flb_out_es_config *ctx = bulk->ctx;
+
+    if (ctx->logstash_format == FLB_FALSE) {
+        if (bulk->header_len == 0) {
+            bulk->header_len = snprintf(bulk->header, ES_BULK_HEADER,
+                                        ES_BULK_INDEX_FMT,
+                                        ctx->index, ctx->type);
         }
-        bulk->ptr  = ptr;
-        bulk->size = new_size;
+        return 0;
     }
 
-    memcpy(bulk->ptr + bulk->len, index, i_len);
-    bulk->len += i_len;
+    day = time - (time % 86400);
+    if (day == bulk->header_day) {
+        return 0;
+    }
 
-    memcpy(bulk->ptr + bulk->len, json, j_len);
-    bulk->len += j_len;
-    bulk->ptr[bulk->len] = '\n';
-    bulk->len++;
+    gmtime_r(&time, &tm);
+    bulk->header_len = snprintf(bulk->header, ES_BULK_HEADER,
+                                ES_BULK_INDEX_DAY,
+                                ctx->logstash_prefix,
+                                tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday,
+                                ctx->type);
+    bulk->header_day = day;
 
     return 0;
-};
+}
+
+/* Append the action line and the record in JSON format */
+int es_bulk_append(struct es_bulk *bulk, struct flb_time *time,
+                   msgpack_object *map)
+{
+    int ret;
+    size_t size;
+
+    es_bulk_header(bulk, time->tm.tv_sec);
+    if (bulk->header_len <= 0 || bulk->header_len >= ES_BULK_HEADER) {
+        flb_error("[out_es] index name is too long");
+        return -1;
+    }
+
+    size = bulk->buf.size;
+    ret = msgpack_sbuffer_write(&bulk->buf, bulk->header, bulk->header_len);
+    if (ret == 0) {
+        ret = flb_msgpack_record_to_json(&bulk->buf, time, map, &bulk->fmt);
+    }
+    if (ret == 0) {
+        ret = msgpack_sbuffer_write(&bulk->buf, "\n", 1);
+    }
+
+    if (ret != 0) {
+        /* discard the partial entry */
+        bulk->buf.size = size;
+        return -1;
+    }
+
+    bulk->records++;
+    return 0;
+}
+
+/*
+ * Bulk API response scanner: the response is walked in place, only the
+ * 'errors' flag and the 'status' of every item are read, anything else
+ * is skipped.
+ */
+static char *json_space(char *p, char *end)
+{
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')) {
+        p++;
+    }
+    return p;
+}
+
+/* Skip a string, 'p' is the opening quote */
+static char *json_string(char *p, char *end)
+{
+    for (p++; p < end; p++) {
+        if (*p == '\\') {
+            p++;
+        }
+        else if (*p == '"') {
+            return p + 1;
+        }
+    }
+    return NULL;
+}
+
+/* Skip a value of any type */
+static char *json_skip(char *p, char *end)
+{
+    int depth = 0;
+
+    if (p < end && *p == '"') {
+        return json_string(p, end);
+    }
+
+    if (p < end && *p != '{' && *p != '[') {
+        /* number, true, false or null */
+        while (p < end && *p != ',' && *p != '}' && *p != ']' &&
+               *p != ' ' && *p != '\n' && *p != '\r' && *p != '\t') {
+            p++;
+        }
+        return p;
+    }
+
+    while (p < end) {
+        if (*p == '"') {
+            p = json_string(p, end);
+            if (!p) {
+                return NULL;
+            }
+            continue;
+        }
+
+        if (*p == '{' || *p == '[') {
+            depth++;
+        }
+        else if (*p == '}' || *p == ']') {
+            depth--;
+            if (depth == 0) {
+                return p + 1;
+            }
+        }
+        p++;
+    }
+
+    return NULL;
+}
+
+/*
+ * Move to the next member of an object: returns 1 and sets the key with
+ * '*cur' on its value, 0 at the end of the object and -1 on errors.
+ */
+static int json_member(char **cur, char *end, char **key, int *key_len)
+{
+    char *p;
+    char *q;
+
+    p = json_space(*cur, end);
+    if (p < end && *p == ',') {
+        p = json_space(p + 1, end);
+    }
+    if (p == end) {
+        return -1;
+    }
+    if (*p == '}') {
+        *cur = p + 1;
+        return 0;
+    }
+    if (*p != '"') {
+        return -1;
+    }
+
+    q = json_string(p, end);
+    if (!q) {
+        return -1;
+    }
+    *key = p + 1;
+    *key_len = (q - p) - 2;
+
+    q = json_space(q, end);
+    if (q == end || *q != ':') {
+        return -1;
+    }
+    *cur = json_space(q + 1, end);
+    return 1;
+}
+
+/* Move to the next element of an array, same return values */
+static int json_element(char **cur, char *end)
+{
+    char *p;
+
+    p = json_space(*cur, end);
+    if (p < end && *p == ',') {
+        p = json_space(p + 1, end);
+    }
+    if (p == end) {
+        return -1;
+    }
+    if (*p == ']') {
+        *cur = p + 1;
+        return 0;
+    }
+    *cur = p;
+    return 1;
+}
+
+#define json_key_is(key, len, str)                                  \
+    (len == sizeof(str) - 1 && strncmp(key, str, len) == 0)
+
+/*
+ * Get the status of a bulk item: {"index": {..., "status": 201}}, the
+ * action can be index, create, update or delete.
+ */
+static int bulk_item_status(char **cur, char *end)
+{
+    int ret;
+    int len;
+    int status = -1;
+    char *p = *cur;
+    char *key;
+
+    if (*p != '{') {
+        return -1;
+    }
+    p++;
+
+    while ((ret = json_member(&p, end, &key, &len)) == 1) {
+        if (p == end || *p != '{') {
+            return -1;
+        }
+        p++;
+
+        while ((ret = json_member(&p, end, &key, &len)) == 1) {
+            if (json_key_is(key, len, "status")) {
+                status = strtol(p, NULL, 10);
+            }
+            p = json_skip(p, end);
+            if (!p) {
+                return -1;
+            }
+        }
+        if (ret == -1) {
+            return -1;
+        }
+    }
+    if (ret == -1) {
+        return -1;
+    }
+
+    *cur = p;
+    return status;
+}
+
+/*
+ * Check the response of a bulk request with 'records' items. Every item
+ * rejected with a status that may succeed later (429 or 5xx) is flagged
+ * in 'retry', 'failed' gets the number of items that failed for any reason.
+ *
+ * Returns the number of items to retry or -1 if the response is invalid.
+ */
+int es_bulk_response(char *buf, size_t size, char *retry, int records,
+                     int *failed)
+{
+    int i = 0;
+    int ret;
+    int len;
+    int status;
+    int count = 0;
+    char *key;
+    char *p = buf;
+    char *end = buf + size;
+
+    *failed = 0;
+
+    p = json_space(p, end);
+    if (p == end || *p != '{') {
+        return -1;
+    }
+    p++;
+
+    while ((ret = json_member(&p, end, &key, &len)) == 1) {
+        if (json_key_is(key, len, "errors")) {
+            /* 'errors' comes before the items, nothing else to check */
+            if (end - p >= 5 && strncmp(p, "false", 5) == 0) {
+                return 0;
+            }
+        }
+        else if (json_key_is(key, len, "items")) {
+            if (p == end || *p != '[') {
+                return -1;
+            }
+            p++;
+
+            while ((ret = json_element(&p, end)) == 1) {
+                status = bulk_item_status(&p, end);
+                if (status == -1 || i >= records) {
+                    return -1;
+                }
+
+                if (status < 200 || status > 299) {
+                    (*failed)++;
+                    if (status == 429 || status >= 500) {
+                        retry[i] = 1;
+                        count++;
+                    }
+                }
+                i++;
+            }
+            if (ret == -1) {
+                return -1;
+            }
+            continue;
+        }
+
+        p = json_skip(p, end);
+        if (!p) {
+            return -1;
+        }
+    }
+
+    if (ret == -1 || i != records) {
+        return -1;
+    }
+
+    return count;
+}
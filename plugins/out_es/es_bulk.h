@@ -20,20 +20,37 @@
 #ifndef FLB_OUT_ES_BULK_H
 #define FLB_OUT_ES_BULK_H
 
+#include <time.h>
 #include <inttypes.h>
+#include <msgpack.h>
+#include <fluent-bit/flb_pack.h>
 
 #define ES_BULK_CHUNK      4096  /* Size of buffer chunks    */
-#define ES_BULK_HEADER      128  /* ES Bulk API prefix line  */
+#define ES_BULK_HEADER      256  /* ES Bulk API prefix line  */
 #define ES_BULK_INDEX_FMT   "{\"index\":{\"_index\":\"%s\",\"_type\":\"%s\"}}\n"
+#define ES_BULK_INDEX_DAY   "{\"index\":{\"_index\":\"%s-%04d.%02d.%02d\"," \
+                            "\"_type\":\"%s\"}}\n"
+
+struct flb_out_es_config;
 
 struct es_bulk {
-    char *ptr;
-    uint32_t len;
-    uint32_t size;
+    msgpack_sbuffer buf;         /* bulk request payload          */
+    int records;                 /* number of records appended    */
+
+    /* Cached action line */
+    int header_len;
+    time_t header_day;           /* day of the index (logstash)   */
+    char header[ES_BULK_HEADER];
+
+    struct flb_pack_json_fmt fmt;
+    struct flb_out_es_config *ctx;
 };
 
-struct es_bulk *es_bulk_create();
-int es_bulk_append(struct es_bulk *bulk, char *index, int i_len, char *json, int j_len);
+struct es_bulk *es_bulk_create(struct flb_out_es_config *ctx, size_t size);
+int es_bulk_append(struct es_bulk *bulk, struct flb_time *time,
+                   msgpack_object *map);
 void es_bulk_destroy(struct es_bulk *bulk);
+int es_bulk_response(char *buf, size_t size, char *retry, int records,
+                     int *failed);
 
 #endif
@@ -26,6 +26,9 @@
 #include <fluent-bit/flb_output.h>
 #include <fluent-bit/flb_utils.h>
 #include <fluent-bit/flb_network.h>
+#include <fluent-bit/flb_upstream_ha.h>
+#include <fluent-bit/flb_gzip.h>
+#include <fluent-bit/flb_time.h>
 
 #include "forward.h"
 
@@ -35,7 +38,10 @@ int cb_forward_init(struct flb_output_instance *ins, struct flb_config *config,
                     void *data)
 {
     struct flb_out_forward_config *ctx;
+    char *tmp;
+    struct mk_list *head;
     struct flb_upstream *upstream;
+    struct flb_upstream_node *node;
     struct flb_uri_field *f_tag = NULL;
     (void) data;
 
@@ -53,16 +59,70 @@ int cb_forward_init(struct flb_output_instance *ins, struct flb_config *config,
         ins->host.port = 24224;
     }
 
-    /* Prepare an upstream handler */
-    upstream = flb_upstream_create(config,
-                                   ins->host.name,
-                                   ins->host.port,
-                                   FLB_IO_TCP, NULL);
-    if (!upstream) {
-        free(ctx);
-        return -1;
+    /* Compress: send entries in CompressedPackedForward mode */
+    ctx->compress_level = FLB_GZIP_LEVEL_DEFAULT;
+    tmp = flb_output_get_property("compress", ins);
+    if (tmp) {
+        if (strcasecmp(tmp, "gzip") != 0) {
+            flb_error("[out_forward] invalid Compress '%s', only gzip is "
+                      "supported", tmp);
+            free(ctx);
+            return -1;
+        }
+        ctx->compress_gzip = FLB_TRUE;
+    }
+
+    tmp = flb_output_get_property("compress_level", ins);
+    if (tmp) {
+        ctx->compress_level = flb_gzip_level(tmp);
+        if (ctx->compress_level == -1) {
+            flb_error("[out_forward] invalid Compress_Level '%s' (1-9)", tmp);
+            free(ctx);
+            return -1;
+        }
+    }
+
+    /*
+     * Time_As_Integer: entries carry EventTime timestamps (nanoseconds)
+     * which Fluentd understands since v0.14, older versions require the
+     * time as integer seconds.
+     */
+    tmp = flb_output_get_property("time_as_integer", ins);
+    if (tmp) {
+        if (strcasecmp(tmp, "true") == 0 || strcasecmp(tmp, "on") == 0) {
+            ctx->time_as_integer = FLB_TRUE;
+        }
+    }
+
+    /* An upstream group replaces the single Host and Port */
+    tmp = flb_output_get_property("upstream", ins);
+    if (tmp) {
+        ctx->ha = flb_upstream_ha_from_file(tmp, config, FLB_IO_TCP, NULL);
+        if (!ctx->ha) {
+            flb_error("[out_forward] cannot load Upstream file %s", tmp);
+            free(ctx);
+            return -1;
+        }
+        mk_list_foreach(head, &ctx->ha->nodes) {
+            node = mk_list_entry(head, struct flb_upstream_node, _head);
+            flb_output_upstream_set(node->u, ins);
+        }
+        flb_info("[out_forward] upstream group '%s' with %i nodes",
+                 ctx->ha->name, ctx->ha->count);
+    }
+    else {
+        /* Prepare an upstream handler */
+        upstream = flb_upstream_create(config,
+                                       ins->host.name,
+                                       ins->host.port,
+                                       FLB_IO_TCP, NULL);
+        if (!upstream) {
+            free(ctx);
+            return -1;
+        }
+        flb_output_upstream_set(upstream, ins);
+        ctx->u = upstream;
     }
-    ctx->u = upstream;
     ctx->tag = FLB_CONFIG_DEFAULT_TAG;
     ctx->tag_len = sizeof(FLB_CONFIG_DEFAULT_TAG) - 1;
 
@@ -83,32 +143,117 @@ int cb_forward_exit(void *data, struct flb_config *config)
     (void) config;
     struct flb_out_forward_config *ctx = data;
 
-    flb_upstream_destroy(ctx->u);
+    if (ctx->ha) {
+        flb_upstream_ha_destroy(ctx->ha);
+    }
+    else {
+        flb_upstream_destroy(ctx->u);
+    }
     free(ctx);
 
     return 0;
 }
 
+/* Repack the entries with the timestamps as integer seconds */
+static int forward_time_as_integer(void *data, size_t bytes,
+                                   msgpack_sbuffer *sbuf)
+{
+    size_t off = 0;
+    msgpack_packer pck;
+    msgpack_unpacked result;
+    msgpack_object root;
+    struct flb_time tm;
+
+    sbuf->data = malloc(bytes);
+    if (!sbuf->data) {
+        perror("malloc");
+        return -1;
+    }
+    sbuf->alloc = bytes;
+    msgpack_packer_init(&pck, sbuf, msgpack_sbuffer_write);
+
+    msgpack_unpacked_init(&result);
+    while (msgpack_unpack_next(&result, data, bytes, &off)) {
+        root = result.data;
+        if (root.type != MSGPACK_OBJECT_ARRAY || root.via.array.size != 2) {
+            msgpack_pack_object(&pck, root);
+            continue;
+        }
+
+        flb_time_pop_from_msgpack(&tm, &root.via.array.ptr[0]);
+        msgpack_pack_array(&pck, 2);
+        flb_time_append_to_msgpack(&tm, &pck, FLB_TIME_FMT_INT);
+        msgpack_pack_object(&pck, root.via.array.ptr[1]);
+    }
+    msgpack_unpacked_destroy(&result);
+
+    return 0;
+}
+
+/* Write the message header and the body in one call */
+static int forward_send(struct flb_upstream *u, struct iovec *iov, int iovcnt,
+                        size_t *bytes_sent)
+{
+    int ret;
+    struct flb_upstream_conn *u_conn;
+
+    /* Get a TCP connection instance */
+    u_conn = flb_upstream_conn_get(u);
+    if (!u_conn) {
+        flb_error("[out_forward] no upstream connections available to %s:%i",
+                  u->tcp_host, u->tcp_port);
+        return -1;
+    }
+
+    ret = flb_io_net_writev(u_conn, iov, iovcnt, bytes_sent);
+    flb_upstream_conn_release(u_conn);
+    if (ret == -1) {
+        flb_error("[out_forward] could not write chunk to %s:%i",
+                  u->tcp_host, u->tcp_port);
+        return -1;
+    }
+
+    flb_trace("[out_forward] ended write()=%lu bytes", *bytes_sent);
+    return 0;
+}
+
 int cb_forward_flush(void *data, size_t bytes,
                      char *tag, int tag_len,
                      struct flb_input_instance *i_ins, void *out_context,
                      struct flb_config *config)
 {
     int ret = -1;
+    int iovcnt;
     int entries = 0;
     size_t off = 0;
-    size_t total;
+    size_t hdr_size;
+    size_t gz_size;
     size_t bytes_sent;
+    void *gz = NULL;
+    uint64_t tried = 0;
+    struct iovec iov[3];
     msgpack_packer   mp_pck;
     msgpack_sbuffer  mp_sbuf;
+    msgpack_sbuffer  tm_sbuf;
     msgpack_unpacked result;
     struct flb_out_forward_config *ctx = out_context;
-    struct flb_upstream_conn *u_conn;
+    struct flb_upstream_node *node;
     (void) i_ins;
     (void) config;
 
     flb_debug("[out_forward] request %lu bytes to flush", bytes);
 
+    /* Entries for Fluentd < v0.14 */
+    msgpack_sbuffer_init(&tm_sbuf);
+    if (ctx->time_as_integer == FLB_TRUE) {
+        ret = forward_time_as_integer(data, bytes, &tm_sbuf);
+        if (ret == -1) {
+            FLB_OUTPUT_RETURN(FLB_RETRY);
+        }
+        data  = tm_sbuf.data;
+        bytes = tm_sbuf.size;
+    }
+
     /* Initialize packager */
     msgpack_sbuffer_init(&mp_sbuf);
     msgpack_packer_init(&mp_pck, &mp_sbuf, msgpack_sbuffer_write);
@@ -122,42 +267,90 @@ int cb_forward_flush(void *data, size_t bytes,
               entries, tag, tag_len);
     msgpack_unpacked_destroy(&result);
 
-    /* Output: root array */
-    msgpack_pack_array(&mp_pck, 2);
-    msgpack_pack_bin(&mp_pck, tag_len);
-    msgpack_pack_bin_body(&mp_pck, tag, tag_len);
-    msgpack_pack_array(&mp_pck, entries);
+    if (ctx->compress_gzip == FLB_TRUE) {
+        ret = flb_gzip_compress(data, bytes, ctx->compress_level,
+                                &gz, &gz_size);
+        if (ret == -1) {
+            msgpack_sbuffer_destroy(&mp_sbuf);
+            msgpack_sbuffer_destroy(&tm_sbuf);
+            FLB_OUTPUT_RETURN(FLB_RETRY);
+        }
+        flb_debug("[out_forward] compressed %lu bytes into %lu",
+                  bytes, gz_size);
 
-    /* Get a TCP connection instance */
-    u_conn = flb_upstream_conn_get(ctx->u);
-    if (!u_conn) {
-        flb_error("[out_forward] no upstream connections available");
-        FLB_OUTPUT_RETURN(FLB_RETRY);
+        /*
+         * CompressedPackedForward: [tag, bin(gzip entries), option], the
+         * option map is packed after the header in the same buffer.
+         */
+        msgpack_pack_array(&mp_pck, 3);
+        msgpack_pack_bin(&mp_pck, tag_len);
+        msgpack_pack_bin_body(&mp_pck, tag, tag_len);
+        msgpack_pack_bin(&mp_pck, gz_size);
+        hdr_size = mp_sbuf.size;
+
+        msgpack_pack_map(&mp_pck, 2);
+        msgpack_pack_str(&mp_pck, 10);
+        msgpack_pack_str_body(&mp_pck, "compressed", 10);
+        msgpack_pack_str(&mp_pck, 4);
+        msgpack_pack_str_body(&mp_pck, "gzip", 4);
+        msgpack_pack_str(&mp_pck, 4);
+        msgpack_pack_str_body(&mp_pck, "size", 4);
+        msgpack_pack_int(&mp_pck, entries);
+
+        iov[0].iov_base = mp_sbuf.data;
+        iov[0].iov_len  = hdr_size;
+        iov[1].iov_base = gz;
+        iov[1].iov_len  = gz_size;
+        iov[2].iov_base = mp_sbuf.data + hdr_size;
+        iov[2].iov_len  = mp_sbuf.size - hdr_size;
+        iovcnt = 3;
     }
+    else {
+        /* Output: root array */
+        msgpack_pack_array(&mp_pck, 2);
+        msgpack_pack_bin(&mp_pck, tag_len);
+        msgpack_pack_bin_body(&mp_pck, tag, tag_len);
+        msgpack_pack_array(&mp_pck, entries);
 
-    /* Write message header */
-    ret = flb_io_net_write(u_conn, mp_sbuf.data, mp_sbuf.size, &bytes_sent);
-    if (ret == -1) {
-        flb_error("[out_forward] could not write chunk header");
-        flb_upstream_conn_release(u_conn);
-        FLB_OUTPUT_RETURN(FLB_RETRY);
+        iov[0].iov_base = mp_sbuf.data;
+        iov[0].iov_len  = mp_sbuf.size;
+        iov[1].iov_base = (void *) data;
+        iov[1].iov_len  = bytes;
+        iovcnt = 2;
     }
 
+    if (!ctx->ha) {
+        ret = forward_send(ctx->u, iov, iovcnt, &bytes_sent);
+        msgpack_sbuffer_destroy(&mp_sbuf);
+        msgpack_sbuffer_destroy(&tm_sbuf);
+        free(gz);
+        if (ret == -1) {
+            FLB_OUTPUT_RETURN(FLB_RETRY);
+        }
+        FLB_OUTPUT_RETURN(FLB_OK);
+    }
+
+    /* Upstream group: on error fail over to the other nodes */
+    ret = -1;
+    while ((node = flb_upstream_ha_node_get(ctx->ha, &tried))) {
+        ret = forward_send(node->u, iov, iovcnt, &bytes_sent);
+        flb_upstream_ha_node_done(ctx->ha, node,
+                                  ret == 0 ? FLB_TRUE : FLB_FALSE);
+        if (ret == 0) {
+            break;
+        }
+        flb_warn("[out_forward] flush to node '%s' failed, trying next node",
+                 node->name);
+    }
     msgpack_sbuffer_destroy(&mp_sbuf);
-    total = ret;
+    msgpack_sbuffer_destroy(&tm_sbuf);
+    free(gz);
 
-    /* Write body */
-    ret = flb_io_net_write(u_conn, data, bytes, &bytes_sent);
     if (ret == -1) {
-        flb_error("[out_forward] error writing content body");
-        flb_upstream_conn_release(u_conn);
+        flb_error("[out_forward] no healthy nodes available in '%s'",
+                  ctx->ha->name);
         FLB_OUTPUT_RETURN(FLB_RETRY);
     }
-
-    total += bytes_sent;
-    flb_upstream_conn_release(u_conn);
-    flb_trace("[out_forward] ended write()=%d bytes", total);
-
     FLB_OUTPUT_RETURN(FLB_OK);
 }
 
@@ -24,6 +24,14 @@ struct flb_out_forward_config {
     size_t tag_len;
     char *tag;
     struct flb_upstream *u;
+    struct flb_upstream_ha *ha;     /* upstream group (optional) */
+
+    /* CompressedPackedForward mode, entries are gzipped */
+    int compress_gzip;
+    int compress_level;
+
+    /* Time_As_Integer: send integer seconds for Fluentd < v0.14 */
+    int time_as_integer;
 };
 
 #endif
@@ -24,158 +24,17 @@
 #include <errno.h>
 
 #include <msgpack.h>
-#include <cjson/cjson.h>
 #include <fluent-bit/flb_info.h>
 #include <fluent-bit/flb_output.h>
 #include <fluent-bit/flb_http_client.h>
+#include <fluent-bit/flb_pack.h>
+#include <fluent-bit/flb_gzip.h>
 
 #include "http.h"
+#include "http_json.h"
 
 struct flb_output_plugin out_http_plugin;
 
-static char *msgpack_to_json(char *data, uint64_t bytes, uint64_t *out_size)
-{
-    int i;
-    int n_size;
-    uint32_t psize;
-    size_t off = 0;
-    time_t atime;
-    char *ptr_key = NULL;
-    char *ptr_val = NULL;
-    char buf_key[256];
-    char buf_val[512];
-    char *out_json;
-    msgpack_unpacked result;
-    msgpack_object root;
-    msgpack_object map;
-    json_t *j_arr;
-    json_t *j_map;
-
-    /* Iterate the original buffer and perform adjustments */
-    msgpack_unpacked_init(&result);
-
-    j_arr = json_create_array();
-    while (msgpack_unpack_next(&result, data, bytes, &off)) {
-        if (result.data.type != MSGPACK_OBJECT_ARRAY) {
-            continue;
-        }
-
-        /* Each array must have two entries: time and record */
-        root = result.data;
-        if (root.via.array.size != 2) {
-            continue;
-        }
-
-        /* Create a map entry */
-        j_map = json_create_object();
-
-        atime = root.via.array.ptr[0].via.u64;
-        map   = root.via.array.ptr[1];
-
-        n_size = map.via.map.size + 1;
-
-        json_add_to_object(j_map, "date", json_create_number(atime));
-        for (i = 0; i < n_size - 1; i++) {
-            msgpack_object *k = &map.via.map.ptr[i].key;
-            msgpack_object *v = &map.via.map.ptr[i].val;
-
-            if (k->type != MSGPACK_OBJECT_BIN && k->type != MSGPACK_OBJECT_STR) {
-                continue;
-            }
-
-            /* Store key */
-            psize = k->via.str.size;
-            if (psize <= (sizeof(buf_key) - 1)) {
-                memcpy(buf_key, k->via.str.ptr, psize);
-                buf_key[psize] = '\0';
-                ptr_key = buf_key;
-            }
-            else {
-                /* Long JSON map keys have a performance penalty */
-                ptr_key = malloc(psize + 1);
-                memcpy(ptr_key, k->via.str.ptr, psize);
-                ptr_key[psize] = '\0';
-            }
-
-            /* Store value */
-            if (v->type == MSGPACK_OBJECT_NIL) {
-                json_add_to_object(j_map, ptr_key, json_create_null());
-            }
-            else if (v->type == MSGPACK_OBJECT_BOOLEAN) {
-                json_add_to_object(j_map, ptr_key,
-                                   json_create_bool(v->via.boolean));
-            }
-            else if (v->type == MSGPACK_OBJECT_POSITIVE_INTEGER) {
-                json_add_to_object(j_map, ptr_key,
-                                   json_create_number(v->via.u64));
-            }
-            else if (v->type == MSGPACK_OBJECT_NEGATIVE_INTEGER) {
-                json_add_to_object(j_map, ptr_key,
-                                   json_create_number(v->via.i64));
-            }
-            else if (v->type == MSGPACK_OBJECT_FLOAT) {
-                json_add_to_object(j_map, ptr_key,
-                                   json_create_number(v->via.f64));
-            }
-            else if (v->type == MSGPACK_OBJECT_STR) {
-                /* String value */
-                psize = v->via.str.size;
-                if (psize <= (sizeof(buf_val) - 1)) {
-                    memcpy(buf_val, v->via.str.ptr, psize);
-                    buf_val[psize] = '\0';
-                    ptr_val = buf_val;
-                }
-                else {
-                    ptr_val = malloc(psize + 1);
-                    memcpy(ptr_val, v->via.str.ptr, psize);
-                    ptr_val[psize] = '\0';
-                }
-                json_add_to_object(j_map, ptr_key,
-                                   json_create_string(ptr_val));
-            }
-            else if (v->type == MSGPACK_OBJECT_BIN) {
-                /* Bin value */
-                psize = v->via.bin.size;
-                if (psize <= (sizeof(buf_val) - 1)) {
-                    memcpy(buf_val, v->via.bin.ptr, psize);
-                    buf_val[psize] = '\0';
-                    ptr_val = buf_val;
-                }
-                else {
-                    ptr_val = malloc(psize + 1);
-                    memcpy(ptr_val, v->via.bin.ptr, psize);
-                    ptr_val[psize] = '\0';
-                }
-                json_add_to_object(j_map, ptr_key,
-                                   json_create_string(ptr_val));
-            }
-
-            if (ptr_key && ptr_key != buf_key) {
-                free(ptr_key);
-            }
-            ptr_key = NULL;
-
-            if (ptr_val && ptr_val != buf_val) {
-                free(ptr_val);
-            }
-            ptr_val = NULL;
-        }
-
-        /* Append the new map to the main array */
-        json_add_to_array(j_arr, j_map);
-    }
-
-    /* Release msgpack */
-    msgpack_unpacked_destroy(&result);
-
-    /* Format to JSON */
-    out_json = json_print_unformatted(j_arr);
-    json_delete(j_arr);
-    *out_size = strlen(out_json);
-
-    return out_json;
-}
-
 int cb_http_init(struct flb_output_instance *ins, struct flb_config *config,
                void *data)
 {
@@ -284,6 +143,7 @@ int cb_http_init(struct flb_output_instance *ins, struct flb_config *config,
         free(ctx);
         FLB_OUTPUT_RETURN(FLB_RETRY);
     }
+    flb_output_upstream_set(upstream, ins);
 
     if (ins->host.uri) {
         uri = strdup(ins->host.uri->full);
@@ -324,6 +184,42 @@ int cb_http_init(struct flb_output_instance *ins, struct flb_config *config,
         }
     }
 
+    /* Time_Precision: fraction digits of the JSON 'date' field */
+    ctx->time_precision = 0;
+    tmp = flb_output_get_property("time_precision", ins);
+    if (tmp) {
+        ctx->time_precision = flb_time_precision(tmp);
+        if (ctx->time_precision == -1) {
+            flb_warn("[out_http] invalid 'time_precision' option. "
+                     "Using seconds");
+            ctx->time_precision = 0;
+        }
+    }
+
+    /* Compress */
+    ctx->compress_gzip = FLB_FALSE;
+    ctx->compress_level = FLB_GZIP_LEVEL_DEFAULT;
+    tmp = flb_output_get_property("compress", ins);
+    if (tmp) {
+        if (strcasecmp(tmp, "gzip") == 0) {
+            ctx->compress_gzip = FLB_TRUE;
+        }
+        else {
+            flb_warn("[out_http] unrecognized 'compress' option. "
+                     "Compression disabled");
+        }
+    }
+
+    tmp = flb_output_get_property("compress_level", ins);
+    if (tmp) {
+        ctx->compress_level = flb_gzip_level(tmp);
+        if (ctx->compress_level == -1) {
+            flb_warn("[out_http] invalid 'compress_level' option. "
+                     "Using default");
+            ctx->compress_level = FLB_GZIP_LEVEL_DEFAULT;
+        }
+    }
+
     ctx->u = upstream;
     ctx->uri  = uri;
     ctx->host = ins->host.name;
@@ -348,22 +244,43 @@ int cb_http_flush(void *data, size_t bytes,
     struct flb_upstream_conn *u_conn;
     struct flb_http_client *c;
     void *body;
+    void *gz;
+    size_t gz_size;
     uint64_t body_len;
     (void) i_ins;
 
     if (ctx->out_format == FLB_HTTP_OUT_JSON) {
-        body = msgpack_to_json(data, bytes, &body_len);
+        body = http_msgpack_to_json(data, bytes, &body_len, ctx);
+        if (!body) {
+            FLB_OUTPUT_RETURN(FLB_RETRY);
+        }
     }
     else {
         body = data;
         body_len = bytes;
     }
 
+    if (ctx->compress_gzip == FLB_TRUE) {
+        ret = flb_gzip_compress(body, body_len, ctx->compress_level,
+                                &gz, &gz_size);
+        if (body != data) {
+            free(body);
+        }
+        if (ret == -1) {
+            FLB_OUTPUT_RETURN(FLB_RETRY);
+        }
+        body = gz;
+        body_len = gz_size;
+    }
+
     /* Get upstream context and connection */
     u = ctx->u;
     u_conn = flb_upstream_conn_get(u);
     if (!u_conn) {
         flb_error("[out_http] no upstream connections available");
+        if (body != data) {
+            free(body);
+        }
         FLB_OUTPUT_RETURN(FLB_ERROR);
     }
 
@@ -389,6 +306,13 @@ int cb_http_flush(void *data, size_t bytes,
                             sizeof(FLB_HTTP_MIME_MSGPACK) -1);
     }
 
+    if (ctx->compress_gzip == FLB_TRUE) {
+        flb_http_add_header(c,
+                            FLB_HTTP_CONTENT_ENCODING,
+                            sizeof(FLB_HTTP_CONTENT_ENCODING) - 1,
+                            "gzip", 4);
+    }
+
     ret = flb_http_do(c, &b_sent);
     if (ret == 0) {
         if (c->resp.status != 200) {
@@ -409,7 +333,7 @@ int cb_http_flush(void *data, size_t bytes,
     /* Release the connection */
     flb_upstream_conn_release(u_conn);
 
-    if (ctx->out_format == FLB_HTTP_OUT_JSON) {
+    if (body != data) {
         free(body);
     }
 
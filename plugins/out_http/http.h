@@ -27,6 +27,8 @@
 #define FLB_HTTP_MIME_MSGPACK   "application/msgpack"
 #define FLB_HTTP_MIME_JSON      "application/json"
 
+#define FLB_HTTP_CONTENT_ENCODING "Content-Encoding"
+
 struct flb_out_http_config {
     /* Proxy */
     char *proxy;
@@ -35,6 +37,11 @@ struct flb_out_http_config {
 
     /* Output format */
     int out_format;
+    int time_precision;         /* JSON date fraction digits */
+
+    /* Compress: gzip request bodies */
+    int compress_gzip;
+    int compress_level;
 
     /* HTTP URI */
     char *uri;
@@ -0,0 +1,81 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Fluent Bit
+ *  ==========
+ *  Copyright (C) 2015-2016 Treasure Data Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <msgpack.h>
+#include <fluent-bit/flb_time.h>
+#include <fluent-bit/flb_pack.h>
+
+#include "http.h"
+#include "http_json.h"
+
+/* Convert a chunk of [time, map] records to a JSON array */
+char *http_msgpack_to_json(char *data, uint64_t bytes, uint64_t *out_size,
+                           struct flb_out_http_config *ctx)
+{
+    int n = 0;
+    size_t off = 0;
+    msgpack_unpacked result;
+    msgpack_object root;
+    msgpack_sbuffer out;
+    struct flb_time tm;
+    struct flb_pack_json_fmt fmt;
+
+    flb_pack_json_fmt_init(&fmt);
+    fmt.date_precision = ctx->time_precision;
+
+    /* The JSON output is roughly the size of the msgpack input */
+    msgpack_sbuffer_init(&out);
+    out.data = malloc(bytes + (bytes / 4) + 2);
+    if (!out.data) {
+        perror("malloc");
+        return NULL;
+    }
+    out.alloc = bytes + (bytes / 4) + 2;
+    out.data[out.size++] = '[';
+
+    msgpack_unpacked_init(&result);
+    while (msgpack_unpack_next(&result, data, bytes, &off)) {
+        if (result.data.type != MSGPACK_OBJECT_ARRAY) {
+            continue;
+        }
+
+        /* Each array must have two entries: time and record */
+        root = result.data;
+        if (root.via.array.size != 2) {
+            continue;
+        }
+
+        if (n > 0) {
+            msgpack_sbuffer_write(&out, ",", 1);
+        }
+
+        flb_time_pop_from_msgpack(&tm, &root.via.array.ptr[0]);
+        flb_msgpack_record_to_json(&out, &tm, &root.via.array.ptr[1], &fmt);
+        n++;
+    }
+    msgpack_unpacked_destroy(&result);
+
+    msgpack_sbuffer_write(&out, "]", 1);
+    *out_size = out.size;
+
+    return out.data;
+}
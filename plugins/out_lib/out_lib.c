@@ -18,6 +18,7 @@
  */
 
 #include <stdio.h>
+#include <string.h>
 
 #include <fluent-bit/flb_output.h>
 #include <fluent-bit/flb_utils.h>
@@ -27,20 +28,21 @@
 #include "out_lib.h"
 
 
-/**
- * User callback is passed from flb_output(ctx, output, callback)
+/*
+ * The user callback is passed from flb_output(ctx, "lib", data). In the
+ * default record mode 'data' is the callback:
  *
- *  The prototype of callback should be
- *   int (*callback)(void* data, size_t size );
- *    @param   data  The data which comes from input plugin.
- *    @param   size  The size of data.
- *    @return  success ? 0 : negative value
+ *   int callback(void *record, size_t size);
  *
+ * it receives a copy of every MessagePack record that it must free(). In
+ * chunk mode 'data' is a 'struct flb_lib_out_cb', see flb_lib.h.
  */
 static int out_lib_init(struct flb_output_instance *ins,
                         struct flb_config *config,
                         void *data)
 {
+    char *tmp;
+    struct flb_lib_out_cb *cb;
     struct flb_out_lib_config *ctx = NULL;
 
     (void) config;
@@ -51,50 +53,146 @@ static int out_lib_init(struct flb_output_instance *ins,
         perror("calloc");
         return -1;
     }
-    if (ins->data != NULL) {
-        /* set user callback */
-        ctx->user_callback = ins->data;
-    }else{
+    if (ins->data == NULL) {
         flb_error("[out_lib] Callback is NULL");
         free(ctx);
         return -1;
     }
 
+    ctx->mode = FLB_OUT_LIB_RECORD;
+    tmp = flb_output_get_property("mode", ins);
+    if (tmp) {
+        if (strcasecmp(tmp, "chunk") == 0) {
+            ctx->mode = FLB_OUT_LIB_CHUNK;
+        }
+        else if (strcasecmp(tmp, "record") != 0) {
+            flb_error("[out_lib] invalid Mode '%s' (record or chunk)", tmp);
+            free(ctx);
+            return -1;
+        }
+    }
+
+    tmp = flb_output_get_property("chunk_ownership", ins);
+    if (tmp) {
+        if (strcasecmp(tmp, "transfer") == 0) {
+            ctx->transfer = FLB_TRUE;
+        }
+        else if (strcasecmp(tmp, "borrow") != 0) {
+            flb_error("[out_lib] invalid Chunk_Ownership '%s' "
+                      "(borrow or transfer)", tmp);
+            free(ctx);
+            return -1;
+        }
+    }
+
+    if (ctx->mode == FLB_OUT_LIB_CHUNK) {
+        cb = ins->data;
+        if (!cb->cb) {
+            flb_error("[out_lib] Callback is NULL");
+            free(ctx);
+            return -1;
+        }
+        ctx->chunk_cb = *cb;
+    }
+    else {
+        /* set user callback */
+        ctx->user_callback = ins->data;
+    }
+
     flb_output_set_context(ins, ctx);
     return 0;
 }
 
+/* Deliver a copy of every record */
+static int out_lib_flush_records(struct flb_out_lib_config *ctx,
+                                 void *data, size_t bytes)
+{
+    void *record;
+    void *copy;
+    size_t size;
+    struct flb_lib_iter it;
+
+    flb_lib_iter_init(&it, data, bytes);
+    while (flb_lib_iter_next(&it, &record, &size)) {
+        copy = malloc(size);
+        if (!copy) {
+            perror("malloc");
+            flb_lib_iter_destroy(&it);
+            return FLB_RETRY;
+        }
+        memcpy(copy, record, size);
+        ctx->user_callback(copy, size);
+    }
+    flb_lib_iter_destroy(&it);
+
+    return FLB_OK;
+}
+
+/*
+ * Deliver the whole chunk. When the callback takes the ownership the
+ * task buffer is handed over, a copy is only needed if it's shared with
+ * other outputs.
+ */
+static int out_lib_flush_chunk(struct flb_out_lib_config *ctx,
+                               void *data, size_t bytes, char *tag)
+{
+    int ret;
+    void *buf = data;
+    struct flb_thread *th = NULL;
+
+    if (ctx->transfer == FLB_TRUE) {
+        th = (struct flb_thread *) pthread_getspecific(flb_thread_key);
+        buf = flb_task_buffer_take(th->task, data);
+        if (!buf) {
+            buf = malloc(bytes);
+            if (!buf) {
+                perror("malloc");
+                return FLB_RETRY;
+            }
+            memcpy(buf, data, bytes);
+        }
+    }
+
+    ret = ctx->chunk_cb.cb(tag, buf, bytes, ctx->chunk_cb.data);
+    if (ret == FLB_LIB_OK) {
+        return FLB_OK;
+    }
+
+    /* the callback did not take the buffer */
+    if (ctx->transfer == FLB_TRUE) {
+        if (buf != data) {
+            free(buf);
+        }
+        else {
+            th->task->buf = buf;
+        }
+    }
+
+    if (ret == FLB_LIB_RETRY) {
+        return FLB_RETRY;
+    }
+    return FLB_ERROR;
+}
+
 static int out_lib_flush(void *data, size_t bytes,
                          char *tag, int tag_len,
                          struct flb_input_instance *i_ins,
                          void *out_context,
                          struct flb_config *config)
 {
-    msgpack_unpacked result;
-    size_t off = 0;
+    int ret;
     struct flb_out_lib_config *ctx = out_context;
-    unsigned char* data_for_user   = NULL;
     (void) i_ins;
     (void) config;
-    (void) tag;
     (void) tag_len;
 
-    if (ctx->user_callback == NULL) {
-        flb_error("[out_lib] Callback is NULL");
-        FLB_OUTPUT_RETURN(FLB_ERROR);
+    if (ctx->mode == FLB_OUT_LIB_CHUNK) {
+        ret = out_lib_flush_chunk(ctx, data, bytes, tag);
     }
-
-    msgpack_unpacked_init(&result);
-    while (msgpack_unpack_next(&result, data, bytes, &off)) {
-        data_for_user = calloc(1, bytes);
-        /* FIXME: Now we return raw msgpack
-                  we should return JSON format.
-         */
-        memcpy(data_for_user, &result.data, bytes);
-        ctx->user_callback((void*)data_for_user, bytes);
+    else {
+        ret = out_lib_flush_records(ctx, data, bytes);
     }
-    msgpack_unpacked_destroy(&result);
-    FLB_OUTPUT_RETURN(FLB_OK);
+    FLB_OUTPUT_RETURN(ret);
 }
 
 static int out_lib_exit(void *data, struct flb_config *config)
@@ -20,8 +20,17 @@
 #ifndef FLB_OUT_LIB
 #define FLB_OUT_LIB
 
-struct flb_out_lib_config{
+#include <fluent-bit/flb_lib.h>
+
+/* Delivery modes */
+#define FLB_OUT_LIB_RECORD   0   /* callback(record, size) per record */
+#define FLB_OUT_LIB_CHUNK    1   /* flb_lib_out_cb per chunk          */
+
+struct flb_out_lib_config {
+    int mode;
+    int transfer;                /* chunk ownership moves to the callback */
     int (*user_callback)(void* data, size_t size);
+    struct flb_lib_out_cb chunk_cb;
 };
 
 #endif
@@ -18,17 +18,45 @@
  */
 
 #include <stdio.h>
+#include <sys/uio.h>
 #include <fluent-bit/flb_output.h>
 #include <fluent-bit/flb_utils.h>
-#include <cjson.h>
+#include <fluent-bit/flb_pack.h>
 
 #include <msgpack.h>
 
 #include "nats.h"
 
+/* A PUB frame: the protocol line and the payload, both in the batch */
+struct nats_frame {
+    size_t hdr_off;
+    size_t hdr_len;
+    size_t data_off;
+    size_t data_len;             /* payload plus the ending CRLF */
+};
+
+/* PUB frames composed on a flush, written at once */
+struct nats_batch {
+    msgpack_sbuffer hdr;         /* PUB protocol lines            */
+    msgpack_sbuffer data;        /* payloads                      */
+    msgpack_sbuffer rec;         /* JSON of the current record    */
+    int open;                    /* a frame is being composed     */
+    int count;
+    int size;
+    struct nats_frame *frames;
+};
+
+/* Server messages are read line by line */
+struct nats_reader {
+    size_t len;
+    size_t pos;
+    char buf[NATS_READ_BUF];
+};
+
 int cb_nats_init(struct flb_output_instance *ins, struct flb_config *config,
                    void *data)
 {
+    char *tmp;
     struct flb_upstream *upstream;
     struct flb_out_nats_config *ctx;
 
@@ -46,6 +74,26 @@ int cb_nats_init(struct flb_output_instance *ins, struct flb_config *config,
         perror("malloc");
         return -1;
     }
+    ctx->mode = NATS_MODE_CHUNK;
+    ctx->max_payload = 0;
+    ctx->server_max_payload = 0;
+
+    tmp = flb_output_get_property("mode", ins);
+    if (tmp) {
+        if (strcasecmp(tmp, "record") == 0) {
+            ctx->mode = NATS_MODE_RECORD;
+        }
+        else if (strcasecmp(tmp, "chunk") != 0) {
+            flb_error("[out_nats] invalid Mode '%s' (chunk or record)", tmp);
+            free(ctx);
+            return -1;
+        }
+    }
+
+    tmp = flb_output_get_property("max_payload", ins);
+    if (tmp) {
+        ctx->max_payload = strtoul(tmp, NULL, 10);
+    }
 
     /* Prepare an upstream handler */
     upstream = flb_upstream_create(config,
@@ -57,6 +105,7 @@ int cb_nats_init(struct flb_output_instance *ins, struct flb_config *config,
         free(ctx);
         return -1;
     }
+    flb_output_upstream_set(upstream, ins);
     ctx->u   = upstream;
     ctx->ins = ins;
     flb_output_set_context(ins, ctx);
@@ -64,133 +113,330 @@ int cb_nats_init(struct flb_output_instance *ins, struct flb_config *config,
     return 0;
 }
 
-static int msgpack_to_json(void *data, size_t bytes, char *tag,
-                           char **out_json, size_t *out_len)
+/* Get the next line sent by the server, without the CRLF */
+static char *nats_read_line(struct flb_upstream_conn *u_conn,
+                            struct nats_reader *r)
 {
-    int i;
-    int n_size;
-    size_t off = 0;
-    time_t atime;
-    char tmp_key[32];
-    char tmp_val[256];
-    char *tmp_ext;
-    json_t *j_root;
-    json_t *j_arr;
-    msgpack_object map;
-    msgpack_object root;
-    msgpack_object m_key;
-    msgpack_object m_val;
-    msgpack_packer   mp_pck;
-    msgpack_sbuffer  mp_sbuf;
-    msgpack_unpacked result;
+    char *p;
+    char *line;
+    ssize_t bytes;
+
+    while (1) {
+        p = memchr(r->buf + r->pos, '\n', r->len - r->pos);
+        if (p) {
+            line = r->buf + r->pos;
+            r->pos = (p - r->buf) + 1;
+            *p = '\0';
+            if (p > line && *(p - 1) == '\r') {
+                *(p - 1) = '\0';
+            }
+            return line;
+        }
 
-    /* Convert MsgPack to JSON */
-    msgpack_sbuffer_init(&mp_sbuf);
-    msgpack_packer_init(&mp_pck, &mp_sbuf, msgpack_sbuffer_write);
-    msgpack_unpacked_init(&result);
+        if (r->pos > 0) {
+            memmove(r->buf, r->buf + r->pos, r->len - r->pos);
+            r->len -= r->pos;
+            r->pos = 0;
+        }
+        if (r->len == sizeof(r->buf)) {
+            flb_error("[out_nats] server message too long");
+            return NULL;
+        }
 
-    j_root = json_create_array();
+        bytes = flb_io_net_read(u_conn, r->buf + r->len,
+                                sizeof(r->buf) - r->len);
+        if (bytes <= 0) {
+            return NULL;
+        }
+        r->len += bytes;
+    }
+}
 
-    while (msgpack_unpack_next(&result, data, bytes, &off)) {
-        if (result.data.type != MSGPACK_OBJECT_ARRAY) {
-            continue;
+/* INFO {"server_id":"...",...,"max_payload":1048576} */
+static void nats_info(struct flb_out_nats_config *ctx, char *line)
+{
+    char *p;
+
+    p = strstr(line, "\"max_payload\":");
+    if (p) {
+        ctx->server_max_payload = strtoul(p + 14, NULL, 10);
+    }
+}
+
+static size_t nats_max_payload(struct flb_out_nats_config *ctx)
+{
+    size_t max = ctx->server_max_payload;
+
+    if (ctx->max_payload > 0 && (max == 0 || ctx->max_payload < max)) {
+        max = ctx->max_payload;
+    }
+    return max;
+}
+
+/*
+ * Handle the server messages until the PONG of our PING arrives, it
+ * confirms the server processed every PUB written before it.
+ */
+static int nats_wait_pong(struct flb_out_nats_config *ctx,
+                          struct flb_upstream_conn *u_conn,
+                          struct nats_reader *r)
+{
+    int ret;
+    char *line;
+    size_t bytes_sent;
+
+    while ((line = nats_read_line(u_conn, r))) {
+        if (strcmp(line, "PONG") == 0) {
+            return 0;
+        }
+        else if (strcmp(line, "PING") == 0) {
+            ret = flb_io_net_write(u_conn, NATS_PONG, sizeof(NATS_PONG) - 1,
+                                   &bytes_sent);
+            if (ret == -1) {
+                return -1;
+            }
         }
+        else if (strncmp(line, "INFO ", 5) == 0) {
+            nats_info(ctx, line);
+        }
+        else if (strncmp(line, "-ERR", 4) == 0) {
+            flb_error("[out_nats] server error: %s", line + 4);
+            return -1;
+        }
+    }
+
+    return -1;
+}
 
-        j_arr = json_create_array();
+static void nats_batch_init(struct nats_batch *b)
+{
+    msgpack_sbuffer_init(&b->hdr);
+    msgpack_sbuffer_init(&b->data);
+    msgpack_sbuffer_init(&b->rec);
+    b->open = FLB_FALSE;
+    b->count = 0;
+    b->size = 0;
+    b->frames = NULL;
+}
 
-        root = result.data;
-        if (root.via.array.size != 2) {
-            continue;
+static void nats_batch_destroy(struct nats_batch *b)
+{
+    msgpack_sbuffer_destroy(&b->hdr);
+    msgpack_sbuffer_destroy(&b->data);
+    msgpack_sbuffer_destroy(&b->rec);
+    free(b->frames);
+}
+
+static int nats_frame_open(struct nats_batch *b)
+{
+    int size;
+    struct nats_frame *tmp;
+
+    if (b->count == b->size) {
+        size = b->size ? b->size * 2 : NATS_FRAMES;
+        tmp = realloc(b->frames, sizeof(struct nats_frame) * size);
+        if (!tmp) {
+            perror("realloc");
+            return -1;
         }
+        b->frames = tmp;
+        b->size = size;
+    }
 
-        atime  = root.via.array.ptr[0].via.u64;
-        map    = root.via.array.ptr[1];
-        n_size = map.via.map.size + 1;
+    b->frames[b->count].data_off = b->data.size;
+    b->open = FLB_TRUE;
+    return 0;
+}
 
-        json_add_to_array(j_arr, json_create_number(atime));
+/* Terminate the payload and compose the PUB line for it */
+static int nats_frame_close(struct nats_batch *b, char *subject)
+{
+    int ret;
+    char line[256];
+    size_t len;
+    struct nats_frame *f = &b->frames[b->count];
+
+    len = b->data.size - f->data_off;
+    ret = snprintf(line, sizeof(line), "PUB %s %zu\r\n", subject, len);
+    if (ret < 0 || ret >= sizeof(line)) {
+        flb_error("[out_nats] subject too long");
+        return -1;
+    }
+
+    f->hdr_off = b->hdr.size;
+    f->hdr_len = ret;
+    if (msgpack_sbuffer_write(&b->hdr, line, ret) != 0 ||
+        msgpack_sbuffer_write(&b->data, "\r\n", 2) != 0) {
+        return -1;
+    }
+    f->data_len = len + 2;
 
-        json_t *j_obj = json_create_object();
+    b->open = FLB_FALSE;
+    b->count++;
+    return 0;
+}
 
-        if (!tag) {
-            json_add_to_object(j_obj, "tag",
-                               json_create_string("fluentbit"));
+/*
+ * Add a record to the batch: in record mode it's a new PUB, in chunk mode
+ * it's appended to the array of the open PUB unless it would exceed the
+ * payload limit.
+ */
+static int nats_batch_add(struct nats_batch *b, int mode, size_t max,
+                          char *subject)
+{
+    int ret = 0;
+    size_t len;
+    msgpack_sbuffer *rec = &b->rec;
+
+    if (mode == NATS_MODE_RECORD) {
+        if (nats_frame_open(b) == -1 ||
+            msgpack_sbuffer_write(&b->data, rec->data, rec->size) != 0) {
+            return -1;
         }
-        else {
-            json_add_to_object(j_obj, "tag",
-                               json_create_string(tag));
+        return nats_frame_close(b, subject);
+    }
+
+    if (b->open == FLB_TRUE && max > 0) {
+        len = b->data.size - b->frames[b->count].data_off;
+        if (len + 1 + rec->size + 1 > max) {
+            if (msgpack_sbuffer_write(&b->data, "]", 1) != 0 ||
+                nats_frame_close(b, subject) == -1) {
+                return -1;
+            }
         }
+    }
 
-        for (i = 0; i < n_size - 1; i++) {
-            m_key = map.via.map.ptr[i].key;
-            m_val = map.via.map.ptr[i].val;
+    if (b->open == FLB_FALSE) {
+        if (nats_frame_open(b) == -1) {
+            return -1;
+        }
+        ret = msgpack_sbuffer_write(&b->data, "[", 1);
+    }
+    else {
+        ret = msgpack_sbuffer_write(&b->data, ",", 1);
+    }
 
-            memcpy(tmp_key, m_key.via.bin.ptr, m_key.via.bin.size);
-            tmp_key[m_key.via.bin.size] = '\0';
+    if (ret == 0) {
+        ret = msgpack_sbuffer_write(&b->data, rec->data, rec->size);
+    }
 
-            if (m_val.type == MSGPACK_OBJECT_NIL) {
-                json_add_to_object(j_obj, tmp_key,
-                                   json_create_null());
-            }
-            else if (m_val.type == MSGPACK_OBJECT_BOOLEAN) {
-                json_add_to_object(j_obj, tmp_key,
-                                   json_create_bool(m_val.via.boolean));
-            }
-            else if (m_val.type == MSGPACK_OBJECT_POSITIVE_INTEGER) {
-                json_add_to_object(j_obj, tmp_key,
-                                   json_create_number(m_val.via.u64));
-            }
-            else if (m_val.type == MSGPACK_OBJECT_NEGATIVE_INTEGER) {
-                json_add_to_object(j_obj, tmp_key,
-                                   json_create_number(m_val.via.i64));
-            }
-            else if (m_val.type == MSGPACK_OBJECT_FLOAT) {
-                json_add_to_object(j_obj, tmp_key,
-                                   json_create_number(m_val.via.f64));
-            }
-            else if (m_val.type == MSGPACK_OBJECT_STR) {
-                if (m_val.via.str.size > sizeof(tmp_val) - 1) {
-                    tmp_ext = malloc(m_val.via.str.size + 1);
-                }
-                else {
-                    tmp_ext = tmp_val;
-                }
-                memcpy(tmp_ext, m_val.via.str.ptr, m_val.via.str.size);
-                tmp_ext[m_val.via.str.size] = '\0';
-
-                json_add_to_object(j_obj, tmp_key, json_create_string(tmp_ext));
-                if (tmp_ext != tmp_val) {
-                    free(tmp_ext);
-                }
-            }
-            else if (m_val.type == MSGPACK_OBJECT_BIN) {
-                if (m_val.via.bin.size > sizeof(tmp_val)) {
-                    tmp_ext = malloc(m_val.via.bin.size + 1);
-                }
-                else {
-                    tmp_ext = tmp_val;
-                }
-                memcpy(tmp_ext, m_val.via.bin.ptr, m_val.via.bin.size);
-                tmp_ext[m_val.via.bin.size] = '\0';
-
-                json_add_to_object(j_obj, tmp_key, json_create_string(tmp_ext));
-                if (tmp_ext != tmp_val) {
-                    free(tmp_ext);
-                }
-            }
+    return ret;
+}
+
+/*
+ * Compose the PUB frames for the chunk, every entry is formatted as
+ * [time, {"tag": tag, ...record}]. Returns the number of frames.
+ */
+static int nats_batch_compose(struct flb_out_nats_config *ctx,
+                              struct nats_batch *b,
+                              void *data, size_t bytes,
+                              char *tag, int tag_len)
+{
+    int ret = 0;
+    size_t off = 0;
+    size_t max;
+    size_t extra;
+    msgpack_object root;
+    msgpack_unpacked result;
+    struct flb_time tm;
+    struct flb_pack_json_fmt fmt;
+
+    flb_pack_json_fmt_init(&fmt);
+    fmt.date_key = NULL;
+    fmt.tag_key  = "tag";
+    fmt.tag      = tag;
+    fmt.tag_len  = tag_len;
+
+    max = nats_max_payload(ctx);
+    extra = (ctx->mode == NATS_MODE_CHUNK) ? 2 : 0;
+
+    msgpack_unpacked_init(&result);
+    while (msgpack_unpack_next(&result, data, bytes, &off)) {
+        root = result.data;
+        if (root.type != MSGPACK_OBJECT_ARRAY || root.via.array.size != 2) {
+            continue;
+        }
+
+        b->rec.size = 0;
+        flb_time_pop_from_msgpack(&tm, &root.via.array.ptr[0]);
+        ret = msgpack_sbuffer_write(&b->rec, "[", 1);
+        ret |= flb_msgpack_to_json(&b->rec, &root.via.array.ptr[0]);
+        ret |= msgpack_sbuffer_write(&b->rec, ",", 1);
+        ret |= flb_msgpack_record_to_json(&b->rec, &tm,
+                                          &root.via.array.ptr[1], &fmt);
+        ret |= msgpack_sbuffer_write(&b->rec, "]", 1);
+        if (ret != 0) {
+            break;
         }
 
-        json_add_to_array(j_arr, j_obj);
-        json_add_to_array(j_root, j_arr);
+        if (max > 0 && b->rec.size + extra > max) {
+            flb_error("[out_nats] record of %zu bytes exceeds max_payload "
+                      "(%zu), dropped", b->rec.size, max);
+            continue;
+        }
+
+        ret = nats_batch_add(b, ctx->mode, max, tag);
+        if (ret != 0) {
+            break;
+        }
     }
     msgpack_unpacked_destroy(&result);
 
-    *out_json = json_print_unformatted(j_root);
-    json_delete(j_root);
+    if (ret == 0 && b->open == FLB_TRUE) {
+        ret = msgpack_sbuffer_write(&b->data, "]", 1);
+        if (ret == 0) {
+            ret = nats_frame_close(b, tag);
+        }
+    }
 
-    *out_len = strlen(*out_json);
-    return 0;
+    if (ret != 0) {
+        return -1;
+    }
+    return b->count;
 }
 
+/* Write the batch, preceded by the CONNECT on a new connection */
+static int nats_batch_write(struct nats_batch *b,
+                            struct flb_upstream_conn *u_conn)
+{
+    int i;
+    int n = 0;
+    int ret;
+    size_t bytes_sent;
+    struct iovec *iov;
+    struct nats_frame *f;
+
+    iov = malloc(sizeof(struct iovec) * ((b->count * 2) + 2));
+    if (!iov) {
+        perror("malloc");
+        return -1;
+    }
+
+    if (u_conn->handshake == FLB_FALSE) {
+        iov[n].iov_base = NATS_CONNECT;
+        iov[n].iov_len  = sizeof(NATS_CONNECT) - 1;
+        n++;
+    }
+
+    for (i = 0; i < b->count; i++) {
+        f = &b->frames[i];
+        iov[n].iov_base = b->hdr.data + f->hdr_off;
+        iov[n].iov_len  = f->hdr_len;
+        n++;
+        iov[n].iov_base = b->data.data + f->data_off;
+        iov[n].iov_len  = f->data_len;
+        n++;
+    }
+
+    iov[n].iov_base = NATS_PING;
+    iov[n].iov_len  = sizeof(NATS_PING) - 1;
+    n++;
+
+    ret = flb_io_net_writev(u_conn, iov, n, &bytes_sent);
+    free(iov);
+
+    return ret;
+}
 
 int cb_nats_flush(void *data, size_t bytes,
                   char *tag, int tag_len,
@@ -199,61 +445,83 @@ int cb_nats_flush(void *data, size_t bytes,
                   struct flb_config *config)
 {
     int ret;
-    size_t bytes_sent;
-    size_t json_len;
-    char *json_msg;
-    char *request;
-    int req_len;
+    char *line;
+    struct nats_batch batch;
+    struct nats_reader *reader;
     struct flb_out_nats_config *ctx = out_context;
     struct flb_upstream_conn *u_conn;
+    (void) i_ins;
+    (void) config;
+
+    if (!tag) {
+        tag = "fluentbit";
+        tag_len = 9;
+    }
+
+    reader = malloc(sizeof(struct nats_reader));
+    if (!reader) {
+        perror("malloc");
+        FLB_OUTPUT_RETURN(FLB_RETRY);
+    }
+    reader->len = 0;
+    reader->pos = 0;
 
     u_conn = flb_upstream_conn_get(ctx->u);
     if (!u_conn) {
         flb_error("[out_nats] no upstream connections available");
-        return -1;
+        free(reader);
+        FLB_OUTPUT_RETURN(FLB_RETRY);
     }
 
-    /* Before to flush the content check if we need to start the handshake */
-    if (u_conn->fd <= 0) {
-        ret = flb_io_net_write(u_conn,
-                               NATS_CONNECT,
-                               sizeof(NATS_CONNECT) - 1,
-                               &bytes_sent);
-        if (ret == -1) {
-            flb_upstream_conn_release(u_conn);
-            FLB_OUTPUT_RETURN(FLB_RETRY);
+    /* A new connection starts with the server INFO */
+    if (u_conn->handshake == FLB_FALSE) {
+        line = nats_read_line(u_conn, reader);
+        if (!line || strncmp(line, "INFO ", 5) != 0) {
+            flb_error("[out_nats] invalid server greeting");
+            goto retry;
         }
+        nats_info(ctx, line);
     }
 
-    /* Convert original Fluent Bit MsgPack format to JSON */
-    ret = msgpack_to_json(data, bytes, tag, &json_msg, &json_len);
-    if (ret == -1) {
-        FLB_OUTPUT_RETURN(FLB_ERROR);
+    /* Compose every PUB frame, with the payload limit from INFO */
+    nats_batch_init(&batch);
+    ret = nats_batch_compose(ctx, &batch, data, bytes, tag, tag_len);
+    if (ret <= 0) {
+        nats_batch_destroy(&batch);
+        free(reader);
+
+        /*
+         * Nothing was sent: a new connection already consumed the INFO but
+         * never got the CONNECT, it can't be reused.
+         */
+        if (u_conn->handshake == FLB_FALSE) {
+            u_conn->recycle = FLB_FALSE;
+        }
+        flb_upstream_conn_release(u_conn);
+        FLB_OUTPUT_RETURN(ret == 0 ? FLB_OK : FLB_ERROR);
     }
 
-    /* Compose the NATS Publish request */
-    request = malloc(json_len + 32);
-    req_len = snprintf(request, json_len + 32, "PUB %s %zu\r\n",
-                       tag, json_len);
-
-    /* Append JSON message and ending CRLF */
-    memcpy(request + req_len, json_msg, json_len);
-    req_len += json_len;
-    request[req_len++] = '\r';
-    request[req_len++] = '\n';
-    free(json_msg);
+    ret = nats_batch_write(&batch, u_conn);
+    nats_batch_destroy(&batch);
+    if (ret == -1) {
+        goto retry;
+    }
 
-    ret = flb_io_net_write(u_conn, request, req_len, &bytes_sent);
+    ret = nats_wait_pong(ctx, u_conn, reader);
     if (ret == -1) {
-        perror("write");
-        free(request);
-        flb_upstream_conn_release(u_conn);
-        FLB_OUTPUT_RETURN(FLB_RETRY);
+        goto retry;
     }
 
-    free(request);
+    u_conn->handshake = FLB_TRUE;
+    free(reader);
     flb_upstream_conn_release(u_conn);
     FLB_OUTPUT_RETURN(FLB_OK);
+
+ retry:
+    free(reader);
+    u_conn->recycle = FLB_FALSE;
+    flb_upstream_conn_release(u_conn);
+    FLB_OUTPUT_RETURN(FLB_RETRY);
 }
 
 int cb_nats_exit(void *data, struct flb_config *config)
@@ -23,8 +23,26 @@
 #include <fluent-bit/flb_version.h>
 
 #define NATS_CONNECT "CONNECT {\"verbose\":false,\"pedantic\":false,\"ssl_required\":false,\"name\":\"fluent-bit\",\"lang\":\"c\",\"version\":\"" FLB_VERSION_STR "\"}\r\n"
+#define NATS_PING    "PING\r\n"
+#define NATS_PONG    "PONG\r\n"
+
+/* Publish modes */
+#define NATS_MODE_CHUNK     0   /* one JSON array of records per PUB */
+#define NATS_MODE_RECORD    1   /* one record per PUB                */
+
+#define NATS_FRAMES         64  /* initial PUB frames per batch      */
+#define NATS_READ_BUF     4096  /* server messages (INFO, PONG, ...) */
 
 struct flb_out_nats_config {
+    int mode;
+
+    /*
+     * Payload limit of a PUB: the 'max_payload' announced by the server
+     * in its INFO message, or the configured one if it's lower.
+     */
+    size_t max_payload;
+    size_t server_max_payload;
+
     struct flb_output_instance *ins;
     struct flb_upstream *u;
 };
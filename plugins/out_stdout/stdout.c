@@ -21,6 +21,7 @@
 
 #include <fluent-bit/flb_output.h>
 #include <fluent-bit/flb_utils.h>
+#include <fluent-bit/flb_pack.h>
 
 #include <msgpack.h>
 
@@ -51,7 +52,7 @@ int cb_stdout_flush(void *data, size_t bytes,
     msgpack_unpacked_init(&result);
     while (msgpack_unpack_next(&result, data, bytes, &off)) {
         printf("[%zd] %s: ", cnt++, tag);
-        msgpack_object_print(stdout, result.data);
+        flb_pack_print_entry(stdout, &result.data);
         printf("\n");
     }
     msgpack_unpacked_destroy(&result);
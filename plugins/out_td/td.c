@@ -49,7 +49,6 @@ static char *td_format(void *data, size_t bytes, int *out_size)
     int ret;
     int n_size;
     size_t off = 0;
-    time_t atime;
     char *buf;
     struct msgpack_sbuffer mp_sbuf;
     struct msgpack_packer mp_pck;
@@ -57,6 +56,7 @@ static char *td_format(void *data, size_t bytes, int *out_size)
     msgpack_object root;
     msgpack_object map;
     msgpack_sbuffer *sbuf;
+    struct flb_time tm;
 
     /* Initialize contexts for new output */
     msgpack_sbuffer_init(&mp_sbuf);
@@ -106,14 +106,14 @@ static char *td_format(void *data, size_t bytes, int *out_size)
             continue;
         }
 
-        atime = root.via.array.ptr[0].via.u64;
-        map   = root.via.array.ptr[1];
+        flb_time_pop_from_msgpack(&tm, &root.via.array.ptr[0]);
+        map = root.via.array.ptr[1];
 
         n_size = map.via.map.size + 1;
         msgpack_pack_map(&mp_pck, n_size);
         msgpack_pack_bin(&mp_pck, 4);
         msgpack_pack_bin_body(&mp_pck, "time", 4);
-        msgpack_pack_int32(&mp_pck, atime);
+        msgpack_pack_int32(&mp_pck, tm.tm.tv_sec);
 
         for (i = 0; i < n_size - 1; i++) {
             msgpack_pack_object(&mp_pck, map.via.map.ptr[i].key);
@@ -161,6 +161,7 @@ int cb_td_init(struct flb_output_instance *ins, struct flb_config *config,
         free(ctx);
         return -1;
     }
+    flb_output_upstream_set(upstream, ins);
     ctx->u = upstream;
 
     flb_output_set_context(ins, ctx);
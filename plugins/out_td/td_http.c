@@ -20,86 +20,32 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <zlib.h>
 
 #include <fluent-bit/flb_config.h>
 #include <fluent-bit/flb_http_client.h>
+#include <fluent-bit/flb_gzip.h>
 #include "td_config.h"
 
 #define TD_HTTP_HEADER_SIZE  512
 
-static inline void strm_init(z_stream *strm)
-{
-    strm->zalloc = Z_NULL;
-    strm->zfree  = Z_NULL;
-    strm->opaque = Z_NULL;
-
-    deflateInit2(strm, Z_DEFAULT_COMPRESSION,
-                 Z_DEFLATED, 31, 9, Z_DEFAULT_STRATEGY);
-}
-
-static void *gzip_compress(void *data, size_t len, size_t *out_len)
-{
-    int flush;
-    int status;
-    int buf_len;
-    void *buf;
-    z_stream strm;
-
-    strm_init(&strm);
-
-    buf_len = len + 32;
-    buf = malloc(buf_len);
-    if (!buf) {
-        perror("malloc");
-        return NULL;
-    }
-
-    strm.next_in   = data;
-    strm.avail_in  = len;
-    strm.total_out = 0;
-    flush = Z_NO_FLUSH;
-
-    while (1) {
-        strm.next_out  = buf + strm.total_out;
-        strm.avail_out = buf_len - strm.total_out;
-
-        if (strm.avail_in == 0) {
-            flush = Z_FINISH;
-        }
-
-        status = deflate(&strm, flush);
-        if (status == Z_STREAM_END) {
-            break;
-        }
-        else if (status != Z_OK) {
-            deflateEnd(&strm);
-            free(buf);
-            return NULL;
-        }
-    }
-    deflateEnd(&strm);
-    *out_len = strm.total_out;
-
-    return buf;
-}
-
 struct flb_http_client *td_http_client(struct flb_upstream_conn *u_conn,
                                        void *data, size_t len,
                                        char **body,
                                        struct flb_out_td_config *ctx,
                                        struct flb_config *config)
 {
+    int ret;
     int pos = 0;
     int api_len;
     size_t gz_size;
-    char *gz;
+    void *gz;
     char *tmp;
     struct flb_http_client *c;
 
     /* Compress data */
-    gz = gzip_compress(data, len, &gz_size);
-    if (!gz) {
+    ret = flb_gzip_compress(data, len, FLB_GZIP_LEVEL_DEFAULT,
+                            &gz, &gz_size);
+    if (ret == -1) {
         return NULL;
     }
 
@@ -119,6 +119,7 @@ static void flb_buffer_worker_init(void *arg)
                 /* Read event triggered from flb_buffer_chunk_push(...) */
                 filename = NULL;
                 ret = flb_buffer_chunk_add(ctx, event, &filename);
+                __atomic_sub_fetch(&ctx->pending, 1, __ATOMIC_RELAXED);
                 if (ret >= 0) {
                     /*
                      * If a buffer chunk have been stored properly, now it
@@ -142,6 +143,7 @@ static void flb_buffer_worker_init(void *arg)
             }
             else if (event->type == FLB_BUFFER_EV_DEL_REF) {
                 ret = flb_buffer_chunk_delete_ref(ctx, event);
+                __atomic_sub_fetch(&ctx->pending, 1, __ATOMIC_RELAXED);
                 if (ret == FLB_BUFFER_NOTFOUND) {
                     /*
                      * The Buffer Chunk Reference was not found, likely it
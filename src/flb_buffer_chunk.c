@@ -643,6 +643,7 @@ int flb_buffer_chunk_push(struct flb_buffer *ctx, void *data,
         perror("write");
         return -1;
     }
+    __atomic_add_fetch(&worker->pending, 1, __ATOMIC_RELAXED);
 
     flb_debug("[buffer] created records=%p size=%lu worker=%i",
               data, size, ctx->worker_lru);
@@ -688,6 +689,7 @@ int flb_buffer_chunk_pop(struct flb_buffer *ctx, int thread_id,
         perror("write");
         return -1;
     }
+    __atomic_add_fetch(&worker->pending, 1, __ATOMIC_RELAXED);
 
     return 0;
 }
@@ -29,6 +29,7 @@
 #include <fluent-bit/flb_plugins.h>
 #include <fluent-bit/flb_io_tls.h>
 #include <fluent-bit/flb_kernel.h>
+#include <fluent-bit/flb_stats.h>
 
 struct flb_service_config service_configs[] = {
     {FLB_CONF_STR_FLUSH,
@@ -43,6 +44,10 @@ struct flb_service_config service_configs[] = {
      FLB_CONF_TYPE_STR,
      offsetof(struct flb_config, log)},
 
+    {FLB_CONF_STR_LAT_SAMPLING,
+     FLB_CONF_TYPE_INT,
+     offsetof(struct flb_config, latency_sampling)},
+
 #ifdef FLB_HAVE_HTTP
     {FLB_CONF_STR_HTTP_MONITOR,
      FLB_CONF_TYPE_BOOL,
@@ -88,6 +93,8 @@ struct flb_config *flb_config_init()
     config->init_time    = time(NULL);
     config->kernel       = flb_kernel_info();
     config->verbose      = 3;
+    config->latency_sampling = 0;
+    flb_time_get(&config->clock);
 
 #ifdef FLB_HAVE_HTTP
     config->http_server  = FLB_FALSE;
@@ -181,10 +188,6 @@ void flb_config_exit(struct flb_config *config)
     if (config->http_port) {
         free(config->http_port);
     }
-
-    if (config->http_server) {
-        free(config->http_server);
-    }
 #endif
 
 #ifdef FLB_HAVE_STATS
@@ -254,7 +257,9 @@ static int set_log_level(struct flb_config *config, char *v_str)
 
 static inline int atobool(char*v)
 {
-    return  (strncasecmp("true", v, 256) == 0)
+    /* Same values accepted by the configuration file ('On') */
+    return  (strncasecmp("true", v, 256) == 0 ||
+             strncasecmp("on", v, 256) == 0)
         ? FLB_TRUE
         : FLB_FALSE;
 }   
@@ -265,7 +270,7 @@ int flb_config_set_property(struct flb_config *config,
     int i=0;
     int ret = -1;
     int*  i_val;
-    char* s_val;
+    char** s_val;
     size_t len = strnlen(k, 256);
     char* key = service_configs[0].key;
 
@@ -287,8 +292,9 @@ int flb_config_set_property(struct flb_config *config,
                     break;
 
                 case FLB_CONF_TYPE_STR:
-                    s_val = (char*)config+service_configs[i].offset;
-                    s_val = strdup(v);
+                    s_val = (char**)((char*)config+service_configs[i].offset);
+                    free(*s_val);
+                    *s_val = strdup(v);
                     break;
 
                 default:
@@ -0,0 +1,525 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Fluent Bit
+ *  ==========
+ *  Copyright (C) 2015-2016 Treasure Data Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+/*
+ * FLB_DNS
+ * =======
+ * Host name resolution for upstream connections. getaddrinfo(3) is a
+ * blocking call and it does not expose the records TTL, so when the system
+ * provides res_search(3) the A and AAAA records are queried directly and
+ * the smallest TTL found is used to expire the cached addresses. Names
+ * listed in /etc/hosts and numeric addresses never hit the network.
+ *
+ * Lookups issued from a co-routine run in a helper thread, the co-routine
+ * yields until the result is notified through a pipe registered in the
+ * event loop (see flb_io.c).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <limits.h>
+#include <errno.h>
+#include <pthread.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <fluent-bit/flb_info.h>
+#include <fluent-bit/flb_log.h>
+#include <fluent-bit/flb_macros.h>
+#include <fluent-bit/flb_dns.h>
+
+#ifdef FLB_HAVE_RES_QUERY
+#include <arpa/nameser.h>
+#include <resolv.h>
+
+/* Answers are received over UDP, TCP is used for bigger ones */
+#define DNS_ANSWER_SIZE  2048
+
+/*
+ * Name servers replacing the ones of /etc/resolv.conf. The resolver state
+ * is per thread, so every thread applies the list again when the
+ * generation changes (helper threads start with a fresh state).
+ */
+static pthread_mutex_t dns_servers_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct sockaddr_in dns_servers[MAXNS];
+static int dns_servers_count;
+static int dns_servers_gen;
+static __thread int dns_servers_applied;
+#endif
+
+/* Append an address in network byte order to the list */
+static int addrs_add(struct flb_dns_addrs *out, int family,
+                     void *raw, int port)
+{
+    struct sockaddr_in *s4;
+    struct sockaddr_in6 *s6;
+    struct sockaddr_storage *ss;
+
+    if (out->count >= FLB_DNS_MAX_ADDRS) {
+        return -1;
+    }
+
+    ss = &out->addr[out->count];
+    memset(ss, 0, sizeof(struct sockaddr_storage));
+
+    if (family == AF_INET) {
+        s4 = (struct sockaddr_in *) ss;
+        s4->sin_family = AF_INET;
+        s4->sin_port   = htons(port);
+        memcpy(&s4->sin_addr, raw, 4);
+        out->addr_len[out->count] = sizeof(struct sockaddr_in);
+    }
+    else {
+        s6 = (struct sockaddr_in6 *) ss;
+        s6->sin6_family = AF_INET6;
+        s6->sin6_port   = htons(port);
+        memcpy(&s6->sin6_addr, raw, 16);
+        out->addr_len[out->count] = sizeof(struct sockaddr_in6);
+    }
+
+    out->count++;
+    return 0;
+}
+
+/* Numeric IPv4 or IPv6 address, no lookup needed */
+int flb_dns_numeric(char *host, int port, struct flb_dns_addrs *out)
+{
+    unsigned char raw[16];
+
+    out->count = 0;
+    out->ttl   = -1;
+
+    if (inet_pton(AF_INET, host, raw) == 1) {
+        return addrs_add(out, AF_INET, raw, port);
+    }
+    else if (inet_pton(AF_INET6, host, raw) == 1) {
+        return addrs_add(out, AF_INET6, raw, port);
+    }
+
+    return -1;
+}
+
+static int gai_lookup(char *host, int port, struct flb_dns_addrs *out)
+{
+    int ret;
+    char _port[6];
+    struct addrinfo hints;
+    struct addrinfo *res;
+    struct addrinfo *rp;
+
+    memset(&hints, 0, sizeof hints);
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    snprintf(_port, sizeof(_port), "%i", port);
+    ret = getaddrinfo(host, _port, &hints, &res);
+    if (ret != 0) {
+        flb_error("[dns] cannot resolve %s: %s", host, gai_strerror(ret));
+        return -1;
+    }
+
+    for (rp = res; rp != NULL && out->count < FLB_DNS_MAX_ADDRS;
+         rp = rp->ai_next) {
+        memcpy(&out->addr[out->count], rp->ai_addr, rp->ai_addrlen);
+        out->addr_len[out->count] = rp->ai_addrlen;
+        out->count++;
+    }
+    freeaddrinfo(res);
+
+    out->ttl = FLB_DNS_TTL_DEFAULT;
+    return (out->count > 0) ? 0 : -1;
+}
+
+#ifdef FLB_HAVE_RES_QUERY
+
+/* Lookup the name in /etc/hosts */
+static int hosts_lookup(char *host, int port, struct flb_dns_addrs *out)
+{
+    int family;
+    char *ip;
+    char *name;
+    char *save;
+    char line[512];
+    unsigned char raw[16];
+    FILE *f;
+
+    f = fopen("/etc/hosts", "r");
+    if (!f) {
+        return -1;
+    }
+
+    while (fgets(line, sizeof(line), f)) {
+        name = strchr(line, '#');
+        if (name) {
+            *name = '\0';
+        }
+
+        ip = strtok_r(line, " \t\r\n", &save);
+        if (!ip) {
+            continue;
+        }
+
+        if (inet_pton(AF_INET, ip, raw) == 1) {
+            family = AF_INET;
+        }
+        else if (inet_pton(AF_INET6, ip, raw) == 1) {
+            family = AF_INET6;
+        }
+        else {
+            continue;
+        }
+
+        while ((name = strtok_r(NULL, " \t\r\n", &save))) {
+            if (strcasecmp(name, host) == 0) {
+                addrs_add(out, family, raw, port);
+                break;
+            }
+        }
+    }
+    fclose(f);
+
+    if (out->count == 0) {
+        return -1;
+    }
+
+    out->ttl = FLB_DNS_TTL_DEFAULT;
+    return 0;
+}
+
+/* Skip a (possibly compressed) domain name, returns the bytes used */
+static int dns_name_skip(unsigned char *p, unsigned char *end)
+{
+    unsigned char *s = p;
+
+    while (p < end) {
+        if (*p == 0) {
+            return (p - s) + 1;
+        }
+        else if ((*p & 0xc0) == 0xc0) {
+            return (p - s) + 2;
+        }
+        p += *p + 1;
+    }
+
+    return -1;
+}
+
+/* Make the thread resolver state use the configured name servers */
+static void dns_servers_apply()
+{
+    pthread_mutex_lock(&dns_servers_lock);
+    if (dns_servers_applied != dns_servers_gen) {
+        res_init();
+        if (dns_servers_count > 0) {
+            memcpy(_res.nsaddr_list, dns_servers,
+                   sizeof(struct sockaddr_in) * dns_servers_count);
+            _res.nscount = dns_servers_count;
+        }
+        dns_servers_applied = dns_servers_gen;
+    }
+    pthread_mutex_unlock(&dns_servers_lock);
+}
+
+/*
+ * Query the A or AAAA records of a host and append the addresses found,
+ * 'ttl' is updated with the smallest TTL of the answers.
+ */
+static int dns_query(char *host, int type, int port,
+                     struct flb_dns_addrs *out, int *ttl)
+{
+    int i;
+    int n;
+    int len;
+    int qdcount;
+    int ancount;
+    int rr_type;
+    int rr_class;
+    int rr_ttl;
+    int rr_len;
+    unsigned char *p;
+    unsigned char *end;
+    unsigned char buf[DNS_ANSWER_SIZE];
+
+    dns_servers_apply();
+
+    /* res_search() honours the 'search' and 'ndots' options */
+    len = res_search(host, C_IN, type, buf, sizeof(buf));
+    if (len < NS_HFIXEDSZ) {
+        return -1;
+    }
+    if (len > (int) sizeof(buf)) {
+        len = sizeof(buf);
+    }
+
+    p   = buf;
+    end = buf + len;
+    qdcount = (p[4] << 8) | p[5];
+    ancount = (p[6] << 8) | p[7];
+    p += NS_HFIXEDSZ;
+
+    /* Skip the question section */
+    for (i = 0; i < qdcount; i++) {
+        n = dns_name_skip(p, end);
+        if (n == -1 || p + n + NS_QFIXEDSZ > end) {
+            return -1;
+        }
+        p += n + NS_QFIXEDSZ;
+    }
+
+    /* Answers, CNAME records are skipped */
+    for (i = 0; i < ancount; i++) {
+        n = dns_name_skip(p, end);
+        if (n == -1 || p + n + NS_RRFIXEDSZ > end) {
+            return -1;
+        }
+        p += n;
+
+        rr_type  = (p[0] << 8) | p[1];
+        rr_class = (p[2] << 8) | p[3];
+        rr_ttl   = (p[4] << 24) | (p[5] << 16) | (p[6] << 8) | p[7];
+        rr_len   = (p[8] << 8) | p[9];
+        p += NS_RRFIXEDSZ;
+
+        if (p + rr_len > end) {
+            return -1;
+        }
+
+        if (rr_class == C_IN &&
+            ((rr_type == T_A && rr_len == 4) ||
+             (rr_type == T_AAAA && rr_len == 16))) {
+            addrs_add(out, (rr_type == T_A) ? AF_INET : AF_INET6, p, port);
+            if (rr_ttl < *ttl) {
+                *ttl = rr_ttl;
+            }
+        }
+        p += rr_len;
+    }
+
+    return 0;
+}
+#endif
+
+/* Blocking lookup of the host addresses */
+int flb_dns_resolve(char *host, int port, struct flb_dns_addrs *out)
+{
+#ifdef FLB_HAVE_RES_QUERY
+    int ttl = INT_MAX;
+#endif
+
+    out->count = 0;
+    out->ttl   = -1;
+
+    if (flb_dns_numeric(host, port, out) == 0) {
+        return 0;
+    }
+
+#ifdef FLB_HAVE_RES_QUERY
+    if (hosts_lookup(host, port, out) == 0) {
+        return 0;
+    }
+
+    dns_query(host, T_A, port, out, &ttl);
+    dns_query(host, T_AAAA, port, out, &ttl);
+    if (out->count > 0) {
+        if (ttl < FLB_DNS_TTL_MIN) {
+            ttl = FLB_DNS_TTL_MIN;
+        }
+        out->ttl = ttl;
+        flb_debug("[dns] %s: %i addresses, ttl=%i", host, out->count, ttl);
+        return 0;
+    }
+#endif
+
+    /* Let the system resolver try (e.g: other NSS sources) */
+    return gai_lookup(host, port, out);
+}
+
+/*
+ * Set the name servers (IPv4 only) queried for the A and AAAA records
+ * instead of the system ones, a count of zero restores them. It returns -1
+ * when the list is too long or the system lacks res_search(3).
+ */
+int flb_dns_servers_set(struct sockaddr_in *servers, int count)
+{
+#ifdef FLB_HAVE_RES_QUERY
+    if (count < 0 || count > MAXNS) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&dns_servers_lock);
+    if (count > 0) {
+        memcpy(dns_servers, servers, sizeof(struct sockaddr_in) * count);
+    }
+    dns_servers_count = count;
+    dns_servers_gen++;
+    pthread_mutex_unlock(&dns_servers_lock);
+
+    return 0;
+#else
+    (void) servers;
+    (void) count;
+    return -1;
+#endif
+}
+
+static void *dns_worker(void *data)
+{
+    struct flb_dns_request *req = data;
+
+    FLB_TLS_SET(flb_log_ctx, req->log);
+    req->ret = flb_dns_resolve(req->host, req->port, &req->addrs);
+
+    /* Wake up the waiters: the read end of the channel gets EOF */
+    close(req->ch[1]);
+    flb_dns_request_put(req);
+
+    return NULL;
+}
+
+/* Start an asynchronous lookup, the caller owns one reference */
+struct flb_dns_request *flb_dns_request_create(char *host, int port)
+{
+    int ret;
+    pthread_t tid;
+    pthread_attr_t attr;
+    struct flb_dns_request *req;
+
+    req = malloc(sizeof(struct flb_dns_request));
+    if (!req) {
+        perror("malloc");
+        return NULL;
+    }
+    req->host = strdup(host);
+    req->port = port;
+    req->ret  = -1;
+    req->refs = 2;
+    req->log  = FLB_TLS_GET(flb_log_ctx);
+
+    ret = pipe(req->ch);
+    if (ret == -1) {
+        perror("pipe");
+        free(req->host);
+        free(req);
+        return NULL;
+    }
+
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    ret = pthread_create(&tid, &attr, dns_worker, req);
+    pthread_attr_destroy(&attr);
+    if (ret != 0) {
+        flb_error("[dns] could not start lookup thread");
+        close(req->ch[0]);
+        close(req->ch[1]);
+        free(req->host);
+        free(req);
+        return NULL;
+    }
+
+    return req;
+}
+
+/* Wait for the lookup to finish (it returns right away once notified) */
+int flb_dns_request_wait(struct flb_dns_request *req)
+{
+    char c;
+    ssize_t bytes;
+
+    do {
+        bytes = read(req->ch[0], &c, 1);
+    } while (bytes > 0 || (bytes == -1 && errno == EINTR));
+
+    return req->ret;
+}
+
+void flb_dns_request_get(struct flb_dns_request *req)
+{
+    __atomic_add_fetch(&req->refs, 1, __ATOMIC_ACQ_REL);
+}
+
+void flb_dns_request_put(struct flb_dns_request *req)
+{
+    if (__atomic_sub_fetch(&req->refs, 1, __ATOMIC_ACQ_REL) > 0) {
+        return;
+    }
+
+    close(req->ch[0]);
+    free(req->host);
+    free(req);
+}
+
+void flb_dns_cache_init(struct flb_dns_cache *cache)
+{
+    memset(cache, 0, sizeof(struct flb_dns_cache));
+}
+
+int flb_dns_cache_valid(struct flb_dns_cache *cache, time_t now)
+{
+    if (cache->addrs.count == 0) {
+        return FLB_FALSE;
+    }
+
+    if (cache->addrs.ttl >= 0 && now >= cache->expire) {
+        return FLB_FALSE;
+    }
+
+    return FLB_TRUE;
+}
+
+void flb_dns_cache_set(struct flb_dns_cache *cache,
+                       struct flb_dns_addrs *addrs, time_t now)
+{
+    memcpy(&cache->addrs, addrs, sizeof(struct flb_dns_addrs));
+    cache->expire = now + addrs->ttl;
+
+    /* Keep the rotation position unless the list got shorter */
+    if (cache->index >= addrs->count) {
+        cache->index = 0;
+    }
+}
+
+void flb_dns_cache_invalidate(struct flb_dns_cache *cache)
+{
+    cache->expire = 0;
+    if (cache->addrs.ttl < 0) {
+        return;
+    }
+    cache->addrs.count = 0;
+}
+
+/* Get the next address to connect to (round-robin) */
+struct sockaddr *flb_dns_cache_next(struct flb_dns_cache *cache,
+                                    socklen_t *len)
+{
+    int i;
+
+    if (cache->addrs.count == 0) {
+        return NULL;
+    }
+
+    i = cache->index;
+    cache->index = (i + 1) % cache->addrs.count;
+
+    *len = cache->addrs.addr_len[i];
+    return (struct sockaddr *) &cache->addrs.addr[i];
+}
@@ -40,10 +40,7 @@
 #include <fluent-bit/flb_http_server.h>
 #include <fluent-bit/flb_buffer.h>
 #include <fluent-bit/flb_scheduler.h>
-
-#ifdef FLB_HAVE_STATS
 #include <fluent-bit/flb_stats.h>
-#endif
 
 #ifdef FLB_HAVE_FLUSH_UCONTEXT
 static int flb_engine_destroy_threads(struct mk_list *threads)
@@ -94,11 +91,49 @@ int flb_engine_flush(struct flb_config *config,
             continue;
         }
         flb_engine_dispatch(in, config);
+
+        /* The next collection opens a new latency tracing window */
+        in->t_collect = 0;
     }
 
     return 0;
 }
 
+/* Latency tracing: remember the first collection since the last flush */
+static inline void trace_collect(struct flb_input_instance *in,
+                                 struct flb_config *config)
+{
+    if (config->latency_sampling > 0 && in->t_collect == 0) {
+        in->t_collect = flb_metrics_time();
+    }
+}
+
+/* Latency tracing: register the stages of a sampled flush */
+static void trace_return(struct flb_thread *th, struct flb_task *task,
+                         struct flb_output_instance *o_ins, int ret)
+{
+    uint64_t now;
+    uint64_t start;
+    struct flb_metrics_hdr *lat = o_ins->metrics.latency;
+
+    now = flb_metrics_time();
+    start = th->t_start ? th->t_start : th->start;
+
+    flb_metrics_hdr_add(&lat[FLB_METRIC_LAT_START], start - th->start);
+    if (th->t_write > 0) {
+        flb_metrics_hdr_add(&lat[FLB_METRIC_LAT_WRITE], th->t_write - start);
+        flb_metrics_hdr_add(&lat[FLB_METRIC_LAT_RETURN], now - th->t_write);
+    }
+    else {
+        flb_metrics_hdr_add(&lat[FLB_METRIC_LAT_RETURN], now - start);
+    }
+
+    /* End to end, only once the records are delivered */
+    if (ret == FLB_OK) {
+        flb_metrics_hdr_add(&lat[FLB_METRIC_LAT_TOTAL], now - task->t_collect);
+    }
+}
+
 static inline int consume_byte(int fd)
 {
     int ret;
@@ -116,6 +151,7 @@ static inline int consume_byte(int fd)
 
 static inline int flb_engine_manager(int fd, struct flb_config *config)
 {
+    int s;
     int ret;
     int bytes;
     int task_id;
@@ -124,7 +160,9 @@ static inline int flb_engine_manager(int fd, struct flb_config *config)
     uint32_t key;
     uint64_t val;
     struct flb_task *task;
+    struct flb_task_retry *retry;
     struct flb_thread *thread;
+    struct flb_output_instance *o_ins;
 
     bytes = read(fd, &val, sizeof(val));
     if (bytes == -1) {
@@ -140,6 +178,7 @@ static inline int flb_engine_manager(int fd, struct flb_config *config)
     if (type == 1) {                  /* Engine type */
         if (key == FLB_ENGINE_STOP) {
             flb_trace("[engine] flush enqueued data");
+            flb_input_pre_exit_all(config);
             flb_engine_flush(config, NULL);
             return FLB_ENGINE_STOP;
         }
@@ -169,9 +208,19 @@ static inline int flb_engine_manager(int fd, struct flb_config *config)
 #endif
 
         task = config->tasks_map[task_id].task;
+        thread = flb_thread_get(thread_id, task);
+        o_ins = thread->data;
+        if (thread->trace) {
+            trace_return(thread, task, o_ins, ret);
+        }
 
         /* A thread has finished, delete it */
         if (ret == FLB_OK) {
+            flb_metrics_add(&o_ins->metrics, FLB_METRIC_RECORDS,
+                            thread->records);
+            flb_metrics_add(&o_ins->metrics, FLB_METRIC_BYTES, thread->size);
+            flb_metrics_hist_add(&o_ins->metrics.flush,
+                                 flb_metrics_time() - thread->start);
 #ifdef FLB_HAVE_BUFFERING
             if (config->buffer_path) {
                 flb_buffer_chunk_pop(config->buffer_ctx, thread_id, task);
@@ -182,12 +231,21 @@ static inline int flb_engine_manager(int fd, struct flb_config *config)
                 flb_task_destroy(task);
             }
         }
+        else if (ret == FLB_ERROR) {
+            /* The output gave up (or exceeded its retry limit) */
+            flb_metrics_add(&o_ins->metrics, FLB_METRIC_ERRORS, 1);
+            flb_metrics_add(&o_ins->metrics, FLB_METRIC_DROPPED,
+                            thread->records);
+            flb_thread_destroy_id(thread_id, task);
+            if (task->users == 0) {
+                flb_task_destroy(task);
+            }
+        }
         else if (ret == FLB_RETRY) {
-            /* Create a Task-Retry */
-            thread = flb_thread_get(task_id, task);
-            struct flb_task_retry *retry;
+            flb_metrics_add(&o_ins->metrics, FLB_METRIC_RETRIES, 1);
 
-            retry = flb_task_retry_create(task, thread->data);
+            /* Create a Task-Retry */
+            retry = flb_task_retry_create(task, o_ins);
             if (!retry) {
                 /*
                  * It can fail in two situations:
@@ -195,19 +253,35 @@ static inline int flb_engine_manager(int fd, struct flb_config *config)
                  * - No enough memory (unlikely)
                  * - It reached the maximum number of re-tries
                  */
+                flb_metrics_add(&o_ins->metrics, FLB_METRIC_RETRIES_FAILED, 1);
+                flb_metrics_add(&o_ins->metrics, FLB_METRIC_DROPPED,
+                                thread->records);
                 flb_thread_destroy_id(thread_id, task);
                 if (task->users == 0) {
                     flb_task_destroy(task);
                 }
+                return 0;
+            }
+
+            if (thread->retry_buffer) {
+                /*
+                 * The plugin only wants to retry a part of the records,
+                 * otherwise the retry keeps the records it already had.
+                 */
+                free(retry->buf);
+                retry->buf  = thread->retry_buffer;
+                retry->size = thread->retry_size;
+                thread->retry_buffer = NULL;
             }
 
             /* Always destroy the old thread */
             flb_thread_destroy_id(thread_id, task);
 
             /* Let the scheduler to retry the failed task/thread */
-            int s = flb_sched_request_create(config, retry, retry->attemps);
+            flb_metrics_add(&o_ins->metrics, FLB_METRIC_RETRIES_PENDING, 1);
+            s = flb_sched_request_create(config, retry, retry->attemps);
             flb_debug("[sched] retry %i.%i in %i seconds",
-                      task->id, thread->id, s);
+                      task->id, thread_id, s);
         }
     }
 
@@ -231,12 +305,6 @@ static FLB_INLINE int flb_engine_handle_event(int fd, int mask,
         else if (config->shutdown_fd == fd) {
             return FLB_ENGINE_SHUTDOWN;
         }
-#ifdef FLB_HAVE_STATS
-        else if (config->stats_fd == fd) {
-            consume_byte(fd);
-            return FLB_ENGINE_STATS;
-        }
-#endif
         else if (config->ch_manager[0] == fd) {
             ret = flb_engine_manager(fd, config);
             if (ret == FLB_ENGINE_STOP) {
@@ -248,11 +316,13 @@ static FLB_INLINE int flb_engine_handle_event(int fd, int mask,
         mk_list_foreach(head, &config->collectors) {
             collector = mk_list_entry(head, struct flb_input_collector, _head);
             if (collector->fd_event == fd) {
+                trace_collect(collector->instance, config);
                 return collector->cb_collect(config,
                                              collector->instance->context);
             }
             else if (collector->fd_timer == fd) {
                 consume_byte(fd);
+                trace_collect(collector->instance, config);
                 return collector->cb_collect(config,
                                              collector->instance->context);
             }
@@ -284,13 +354,6 @@ int flb_engine_start(struct flb_config *config)
     struct mk_event_loop *evl;
     struct flb_input_collector *collector;
 
-    /* HTTP Server */
-#ifdef FLB_HAVE_HTTP
-    if (config->http_server == FLB_TRUE) {
-        flb_http_server_start(config);
-    }
-#endif
-
     /* Buffering Support */
 #ifdef FLB_HAVE_BUFFERING
     struct flb_buffer *buf_ctx;
@@ -351,6 +414,12 @@ int flb_engine_start(struct flb_config *config)
 
     flb_output_pre_run(config);
 
+    /* HTTP Server: the metrics read the instances once they are running */
+#ifdef FLB_HAVE_HTTP
+    if (config->http_server == FLB_TRUE) {
+        flb_http_server_start(config);
+    }
+#endif
 
     /* Create and register the timer fd for flush procedure */
     event = &config->event_flush;
@@ -404,8 +473,10 @@ int flb_engine_start(struct flb_config *config)
 
     /* Signal that we have started */
     flb_engine_started(config);
+    flb_time_get(&config->clock);
     while (1) {
         mk_event_wait(evl);
+        flb_time_get(&config->clock);
         mk_event_foreach(event, evl) {
             if (event->type == FLB_ENGINE_EV_CORE) {
                 ret = flb_engine_handle_event(event->fd, event->mask, config);
@@ -424,11 +495,6 @@ int flb_engine_start(struct flb_config *config)
                     flb_info("[engine] service stopped");
                     return flb_engine_shutdown(config);
                 }
-#ifdef FLB_HAVE_STATS
-                else if (ret == FLB_ENGINE_STATS) {
-                    //flb_stats_collect(config);
-                }
-#endif
             }
             else if (event->type == FLB_ENGINE_EV_SCHED) {
                 /* Event type registered by the Scheduler */
@@ -459,6 +525,13 @@ int flb_engine_start(struct flb_config *config)
 /* Release all resources associated to the engine */
 int flb_engine_shutdown(struct flb_config *config)
 {
+#ifdef FLB_HAVE_HTTP
+    /* no more metrics snapshots of the instances */
+    if (config->http_server == FLB_TRUE) {
+        flb_http_server_stop();
+    }
+#endif
+
     /* router */
     flb_router_exit(config);
 
@@ -37,24 +37,40 @@ void flb_task_add_thread(struct flb_thread *thread,
 int flb_engine_dispatch_retry(struct flb_task_retry *retry,
                               struct flb_config *config)
 {
+    char *buf;
+    size_t size;
     struct flb_thread *th;
     struct flb_task *task;
     struct flb_intput_instance *i_ins;
 
     task = retry->parent;
     i_ins = task->i_ins;
+    flb_metrics_sub(&retry->o_ins->metrics, FLB_METRIC_RETRIES_PENDING, 1);
+
+    /* A partial retry only carries the records that failed */
+    if (retry->buf) {
+        buf  = retry->buf;
+        size = retry->size;
+    }
+    else {
+        buf  = task->buf;
+        size = task->size;
+    }
 
     th = flb_output_thread(task,
                            i_ins,
                            retry->o_ins,
                            config,
-                           task->buf, task->size,
+                           buf, size,
                            task->tag,
                            strlen(task->tag));
     if (!th) {
         return -1;
     }
 
+    /* The retry_limit counts the attempts of every thread of the route */
+    th->retries = retry->attemps;
+
     flb_task_add_thread(th, task);
     flb_thread_resume(th);
 
@@ -132,6 +148,9 @@ int flb_engine_dispatch(struct flb_input_instance *in,
                 free(buf);
                 continue;
             }
+
+            /* The node is released with the task, don't append more data */
+            dt->busy = FLB_TRUE;
         }
     }
 
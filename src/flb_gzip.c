@@ -0,0 +1,221 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Fluent Bit
+ *  ==========
+ *  Copyright (C) 2015-2016 Treasure Data Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+
+/*
+ * GZIP compression for the output plugins. Every thread keeps a deflate
+ * stream per compression level in use, streams are reset on each call
+ * instead of allocating the compression state every time. A compression
+ * never yields, so co-routines of the same thread cannot interleave on it.
+ *
+ * The output buffer is sized from the expected ratio and grows if the data
+ * does not compress that well.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <zlib.h>
+
+#include <fluent-bit/flb_log.h>
+#include <fluent-bit/flb_gzip.h>
+
+/* gzip header and trailer instead of the zlib ones */
+#define GZIP_WINDOW_BITS   (15 + 16)
+#define GZIP_MEM_LEVEL      8
+
+/* Streams of a thread, indexed by level + 1 (zlib default is -1) */
+struct gzip_streams {
+    z_stream *strm[FLB_GZIP_LEVEL_MAX + 2];
+};
+
+static pthread_key_t gzip_key;
+static pthread_once_t gzip_once = PTHREAD_ONCE_INIT;
+
+static void gzip_streams_destroy(void *data)
+{
+    int i;
+    struct gzip_streams *gs = data;
+
+    for (i = 0; i < FLB_GZIP_LEVEL_MAX + 2; i++) {
+        if (gs->strm[i]) {
+            deflateEnd(gs->strm[i]);
+            free(gs->strm[i]);
+        }
+    }
+    free(gs);
+}
+
+static void gzip_key_init()
+{
+    pthread_key_create(&gzip_key, gzip_streams_destroy);
+}
+
+/* Get the thread deflate stream for 'level', ready to compress */
+static z_stream *gzip_stream_get(int level)
+{
+    int ret;
+    z_stream *strm;
+    struct gzip_streams *gs;
+
+    pthread_once(&gzip_once, gzip_key_init);
+
+    gs = pthread_getspecific(gzip_key);
+    if (!gs) {
+        gs = calloc(1, sizeof(struct gzip_streams));
+        if (!gs) {
+            perror("calloc");
+            return NULL;
+        }
+        pthread_setspecific(gzip_key, gs);
+    }
+
+    strm = gs->strm[level + 1];
+    if (strm) {
+        deflateReset(strm);
+        return strm;
+    }
+
+    strm = calloc(1, sizeof(z_stream));
+    if (!strm) {
+        perror("calloc");
+        return NULL;
+    }
+
+    ret = deflateInit2(strm, level, Z_DEFLATED, GZIP_WINDOW_BITS,
+                       GZIP_MEM_LEVEL, Z_DEFAULT_STRATEGY);
+    if (ret != Z_OK) {
+        flb_error("[gzip] could not initialize stream: %i", ret);
+        free(strm);
+        return NULL;
+    }
+    gs->strm[level + 1] = strm;
+
+    return strm;
+}
+
+/* Convert a configuration value to a compression level, -1 if invalid */
+int flb_gzip_level(char *str)
+{
+    int level;
+
+    level = atoi(str);
+    if (level < FLB_GZIP_LEVEL_MIN || level > FLB_GZIP_LEVEL_MAX) {
+        return -1;
+    }
+
+    return level;
+}
+
+/*
+ * Compress a set of buffers into a single gzip member, on success the new
+ * buffer is set in 'out_data' and must be released by the caller.
+ */
+int flb_gzip_compressv(struct iovec *iov, int iovcnt, int level,
+                       void **out_data, size_t *out_len)
+{
+    int i;
+    int ret;
+    int flush;
+    size_t len = 0;
+    size_t size;
+    char *tmp;
+    char *buf;
+    z_stream *strm;
+
+    if (iovcnt <= 0) {
+        return -1;
+    }
+
+    if (level != FLB_GZIP_LEVEL_DEFAULT &&
+        (level < FLB_GZIP_LEVEL_MIN || level > FLB_GZIP_LEVEL_MAX)) {
+        return -1;
+    }
+
+    strm = gzip_stream_get(level);
+    if (!strm) {
+        return -1;
+    }
+
+    for (i = 0; i < iovcnt; i++) {
+        len += iov[i].iov_len;
+    }
+
+    /* Log records usually compress better than 1:4 */
+    size = (len / 4) + 64;
+    buf = malloc(size);
+    if (!buf) {
+        perror("malloc");
+        return -1;
+    }
+
+    strm->next_out  = (Bytef *) buf;
+    strm->avail_out = size;
+
+    for (i = 0; i < iovcnt; i++) {
+        strm->next_in  = iov[i].iov_base;
+        strm->avail_in = iov[i].iov_len;
+        flush = (i == iovcnt - 1) ? Z_FINISH : Z_NO_FLUSH;
+        if (strm->avail_in == 0 && flush == Z_NO_FLUSH) {
+            continue;
+        }
+
+        do {
+            if (strm->avail_out == 0) {
+                /* Grow the output buffer and continue */
+                tmp = realloc(buf, size * 2);
+                if (!tmp) {
+                    perror("realloc");
+                    free(buf);
+                    return -1;
+                }
+                buf = tmp;
+                strm->next_out  = (Bytef *) buf + size;
+                strm->avail_out = size;
+                size *= 2;
+            }
+
+            ret = deflate(strm, flush);
+            if (ret == Z_STREAM_ERROR ||
+                (ret == Z_BUF_ERROR && strm->avail_out > 0)) {
+                flb_error("[gzip] compression failed: %i", ret);
+                free(buf);
+                return -1;
+            }
+        } while (flush == Z_FINISH ? ret != Z_STREAM_END :
+                 strm->avail_in > 0);
+    }
+
+    *out_data = buf;
+    *out_len  = strm->total_out;
+
+    return 0;
+}
+
+int flb_gzip_compress(void *data, size_t len, int level,
+                      void **out_data, size_t *out_len)
+{
+    struct iovec iov;
+
+    iov.iov_base = data;
+    iov.iov_len  = len;
+
+    return flb_gzip_compressv(&iov, 1, level, out_data, out_len);
+}
@@ -29,6 +29,11 @@
  * - Get return Status, Headers and Body content if found.
  */
 
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
 #include <fluent-bit/flb_http_client.h>
 
 /* check if there is enough space in the client header buffer */
@@ -44,15 +49,266 @@ static int header_available(struct flb_http_client *c, int bytes)
     return 0;
 }
 
-static int process_response(struct flb_http_client *c)
+/* Response parser states */
+#define RESP_HEADERS        0
+#define RESP_BODY           1
+#define RESP_CHUNK_SIZE     2
+#define RESP_CHUNK_DATA     3
+#define RESP_CHUNK_END      4
+#define RESP_CHUNK_TRAILER  5
+#define RESP_DONE           6
+
+/* Max length of a chunk size line */
+#define RESP_CHUNK_LINE_MAX 1024
+
+/*
+ * Lookup a response header value, returns the value and it length or NULL
+ * if the header is not set.
+ */
+static char *header_lookup(struct flb_http_client *c,
+                           char *key, int key_len, int *val_len)
 {
-    char *tmp;
+    char *p;
+    char *eol;
+    char *end;
+
+    p = strstr(c->resp.data, "\r\n") + 2;
+    end = c->resp.data + c->resp.headers_len - 2;
+
+    while (p < end) {
+        eol = strstr(p, "\r\n");
+        if (eol - p > key_len && p[key_len] == ':' &&
+            strncasecmp(p, key, key_len) == 0) {
+            p += key_len + 1;
+            while (*p == ' ' || *p == '\t') {
+                p++;
+            }
+            *val_len = eol - p;
+            return p;
+        }
+        p = eol + 2;
+    }
 
-    tmp = mk_string_copy_substr(c->resp.data, 9, 12);
-    c->resp.status = atoi(tmp);
-    free(tmp);
+    return NULL;
+}
 
-    return 0;
+/* Check if a comma separated header value contains 'token' */
+static int header_has_token(char *val, int val_len, char *token)
+{
+    int len;
+    char *p = val;
+    char *end = val + val_len;
+
+    len = strlen(token);
+    while (p < end) {
+        while (p < end && (*p == ' ' || *p == ',')) {
+            p++;
+        }
+        if (end - p >= len && strncasecmp(p, token, len) == 0 &&
+            (end - p == len || p[len] == ' ' || p[len] == ',' ||
+             p[len] == ';')) {
+            return FLB_TRUE;
+        }
+        while (p < end && *p != ',') {
+            p++;
+        }
+    }
+
+    return FLB_FALSE;
+}
+
+/* Status line and headers: set the body framing and keep-alive mode */
+static int response_headers(struct flb_http_client *c)
+{
+    int len;
+    char *end;
+    char *val;
+    size_t off;
+    struct flb_http_response *r = &c->resp;
+
+    off = r->parse_off > 3 ? r->parse_off - 3 : 0;
+    end = strstr(r->data + off, "\r\n\r\n");
+    if (!end) {
+        r->parse_off = r->data_len;
+        return FLB_HTTP_MORE;
+    }
+
+    if (r->data_len < 12 || strncmp(r->data, "HTTP/1.", 7) != 0) {
+        return FLB_HTTP_ERROR;
+    }
+
+    r->status = atoi(r->data + 9);
+    r->headers_len = (end - r->data) + 4;
+    r->parse_off = r->headers_len;
+    r->payload = r->data + r->headers_len;
+    r->payload_size = 0;
+
+    /* HTTP/1.0 closes the connection unless the server says otherwise */
+    r->keepalive = (r->data[7] == '1') ? FLB_TRUE : FLB_FALSE;
+    val = header_lookup(c, "Connection", 10, &len);
+    if (val) {
+        if (header_has_token(val, len, "close") == FLB_TRUE) {
+            r->keepalive = FLB_FALSE;
+        }
+        else if (header_has_token(val, len, "keep-alive") == FLB_TRUE) {
+            r->keepalive = FLB_TRUE;
+        }
+    }
+
+    r->content_length = -1;
+    val = header_lookup(c, "Content-Length", 14, &len);
+    if (val) {
+        r->content_length = atoi(val);
+    }
+
+    if (c->method == FLB_HTTP_HEAD || r->status < 200 ||
+        r->status == 204 || r->status == 304) {
+        r->body_type = FLB_HTTP_BODY_NONE;
+        r->state = RESP_DONE;
+        return FLB_HTTP_OK;
+    }
+
+    val = header_lookup(c, "Transfer-Encoding", 17, &len);
+    if (val && header_has_token(val, len, "chunked") == FLB_TRUE) {
+        r->body_type = FLB_HTTP_BODY_CHUNKED;
+        r->state = RESP_CHUNK_SIZE;
+    }
+    else if (r->content_length >= 0) {
+        r->body_type = FLB_HTTP_BODY_LENGTH;
+        r->state = RESP_BODY;
+    }
+    else {
+        /* The body ends when the server closes the connection */
+        r->body_type = FLB_HTTP_BODY_EOF;
+        r->keepalive = FLB_FALSE;
+        r->state = RESP_BODY;
+    }
+
+    return FLB_HTTP_MORE;
+}
+
+/*
+ * Decode the available chunks: the data of every chunk is moved right
+ * after the previous one, so the decoded body grows at the beginning of
+ * the payload and the pending raw data is kept after it.
+ */
+static int response_chunked(struct flb_http_client *c)
+{
+    long val;
+    size_t n;
+    size_t tail;
+    char *p;
+    char *eol;
+    char *end;
+    struct flb_http_response *r = &c->resp;
+
+    while (r->state != RESP_DONE) {
+        p = r->data + r->parse_off;
+        n = r->data_len - r->parse_off;
+
+        if (r->state == RESP_CHUNK_SIZE || r->state == RESP_CHUNK_TRAILER) {
+            eol = strstr(p, "\r\n");
+            if (!eol) {
+                if (n > RESP_CHUNK_LINE_MAX) {
+                    return FLB_HTTP_ERROR;
+                }
+                break;
+            }
+
+            if (r->state == RESP_CHUNK_TRAILER) {
+                /* An empty line ends the trailer */
+                if (eol == p) {
+                    r->state = RESP_DONE;
+                }
+                r->parse_off += (eol - p) + 2;
+                continue;
+            }
+
+            errno = 0;
+            val = strtol(p, &end, 16);
+            if (end == p || errno != 0 || val < 0 ||
+                (*end != '\r' && *end != ';' && *end != ' ')) {
+                return FLB_HTTP_ERROR;
+            }
+            r->parse_off += (eol - p) + 2;
+            if (val == 0) {
+                r->state = RESP_CHUNK_TRAILER;
+            }
+            else {
+                r->chunk_left = val;
+                r->state = RESP_CHUNK_DATA;
+            }
+        }
+        else if (r->state == RESP_CHUNK_DATA) {
+            if (n == 0) {
+                break;
+            }
+            if (n > r->chunk_left) {
+                n = r->chunk_left;
+            }
+            memmove(r->payload + r->payload_size, p, n);
+            r->payload_size += n;
+            r->parse_off += n;
+            r->chunk_left -= n;
+            if (r->chunk_left == 0) {
+                r->state = RESP_CHUNK_END;
+            }
+        }
+        else if (r->state == RESP_CHUNK_END) {
+            if (n < 2) {
+                break;
+            }
+            if (p[0] != '\r' || p[1] != '\n') {
+                return FLB_HTTP_ERROR;
+            }
+            r->parse_off += 2;
+            r->state = RESP_CHUNK_SIZE;
+        }
+    }
+
+    /* Move the pending data after the decoded body */
+    tail = r->data_len - r->parse_off;
+    if (r->payload + r->payload_size != r->data + r->parse_off) {
+        memmove(r->payload + r->payload_size, r->data + r->parse_off, tail);
+        r->parse_off = r->headers_len + r->payload_size;
+        r->data_len = r->parse_off + tail;
+        r->data[r->data_len] = '\0';
+    }
+
+    return (r->state == RESP_DONE) ? FLB_HTTP_OK : FLB_HTTP_MORE;
+}
+
+/* Incremental response parser, invoked every time new data arrives */
+static int response_parse(struct flb_http_client *c)
+{
+    int ret;
+    size_t len;
+    struct flb_http_response *r = &c->resp;
+
+    if (r->state == RESP_HEADERS) {
+        ret = response_headers(c);
+        if (ret != FLB_HTTP_MORE) {
+            return ret;
+        }
+    }
+
+    if (r->body_type == FLB_HTTP_BODY_CHUNKED) {
+        return response_chunked(c);
+    }
+
+    len = r->data_len - r->headers_len;
+    if (r->body_type == FLB_HTTP_BODY_LENGTH) {
+        if (len >= (size_t) r->content_length) {
+            r->payload_size = r->content_length;
+            r->parse_off = r->headers_len + r->content_length;
+            r->state = RESP_DONE;
+            return FLB_HTTP_OK;
+        }
+    }
+    r->payload_size = len;
+    r->parse_off = r->data_len;
+
+    return FLB_HTTP_MORE;
 }
 
 static int proxy_parse(char *proxy, struct flb_http_client *c)
@@ -125,6 +381,7 @@ struct flb_http_client *flb_http_client(struct flb_upstream_conn *u_conn,
                                         char *proxy)
 {
     int ret;
+    int buf_size;
     char *buf = NULL;
     char *str_method = NULL;
     char *fmt_plain =                           \
@@ -156,15 +413,25 @@ struct flb_http_client *flb_http_client(struct flb_upstream_conn *u_conn,
         break;
     };
 
-    buf = calloc(1, FLB_HTTP_BUF_SIZE);
-    if (!buf) {
-        perror("malloc");
-        return NULL;
+    /* Reuse the header buffer of a previous request on this connection */
+    if (u_conn->http_buf) {
+        buf = u_conn->http_buf;
+        buf_size = u_conn->http_buf_size;
+        u_conn->http_buf = NULL;
+        u_conn->http_buf_size = 0;
+    }
+    else {
+        buf = malloc(FLB_HTTP_BUF_SIZE);
+        if (!buf) {
+            perror("malloc");
+            return NULL;
+        }
+        buf_size = FLB_HTTP_BUF_SIZE;
     }
 
     /* FIXME: handler for HTTPS proxy */
     if (!proxy) {
-        ret = snprintf(buf, FLB_HTTP_BUF_SIZE,
+        ret = snprintf(buf, buf_size,
                        fmt_plain,
                        str_method,
                        uri,
@@ -173,7 +440,7 @@ struct flb_http_client *flb_http_client(struct flb_upstream_conn *u_conn,
                        body_len);
     }
     else {
-        ret = snprintf(buf, FLB_HTTP_BUF_SIZE,
+        ret = snprintf(buf, buf_size,
                        fmt_proxy,
                        str_method,
                        host,
@@ -184,7 +451,7 @@ struct flb_http_client *flb_http_client(struct flb_upstream_conn *u_conn,
                        body_len);
     }
 
-    if (ret == -1) {
+    if (ret == -1 || ret >= buf_size) {
         perror("snprintf");
         free(buf);
         return NULL;
@@ -199,8 +466,9 @@ struct flb_http_client *flb_http_client(struct flb_upstream_conn *u_conn,
     c->u_conn      = u_conn;
     c->method      = method;
     c->header_buf  = buf;
-    c->header_size = FLB_HTTP_BUF_SIZE;
+    c->header_size = buf_size;
     c->header_len  = ret;
+    c->resp.data_size_max = FLB_HTTP_DATA_SIZE_MAX;
 
     if (body && body_len > 0) {
         c->body_buf = body;
@@ -276,16 +544,62 @@ int flb_http_add_header(struct flb_http_client *c,
     return 0;
 }
 
+/*
+ * Set the maximum size of the response buffer, a response that does not
+ * fit is truncated and the connection is not reused.
+ */
+int flb_http_buffer_size(struct flb_http_client *c, size_t size)
+{
+    if (size < FLB_HTTP_DATA_SIZE) {
+        return -1;
+    }
+
+    c->resp.data_size_max = size;
+    return 0;
+}
+
+/* Make room for more response data, up to 'data_size_max' */
+static int response_buffer_grow(struct flb_http_client *c)
+{
+    size_t new_size;
+    char *tmp;
+    struct flb_http_response *r = &c->resp;
+
+    if (r->data_size >= r->data_size_max) {
+        return -1;
+    }
+
+    new_size = r->data_size ? r->data_size * 2 : FLB_HTTP_DATA_SIZE;
+    if (new_size > r->data_size_max) {
+        new_size = r->data_size_max;
+    }
+
+    tmp = realloc(r->data, new_size);
+    if (!tmp) {
+        perror("realloc");
+        return -1;
+    }
+    r->data = tmp;
+    r->data_size = new_size;
+
+    if (r->payload) {
+        r->payload = r->data + r->headers_len;
+    }
+
+    return 0;
+}
+
 int flb_http_do(struct flb_http_client *c, size_t *bytes)
 {
     int ret;
     int r_bytes;
-    int available;
     int crlf = 2;
     int new_size;
-    size_t bytes_header = 0;
-    size_t bytes_body = 0;
+    size_t available;
+    size_t bytes_sent = 0;
     char *tmp;
+    struct iovec iov[2];
+    struct flb_http_response *r = &c->resp;
 
     /* check enough space for the ending CRLF */
     if (header_available(c, crlf) != 0) {
@@ -295,60 +609,98 @@ int flb_http_do(struct flb_http_client *c, size_t *bytes)
             return -1;
         }
         c->header_buf = tmp;
-        c->header_len = new_size;
+        c->header_size = new_size;
     }
 
     /* Append the ending header CRLF */
     c->header_buf[c->header_len++] = '\r';
     c->header_buf[c->header_len++] = '\n';
 
-    /* Write the header */
-    ret = flb_io_net_write(c->u_conn,
-                           c->header_buf, c->header_len,
-                           &bytes_header);
+    /* Write the header and the body in one call */
+    iov[0].iov_base = c->header_buf;
+    iov[0].iov_len  = c->header_len;
+    iov[1].iov_base = (void *) c->body_buf;
+    iov[1].iov_len  = c->body_len;
+
+    ret = flb_io_net_writev(c->u_conn, iov, c->body_len > 0 ? 2 : 1,
+                            &bytes_sent);
+
+    /* The header buffer is kept for the next request */
+    if (!c->u_conn->http_buf) {
+        c->u_conn->http_buf = c->header_buf;
+        c->u_conn->http_buf_size = c->header_size;
+        c->header_buf = NULL;
+    }
+
     if (ret == -1) {
         perror("write");
         return -1;
     }
 
-    if (c->body_len > 0) {
-        ret = flb_io_net_write(c->u_conn,
-                               c->body_buf, c->body_len,
-                               &bytes_body);
-        if (ret == -1) {
-            perror("write");
-            return -1;
-        }
-    }
-
     /* number of sent bytes */
-    *bytes = (bytes_header + bytes_body);
-
-    /* Read the server response, we need at least 19 bytes */
-    c->resp.data_len = 0;
-    while (c->resp.data_len < 19) {
-        available = ((sizeof(c->resp.data) - 1) - c->resp.data_len);
-        if (available < 1) {
-            return -1;
+    *bytes = bytes_sent;
+
+    /* Read and parse the response */
+    r->data_len = 0;
+    r->parse_off = 0;
+    r->state = RESP_HEADERS;
+    while (1) {
+        available = r->data_size - r->data_len;
+        if (available <= 1) {
+            if (response_buffer_grow(c) == -1) {
+                flb_debug("[http_client] response exceeds %lu bytes, "
+                          "truncated", r->data_size_max);
+                break;
+            }
+            available = r->data_size - r->data_len;
         }
 
         r_bytes = flb_io_net_read(c->u_conn,
-                                  c->resp.data + c->resp.data_len,
-                                  available);
+                                  r->data + r->data_len,
+                                  available - 1);
         if (r_bytes <= 0) {
-            return -1;
+            /* The body without a length ends when the server closes */
+            if (r->state == RESP_BODY && r->body_type == FLB_HTTP_BODY_EOF) {
+                r->state = RESP_DONE;
+            }
+            break;
         }
 
-        c->resp.data_len += r_bytes;
-        c->resp.data[c->resp.data_len] = '\0';
+        r->data_len += r_bytes;
+        r->data[r->data_len] = '\0';
+
+        ret = response_parse(c);
+        if (ret != FLB_HTTP_MORE) {
+            break;
+        }
+    }
+
+    if (r->state == RESP_HEADERS) {
+        /* No valid status line and headers */
+        c->u_conn->recycle = FLB_FALSE;
+        return -1;
+    }
+
+    if (r->state == RESP_DONE) {
+        r->complete = FLB_TRUE;
+        r->payload[r->payload_size] = '\0';
+    }
+
+    /*
+     * The connection can be reused only if the response was fully read
+     * and nothing else was sent after it.
+     */
+    if (r->complete == FLB_FALSE || r->keepalive == FLB_FALSE ||
+        r->parse_off != r->data_len) {
+        c->u_conn->recycle = FLB_FALSE;
     }
 
-    process_response(c);
     return 0;
 }
 
 void flb_http_client_destroy(struct flb_http_client *c)
 {
     free(c->header_buf);
+    free(c->resp.data);
     free(c);
 }
@@ -19,9 +19,18 @@
 
 #include <monkey/mk_lib.h>
 #include <fluent-bit/flb_lib.h>
+#include <fluent-bit/flb_metrics.h>
 #include <fluent-bit/flb_http_server.h>
 #include <pthread.h>
 
+/*
+ * The HTTP worker thread does not get the configuration in the request.
+ * The server can't be stopped, flb_http_server_stop() resets it under the
+ * lock before the instances are destroyed.
+ */
+static struct flb_config *http_config;
+static pthread_mutex_t http_lock = PTHREAD_MUTEX_INITIALIZER;
+
 static void cb_root(mk_session_t *session, mk_request_t *request)
 {
     (void) session;
@@ -31,6 +40,71 @@ static void cb_root(mk_session_t *session, mk_request_t *request)
     mk_http_send(request, FLB_HTTP_BANNER, sizeof(FLB_HTTP_BANNER) - 1, NULL);
 }
 
+/*
+ * mk_http_send() references the buffer until the response is written,
+ * a copy is queued instead so the local buffer can be released.
+ */
+static void http_send_copy(mk_request_t *request, char *buf, size_t len)
+{
+    int ret;
+
+    ret = mk_stream_in_cbuf(&request->stream, NULL, buf, len, NULL, NULL);
+    if (ret == 0) {
+        request->headers.content_length += len;
+    }
+}
+
+static void metrics_send(mk_request_t *request, int prometheus)
+{
+    int ret;
+    msgpack_sbuffer out;
+    struct flb_metrics_snapshot s;
+
+    pthread_mutex_lock(&http_lock);
+    if (!http_config) {
+        pthread_mutex_unlock(&http_lock);
+        mk_http_status(request, 503);
+        return;
+    }
+    ret = flb_metrics_snapshot_create(http_config, &s);
+    pthread_mutex_unlock(&http_lock);
+    if (ret == -1) {
+        mk_http_status(request, 500);
+        return;
+    }
+
+    msgpack_sbuffer_init(&out);
+    if (prometheus == FLB_TRUE) {
+        flb_metrics_snapshot_prometheus(&s, &out);
+        mk_http_header(request, "Content-Type", 12,
+                       FLB_HTTP_PROMETHEUS_TYPE,
+                       sizeof(FLB_HTTP_PROMETHEUS_TYPE) - 1);
+    }
+    else {
+        flb_metrics_snapshot_json(&s, &out);
+        mk_http_header(request, "Content-Type", 12, "application/json", 16);
+    }
+    flb_metrics_snapshot_destroy(&s);
+
+    mk_http_status(request, 200);
+    http_send_copy(request, out.data, out.size);
+    msgpack_sbuffer_destroy(&out);
+}
+
+/* GET /api/v1/metrics */
+static void cb_metrics(mk_session_t *session, mk_request_t *request)
+{
+    (void) session;
+    metrics_send(request, FLB_FALSE);
+}
+
+/* GET /api/v1/metrics/prometheus */
+static void cb_metrics_prometheus(mk_session_t *session, mk_request_t *request)
+{
+    (void) session;
+    metrics_send(request, FLB_TRUE);
+}
+
 static void monkey_http_service(void *data)
 {
     mk_ctx_t *ctx;
@@ -49,6 +123,10 @@ static void monkey_http_service(void *data)
     mk_vhost_set(vh,
                  "Name", "default",
                  NULL);
+    /* Handlers are matched in order, the root one matches any path */
+    mk_vhost_handler(vh, "^/api/v1/metrics/prometheus/?$",
+                     cb_metrics_prometheus);
+    mk_vhost_handler(vh, "^/api/v1/metrics/?$", cb_metrics);
     mk_vhost_handler(vh, "/", cb_root);
     mk_start(ctx);
 }
@@ -59,15 +137,28 @@ int flb_http_server_start(struct flb_config *config)
     int ret;
     pthread_t tid;
 
+    pthread_mutex_lock(&http_lock);
+    http_config = config;
+    pthread_mutex_unlock(&http_lock);
+
     ret = mk_utils_worker_spawn(monkey_http_service, config, &tid);
     if (ret == -1) {
+        flb_http_server_stop();
         return -1;
     }
 
     return 0;
 }
 
+/*
+ * Detach the server from the configuration, it waits for a snapshot in
+ * progress and the next requests get a 503.
+ */
 int flb_http_server_stop()
 {
+    pthread_mutex_lock(&http_lock);
+    http_config = NULL;
+    pthread_mutex_unlock(&http_lock);
+
     return 0;
 }
@@ -104,6 +104,12 @@ struct flb_input_instance *flb_input_new(struct flb_config *config,
         mk_list_init(&instance->tasks);
         mk_list_init(&instance->dyntags);
         mk_list_init(&instance->properties);
+        flb_mpsc_init(&instance->lib_chunks);
+        instance->lib_queued = 0;
+        instance->lib_queue_limit = 0;
+        flb_metrics_init(&instance->metrics, FLB_METRICS_INPUT,
+                         instance->name);
+        instance->t_collect = 0;
 
         if (plugin->flags & FLB_INPUT_NET) {
             ret = flb_net_host_set(plugin->name, &instance->host, input);
@@ -215,6 +221,23 @@ void flb_input_pre_run_all(struct flb_config *config)
     }
 }
 
+/* Invoke all pre-exit input callbacks, before the last engine flush */
+void flb_input_pre_exit_all(struct flb_config *config)
+{
+    struct mk_list *head;
+    struct flb_input_instance *in;
+    struct flb_input_plugin *p;
+
+    mk_list_foreach(head, &config->inputs) {
+        in = mk_list_entry(head, struct flb_input_instance, _head);
+        p = in->p;
+
+        if (p->cb_pre_exit) {
+            p->cb_pre_exit(in->context, config);
+        }
+    }
+}
+
 /* Invoke all exit input callbacks */
 void flb_input_exit_all(struct flb_config *config)
 {
@@ -445,52 +468,85 @@ void flb_input_dyntag_exit(struct flb_input_instance *in)
 }
 
 
-/* Append a MessagPack Map to an active buffer in the input instance */
-int flb_input_dyntag_append(struct flb_input_instance *in,
-                            char *tag, size_t tag_len,
-                            msgpack_object data)
+/*
+ * Lookup an active dyntag node that can receive more data for the given
+ * tag, if no node is found a new one is created.
+ */
+static struct flb_input_dyntag *dyntag_get(struct flb_input_instance *in,
+                                           char *tag, size_t tag_len)
 {
     struct mk_list *head;
-    struct flb_input_dyntag *dt = NULL;
+    struct flb_input_dyntag *dt;
 
     /* Try to find a current dyntag node to append the data */
     mk_list_foreach(head, &in->dyntags) {
         dt = mk_list_entry(head, struct flb_input_dyntag, _head);
         if (dt->busy == FLB_TRUE || dt->lock == FLB_TRUE) {
-            dt = NULL;
             continue;
         }
 
         if (dt->tag_len != tag_len) {
-            dt = NULL;
             continue;
         }
 
         if (strncmp(dt->tag, tag, tag_len) != 0) {
-            dt = NULL;
             continue;
         }
-        break;
+        return dt;
     }
 
-    /* Found a dyntag node that can append the new info */
-    if (dt) {
-        msgpack_pack_object(&dt->mp_pck, data);
-        goto out;
+    /* No dyntag was found, we need to create a new one */
+    return flb_input_dyntag_create(in, tag, tag_len);
+}
+
+/* Lock buffers where size > 2MB */
+static inline void dyntag_check_size(struct flb_input_dyntag *dt)
+{
+    if (dt->mp_sbuf.size > 2048000) {
+        dt->lock = FLB_TRUE;
     }
+}
 
-    /* No dyntag was found, we need to create a new one */
-    dt = flb_input_dyntag_create(in, tag, tag_len);
+/* Append a MessagPack Map to an active buffer in the input instance */
+int flb_input_dyntag_append(struct flb_input_instance *in,
+                            char *tag, size_t tag_len,
+                            msgpack_object data)
+{
+    struct flb_input_dyntag *dt;
+
+    dt = dyntag_get(in, tag, tag_len);
     if (!dt) {
         return -1;
     }
+
     msgpack_pack_object(&dt->mp_pck, data);
+    dyntag_check_size(dt);
 
- out:
-    /* Lock buffers where size > 2MB */
-    if (dt->mp_sbuf.size > 2048000) {
-        dt->lock = FLB_TRUE;
+    return 0;
+}
+
+/*
+ * Append a buffer of already serialized MessagePack records to an active
+ * buffer in the input instance. The caller is responsible to provide
+ * a sequence of complete [time, map] entries.
+ */
+int flb_input_dyntag_append_raw(struct flb_input_instance *in,
+                                char *tag, size_t tag_len,
+                                void *buf, size_t size)
+{
+    int ret;
+    struct flb_input_dyntag *dt;
+
+    dt = dyntag_get(in, tag, tag_len);
+    if (!dt) {
+        return -1;
+    }
+
+    ret = msgpack_sbuffer_write(&dt->mp_sbuf, buf, size);
+    if (ret != 0) {
+        return -1;
     }
+    dyntag_check_size(dt);
 
     return 0;
 }
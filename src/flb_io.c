@@ -47,9 +47,11 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <limits.h>
 #include <assert.h>
+#include <sys/uio.h>
 
 #include <fluent-bit/flb_info.h>
 #include <fluent-bit/flb_config.h>
@@ -61,24 +63,174 @@
 #include <fluent-bit/flb_utils.h>
 #include <fluent-bit/flb_macros.h>
 #include <fluent-bit/flb_network.h>
+#include <fluent-bit/flb_dns.h>
 #include <fluent-bit/flb_engine.h>
 #include <fluent-bit/flb_thread.h>
 
-FLB_INLINE int flb_io_net_connect(struct flb_upstream_conn *u_conn,
-                                  struct flb_thread *th)
+#ifndef IOV_MAX
+#define IOV_MAX   1024
+#endif
+
+/*
+ * Resolve the host from a helper thread, the co-routine yields until the
+ * result is ready so a slow DNS server does not block the event loop.
+ * Concurrent connections to the same upstream share the pending lookup.
+ */
+static int net_io_resolve_async(struct flb_upstream_conn *u_conn,
+                                struct flb_thread *th,
+                                struct flb_dns_addrs *addrs)
 {
     int fd;
     int ret;
-    int error = 0;
-    socklen_t len = sizeof(error);
+    struct flb_dns_request *req;
     struct flb_upstream *u = u_conn->u;
 
-    if (u_conn->fd > 0) {
-        close(u_conn->fd);
+    req = u->dns_req;
+    if (!req) {
+        req = flb_dns_request_create(u->tcp_host, u->tcp_port);
+        if (!req) {
+            return flb_dns_resolve(u->tcp_host, u->tcp_port, addrs);
+        }
+        u->dns_req = req;
+    }
+    flb_dns_request_get(req);
+
+    /* Every waiter needs its own descriptor to be registered */
+    fd = dup(req->ch[0]);
+    if (fd != -1) {
+        MK_EVENT_NEW(&u_conn->event);
+        u_conn->thread = th;
+        ret = mk_event_add(u->evl, fd,
+                           FLB_ENGINE_EV_THREAD,
+                           MK_EVENT_READ, &u_conn->event);
+        if (ret == 0) {
+            flb_trace("[io thread=%p] resolving %s", th, u->tcp_host);
+            flb_thread_yield(th, FLB_FALSE);
+            mk_event_del(u->evl, &u_conn->event);
+            MK_EVENT_NEW(&u_conn->event);
+        }
+        close(fd);
+    }
+
+    /* Returns right away once notified, otherwise it blocks */
+    ret = flb_dns_request_wait(req);
+    if (ret == 0) {
+        memcpy(addrs, &req->addrs, sizeof(struct flb_dns_addrs));
+    }
+
+    if (u->dns_req == req) {
+        u->dns_req = NULL;
+        flb_dns_request_put(req);
+    }
+    flb_dns_request_put(req);
+
+    return ret;
+}
+
+/* Make sure the upstream host addresses are resolved and not expired */
+static int net_io_resolve(struct flb_upstream_conn *u_conn,
+                          struct flb_thread *th)
+{
+    int ret;
+    int valid;
+    time_t now;
+    struct flb_dns_addrs *addrs;
+    struct flb_upstream *u = u_conn->u;
+
+    now = time(NULL);
+
+#ifdef FLB_HAVE_FLUSH_PTHREADS
+    pthread_mutex_lock(&u->mutex_queue);
+#endif
+    valid = flb_dns_cache_valid(&u->dns, now);
+#ifdef FLB_HAVE_FLUSH_PTHREADS
+    pthread_mutex_unlock(&u->mutex_queue);
+#endif
+    if (valid == FLB_TRUE) {
+        return 0;
+    }
+
+    addrs = malloc(sizeof(struct flb_dns_addrs));
+    if (!addrs) {
+        perror("malloc");
+        return -1;
     }
 
+    ret = flb_dns_numeric(u->tcp_host, u->tcp_port, addrs);
+    if (ret == -1) {
+        if (th && (u->flags & FLB_IO_ASYNC)) {
+            ret = net_io_resolve_async(u_conn, th, addrs);
+        }
+        else {
+            ret = flb_dns_resolve(u->tcp_host, u->tcp_port, addrs);
+        }
+    }
+
+    if (ret == 0) {
+#ifdef FLB_HAVE_FLUSH_PTHREADS
+        pthread_mutex_lock(&u->mutex_queue);
+#endif
+        flb_dns_cache_set(&u->dns, addrs, now);
+#ifdef FLB_HAVE_FLUSH_PTHREADS
+        pthread_mutex_unlock(&u->mutex_queue);
+#endif
+    }
+    else {
+        flb_error("[io] could not resolve %s", u->tcp_host);
+    }
+
+    free(addrs);
+    return ret;
+}
+
+/*
+ * Yield until the connection event is triggered, waiting up to 'timeout'
+ * seconds (zero waits forever). Once the deadline expires the upstream
+ * timer shuts the socket down, so the co-routine is resumed and -1 is
+ * returned.
+ */
+int flb_io_net_wait(struct flb_thread *th, struct flb_upstream_conn *u_conn,
+                    int timeout)
+{
+    struct flb_upstream *u = u_conn->u;
+
+    u_conn->io_timeout = FLB_FALSE;
+    flb_upstream_conn_timeout_set(u_conn, timeout);
+    flb_thread_yield(th, FLB_FALSE);
+    flb_upstream_conn_timeout_clear(u_conn);
+
+    if (u_conn->io_timeout == FLB_TRUE) {
+        flb_error("[io] connection to %s:%i timed out after %i seconds",
+                  u->tcp_host, u->tcp_port, timeout);
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Blocking mode: timeouts are enforced by the socket options */
+static void net_io_socket_timeout(int fd, int opt, int seconds)
+{
+    struct timeval tv;
+
+    tv.tv_sec  = seconds;
+    tv.tv_usec = 0;
+    setsockopt(fd, SOL_SOCKET, opt, &tv, sizeof(tv));
+}
+
+/* Connect the socket to one address of the upstream */
+static int net_io_connect_addr(struct flb_upstream_conn *u_conn,
+                               struct flb_thread *th,
+                               struct sockaddr *addr, socklen_t addr_len)
+{
+    int fd;
+    int ret;
+    int error = 0;
+    socklen_t len = sizeof(error);
+    struct flb_upstream *u = u_conn->u;
+
     /* Create the socket */
-    fd = flb_net_socket_create(AF_INET, FLB_FALSE);
+    fd = flb_net_socket_create(addr->sa_family, FLB_FALSE);
     if (fd == -1) {
         flb_error("[io] could not create socket");
         return -1;
@@ -92,14 +244,23 @@ FLB_INLINE int flb_io_net_connect(struct flb_upstream_conn *u_conn,
     if (u->flags & FLB_IO_ASYNC) {
         flb_net_socket_nonblocking(u_conn->fd);
     }
+    else {
+        /* connect(2) is bound by the send timeout */
+        net_io_socket_timeout(fd, SO_SNDTIMEO, u->connect_timeout);
+    }
 
     flb_net_socket_tcp_nodelay(fd);
 
     /* Start the connection */
-    ret = flb_net_tcp_fd_connect(fd, u->tcp_host, u->tcp_port);
+    ret = connect(fd, addr, addr_len);
     if (ret == -1) {
         /* In blocking mode connect() fails right away */
         if ((u->flags & FLB_IO_ASYNC) == 0) {
+            if (errno == EINPROGRESS) {
+                flb_error("[io] connection to %s:%i timed out after "
+                          "%i seconds", u->tcp_host, u->tcp_port,
+                          u->connect_timeout);
+            }
             close(fd);
             return -1;
         }
@@ -131,11 +292,14 @@ FLB_INLINE int flb_io_net_connect(struct flb_upstream_conn *u_conn,
          * Return the control to the parent caller, we need to wait for
          * the event loop to get back to us.
          */
-        flb_thread_yield(th, FLB_FALSE);
+        ret = flb_io_net_wait(th, u_conn, u->connect_timeout);
 
         /* We got a notification, remove the event registered */
-        ret = mk_event_del(u->evl, &u_conn->event);
-        assert(ret == 0);
+        mk_event_del(u->evl, &u_conn->event);
+        if (ret == -1) {
+            close(fd);
+            return -1;
+        }
 
         /* Check the connection status */
         if (u_conn->event.mask & MK_EVENT_WRITE) {
@@ -161,13 +325,76 @@ FLB_INLINE int flb_io_net_connect(struct flb_upstream_conn *u_conn,
             return -1;
         }
     }
+    else if ((u->flags & FLB_IO_ASYNC) == 0) {
+        net_io_socket_timeout(fd, SO_SNDTIMEO, u->write_timeout);
+        net_io_socket_timeout(fd, SO_RCVTIMEO, u->read_timeout);
+    }
+
+    return 0;
+}
+
+FLB_INLINE int flb_io_net_connect(struct flb_upstream_conn *u_conn,
+                                  struct flb_thread *th)
+{
+    int i;
+    int ret;
+    int count;
+    socklen_t addr_len = 0;
+    struct sockaddr *next;
+    struct sockaddr_storage addr;
+    struct flb_upstream *u = u_conn->u;
+
+    if (u_conn->fd > 0) {
+        close(u_conn->fd);
+        u_conn->fd = -1;
+    }
+
+    ret = net_io_resolve(u_conn, th);
+    if (ret == -1) {
+        return -1;
+    }
+
+    /*
+     * Every new connection starts with the next address of the host, if
+     * it fails the remaining ones are tried.
+     */
+    count = u->dns.addrs.count;
+    for (i = 0; i < count; i++) {
+#ifdef FLB_HAVE_FLUSH_PTHREADS
+        pthread_mutex_lock(&u->mutex_queue);
+#endif
+        next = flb_dns_cache_next(&u->dns, &addr_len);
+        if (next) {
+            memcpy(&addr, next, addr_len);
+        }
+#ifdef FLB_HAVE_FLUSH_PTHREADS
+        pthread_mutex_unlock(&u->mutex_queue);
+#endif
+        if (!next) {
+            break;
+        }
+
+        ret = net_io_connect_addr(u_conn, th,
+                                  (struct sockaddr *) &addr, addr_len);
+        if (ret == 0) {
+            break;
+        }
+        u_conn->fd = -1;
+    }
+
+    if (ret == -1 || u_conn->fd == -1) {
+        /* Addresses may have changed, resolve again on next attempt */
+        flb_dns_cache_invalidate(&u->dns);
+        return -1;
+    }
 
 #ifdef FLB_HAVE_TLS
     /* Check if TLS was enabled, if so perform the handshakee */
     if (u_conn->u->flags & FLB_IO_TLS) {
         ret = net_io_tls_handshake(u_conn, th);
         if (ret != 0) {
-            close(fd);
+            close(u_conn->fd);
+            u_conn->fd = -1;
             return -1;
         }
     }
@@ -179,11 +406,28 @@ FLB_INLINE int flb_io_net_connect(struct flb_upstream_conn *u_conn,
     return 0;
 }
 
+/* Blocking mode: a send or receive timeout expired on the socket */
+static void net_io_timeout(struct flb_upstream_conn *u_conn, char *op,
+                           int seconds)
+{
+    struct flb_upstream *u = u_conn->u;
+
+    u_conn->recycle = FLB_FALSE;
+#ifdef FLB_HAVE_FLUSH_PTHREADS
+    pthread_mutex_lock(&u->mutex_queue);
+#endif
+    u->stats.timeouts++;
+#ifdef FLB_HAVE_FLUSH_PTHREADS
+    pthread_mutex_unlock(&u->mutex_queue);
+#endif
+    flb_error("[io] %s %s:%i timed out after %i seconds",
+              op, u->tcp_host, u->tcp_port, seconds);
+}
+
 static int net_io_write(struct flb_upstream_conn *u_conn,
                         void *data, size_t len, size_t *out_len)
 {
     int ret;
-    int tries = 0;
     size_t total = 0;
 
     if (u_conn->fd <= 0) {
@@ -196,22 +440,12 @@ static int net_io_write(struct flb_upstream_conn *u_conn,
     while (total < len) {
         ret = write(u_conn->fd, data + total, len - total);
         if (ret == -1) {
+            /* A blocking socket only fails with EAGAIN on send timeout */
             if (errno == EAGAIN) {
-                /*
-                 * FIXME: for now we are handling this in a very lazy way,
-                 * just sleep for a second and retry (for a max of 30 tries).
-                 */
-                sleep(1);
-                tries++;
-
-                if (tries == 30) {
-                    return -1;
-                }
-                continue;
+                net_io_timeout(u_conn, "write to", u_conn->u->write_timeout);
             }
             return -1;
         }
-        tries = 0;
         total += ret;
     }
 
@@ -233,6 +467,7 @@ static FLB_INLINE int net_io_write_async(struct flb_thread *th,
 {
     int ret = 0;
     int error;
+    int timeout;
     ssize_t bytes;
     size_t total = 0;
     size_t send;
@@ -282,11 +517,11 @@ static FLB_INLINE int net_io_write_async(struct flb_thread *th,
              * Return the control to the parent caller, we need to wait for
              * the event loop to get back to us.
              */
-            flb_thread_yield(th, FLB_FALSE);
+            timeout = flb_io_net_wait(th, u_conn, u->write_timeout);
 
             /* We got a notification, remove the event registered */
             ret = mk_event_del(u->evl, &u_conn->event);
-            if (ret == -1) {
+            if (ret == -1 || timeout == -1) {
                 return -1;
             }
 
@@ -318,9 +553,6 @@ static FLB_INLINE int net_io_write_async(struct flb_thread *th,
         }
     }
 
-    /* Update statistics */
-    //flb_stats_update(out->stats_fd, ret, 0);
-
     /* Update counters */
     total += bytes;
     if (total < len) {
@@ -339,7 +571,11 @@ static FLB_INLINE int net_io_write_async(struct flb_thread *th,
                 return -1;
             }
         }
-        flb_thread_yield(th, MK_FALSE);
+        ret = flb_io_net_wait(th, u_conn, u->write_timeout);
+        if (ret == -1) {
+            mk_event_del(u->evl, &u_conn->event);
+            return -1;
+        }
         goto retry;
     }
 
@@ -353,6 +589,192 @@ static FLB_INLINE int net_io_write_async(struct flb_thread *th,
     return bytes;
 }
 
+/* Skip the iovec entries (or part of them) already written */
+static inline void net_io_iov_advance(struct iovec **iov, int *iovcnt,
+                                      size_t bytes)
+{
+    while (*iovcnt > 0 && bytes >= (*iov)->iov_len) {
+        bytes -= (*iov)->iov_len;
+        (*iov)++;
+        (*iovcnt)--;
+    }
+
+    if (*iovcnt > 0 && bytes > 0) {
+        (*iov)->iov_base = (char *) (*iov)->iov_base + bytes;
+        (*iov)->iov_len -= bytes;
+    }
+}
+
+static int net_io_writev(struct flb_upstream_conn *u_conn,
+                         struct iovec *iov, int iovcnt, size_t *out_len)
+{
+    int ret;
+    ssize_t bytes;
+    size_t total = 0;
+
+    if (u_conn->fd <= 0) {
+        ret = flb_io_net_connect(u_conn, NULL);
+        if (ret == -1) {
+            return -1;
+        }
+    }
+
+    while (iovcnt > 0) {
+        bytes = writev(u_conn->fd, iov, iovcnt > IOV_MAX ? IOV_MAX : iovcnt);
+        if (bytes == -1) {
+            if (errno == EAGAIN) {
+                net_io_timeout(u_conn, "write to", u_conn->u->write_timeout);
+            }
+            return -1;
+        }
+        total += bytes;
+        net_io_iov_advance(&iov, &iovcnt, bytes);
+    }
+
+    *out_len = total;
+    return 0;
+}
+
+/*
+ * Async writev(2): on EAGAIN or a partial write the socket is registered
+ * in the event loop and the co-routine yields until it becomes writable,
+ * then it continues from the first pending byte.
+ */
+static FLB_INLINE int net_io_writev_async(struct flb_thread *th,
+                                          struct flb_upstream_conn *u_conn,
+                                          struct iovec *iov, int iovcnt,
+                                          size_t *out_len)
+{
+    int ret;
+    int error;
+    ssize_t bytes;
+    size_t total = 0;
+    socklen_t slen = sizeof(error);
+    struct flb_upstream *u = u_conn->u;
+
+    while (1) {
+        bytes = writev(u_conn->fd, iov, iovcnt > IOV_MAX ? IOV_MAX : iovcnt);
+        if (bytes == -1) {
+            if (errno != EAGAIN) {
+                goto error;
+            }
+        }
+        else {
+            flb_trace("[io thread=%p] [fd %i] writev_async(2)=%zd (%lu)",
+                      th, u_conn->fd, bytes, total + bytes);
+            total += bytes;
+            net_io_iov_advance(&iov, &iovcnt, bytes);
+            if (iovcnt == 0) {
+                break;
+            }
+        }
+
+        /* Wait for the socket to become writable */
+        if (!(u_conn->event.status & MK_EVENT_REGISTERED)) {
+            MK_EVENT_NEW(&u_conn->event);
+            u_conn->thread = th;
+            ret = mk_event_add(u->evl,
+                               u_conn->fd,
+                               FLB_ENGINE_EV_THREAD,
+                               MK_EVENT_WRITE, &u_conn->event);
+            if (ret == -1) {
+                return -1;
+            }
+        }
+        ret = flb_io_net_wait(th, u_conn, u->write_timeout);
+        if (ret == -1 || !(u_conn->event.mask & MK_EVENT_WRITE)) {
+            goto error;
+        }
+
+        error = 0;
+        ret = getsockopt(u_conn->fd, SOL_SOCKET, SO_ERROR, &error, &slen);
+        if (ret == -1 || error != 0) {
+            flb_error("[io] TCP connection failed: %s:%i",
+                      u->tcp_host, u->tcp_port);
+            goto error;
+        }
+    }
+
+    if (u_conn->event.status & MK_EVENT_REGISTERED) {
+        mk_event_del(u->evl, &u_conn->event);
+    }
+
+    *out_len = total;
+    return 0;
+
+ error:
+    if (u_conn->event.status & MK_EVENT_REGISTERED) {
+        mk_event_del(u->evl, &u_conn->event);
+    }
+    return -1;
+}
+
+#ifdef FLB_HAVE_TLS
+/*
+ * There is no gather write for TLS, small entries are coalesced into
+ * record size blocks so they are not sent as separate records, large
+ * entries are written as they are.
+ */
+#define FLB_IO_TLS_BLOCK   16384
+
+static int net_io_tls_writev(struct flb_thread *th,
+                             struct flb_upstream_conn *u_conn,
+                             struct iovec *iov, int iovcnt, size_t *out_len)
+{
+    int ret;
+    size_t n;
+    size_t len;
+    size_t sent;
+    size_t total = 0;
+    char *buf = NULL;
+
+    while (iovcnt > 0) {
+        if (iov->iov_len >= FLB_IO_TLS_BLOCK) {
+            ret = net_io_tls_write(th, u_conn, iov->iov_base, iov->iov_len,
+                                   &sent);
+            if (ret == -1) {
+                free(buf);
+                return -1;
+            }
+            total += sent;
+            iov++;
+            iovcnt--;
+            continue;
+        }
+
+        if (!buf) {
+            buf = malloc(FLB_IO_TLS_BLOCK);
+            if (!buf) {
+                perror("malloc");
+                return -1;
+            }
+        }
+
+        len = 0;
+        while (iovcnt > 0 && len < FLB_IO_TLS_BLOCK) {
+            n = iov->iov_len;
+            if (n > FLB_IO_TLS_BLOCK - len) {
+                n = FLB_IO_TLS_BLOCK - len;
+            }
+            memcpy(buf + len, iov->iov_base, n);
+            len += n;
+            net_io_iov_advance(&iov, &iovcnt, n);
+        }
+
+        ret = net_io_tls_write(th, u_conn, buf, len, &sent);
+        if (ret == -1) {
+            free(buf);
+            return -1;
+        }
+        total += sent;
+    }
+
+    free(buf);
+    *out_len = total;
+    return 0;
+}
+#endif
+
 static ssize_t net_io_read(struct flb_upstream_conn *u_conn,
                            void *buf, size_t len)
 {
@@ -360,6 +782,9 @@ static ssize_t net_io_read(struct flb_upstream_conn *u_conn,
 
     ret = read(u_conn->fd, buf, len);
     if (ret == -1) {
+        if (errno == EAGAIN) {
+            net_io_timeout(u_conn, "read from", u_conn->u->read_timeout);
+        }
         return -1;
     }
 
@@ -379,6 +804,11 @@ static FLB_INLINE ssize_t net_io_read_async(struct flb_thread *th,
     if (ret == -1) {
         if (errno == EAGAIN) {
             u_conn->thread = th;
+
+            /* A previous write may have removed the event, start over */
+            if (!(u_conn->event.status & MK_EVENT_REGISTERED)) {
+                MK_EVENT_NEW(&u_conn->event);
+            }
             ret = mk_event_add(u->evl,
                                u_conn->fd,
                                FLB_ENGINE_EV_THREAD,
@@ -391,7 +821,11 @@ static FLB_INLINE ssize_t net_io_read_async(struct flb_thread *th,
                 close(u_conn->fd);
                 return -1;
             }
-            flb_thread_yield(th, MK_FALSE);
+            ret = flb_io_net_wait(th, u_conn, u->read_timeout);
+            if (ret == -1) {
+                mk_event_del(u->evl, &u_conn->event);
+                return -1;
+            }
             goto retry_read;
         }
         return -1;
@@ -403,6 +837,16 @@ static FLB_INLINE ssize_t net_io_read_async(struct flb_thread *th,
     return ret;
 }
 
+#ifdef FLB_HAVE_FLUSH_UCONTEXT
+/* Latency tracing: first byte written by a sampled coroutine */
+static inline void io_trace_write(struct flb_thread *th, int ret)
+{
+    if (ret != -1 && th && th->trace && th->t_write == 0) {
+        th->t_write = flb_metrics_time();
+    }
+}
+#endif
+
 /* Write data to an upstream connection/server */
 int flb_io_net_write(struct flb_upstream_conn *u_conn, void *data,
                      size_t len, size_t *out_len)
@@ -437,6 +881,7 @@ int flb_io_net_write(struct flb_upstream_conn *u_conn, void *data,
     }
 
 #ifdef FLB_HAVE_FLUSH_UCONTEXT
+    io_trace_write(th, ret);
     flb_trace("[io thread=%p] [net_write] ret=%i total=%lu/%lu",
               th, ret, *out_len, len);
 #else
@@ -446,6 +891,77 @@ int flb_io_net_write(struct flb_upstream_conn *u_conn, void *data,
     return ret;
 }
 
+/*
+ * Write a set of buffers to an upstream connection as a single gather
+ * write. The caller iovec array is not modified. Returns 0 on success and
+ * the number of bytes written in 'out_len'.
+ */
+int flb_io_net_writev(struct flb_upstream_conn *u_conn,
+                      struct iovec *iov, int iovcnt, size_t *out_len)
+{
+    int ret = -1;
+    struct iovec *vec;
+    struct iovec vec_local[8];
+    struct flb_upstream *u = u_conn->u;
+
+#ifdef FLB_HAVE_FLUSH_UCONTEXT
+    struct flb_thread *th = pthread_getspecific(flb_thread_key);
+#else
+    void *th = NULL;
+#endif
+
+    *out_len = 0;
+    if (iovcnt <= 0) {
+        return 0;
+    }
+
+    /* Keep the progress on a copy */
+    if (iovcnt <= sizeof(vec_local) / sizeof(struct iovec)) {
+        vec = vec_local;
+    }
+    else {
+        vec = malloc(sizeof(struct iovec) * iovcnt);
+        if (!vec) {
+            perror("malloc");
+            return -1;
+        }
+    }
+    memcpy(vec, iov, sizeof(struct iovec) * iovcnt);
+
+    flb_trace("[io thread=%p] [net_writev] trying %i buffers", th, iovcnt);
+
+    if (u->flags & FLB_IO_TCP) {
+        if (u->flags & FLB_IO_ASYNC) {
+            ret = net_io_writev_async(th, u_conn, vec, iovcnt, out_len);
+        }
+        else {
+            ret = net_io_writev(u_conn, vec, iovcnt, out_len);
+        }
+    }
+#ifdef FLB_HAVE_TLS
+    else if (u->flags & FLB_IO_TLS) {
+        ret = net_io_tls_writev(th, u_conn, vec, iovcnt, out_len);
+    }
+#endif
+
+    if (vec != vec_local) {
+        free(vec);
+    }
+
+#ifdef FLB_HAVE_FLUSH_UCONTEXT
+    io_trace_write(th, ret);
+#endif
+
+    if (ret == -1 && u_conn->fd > 0) {
+        close(u_conn->fd);
+        u_conn->fd = -1;
+    }
+
+    flb_trace("[io thread=%p] [net_writev] ret=%i total=%lu",
+              th, ret, *out_len);
+    return ret;
+}
+
 ssize_t flb_io_net_read(struct flb_upstream_conn *u_conn, void *buf, size_t len)
 {
     int ret = -1;
@@ -474,6 +990,11 @@ ssize_t flb_io_net_read(struct flb_upstream_conn *u_conn, void *buf, size_t len)
     }
 #endif
 
+    /* The connection state is unknown, do not keep it alive */
+    if (ret <= 0) {
+        u_conn->recycle = FLB_FALSE;
+    }
+
     flb_trace("[io thread=%p] [net_read] ret=%i", th, ret);
     return ret;
 }
@@ -17,9 +17,13 @@
  *  limitations under the License.
  */
 
+#include <poll.h>
+#include <errno.h>
 #include <unistd.h>
+#include <pthread.h>
 #include <mbedtls/net.h>
 #include <mbedtls/ssl.h>
+#include <mbedtls/ssl_internal.h>
 #include <mbedtls/entropy.h>
 #include <mbedtls/ctr_drbg.h>
 #include <mbedtls/debug.h>
@@ -28,7 +32,6 @@
 #include <fluent-bit/flb_io.h>
 #include <fluent-bit/flb_tls.h>
 #include <fluent-bit/flb_io_tls.h>
-#include <fluent-bit/flb_stats.h>
 #include <fluent-bit/flb_utils.h>
 #include <fluent-bit/flb_config.h>
 #include <fluent-bit/flb_network.h>
@@ -54,9 +57,15 @@ static inline int io_tls_event_switch(struct flb_upstream_conn *u_conn,
     struct flb_upstream *u = u_conn->u;
 
     event = &u_conn->event;
+
+    /* The mask is kept after mk_event_del(), it must not be modified */
+    if (!(event->status & MK_EVENT_REGISTERED)) {
+        MK_EVENT_NEW(event);
+    }
+
     if ((event->mask & mask) == 0) {
         ret = mk_event_add(u->evl,
-                           event->fd,
+                           u_conn->fd,
                            FLB_ENGINE_EV_THREAD,
                            mask, &u_conn->event);
         if (ret == -1) {
@@ -68,16 +77,73 @@ static inline int io_tls_event_switch(struct flb_upstream_conn *u_conn,
     return 0;
 }
 
-struct flb_tls_context *flb_tls_context_new(int verify,
-                                            char *ca_file, char *crt_file,
-                                            char *key_file, char *key_passwd)
+/*
+ * Contexts are shared by the output instances using the same verification
+ * mode and files, so certificates are parsed once.
+ */
+static struct mk_list tls_contexts;
+static int tls_contexts_ready = FLB_FALSE;
+static pthread_mutex_t tls_contexts_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static inline void tls_lock(struct flb_upstream *u)
+{
+#ifdef FLB_HAVE_FLUSH_PTHREADS
+    pthread_mutex_lock(&u->mutex_queue);
+#endif
+}
+
+static inline void tls_unlock(struct flb_upstream *u)
+{
+#ifdef FLB_HAVE_FLUSH_PTHREADS
+    pthread_mutex_unlock(&u->mutex_queue);
+#endif
+}
+
+static char *tls_context_id(int verify, char *ca_file, char *crt_file,
+                            char *key_file)
+{
+    size_t size;
+    char *id;
+
+    size = 32 + strlen(ca_file);
+    size += crt_file ? strlen(crt_file) : 0;
+    size += key_file ? strlen(key_file) : 0;
+
+    id = malloc(size);
+    if (!id) {
+        perror("malloc");
+        return NULL;
+    }
+    snprintf(id, size, "%i|%s|%s|%s", verify, ca_file,
+             crt_file ? crt_file : "", key_file ? key_file : "");
+
+    return id;
+}
+
+static void tls_context_free(struct flb_tls_context *ctx)
+{
+    mbedtls_ssl_config_free(&ctx->conf);
+    mbedtls_x509_crt_free(&ctx->ca_cert);
+    mbedtls_x509_crt_free(&ctx->cert);
+    mbedtls_pk_free(&ctx->priv_key);
+    mbedtls_ctr_drbg_free(&ctx->ctr_drbg);
+    mbedtls_entropy_free(&ctx->entropy);
+    free(ctx->id);
+    free(ctx);
+}
+
+static struct flb_tls_context *tls_context_create(int verify,
+                                                  char *ca_file,
+                                                  char *crt_file,
+                                                  char *key_file,
+                                                  char *key_passwd)
 {
     int ret;
     struct flb_tls_context *ctx;
 
-    ctx = malloc(sizeof(struct flb_tls_context));
+    ctx = calloc(1, sizeof(struct flb_tls_context));
     if (!ctx) {
-        perror("malloc");
+        perror("calloc");
         return NULL;
     }
     ctx->verify    = verify;
@@ -85,22 +151,22 @@ struct flb_tls_context *flb_tls_context_new(int verify,
 
     mbedtls_entropy_init(&ctx->entropy);
     mbedtls_ctr_drbg_init(&ctx->ctr_drbg);
+    mbedtls_x509_crt_init(&ctx->ca_cert);
+    mbedtls_x509_crt_init(&ctx->cert);
+    mbedtls_pk_init(&ctx->priv_key);
+    mbedtls_ssl_config_init(&ctx->conf);
 
     ret = mbedtls_ctr_drbg_seed(&ctx->ctr_drbg,
                                 mbedtls_entropy_func,
                                 &ctx->entropy,
                                 (const unsigned char *) FLB_TLS_CLIENT,
                                 sizeof(FLB_TLS_CLIENT) -1);
-    if (ret == -1) {
+    if (ret != 0) {
         io_tls_error(ret);
         goto error;
     }
 
     /* Load root certificates */
-    if (!ca_file) {
-        ca_file = "/etc/ssl/certs/ca-certificates.crt";
-    }
-    mbedtls_x509_crt_init(&ctx->ca_cert);
     ret = mbedtls_x509_crt_parse_file(&ctx->ca_cert, ca_file);
     if (ret != 0) {
         flb_error("[TLS] Invalid CA file: %s", ca_file);
@@ -109,7 +175,6 @@ struct flb_tls_context *flb_tls_context_new(int verify,
     ctx->certs_set |= FLB_TLS_CA_ROOT;
 
     if (crt_file) {
-        mbedtls_x509_crt_init(&ctx->cert);
         ret = mbedtls_x509_crt_parse_file(&ctx->cert, crt_file);
         if (ret != 0) {
             flb_error("[TLS] Invalid Certificate file: %s", crt_file);
@@ -119,7 +184,6 @@ struct flb_tls_context *flb_tls_context_new(int verify,
     }
 
     if (key_file) {
-        mbedtls_pk_init(&ctx->priv_key);
         ret = mbedtls_pk_parse_keyfile(&ctx->priv_key, key_file, key_passwd);
         if (ret != 0) {
             flb_error("[TLS] Invalid Key file: %s", key_file);
@@ -128,16 +192,117 @@ struct flb_tls_context *flb_tls_context_new(int verify,
         ctx->certs_set |= FLB_TLS_PRIV_KEY;
     }
 
+    /*
+     * Client configuration, it's read-only once set so every session of
+     * the context uses it. Session tickets are enabled by default.
+     */
+    ret = mbedtls_ssl_config_defaults(&ctx->conf,
+                                      MBEDTLS_SSL_IS_CLIENT,
+                                      MBEDTLS_SSL_TRANSPORT_STREAM,
+                                      MBEDTLS_SSL_PRESET_DEFAULT);
+    if (ret != 0) {
+        io_tls_error(ret);
+        goto error;
+    }
+
+    mbedtls_ssl_conf_rng(&ctx->conf,
+                         mbedtls_ctr_drbg_random,
+                         &ctx->ctr_drbg);
+
+    if (ctx->verify == FLB_TRUE) {
+        mbedtls_ssl_conf_authmode(&ctx->conf, MBEDTLS_SSL_VERIFY_REQUIRED);
+    }
+    else {
+        mbedtls_ssl_conf_authmode(&ctx->conf, MBEDTLS_SSL_VERIFY_NONE);
+    }
+
+    /* CA Root */
+    mbedtls_ssl_conf_ca_chain(&ctx->conf, &ctx->ca_cert, NULL);
+
+    /* Specific Cert */
+    if (ctx->certs_set & FLB_TLS_CERT) {
+        ret = mbedtls_ssl_conf_own_cert(&ctx->conf,
+                                        &ctx->cert,
+                                        &ctx->priv_key);
+        if (ret != 0) {
+            flb_error("[TLS] Error loading certificate with private key");
+            goto error;
+        }
+    }
+
     return ctx;
 
  error:
-    free(ctx);
+    tls_context_free(ctx);
     return NULL;
 }
 
+struct flb_tls_context *flb_tls_context_new(int verify,
+                                            char *ca_file, char *crt_file,
+                                            char *key_file, char *key_passwd)
+{
+    char *id;
+    struct mk_list *head;
+    struct flb_tls_context *ctx = NULL;
+
+    if (!ca_file) {
+        ca_file = "/etc/ssl/certs/ca-certificates.crt";
+    }
+
+    id = tls_context_id(verify, ca_file, crt_file, key_file);
+    if (!id) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&tls_contexts_mutex);
+    if (tls_contexts_ready == FLB_FALSE) {
+        mk_list_init(&tls_contexts);
+        tls_contexts_ready = FLB_TRUE;
+    }
+
+    mk_list_foreach(head, &tls_contexts) {
+        ctx = mk_list_entry(head, struct flb_tls_context, _head);
+        if (strcmp(ctx->id, id) == 0) {
+            ctx->users++;
+            pthread_mutex_unlock(&tls_contexts_mutex);
+            flb_debug("[io_tls] sharing context %s (%i users)",
+                      id, ctx->users);
+            free(id);
+            return ctx;
+        }
+    }
+
+    ctx = tls_context_create(verify, ca_file, crt_file, key_file,
+                             key_passwd);
+    if (ctx) {
+        ctx->id = id;
+        ctx->users = 1;
+        mk_list_add(&ctx->_head, &tls_contexts);
+    }
+    else {
+        free(id);
+    }
+    pthread_mutex_unlock(&tls_contexts_mutex);
+
+    return ctx;
+}
+
 void flb_tls_context_destroy(struct flb_tls_context *ctx)
 {
-    free(ctx);
+    if (!ctx) {
+        return;
+    }
+
+    pthread_mutex_lock(&tls_contexts_mutex);
+    ctx->users--;
+    if (ctx->users > 0) {
+        pthread_mutex_unlock(&tls_contexts_mutex);
+        return;
+    }
+    mk_list_del(&ctx->_head);
+    pthread_mutex_unlock(&tls_contexts_mutex);
+
+    tls_context_free(ctx);
 }
 
 struct flb_tls_session *flb_tls_session_new(struct flb_tls_context *ctx)
@@ -151,67 +316,118 @@ struct flb_tls_session *flb_tls_session_new(struct flb_tls_context *ctx)
     }
 
     mbedtls_ssl_init(&session->ssl);
-    mbedtls_ssl_config_init(&session->conf);
-
-    ret = mbedtls_ssl_config_defaults(&session->conf,
-                                      MBEDTLS_SSL_IS_CLIENT,
-                                      MBEDTLS_SSL_TRANSPORT_STREAM,
-                                      MBEDTLS_SSL_PRESET_DEFAULT);
+    ret = mbedtls_ssl_setup(&session->ssl, &ctx->conf);
     if (ret != 0) {
         io_tls_error(ret);
+        mbedtls_ssl_free(&session->ssl);
+        free(session);
+        return NULL;
     }
 
-    mbedtls_ssl_conf_rng(&session->conf,
-                         mbedtls_ctr_drbg_random,
-                         &ctx->ctr_drbg);
+    return session;
+}
 
-    if (ctx->verify == FLB_TRUE) {
-        mbedtls_ssl_conf_authmode(&session->conf, MBEDTLS_SSL_VERIFY_REQUIRED);
+int tls_session_destroy(struct flb_tls_session *session)
+{
+    if (session) {
+        mbedtls_ssl_free(&session->ssl);
+        free(session);
     }
-    else {
-        mbedtls_ssl_conf_authmode(&session->conf, MBEDTLS_SSL_VERIFY_NONE);
+
+    return 0;
+}
+
+void flb_tls_resume_destroy(mbedtls_ssl_session *resume)
+{
+    if (resume) {
+        mbedtls_ssl_session_free(resume);
+        free(resume);
     }
+}
 
+/* Keep the negotiated session so the next connections can resume it */
+static void tls_resume_save(struct flb_upstream *u, mbedtls_ssl_context *ssl)
+{
+    int ret;
+    mbedtls_ssl_session *old;
+    mbedtls_ssl_session *resume;
 
-    /* CA Root */
-    if (ctx->certs_set & FLB_TLS_CA_ROOT) {
-        mbedtls_ssl_conf_ca_chain(&session->conf, &ctx->ca_cert, NULL);
+    resume = malloc(sizeof(mbedtls_ssl_session));
+    if (!resume) {
+        perror("malloc");
+        return;
     }
+    mbedtls_ssl_session_init(resume);
 
-    /* Specific Cert */
-    if (ctx->certs_set & FLB_TLS_CERT) {
-        ret = mbedtls_ssl_conf_own_cert(&session->conf,
-                                        &ctx->cert,
-                                        &ctx->priv_key);
-        if (ret != 0) {
-            flb_error("[TLS] Error loading certificate with private key");
-            goto error;
-        }
+    ret = mbedtls_ssl_get_session(ssl, resume);
+    if (ret != 0) {
+        io_tls_error(ret);
+        flb_tls_resume_destroy(resume);
+        return;
     }
 
+    tls_lock(u);
+    old = u->tls_resume;
+    u->tls_resume = resume;
+    tls_unlock(u);
 
-    ret = mbedtls_ssl_setup(&session->ssl, &session->conf);
-    if (ret == -1) {
-        flb_error("[tls] ssl_setup");
-        goto error;
-    }
+    flb_tls_resume_destroy(old);
+}
 
-    return session;
+/* Drop the saved session, e.g: the server failed the handshake */
+static void tls_resume_drop(struct flb_upstream *u)
+{
+    mbedtls_ssl_session *old;
 
- error:
-    free(session);
-    return NULL;
+    tls_lock(u);
+    old = u->tls_resume;
+    u->tls_resume = NULL;
+    tls_unlock(u);
+
+    flb_tls_resume_destroy(old);
 }
 
-int tls_session_destroy(struct flb_tls_session *session)
+/*
+ * Socket callbacks for mbedTLS, they use the connection file descriptor
+ * which is set in both blocking and async modes.
+ */
+static int tls_net_send(void *ctx, const unsigned char *buf, size_t len)
 {
-    if (session) {
-        mbedtls_ssl_free(&session->ssl);
-        mbedtls_ssl_config_free(&session->conf);
-        free(session);
+    mbedtls_net_context net;
+    struct flb_upstream_conn *u_conn = ctx;
+
+    net.fd = u_conn->fd;
+    return mbedtls_net_send(&net, buf, len);
+}
+
+static int tls_net_recv(void *ctx, unsigned char *buf, size_t len)
+{
+    mbedtls_net_context net;
+    struct flb_upstream_conn *u_conn = ctx;
+
+    net.fd = u_conn->fd;
+    return mbedtls_net_recv(&net, buf, len);
+}
+
+/*
+ * Run the handshake steps: mbedTLS releases the handshake data once it's
+ * over, so the resumption flag is taken while the steps are running.
+ */
+static int tls_handshake_steps(mbedtls_ssl_context *ssl, int *resumed)
+{
+    int ret = 0;
+
+    while (ssl->state != MBEDTLS_SSL_HANDSHAKE_OVER) {
+        ret = mbedtls_ssl_handshake_step(ssl);
+        if (ssl->handshake) {
+            *resumed = ssl->handshake->resume ? FLB_TRUE : FLB_FALSE;
+        }
+        if (ret != 0) {
+            break;
+        }
     }
 
-    return 0;
+    return ret;
 }
 
 /* Perform a TLS handshake */
@@ -219,6 +435,10 @@ int net_io_tls_handshake(void *_u_conn, void *_th)
 {
     int ret;
     int flag;
+    int wait_ms;
+    int offered = FLB_FALSE;
+    int resumed = FLB_FALSE;
+    struct pollfd pfd;
     struct flb_tls_session *session;
     struct flb_upstream_conn *u_conn = _u_conn;
     struct flb_upstream *u = u_conn->u;
@@ -234,10 +454,20 @@ int net_io_tls_handshake(void *_u_conn, void *_th)
     u_conn->tls_session = session;
     mbedtls_ssl_set_bio(&session->ssl,
                         u_conn,
-                        mbedtls_net_send, mbedtls_net_recv, NULL);
+                        tls_net_send, tls_net_recv, NULL);
+
+    /* Offer the last session negotiated with this server */
+    tls_lock(u);
+    if (u->tls_resume) {
+        ret = mbedtls_ssl_set_session(&session->ssl, u->tls_resume);
+        if (ret == 0) {
+            offered = FLB_TRUE;
+        }
+    }
+    tls_unlock(u);
 
  retry_handshake:
-    ret = mbedtls_ssl_handshake(&session->ssl);
+    ret = tls_handshake_steps(&session->ssl, &resumed);
 
     if (ret != 0) {
         if (ret != MBEDTLS_ERR_SSL_WANT_READ &&
@@ -249,11 +479,26 @@ int net_io_tls_handshake(void *_u_conn, void *_th)
         if (ret == MBEDTLS_ERR_SSL_WANT_WRITE) {
             flag = MK_EVENT_WRITE;
         }
-        else if (ret == MBEDTLS_ERR_SSL_WANT_READ) {
+        else {
             flag = MK_EVENT_READ;
         }
-        else {
 
+        /* Blocking mode: no co-routine to yield, wait for the socket */
+        if (!th) {
+            wait_ms = (u->connect_timeout > 0) ? u->connect_timeout * 1000 : -1;
+            pfd.fd = u_conn->fd;
+            pfd.events = (flag == MK_EVENT_WRITE) ? POLLOUT : POLLIN;
+            ret = poll(&pfd, 1, wait_ms);
+            if (ret == 0) {
+                flb_error("[io_tls] handshake with %s:%i timed out after "
+                          "%i seconds", u->tcp_host, u->tcp_port,
+                          u->connect_timeout);
+                goto error;
+            }
+            if (ret == -1 && errno != EINTR) {
+                goto error;
+            }
+            goto retry_handshake;
         }
 
         /*
@@ -268,11 +513,25 @@ int net_io_tls_handshake(void *_u_conn, void *_th)
             goto error;
         }
 
-        flb_thread_yield(th, FLB_FALSE);
+        ret = flb_io_net_wait(th, u_conn, u->connect_timeout);
+        if (ret == -1) {
+            goto error;
+        }
         goto retry_handshake;
     }
+
+    tls_lock(u);
+    if (resumed == FLB_TRUE) {
+        u->stats.tls_resumed++;
+    }
     else {
-        flb_trace("[io_tls] Handshake OK");
+        u->stats.tls_full++;
+    }
+    tls_unlock(u);
+
+    flb_trace("[io_tls] Handshake OK (%s)", resumed ? "resumed" : "full");
+    if (resumed == FLB_FALSE) {
+        tls_resume_save(u, &session->ssl);
     }
 
     if (u_conn->event.status & MK_EVENT_REGISTERED) {
@@ -283,6 +542,9 @@ int net_io_tls_handshake(void *_u_conn, void *_th)
     return 0;
 
  error:
+    if (offered == FLB_TRUE) {
+        tls_resume_drop(u);
+    }
     if (u_conn->event.status & MK_EVENT_REGISTERED) {
         mk_event_del(u->evl, &u_conn->event);
     }
@@ -302,24 +564,35 @@ FLB_INLINE int net_io_tls_read(struct flb_thread *th,
  retry_read:
     ret = mbedtls_ssl_read(&u_conn->tls_session->ssl, buf, len);
     if (ret == MBEDTLS_ERR_SSL_WANT_READ) {
+        /* Blocking mode: the socket read timeout expired */
+        if (!th) {
+            goto timeout;
+        }
         u_conn->thread = th;
         io_tls_event_switch(u_conn, MK_EVENT_READ);
-        flb_thread_yield(th, FLB_FALSE);
+        if (flb_io_net_wait(th, u_conn, u->read_timeout) == -1) {
+            goto error;
+        }
         goto retry_read;
     }
     else if (ret < 0) {
         char err_buf[72];
         mbedtls_strerror(ret, err_buf, sizeof(err_buf));
         flb_error("[tls] SSL error: %s", err_buf);
-
-        /* There was an error transmitting data */
-        mk_event_del(u->evl, &u_conn->event);
-        tls_session_destroy(u_conn->tls_session);
-        u_conn->tls_session = NULL;
-        return -1;
+        goto error;
     }
 
     return ret;
+
+ timeout:
+    flb_error("[io_tls] read from %s:%i timed out after %i seconds",
+              u->tcp_host, u->tcp_port, u->read_timeout);
+ error:
+    /* There was an error transmitting data */
+    mk_event_del(u->evl, &u_conn->event);
+    tls_session_destroy(u_conn->tls_session);
+    u_conn->tls_session = NULL;
+    return -1;
 }
 
 FLB_INLINE int net_io_tls_write(struct flb_thread *th,
@@ -336,40 +609,54 @@ FLB_INLINE int net_io_tls_write(struct flb_thread *th,
     ret = mbedtls_ssl_write(&u_conn->tls_session->ssl,
                             data + total,
                             len - total);
-    if (ret == MBEDTLS_ERR_SSL_WANT_WRITE) {
-        io_tls_event_switch(u_conn, MK_EVENT_WRITE);
-        flb_thread_yield(th, FLB_FALSE);
-        goto retry_write;
-    }
-    else if (ret == MBEDTLS_ERR_SSL_WANT_READ) {
-        io_tls_event_switch(u_conn, MK_EVENT_READ);
-        flb_thread_yield(th, FLB_FALSE);
+    if (ret == MBEDTLS_ERR_SSL_WANT_WRITE ||
+        ret == MBEDTLS_ERR_SSL_WANT_READ) {
+        /* Blocking mode: the socket timeout expired */
+        if (!th) {
+            goto timeout;
+        }
+        if (ret == MBEDTLS_ERR_SSL_WANT_WRITE) {
+            io_tls_event_switch(u_conn, MK_EVENT_WRITE);
+        }
+        else {
+            io_tls_event_switch(u_conn, MK_EVENT_READ);
+        }
+        if (flb_io_net_wait(th, u_conn, u->write_timeout) == -1) {
+            goto error;
+        }
         goto retry_write;
     }
     else if (ret < 0) {
         char err_buf[72];
         mbedtls_strerror(ret, err_buf, sizeof(err_buf));
         flb_error("[tls] SSL error: %s", err_buf);
-
-        /* There was an error transmitting data */
-        mk_event_del(u->evl, &u_conn->event);
-        tls_session_destroy(u_conn->tls_session);
-        u_conn->tls_session = NULL;
-        return -1;
+        goto error;
     }
 
-    /* Update statistics */
-    //flb_stats_update(out->stats_fd, ret, 0);
-
     /* Update counter and check if we need to continue writing */
     total += ret;
     if (total < len) {
+        if (!th) {
+            goto retry_write;
+        }
         io_tls_event_switch(u_conn, MK_EVENT_WRITE);
-        flb_thread_yield(th, FLB_FALSE);
+        if (flb_io_net_wait(th, u_conn, u->write_timeout) == -1) {
+            goto error;
+        }
         goto retry_write;
     }
 
     *out_len = total;
     mk_event_del(u->evl, &u_conn->event);
     return 0;
+
+ timeout:
+    flb_error("[io_tls] write to %s:%i timed out after %i seconds",
+              u->tcp_host, u->tcp_port, u->write_timeout);
+ error:
+    /* There was an error transmitting data */
+    mk_event_del(u->evl, &u_conn->event);
+    tls_session_destroy(u_conn->tls_session);
+    u_conn->tls_session = NULL;
+    return -1;
 }
@@ -17,9 +17,12 @@
  *  limitations under the License.
  */
 
+#include <errno.h>
 #include <signal.h>
 #include <unistd.h>
 #include <stdarg.h>
+#include <string.h>
+#include <pthread.h>
 
 #include <fluent-bit/flb_lib.h>
 #include <fluent-bit/flb_engine.h>
@@ -33,6 +36,21 @@
 
 extern struct flb_input_plugin in_lib_plugin;
 
+/* Record builder buffer of an application thread */
+struct lib_local {
+    flb_input_t *in;              /* instance of the pending records */
+    msgpack_sbuffer mp_sbuf;
+    msgpack_packer mp_pck;
+    struct mk_list _head;         /* link to lib_locals               */
+};
+
+static pthread_key_t lib_local_key;
+static pthread_once_t lib_local_once = PTHREAD_ONCE_INIT;
+
+/* Every thread buffer, so they can be detached from a destroyed input */
+static struct mk_list lib_locals;
+static pthread_mutex_t lib_locals_mutex = PTHREAD_MUTEX_INITIALIZER;
+
 flb_ctx_t *flb_create()
 {
     int ret;
@@ -233,6 +251,252 @@ int flb_lib_push(flb_input_t *input, void *data, size_t len)
     return ret;
 }
 
+static void lib_local_destroy(void *data)
+{
+    struct lib_local *local = data;
+
+    pthread_mutex_lock(&lib_locals_mutex);
+    mk_list_del(&local->_head);
+    pthread_mutex_unlock(&lib_locals_mutex);
+
+    msgpack_sbuffer_destroy(&local->mp_sbuf);
+    free(local);
+}
+
+static void lib_local_key_init()
+{
+    pthread_key_create(&lib_local_key, lib_local_destroy);
+    mk_list_init(&lib_locals);
+}
+
+static struct lib_local *lib_local_get()
+{
+    struct lib_local *local;
+
+    pthread_once(&lib_local_once, lib_local_key_init);
+
+    local = pthread_getspecific(lib_local_key);
+    if (local) {
+        return local;
+    }
+
+    local = calloc(1, sizeof(struct lib_local));
+    if (!local) {
+        perror("calloc");
+        return NULL;
+    }
+    msgpack_sbuffer_init(&local->mp_sbuf);
+    msgpack_packer_init(&local->mp_pck, &local->mp_sbuf,
+                        msgpack_sbuffer_write);
+    pthread_setspecific(lib_local_key, local);
+
+    pthread_mutex_lock(&lib_locals_mutex);
+    mk_list_add(&local->_head, &lib_locals);
+    pthread_mutex_unlock(&lib_locals_mutex);
+
+    return local;
+}
+
+/*
+ * Enqueue a buffer of records for the engine, it takes the ownership on
+ * success. Above the queue limit of the instance it fails with EAGAIN and
+ * the caller keeps the buffer. The limit is soft: producers racing with
+ * each other may exceed it by their last buffer, and a single buffer is
+ * always accepted by an empty queue.
+ */
+static int lib_enqueue(flb_input_t *in, char *buf, size_t size)
+{
+    size_t queued;
+    struct flb_lib_chunk *chunk;
+
+    queued = __atomic_load_n(&in->lib_queued, __ATOMIC_RELAXED);
+    if (in->lib_queue_limit > 0 && queued > 0 &&
+        queued + size > in->lib_queue_limit) {
+        errno = EAGAIN;
+        return -1;
+    }
+
+    chunk = malloc(sizeof(struct flb_lib_chunk));
+    if (!chunk) {
+        perror("malloc");
+        return -1;
+    }
+    chunk->buf  = buf;
+    chunk->size = size;
+
+    __atomic_add_fetch(&in->lib_queued, size, __ATOMIC_RELAXED);
+    flb_mpsc_push(&in->lib_chunks, &chunk->_node);
+    return 0;
+}
+
+/* Enqueue the records of the thread buffer, they are kept on failure */
+static int lib_local_seal(struct lib_local *local)
+{
+    int ret;
+
+    if (local->mp_sbuf.size == 0) {
+        return 0;
+    }
+
+    ret = lib_enqueue(local->in, local->mp_sbuf.data, local->mp_sbuf.size);
+    if (ret == -1) {
+        return -1;
+    }
+    msgpack_sbuffer_init(&local->mp_sbuf);
+    return 0;
+}
+
+/* Push MessagePack records into the Engine */
+int flb_lib_push_msgpack(flb_input_t *input, void *data, size_t len)
+{
+    char *buf;
+    struct lib_local *local;
+
+    if (len == 0) {
+        return 0;
+    }
+
+    /* Keep the order with the records packed by this thread */
+    pthread_once(&lib_local_once, lib_local_key_init);
+    local = pthread_getspecific(lib_local_key);
+    if (local && local->in == input) {
+        if (lib_local_seal(local) == -1) {
+            return -1;
+        }
+    }
+
+    buf = malloc(len);
+    if (!buf) {
+        perror("malloc");
+        return -1;
+    }
+    memcpy(buf, data, len);
+
+    if (lib_enqueue(input, buf, len) == -1) {
+        free(buf);
+        return -1;
+    }
+    return len;
+}
+
+/* Start a record, the caller packs 'map_size' key/value pairs */
+msgpack_packer *flb_lib_record_begin(flb_input_t *input,
+                                     struct flb_time *time, int map_size)
+{
+    struct lib_local *local;
+
+    local = lib_local_get();
+    if (!local) {
+        return NULL;
+    }
+
+    if (local->in != input) {
+        if (local->in && lib_local_seal(local) == -1) {
+            return NULL;
+        }
+        local->in = input;
+    }
+
+    if (!local->mp_sbuf.data) {
+        local->mp_sbuf.data = malloc(FLB_LIB_CHUNK_SIZE);
+        if (!local->mp_sbuf.data) {
+            perror("malloc");
+            return NULL;
+        }
+        local->mp_sbuf.alloc = FLB_LIB_CHUNK_SIZE;
+    }
+
+    msgpack_pack_array(&local->mp_pck, 2);
+    flb_time_append_to_msgpack(time, &local->mp_pck, FLB_TIME_FMT_EVENTTIME);
+    msgpack_pack_map(&local->mp_pck, map_size);
+
+    return &local->mp_pck;
+}
+
+/* Finish the record, the buffer is enqueued once it's full */
+int flb_lib_record_end(flb_input_t *input)
+{
+    struct lib_local *local;
+
+    local = pthread_getspecific(lib_local_key);
+    if (!local || local->in != input) {
+        return -1;
+    }
+
+    if (local->mp_sbuf.size >= FLB_LIB_CHUNK_SIZE) {
+        return lib_local_seal(local);
+    }
+    return 0;
+}
+
+/* Enqueue the records packed by this thread */
+int flb_lib_record_flush(flb_input_t *input)
+{
+    struct lib_local *local;
+
+    pthread_once(&lib_local_once, lib_local_key_init);
+
+    local = pthread_getspecific(lib_local_key);
+    if (!local || local->in != input) {
+        return 0;
+    }
+    return lib_local_seal(local);
+}
+
+/*
+ * The input instance is being destroyed: detach it from the thread
+ * buffers still referencing it and discard their pending records. The
+ * producer threads must have stopped using the instance at this point.
+ */
+void flb_lib_input_exit(flb_input_t *input)
+{
+    struct mk_list *head;
+    struct lib_local *local;
+
+    pthread_once(&lib_local_once, lib_local_key_init);
+
+    pthread_mutex_lock(&lib_locals_mutex);
+    mk_list_foreach(head, &lib_locals) {
+        local = mk_list_entry(head, struct lib_local, _head);
+        if (local->in == input) {
+            local->mp_sbuf.size = 0;
+            local->in = NULL;
+        }
+    }
+    pthread_mutex_unlock(&lib_locals_mutex);
+}
+
+void flb_lib_iter_init(struct flb_lib_iter *it, void *buf, size_t size)
+{
+    it->buf  = buf;
+    it->size = size;
+    it->off  = 0;
+    msgpack_unpacked_init(&it->result);
+}
+
+/*
+ * Get the next record: 'record' and 'size' reference the MessagePack
+ * bytes inside the chunk and 'it->result.data' is the unpacked object,
+ * valid until the next call. Returns 0 at the end of the chunk.
+ */
+int flb_lib_iter_next(struct flb_lib_iter *it, void **record, size_t *size)
+{
+    size_t prev = it->off;
+
+    if (!msgpack_unpack_next(&it->result, it->buf, it->size, &it->off)) {
+        return 0;
+    }
+
+    *record = it->buf + prev;
+    *size   = it->off - prev;
+    return 1;
+}
+
+void flb_lib_iter_destroy(struct flb_lib_iter *it)
+{
+    msgpack_unpacked_destroy(&it->result);
+}
+
 static void flb_lib_worker(void *data)
 {
     struct flb_config *config = data;
@@ -0,0 +1,683 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Fluent Bit
+ *  ==========
+ *  Copyright (C) 2015-2016 Treasure Data Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+
+#include <fluent-bit/flb_config.h>
+#include <fluent-bit/flb_input.h>
+#include <fluent-bit/flb_output.h>
+#include <fluent-bit/flb_upstream.h>
+#include <fluent-bit/flb_buffer.h>
+#include <fluent-bit/flb_task_map.h>
+#include <fluent-bit/flb_metrics.h>
+
+struct flb_metric_desc {
+    char *name;
+    int type;                   /* counter or gauge           */
+    int instances;              /* instance types that use it */
+    char *help;                 /* Prometheus HELP text       */
+};
+
+static struct flb_metric_desc metrics_desc[FLB_METRICS_SIZE] = {
+    {"records",         FLB_METRIC_COUNTER,
+     FLB_METRICS_INPUT | FLB_METRICS_OUTPUT, "Number of records."},
+    {"bytes",           FLB_METRIC_COUNTER,
+     FLB_METRICS_INPUT | FLB_METRICS_OUTPUT, "Number of bytes."},
+    {"errors",          FLB_METRIC_COUNTER, FLB_METRICS_OUTPUT,
+     "Number of failed flushes."},
+    {"retries",         FLB_METRIC_COUNTER, FLB_METRICS_OUTPUT,
+     "Number of retried flushes."},
+    {"retries_failed",  FLB_METRIC_COUNTER, FLB_METRICS_OUTPUT,
+     "Number of retries that could not be scheduled."},
+    {"dropped_records", FLB_METRIC_COUNTER, FLB_METRICS_OUTPUT,
+     "Number of records discarded."},
+    {"retries_pending", FLB_METRIC_GAUGE,   FLB_METRICS_OUTPUT,
+     "Number of retries waiting to be dispatched."},
+};
+
+static struct flb_metric_desc latency_desc[FLB_METRICS_LAT_SIZE] = {
+    {"collect", FLB_METRIC_SUMMARY, FLB_METRICS_INPUT,
+     "Time from the collection to the dispatch of the records."},
+    {"start",   FLB_METRIC_SUMMARY, FLB_METRICS_OUTPUT,
+     "Time from the dispatch to the start of the flush."},
+    {"write",   FLB_METRIC_SUMMARY, FLB_METRICS_OUTPUT,
+     "Time from the start of the flush to the first byte written."},
+    {"return",  FLB_METRIC_SUMMARY, FLB_METRICS_OUTPUT,
+     "Time from the first byte written to the end of the flush."},
+    {"total",   FLB_METRIC_SUMMARY, FLB_METRICS_OUTPUT,
+     "Time from the collection to the delivery of the records."},
+};
+
+static struct flb_metric_desc upstream_desc[FLB_METRICS_UP_SIZE] = {
+    {"connections", FLB_METRIC_GAUGE,   FLB_METRICS_OUTPUT,
+     "Number of open upstream connections."},
+    {"hits",        FLB_METRIC_COUNTER, FLB_METRICS_OUTPUT,
+     "Number of upstream connections reused."},
+    {"misses",      FLB_METRIC_COUNTER, FLB_METRICS_OUTPUT,
+     "Number of upstream connections created."},
+    {"evictions",   FLB_METRIC_COUNTER, FLB_METRICS_OUTPUT,
+     "Number of idle upstream connections dropped."},
+    {"waits",       FLB_METRIC_COUNTER, FLB_METRICS_OUTPUT,
+     "Number of waits for a free upstream connection."},
+    {"timeouts",    FLB_METRIC_COUNTER, FLB_METRICS_OUTPUT,
+     "Number of upstream I/O operations timed out."},
+    {"tls_full",    FLB_METRIC_COUNTER, FLB_METRICS_OUTPUT,
+     "Number of full TLS handshakes."},
+    {"tls_resumed", FLB_METRIC_COUNTER, FLB_METRICS_OUTPUT,
+     "Number of resumed TLS handshakes."},
+};
+
+void flb_metrics_init(struct flb_metrics *m, int type, char *title)
+{
+    memset(m, '\0', sizeof(struct flb_metrics));
+    m->type  = type;
+    m->title = title;
+}
+
+char *flb_metrics_name(int id)
+{
+    if (id < 0 || id >= FLB_METRICS_SIZE) {
+        return NULL;
+    }
+    return metrics_desc[id].name;
+}
+
+/* Check if the metric applies to the instance type */
+int flb_metrics_enabled(struct flb_metrics *m, int id)
+{
+    return (metrics_desc[id].instances & m->type) ? FLB_TRUE : FLB_FALSE;
+}
+
+/* Register the duration of a flush in nanoseconds */
+void flb_metrics_hist_add(struct flb_metrics_hist *h, uint64_t ns)
+{
+    int i = 0;
+    uint64_t us = ns / 1000;
+
+    if (us > 0) {
+        i = 64 - __builtin_clzll(us);
+        if (i >= FLB_METRICS_HIST_SIZE) {
+            i = FLB_METRICS_HIST_SIZE - 1;
+        }
+    }
+
+    __atomic_add_fetch(&h->buckets[i], 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&h->sum, us, __ATOMIC_RELAXED);
+}
+
+/* Upper bound (exclusive) of a bucket in microseconds, 0 for the last one */
+uint64_t flb_metrics_hist_bound(int bucket)
+{
+    if (bucket >= FLB_METRICS_HIST_SIZE - 1) {
+        return 0;
+    }
+    return 1ULL << bucket;
+}
+
+/* Copy the histogram, the count matches the sum of the buckets copied */
+void flb_metrics_hist_get(struct flb_metrics_hist *h,
+                          struct flb_metrics_hist *out)
+{
+    int i;
+
+    out->count = 0;
+    out->sum = __atomic_load_n(&h->sum, __ATOMIC_RELAXED);
+    for (i = 0; i < FLB_METRICS_HIST_SIZE; i++) {
+        out->buckets[i] = __atomic_load_n(&h->buckets[i], __ATOMIC_RELAXED);
+        out->count += out->buckets[i];
+    }
+}
+
+char *flb_metrics_lat_name(int id)
+{
+    if (id < 0 || id >= FLB_METRICS_LAT_SIZE) {
+        return NULL;
+    }
+    return latency_desc[id].name;
+}
+
+/* Check if the latency stage applies to the instance type */
+int flb_metrics_lat_enabled(struct flb_metrics *m, int id)
+{
+    return (latency_desc[id].instances & m->type) ? FLB_TRUE : FLB_FALSE;
+}
+
+/*
+ * Latency histogram bucket of a value: linear up to 2 * FLB_METRICS_HDR_SUB,
+ * then FLB_METRICS_HDR_SUB buckets for every power of two.
+ */
+static inline int hdr_bucket(uint64_t v)
+{
+    int i;
+    int shift = 0;
+
+    if (v >= 2 * FLB_METRICS_HDR_SUB) {
+        shift = (63 - __builtin_clzll(v)) - FLB_METRICS_HDR_SUB_BITS;
+    }
+
+    i = (shift * FLB_METRICS_HDR_SUB) + (v >> shift);
+    if (i >= FLB_METRICS_HDR_SIZE) {
+        i = FLB_METRICS_HDR_SIZE - 1;
+    }
+    return i;
+}
+
+/* Register a latency in nanoseconds */
+void flb_metrics_hdr_add(struct flb_metrics_hdr *h, uint64_t ns)
+{
+    uint64_t us = ns / 1000;
+
+    __atomic_add_fetch(&h->buckets[hdr_bucket(us)], 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&h->sum, us, __ATOMIC_RELAXED);
+}
+
+/* Upper bound (exclusive) of a latency bucket in microseconds */
+uint64_t flb_metrics_hdr_bound(int bucket)
+{
+    int shift = 0;
+
+    if (bucket >= 2 * FLB_METRICS_HDR_SUB) {
+        shift = (bucket / FLB_METRICS_HDR_SUB) - 1;
+    }
+    return (uint64_t) (bucket - (shift * FLB_METRICS_HDR_SUB) + 1) << shift;
+}
+
+/* Highest value of the bucket that holds the given percentile */
+static uint64_t hdr_percentile(uint64_t *buckets, uint64_t count, int pct)
+{
+    int i;
+    uint64_t total = 0;
+
+    for (i = 0; i < FLB_METRICS_HDR_SIZE; i++) {
+        total += buckets[i];
+        if (total > 0 && total * 100 >= count * pct) {
+            return flb_metrics_hdr_bound(i) - 1;
+        }
+    }
+    return 0;
+}
+
+/* Summarize a latency histogram */
+void flb_metrics_hdr_get(struct flb_metrics_hdr *h,
+                         struct flb_metrics_lat *out)
+{
+    int i;
+    uint64_t buckets[FLB_METRICS_HDR_SIZE];
+
+    memset(out, '\0', sizeof(struct flb_metrics_lat));
+    out->sum = __atomic_load_n(&h->sum, __ATOMIC_RELAXED);
+    for (i = 0; i < FLB_METRICS_HDR_SIZE; i++) {
+        buckets[i] = __atomic_load_n(&h->buckets[i], __ATOMIC_RELAXED);
+        out->count += buckets[i];
+        if (buckets[i] > 0) {
+            out->max = flb_metrics_hdr_bound(i) - 1;
+        }
+    }
+
+    if (out->count > 0) {
+        out->p50 = hdr_percentile(buckets, out->count, 50);
+        out->p90 = hdr_percentile(buckets, out->count, 90);
+        out->p99 = hdr_percentile(buckets, out->count, 99);
+    }
+}
+
+/*
+ * The connection pools and the task map are only modified by the engine
+ * thread, the reader loads every value once with a relaxed atomic load.
+ */
+#define LOAD(v)   __atomic_load_n(&(v), __ATOMIC_RELAXED)
+
+static void snapshot_upstreams(struct flb_output_instance *o,
+                               struct flb_metrics_snapshot_ins *si)
+{
+    struct mk_list *head;
+    struct flb_upstream *u;
+    uint64_t *v = si->upstream;
+
+    mk_list_foreach(head, &o->upstreams) {
+        u = mk_list_entry(head, struct flb_upstream, _head_ins);
+        si->upstreams++;
+        v[FLB_METRIC_UP_CONNECTIONS] += LOAD(u->n_connections);
+        v[FLB_METRIC_UP_HITS]        += LOAD(u->stats.hits);
+        v[FLB_METRIC_UP_MISSES]      += LOAD(u->stats.misses);
+        v[FLB_METRIC_UP_EVICTIONS]   += LOAD(u->stats.evictions);
+        v[FLB_METRIC_UP_WAITS]       += LOAD(u->stats.waits);
+        v[FLB_METRIC_UP_TIMEOUTS]    += LOAD(u->stats.timeouts);
+        v[FLB_METRIC_UP_TLS_FULL]    += LOAD(u->stats.tls_full);
+        v[FLB_METRIC_UP_TLS_RESUMED] += LOAD(u->stats.tls_resumed);
+    }
+}
+
+static void snapshot_ins(struct flb_metrics *m,
+                         struct flb_metrics_snapshot_ins *si)
+{
+    int i;
+
+    si->type  = m->type;
+    si->title = m->title;
+    for (i = 0; i < FLB_METRICS_SIZE; i++) {
+        si->val[i] = flb_metrics_get(m, i);
+    }
+    flb_metrics_hist_get(&m->flush, &si->flush);
+    for (i = 0; i < FLB_METRICS_LAT_SIZE; i++) {
+        if (flb_metrics_lat_enabled(m, i)) {
+            flb_metrics_hdr_get(&m->latency[i], &si->latency[i]);
+        }
+    }
+}
+
+int flb_metrics_snapshot_create(struct flb_config *config,
+                                struct flb_metrics_snapshot *s)
+{
+    int i;
+    int n;
+    struct mk_list *head;
+    struct flb_input_instance *in;
+    struct flb_output_instance *o;
+#ifdef FLB_HAVE_BUFFERING
+    struct flb_buffer_worker *worker;
+#endif
+
+    memset(s, '\0', sizeof(struct flb_metrics_snapshot));
+
+    /* Instances */
+    n = mk_list_size(&config->inputs) + mk_list_size(&config->outputs);
+    if (n > 0) {
+        s->ins = calloc(n, sizeof(struct flb_metrics_snapshot_ins));
+        if (!s->ins) {
+            perror("calloc");
+            return -1;
+        }
+    }
+
+    mk_list_foreach(head, &config->inputs) {
+        in = mk_list_entry(head, struct flb_input_instance, _head);
+        snapshot_ins(&in->metrics, &s->ins[s->n_ins++]);
+    }
+    mk_list_foreach(head, &config->outputs) {
+        o = mk_list_entry(head, struct flb_output_instance, _head);
+        snapshot_upstreams(o, &s->ins[s->n_ins]);
+        snapshot_ins(&o->metrics, &s->ins[s->n_ins++]);
+    }
+
+    s->latency_sampling = config->latency_sampling;
+
+    /* Task map occupancy */
+    s->tasks_max = FLB_TASK_MAP_SIZE;
+    for (i = 0; i < FLB_TASK_MAP_SIZE; i++) {
+        if (LOAD(config->tasks_map[i].task)) {
+            s->tasks++;
+        }
+    }
+
+#ifdef FLB_HAVE_BUFFERING
+    if (config->buffer_ctx) {
+        mk_list_foreach(head, &config->buffer_ctx->workers) {
+            worker = mk_list_entry(head, struct flb_buffer_worker, _head);
+            s->buffer_queue += LOAD(worker->pending);
+        }
+    }
+#endif
+
+    return 0;
+}
+
+void flb_metrics_snapshot_destroy(struct flb_metrics_snapshot *s)
+{
+    free(s->ins);
+    s->ins = NULL;
+    s->n_ins = 0;
+}
+
+static void write_fmt(msgpack_sbuffer *out, const char *fmt, ...)
+{
+    int len;
+    char buf[256];
+    va_list args;
+
+    va_start(args, fmt);
+    len = vsnprintf(buf, sizeof(buf), fmt, args);
+    va_end(args);
+
+    if (len >= (int) sizeof(buf)) {
+        len = sizeof(buf) - 1;
+    }
+    msgpack_sbuffer_write(out, buf, len);
+}
+
+static void json_values(msgpack_sbuffer *out, struct flb_metric_desc *desc,
+                        int size, uint64_t *val, int type)
+{
+    int i;
+    int n = 0;
+
+    for (i = 0; i < size; i++) {
+        if (!(desc[i].instances & type)) {
+            continue;
+        }
+        if (desc[i].type == FLB_METRIC_GAUGE) {
+            write_fmt(out, "%s\"%s\":%" PRIi64, n++ > 0 ? "," : "",
+                      desc[i].name, (int64_t) val[i]);
+        }
+        else {
+            write_fmt(out, "%s\"%s\":%" PRIu64, n++ > 0 ? "," : "",
+                      desc[i].name, val[i]);
+        }
+    }
+}
+
+/* Last histogram bucket (besides the overflow one) with data */
+static int hist_last(struct flb_metrics_hist *h)
+{
+    int i;
+    int last = 0;
+
+    for (i = 0; i < FLB_METRICS_HIST_SIZE - 1; i++) {
+        if (h->buckets[i] > 0) {
+            last = i;
+        }
+    }
+    return last;
+}
+
+static void json_latency(msgpack_sbuffer *out,
+                         struct flb_metrics_snapshot_ins *si)
+{
+    int i;
+    int n = 0;
+    struct flb_metrics_lat *l;
+
+    write_fmt(out, ",\"latency\":{");
+    for (i = 0; i < FLB_METRICS_LAT_SIZE; i++) {
+        if (!(latency_desc[i].instances & si->type)) {
+            continue;
+        }
+        l = &si->latency[i];
+        write_fmt(out, "%s\"%s\":{\"count\":%" PRIu64 ",\"sum_us\":%" PRIu64
+                  ",\"p50_us\":%" PRIu64 ",\"p90_us\":%" PRIu64
+                  ",\"p99_us\":%" PRIu64 ",\"max_us\":%" PRIu64 "}",
+                  n++ > 0 ? "," : "", latency_desc[i].name,
+                  l->count, l->sum, l->p50, l->p90, l->p99, l->max);
+    }
+    msgpack_sbuffer_write(out, "}", 1);
+}
+
+static void json_ins(msgpack_sbuffer *out, struct flb_metrics_snapshot *s,
+                     struct flb_metrics_snapshot_ins *si)
+{
+    int i;
+    int last;
+    uint64_t total = 0;
+    struct flb_metrics_hist *h = &si->flush;
+
+    write_fmt(out, "\"%s\":{", si->title);
+    json_values(out, metrics_desc, FLB_METRICS_SIZE, si->val, si->type);
+
+    /* Only when latency tracing is enabled */
+    if (s->latency_sampling > 0) {
+        json_latency(out, si);
+    }
+
+    if (si->type == FLB_METRICS_OUTPUT) {
+        /* Cumulative buckets up to the last one used */
+        last = hist_last(h);
+        write_fmt(out, ",\"flush_latency\":{\"count\":%" PRIu64
+                  ",\"sum_us\":%" PRIu64 ",\"buckets\":{",
+                  h->count, h->sum);
+        for (i = 0; i <= last; i++) {
+            total += h->buckets[i];
+            write_fmt(out, "\"%" PRIu64 "\":%" PRIu64 ",",
+                      flb_metrics_hist_bound(i), total);
+        }
+        write_fmt(out, "\"+Inf\":%" PRIu64 "}}", h->count);
+
+        if (si->upstreams > 0) {
+            write_fmt(out, ",\"upstream\":{");
+            json_values(out, upstream_desc, FLB_METRICS_UP_SIZE,
+                        si->upstream, si->type);
+            msgpack_sbuffer_write(out, "}", 1);
+        }
+    }
+    msgpack_sbuffer_write(out, "}", 1);
+}
+
+/*
+ * Compose a JSON map with the metrics of every input and output instance
+ * and the engine:
+ *
+ *   {"input": {"cpu.0": {"records": 10, ...}}, "output": {...},
+ *    "engine": {"tasks": 1, "tasks_max": 2048, "buffer_queue": 0}}
+ */
+int flb_metrics_snapshot_json(struct flb_metrics_snapshot *s,
+                              msgpack_sbuffer *out)
+{
+    int i;
+    int type;
+    int n;
+
+    for (type = FLB_METRICS_INPUT; type <= FLB_METRICS_OUTPUT; type++) {
+        write_fmt(out, type == FLB_METRICS_INPUT ? "{\"input\":{" :
+                  "},\"output\":{");
+        n = 0;
+        for (i = 0; i < s->n_ins; i++) {
+            if (s->ins[i].type != type) {
+                continue;
+            }
+            if (n++ > 0) {
+                msgpack_sbuffer_write(out, ",", 1);
+            }
+            json_ins(out, s, &s->ins[i]);
+        }
+    }
+    write_fmt(out, "},\"engine\":{\"tasks\":%i,\"tasks_max\":%i,"
+              "\"buffer_queue\":%i}}",
+              s->tasks, s->tasks_max, s->buffer_queue);
+
+    return 0;
+}
+
+static char *prom_type(int type)
+{
+    return type == FLB_METRIC_GAUGE ? "gauge" : "counter";
+}
+
+/* One metric family for every instance of 'type' */
+static void prom_family(msgpack_sbuffer *out, struct flb_metrics_snapshot *s,
+                        int type, char *prefix, struct flb_metric_desc *d,
+                        int id, int upstream)
+{
+    int i;
+    char *suffix;
+    uint64_t val;
+    struct flb_metrics_snapshot_ins *si;
+
+    suffix = (d->type == FLB_METRIC_COUNTER) ? "_total" : "";
+    write_fmt(out, "# HELP fluentbit_%s_%s%s %s\n",
+              prefix, d->name, suffix, d->help);
+    write_fmt(out, "# TYPE fluentbit_%s_%s%s %s\n",
+              prefix, d->name, suffix, prom_type(d->type));
+
+    for (i = 0; i < s->n_ins; i++) {
+        si = &s->ins[i];
+        if (si->type != type || (upstream && si->upstreams == 0)) {
+            continue;
+        }
+        val = upstream ? si->upstream[id] : si->val[id];
+        if (d->type == FLB_METRIC_GAUGE) {
+            write_fmt(out, "fluentbit_%s_%s{name=\"%s\"} %" PRIi64 "\n",
+                      prefix, d->name, si->title, (int64_t) val);
+        }
+        else {
+            write_fmt(out, "fluentbit_%s_%s_total{name=\"%s\"} %" PRIu64 "\n",
+                      prefix, d->name, si->title, val);
+        }
+    }
+}
+
+static void prom_hist(msgpack_sbuffer *out, struct flb_metrics_snapshot *s)
+{
+    int i;
+    int b;
+    int last;
+    uint64_t total;
+    struct flb_metrics_hist *h;
+    struct flb_metrics_snapshot_ins *si;
+
+    write_fmt(out, "# HELP fluentbit_output_flush_latency_seconds "
+              "Duration of the flushes.\n"
+              "# TYPE fluentbit_output_flush_latency_seconds histogram\n");
+
+    for (i = 0; i < s->n_ins; i++) {
+        si = &s->ins[i];
+        if (si->type != FLB_METRICS_OUTPUT) {
+            continue;
+        }
+
+        h = &si->flush;
+        last = hist_last(h);
+        total = 0;
+        for (b = 0; b <= last; b++) {
+            total += h->buckets[b];
+            write_fmt(out, "fluentbit_output_flush_latency_seconds_bucket"
+                      "{name=\"%s\",le=\"%.6f\"} %" PRIu64 "\n",
+                      si->title, flb_metrics_hist_bound(b) / 1000000.0,
+                      total);
+        }
+        write_fmt(out, "fluentbit_output_flush_latency_seconds_bucket"
+                  "{name=\"%s\",le=\"+Inf\"} %" PRIu64 "\n"
+                  "fluentbit_output_flush_latency_seconds_sum"
+                  "{name=\"%s\"} %.6f\n"
+                  "fluentbit_output_flush_latency_seconds_count"
+                  "{name=\"%s\"} %" PRIu64 "\n",
+                  si->title, h->count,
+                  si->title, h->sum / 1000000.0,
+                  si->title, h->count);
+    }
+}
+
+/* Latency summaries of the instances of 'type', one series per stage */
+static void prom_latency(msgpack_sbuffer *out, struct flb_metrics_snapshot *s,
+                         int type, char *prefix)
+{
+    int i;
+    int id;
+    struct flb_metrics_lat *l;
+    struct flb_metrics_snapshot_ins *si;
+
+    write_fmt(out, "# HELP fluentbit_%s_latency_seconds "
+              "Latency of the sampled tasks per stage.\n"
+              "# TYPE fluentbit_%s_latency_seconds summary\n",
+              prefix, prefix);
+
+    for (i = 0; i < s->n_ins; i++) {
+        si = &s->ins[i];
+        if (si->type != type) {
+            continue;
+        }
+        for (id = 0; id < FLB_METRICS_LAT_SIZE; id++) {
+            if (!(latency_desc[id].instances & type)) {
+                continue;
+            }
+            l = &si->latency[id];
+            write_fmt(out, "fluentbit_%s_latency_seconds"
+                      "{name=\"%s\",stage=\"%s\",quantile=\"0.5\"} %.6f\n",
+                      prefix, si->title, latency_desc[id].name,
+                      l->p50 / 1000000.0);
+            write_fmt(out, "fluentbit_%s_latency_seconds"
+                      "{name=\"%s\",stage=\"%s\",quantile=\"0.9\"} %.6f\n",
+                      prefix, si->title, latency_desc[id].name,
+                      l->p90 / 1000000.0);
+            write_fmt(out, "fluentbit_%s_latency_seconds"
+                      "{name=\"%s\",stage=\"%s\",quantile=\"0.99\"} %.6f\n",
+                      prefix, si->title, latency_desc[id].name,
+                      l->p99 / 1000000.0);
+            write_fmt(out, "fluentbit_%s_latency_seconds_sum"
+                      "{name=\"%s\",stage=\"%s\"} %.6f\n"
+                      "fluentbit_%s_latency_seconds_count"
+                      "{name=\"%s\",stage=\"%s\"} %" PRIu64 "\n",
+                      prefix, si->title, latency_desc[id].name,
+                      l->sum / 1000000.0,
+                      prefix, si->title, latency_desc[id].name, l->count);
+        }
+    }
+}
+
+/* Render the snapshot in the Prometheus text exposition format */
+int flb_metrics_snapshot_prometheus(struct flb_metrics_snapshot *s,
+                                    msgpack_sbuffer *out)
+{
+    int i;
+
+    for (i = 0; i < FLB_METRICS_SIZE; i++) {
+        if (metrics_desc[i].instances & FLB_METRICS_INPUT) {
+            prom_family(out, s, FLB_METRICS_INPUT, "input",
+                        &metrics_desc[i], i, FLB_FALSE);
+        }
+    }
+    for (i = 0; i < FLB_METRICS_SIZE; i++) {
+        if (metrics_desc[i].instances & FLB_METRICS_OUTPUT) {
+            prom_family(out, s, FLB_METRICS_OUTPUT, "output",
+                        &metrics_desc[i], i, FLB_FALSE);
+        }
+    }
+    prom_hist(out, s);
+    if (s->latency_sampling > 0) {
+        prom_latency(out, s, FLB_METRICS_INPUT, "input");
+        prom_latency(out, s, FLB_METRICS_OUTPUT, "output");
+    }
+    for (i = 0; i < FLB_METRICS_UP_SIZE; i++) {
+        prom_family(out, s, FLB_METRICS_OUTPUT, "output_upstream",
+                    &upstream_desc[i], i, FLB_TRUE);
+    }
+
+    write_fmt(out,
+              "# HELP fluentbit_tasks Number of tasks in use.\n"
+              "# TYPE fluentbit_tasks gauge\n"
+              "fluentbit_tasks %i\n"
+              "# HELP fluentbit_tasks_max Maximum number of tasks.\n"
+              "# TYPE fluentbit_tasks_max gauge\n"
+              "fluentbit_tasks_max %i\n",
+              s->tasks, s->tasks_max);
+    write_fmt(out,
+              "# HELP fluentbit_buffer_queue Buffer requests pending.\n"
+              "# TYPE fluentbit_buffer_queue gauge\n"
+              "fluentbit_buffer_queue %i\n",
+              s->buffer_queue);
+
+    return 0;
+}
+
+int flb_metrics_dump_json(struct flb_config *config, msgpack_sbuffer *out)
+{
+    int ret;
+    struct flb_metrics_snapshot s;
+
+    ret = flb_metrics_snapshot_create(config, &s);
+    if (ret == -1) {
+        return -1;
+    }
+
+    flb_metrics_snapshot_json(&s, out);
+    flb_metrics_snapshot_destroy(&s);
+
+    return 0;
+}
@@ -0,0 +1,96 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Fluent Bit
+ *  ==========
+ *  Copyright (C) 2015-2016 Treasure Data Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <fluent-bit/flb_mpsc.h>
+
+/*
+ * The queue follows the design of Dmitry Vyukov's intrusive MPSC
+ * node-based queue: producers only perform an atomic exchange on the head,
+ * the consumer walks the list from the tail. A stub node is used so the
+ * queue is never empty from the producers point of view.
+ */
+
+void flb_mpsc_init(struct flb_mpsc_queue *q)
+{
+    q->stub.next = NULL;
+    q->head = &q->stub;
+    q->tail = &q->stub;
+}
+
+/* Enqueue a node, safe to be called from any thread */
+void flb_mpsc_push(struct flb_mpsc_queue *q, struct flb_mpsc_node *node)
+{
+    struct flb_mpsc_node *prev;
+
+    __atomic_store_n(&node->next, NULL, __ATOMIC_RELAXED);
+    prev = __atomic_exchange_n(&q->head, node, __ATOMIC_ACQ_REL);
+
+    /*
+     * Between the exchange and this store the queue is momentarily
+     * disconnected, the consumer will report it as empty until the link
+     * is visible.
+     */
+    __atomic_store_n(&prev->next, node, __ATOMIC_RELEASE);
+}
+
+/*
+ * Dequeue a node, it must be called always from the same consumer thread.
+ * Returns NULL if the queue is empty or a producer is still linking a node.
+ */
+struct flb_mpsc_node *flb_mpsc_pop(struct flb_mpsc_queue *q)
+{
+    struct flb_mpsc_node *tail;
+    struct flb_mpsc_node *next;
+    struct flb_mpsc_node *head;
+
+    tail = q->tail;
+    next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+
+    /* Skip the stub node */
+    if (tail == &q->stub) {
+        if (!next) {
+            return NULL;
+        }
+        q->tail = next;
+        tail = next;
+        next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+    }
+
+    if (next) {
+        q->tail = next;
+        return tail;
+    }
+
+    head = __atomic_load_n(&q->head, __ATOMIC_ACQUIRE);
+    if (tail != head) {
+        /* A producer is in the middle of a push */
+        return NULL;
+    }
+
+    /* Last node: re-insert the stub so the tail can be detached */
+    flb_mpsc_push(q, &q->stub);
+    next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+    if (next) {
+        q->tail = next;
+        return tail;
+    }
+
+    return NULL;
+}
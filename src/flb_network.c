@@ -121,6 +121,26 @@ int flb_net_socket_reset(int sockfd)
     return 0;
 }
 
+int flb_net_socket_reuseport(int sockfd)
+{
+#ifdef SO_REUSEPORT
+    int on = 1;
+    int ret;
+
+    ret = setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on));
+    if (ret == -1) {
+        perror("setsockopt");
+        return -1;
+    }
+
+    return 0;
+#else
+    (void) sockfd;
+    flb_error("[net] SO_REUSEPORT is not supported on this platform");
+    return -1;
+#endif
+}
+
 int flb_net_socket_tcp_nodelay(int sockfd)
 {
     int on = 1;
@@ -244,7 +264,7 @@ int flb_net_tcp_fd_connect(int fd, char *host, unsigned long port)
     return ret;
 }
 
-int flb_net_server(char *port, char *listen_addr)
+static int net_server(char *port, char *listen_addr, int reuseport)
 {
     int socket_fd = -1;
     int ret;
@@ -272,6 +292,14 @@ int flb_net_server(char *port, char *listen_addr)
         flb_net_socket_tcp_nodelay(socket_fd);
         flb_net_socket_reset(socket_fd);
 
+        if (reuseport == FLB_TRUE) {
+            ret = flb_net_socket_reuseport(socket_fd);
+            if (ret == -1) {
+                close(socket_fd);
+                continue;
+            }
+        }
+
         ret = flb_net_bind(socket_fd, rp->ai_addr, rp->ai_addrlen, 128);
         if(ret == -1) {
             flb_warn("Cannot listen on %s port %s", listen_addr, port);
@@ -289,6 +317,21 @@ int flb_net_server(char *port, char *listen_addr)
     return socket_fd;
 }
 
+int flb_net_server(char *port, char *listen_addr)
+{
+    return net_server(port, listen_addr, FLB_FALSE);
+}
+
+/*
+ * Create a server socket with SO_REUSEPORT enabled, many sockets can be
+ * bound to the same address and the kernel balance the new connections
+ * across them.
+ */
+int flb_net_server_reuseport(char *port, char *listen_addr)
+{
+    return net_server(port, listen_addr, FLB_TRUE);
+}
+
 int flb_net_bind(int socket_fd, const struct sockaddr *addr,
                  socklen_t addrlen, int backlog)
 {
@@ -195,9 +195,20 @@ struct flb_output_instance *flb_output_new(struct flb_config *config,
         instance->context     = NULL;
         instance->data        = data;
         instance->upstream    = NULL;
+        mk_list_init(&instance->upstreams);
         instance->match       = NULL;
         instance->retry_limit = 1;
         instance->host.name   = NULL;
+        flb_metrics_init(&instance->metrics, FLB_METRICS_OUTPUT,
+                         instance->name);
+
+        instance->keepalive              = FLB_TRUE;
+        instance->keepalive_idle_timeout = FLB_UPSTREAM_KA_IDLE_TIMEOUT;
+        instance->keepalive_max_lifetime = FLB_UPSTREAM_KA_MAX_LIFETIME;
+        instance->max_connections        = 0;
+        instance->connect_timeout        = FLB_UPSTREAM_CONNECT_TIMEOUT;
+        instance->write_timeout          = FLB_UPSTREAM_WRITE_TIMEOUT;
+        instance->read_timeout           = FLB_UPSTREAM_READ_TIMEOUT;
 
         instance->use_tls        = FLB_FALSE;
 #ifdef FLB_HAVE_TLS
@@ -258,6 +269,32 @@ int flb_output_set_property(struct flb_output_instance *out, char *k, char *v)
     else if (prop_key_check("retry_limit", k, len) == 0) {
         out->retry_limit = atoi(v);
     }
+    else if (prop_key_check("keepalive", k, len) == 0) {
+        if (strcasecmp(v, "true") == 0 || strcasecmp(v, "on") == 0) {
+            out->keepalive = FLB_TRUE;
+        }
+        else {
+            out->keepalive = FLB_FALSE;
+        }
+    }
+    else if (prop_key_check("keepalive.idle_timeout", k, len) == 0) {
+        out->keepalive_idle_timeout = atoi(v);
+    }
+    else if (prop_key_check("keepalive.max_lifetime", k, len) == 0) {
+        out->keepalive_max_lifetime = atoi(v);
+    }
+    else if (prop_key_check("max_connections", k, len) == 0) {
+        out->max_connections = atoi(v);
+    }
+    else if (prop_key_check("connect_timeout", k, len) == 0) {
+        out->connect_timeout = atoi(v);
+    }
+    else if (prop_key_check("write_timeout", k, len) == 0) {
+        out->write_timeout = atoi(v);
+    }
+    else if (prop_key_check("read_timeout", k, len) == 0) {
+        out->read_timeout = atoi(v);
+    }
 #ifdef FLB_HAVE_TLS
     else if (prop_key_check("tls", k, len) == 0) {
         if (strcasecmp(v, "true") == 0 || strcasecmp(v, "on") == 0) {
@@ -341,13 +378,6 @@ int flb_output_init(struct flb_config *config)
         if (ret == -1) {
             return -1;
         }
-
-
-#ifdef FLB_HAVE_STATS
-        //struct flb_stats *stats;
-        //stats = &out->stats;
-        //stats->n = -1;
-#endif
     }
 
     return 0;
@@ -359,6 +389,23 @@ void flb_output_set_context(struct flb_output_instance *ins, void *context)
     ins->context = context;
 }
 
+/* Apply the instance connection settings to an upstream created by a plugin */
+void flb_output_upstream_set(struct flb_upstream *u,
+                             struct flb_output_instance *ins)
+{
+    u->keepalive              = ins->keepalive;
+    u->keepalive_idle_timeout = ins->keepalive_idle_timeout;
+    u->keepalive_max_lifetime = ins->keepalive_max_lifetime;
+    u->max_connections        = ins->max_connections;
+    u->connect_timeout        = ins->connect_timeout;
+    u->write_timeout          = ins->write_timeout;
+    u->read_timeout           = ins->read_timeout;
+
+    /* Expose the connection pool statistics of the instance */
+    mk_list_del(&u->_head_ins);
+    mk_list_add(&u->_head_ins, &ins->upstreams);
+}
+
 /* Check that at least one Output is enabled */
 int flb_output_check(struct flb_config *config)
 {
@@ -19,6 +19,9 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <inttypes.h>
+#include <float.h>
+#include <time.h>
 
 #include <fluent-bit/flb_error.h>
 #include <fluent-bit/flb_utils.h>
@@ -26,256 +29,1502 @@
 #include <fluent-bit/flb_info.h>
 
 #include <msgpack.h>
-#include <jsmn/jsmn.h>
 
-static int json_tokenise(char *js, size_t len,
-                         struct flb_pack_state *state)
+#ifdef FLB_HAVE_SIMD
+#include <immintrin.h>
+#endif
+
+/*
+ * JSON to MessagePack encoder
+ * ===========================
+ * The JSON input is parsed in a single pass and every value is serialized
+ * straight into the caller msgpack_sbuffer, there are no intermediate
+ * tokens. Since MessagePack requires the number of entries of a map or an
+ * array before it content, a 5 bytes header is reserved when a container
+ * starts and it's compacted once the container is closed.
+ *
+ * Strings are packed as 'bin' (as the previous jsmn based packer did) and
+ * escape sequences are decoded, \uXXXX sequences are converted to UTF-8.
+ */
+
+#define JSON_MAX_DEPTH    256     /* maximum nesting level   */
+#define JSON_NUM_MAX      128     /* maximum number length   */
+
+struct json_ctx {
+    const char *p;                /* current position         */
+    const char *end;              /* end of the input buffer  */
+    msgpack_sbuffer *sbuf;        /* output buffer            */
+    msgpack_packer pck;           /* packer for scalar values */
+};
+
+static int json_value(struct json_ctx *ctx, int depth);
+
+/* Make sure the output buffer have room for 'n' more bytes */
+static inline int out_reserve(msgpack_sbuffer *sbuf, size_t n)
+{
+    size_t size;
+    char *tmp;
+
+    if (sbuf->alloc - sbuf->size >= n) {
+        return 0;
+    }
+
+    size = sbuf->alloc ? sbuf->alloc * 2 : MSGPACK_SBUFFER_INIT_SIZE;
+    while (size < sbuf->size + n) {
+        size *= 2;
+    }
+
+    tmp = realloc(sbuf->data, size);
+    if (!tmp) {
+        perror("realloc");
+        return -1;
+    }
+    sbuf->data  = tmp;
+    sbuf->alloc = size;
+
+    return 0;
+}
+
+/*
+ * String scanners: return the position of the first byte that needs
+ * attention inside a string: a quote, a backslash or a control character.
+ */
+static inline const char *scan_string_scalar(const char *p, const char *end)
+{
+    unsigned char c;
+
+    while (p < end) {
+        c = (unsigned char) *p;
+        if (c == '"' || c == '\\' || c < 0x20) {
+            return p;
+        }
+        p++;
+    }
+    return end;
+}
+
+#ifdef FLB_HAVE_SIMD
+static const char *scan_string_sse2(const char *p, const char *end)
+{
+    int mask;
+    __m128i v;
+    __m128i m;
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i bslash = _mm_set1_epi8('\\');
+    const __m128i ctrl = _mm_set1_epi8(0x1f);
+
+    while (end - p >= 16) {
+        v = _mm_loadu_si128((const __m128i *) p);
+        m = _mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, bslash));
+
+        /* v <= 0x1f  <=>  max(v, 0x1f) == 0x1f */
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(_mm_max_epu8(v, ctrl), ctrl));
+        mask = _mm_movemask_epi8(m);
+        if (mask) {
+            return p + __builtin_ctz(mask);
+        }
+        p += 16;
+    }
+    return scan_string_scalar(p, end);
+}
+
+__attribute__((target("avx2")))
+static const char *scan_string_avx2(const char *p, const char *end)
+{
+    unsigned int mask;
+    __m256i v;
+    __m256i m;
+    const __m256i quote = _mm256_set1_epi8('"');
+    const __m256i bslash = _mm256_set1_epi8('\\');
+    const __m256i ctrl = _mm256_set1_epi8(0x1f);
+
+    while (end - p >= 32) {
+        v = _mm256_loadu_si256((const __m256i *) p);
+        m = _mm256_or_si256(_mm256_cmpeq_epi8(v, quote),
+                            _mm256_cmpeq_epi8(v, bslash));
+        m = _mm256_or_si256(m, _mm256_cmpeq_epi8(_mm256_max_epu8(v, ctrl),
+                                                 ctrl));
+        mask = (unsigned int) _mm256_movemask_epi8(m);
+        if (mask) {
+            return p + __builtin_ctz(mask);
+        }
+        p += 32;
+    }
+    return scan_string_sse2(p, end);
+}
+
+/* 0: not checked, 1: SSE2, 2: AVX2 */
+static int simd_level = 0;
+
+static inline const char *scan_string(const char *p, const char *end)
+{
+    if (simd_level == 0) {
+        __builtin_cpu_init();
+        simd_level = __builtin_cpu_supports("avx2") ? 2 : 1;
+    }
+
+    if (simd_level == 2) {
+        return scan_string_avx2(p, end);
+    }
+    return scan_string_sse2(p, end);
+}
+#else
+#define scan_string scan_string_scalar
+#endif
+
+static inline void skip_whitespace(struct json_ctx *ctx)
+{
+    const char *p = ctx->p;
+
+    while (p < ctx->end &&
+           (*p == ' ' || *p == '\n' || *p == '\r' || *p == '\t')) {
+        p++;
+    }
+    ctx->p = p;
+}
+
+/* Write a container header at 'off' and compact the reserved space */
+static void container_end(struct json_ctx *ctx, size_t off,
+                          uint32_t count, int is_map)
+{
+    int n;
+    char *h;
+    msgpack_sbuffer *sbuf = ctx->sbuf;
+
+    h = sbuf->data + off;
+    if (count < 16) {
+        h[0] = (is_map ? 0x80 : 0x90) | count;
+        n = 1;
+    }
+    else if (count < 65536) {
+        h[0] = is_map ? 0xde : 0xdc;
+        _msgpack_store16(h + 1, (uint16_t) count);
+        n = 3;
+    }
+    else {
+        h[0] = is_map ? 0xdf : 0xdd;
+        _msgpack_store32(h + 1, count);
+        n = 5;
+    }
+
+    if (n < 5) {
+        memmove(h + n, h + 5, sbuf->size - off - 5);
+        sbuf->size -= (5 - n);
+    }
+}
+
+/* Same as container_end() but for 'bin' headers */
+static void bin_end(struct json_ctx *ctx, size_t off, uint32_t len)
+{
+    int n;
+    char *h;
+    msgpack_sbuffer *sbuf = ctx->sbuf;
+
+    h = sbuf->data + off;
+    if (len < 256) {
+        h[0] = 0xc4;
+        h[1] = (uint8_t) len;
+        n = 2;
+    }
+    else if (len < 65536) {
+        h[0] = 0xc5;
+        _msgpack_store16(h + 1, (uint16_t) len);
+        n = 3;
+    }
+    else {
+        h[0] = 0xc6;
+        _msgpack_store32(h + 1, len);
+        n = 5;
+    }
+
+    if (n < 5) {
+        memmove(h + n, h + 5, len);
+        sbuf->size -= (5 - n);
+    }
+}
+
+static inline int hex_value(char c)
+{
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    else if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    else if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+/* Read 4 hex digits of a \uXXXX sequence */
+static inline int read_hex4(const char *p, uint32_t *out)
+{
+    int i;
+    int v;
+    uint32_t cp = 0;
+
+    for (i = 0; i < 4; i++) {
+        v = hex_value(p[i]);
+        if (v == -1) {
+            return -1;
+        }
+        cp = (cp << 4) | v;
+    }
+    *out = cp;
+    return 0;
+}
+
+static inline int utf8_encode(char *out, uint32_t cp)
+{
+    if (cp < 0x80) {
+        out[0] = cp;
+        return 1;
+    }
+    else if (cp < 0x800) {
+        out[0] = 0xc0 | (cp >> 6);
+        out[1] = 0x80 | (cp & 0x3f);
+        return 2;
+    }
+    else if (cp < 0x10000) {
+        out[0] = 0xe0 | (cp >> 12);
+        out[1] = 0x80 | ((cp >> 6) & 0x3f);
+        out[2] = 0x80 | (cp & 0x3f);
+        return 3;
+    }
+    out[0] = 0xf0 | (cp >> 18);
+    out[1] = 0x80 | ((cp >> 12) & 0x3f);
+    out[2] = 0x80 | ((cp >> 6) & 0x3f);
+    out[3] = 0x80 | (cp & 0x3f);
+    return 4;
+}
+
+/*
+ * Decode a string that contains escape sequences. 'q' points to the first
+ * byte that needs attention (a backslash), the output is written after a
+ * reserved 'bin' header which is compacted at the end.
+ */
+static int json_string_escaped(struct json_ctx *ctx, const char *start,
+                               const char *q)
+{
+    int n;
+    char c;
+    size_t off;
+    size_t len;
+    uint32_t cp;
+    uint32_t lo;
+    const char *p;
+    const char *end = ctx->end;
+    msgpack_sbuffer *sbuf = ctx->sbuf;
+
+    off = sbuf->size;
+    if (out_reserve(sbuf, 5 + (q - start)) == -1) {
+        return -1;
+    }
+    sbuf->size += 5;
+
+    p = start;
+    while (1) {
+        /* Copy the plain content found so far */
+        len = q - p;
+        if (out_reserve(sbuf, len + 4) == -1) {
+            return -1;
+        }
+        memcpy(sbuf->data + sbuf->size, p, len);
+        sbuf->size += len;
+        p = q;
+
+        if (p >= end) {
+            return FLB_ERR_JSON_PART;
+        }
+
+        c = *p;
+        if (c == '"') {
+            break;
+        }
+        else if ((unsigned char) c < 0x20) {
+            return FLB_ERR_JSON_INVAL;
+        }
+
+        /* Escape sequence */
+        if (p + 1 >= end) {
+            return FLB_ERR_JSON_PART;
+        }
+
+        c = p[1];
+        switch (c) {
+        case '"':
+        case '\\':
+        case '/':
+            break;
+        case 'b':
+            c = '\b';
+            break;
+        case 'f':
+            c = '\f';
+            break;
+        case 'n':
+            c = '\n';
+            break;
+        case 'r':
+            c = '\r';
+            break;
+        case 't':
+            c = '\t';
+            break;
+        case 'u':
+            if (end - p < 6) {
+                return FLB_ERR_JSON_PART;
+            }
+            if (read_hex4(p + 2, &cp) == -1) {
+                return FLB_ERR_JSON_INVAL;
+            }
+            p += 6;
+
+            if (cp >= 0xd800 && cp <= 0xdbff) {
+                /* High surrogate, it must be followed by a low one */
+                if (end - p < 6) {
+                    if (end - p == 0 || (p[0] == '\\' &&
+                                         (end - p == 1 || p[1] == 'u'))) {
+                        return FLB_ERR_JSON_PART;
+                    }
+                    cp = 0xfffd;
+                }
+                else if (p[0] == '\\' && p[1] == 'u' &&
+                         read_hex4(p + 2, &lo) == 0 &&
+                         lo >= 0xdc00 && lo <= 0xdfff) {
+                    cp = 0x10000 + ((cp - 0xd800) << 10) + (lo - 0xdc00);
+                    p += 6;
+                }
+                else {
+                    cp = 0xfffd;
+                }
+            }
+            else if (cp >= 0xdc00 && cp <= 0xdfff) {
+                /* Lone low surrogate */
+                cp = 0xfffd;
+            }
+
+            n = utf8_encode(sbuf->data + sbuf->size, cp);
+            sbuf->size += n;
+            q = scan_string(p, end);
+            continue;
+        default:
+            return FLB_ERR_JSON_INVAL;
+        }
+
+        sbuf->data[sbuf->size++] = c;
+        p += 2;
+        q = scan_string(p, end);
+    }
+
+    bin_end(ctx, off, sbuf->size - off - 5);
+    ctx->p = p + 1;
+
+    return 0;
+}
+
+static int json_string(struct json_ctx *ctx)
+{
+    size_t len;
+    const char *start;
+    const char *q;
+
+    /* skip the opening quote */
+    start = ctx->p + 1;
+    q = scan_string(start, ctx->end);
+    if (q >= ctx->end) {
+        return FLB_ERR_JSON_PART;
+    }
+
+    if (*q == '"') {
+        /* Fast path: no escape sequences */
+        len = q - start;
+        msgpack_pack_bin(&ctx->pck, len);
+        msgpack_pack_bin_body(&ctx->pck, start, len);
+        ctx->p = q + 1;
+        return 0;
+    }
+    else if (*q != '\\') {
+        /* control characters must be escaped */
+        return FLB_ERR_JSON_INVAL;
+    }
+
+    return json_string_escaped(ctx, start, q);
+}
+
+static int json_number(struct json_ctx *ctx)
+{
+    int neg = FLB_FALSE;
+    int is_float = FLB_FALSE;
+    int overflow = FLB_FALSE;
+    size_t len;
+    uint64_t val = 0;
+    char tmp[JSON_NUM_MAX];
+    const char *p = ctx->p;
+    const char *end = ctx->end;
+    const char *start = p;
+
+    if (*p == '-') {
+        neg = FLB_TRUE;
+        p++;
+    }
+
+    if (p >= end) {
+        return FLB_ERR_JSON_PART;
+    }
+
+    /* Integer part */
+    if (*p == '0') {
+        p++;
+    }
+    else if (*p >= '1' && *p <= '9') {
+        while (p < end && *p >= '0' && *p <= '9') {
+            if (val > (UINT64_MAX - (*p - '0')) / 10) {
+                overflow = FLB_TRUE;
+            }
+            else {
+                val = (val * 10) + (*p - '0');
+            }
+            p++;
+        }
+    }
+    else {
+        return FLB_ERR_JSON_INVAL;
+    }
+
+    /* Fraction */
+    if (p < end && *p == '.') {
+        is_float = FLB_TRUE;
+        p++;
+        if (p >= end) {
+            return FLB_ERR_JSON_PART;
+        }
+        if (*p < '0' || *p > '9') {
+            return FLB_ERR_JSON_INVAL;
+        }
+        while (p < end && *p >= '0' && *p <= '9') {
+            p++;
+        }
+    }
+
+    /* Exponent */
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        is_float = FLB_TRUE;
+        p++;
+        if (p < end && (*p == '+' || *p == '-')) {
+            p++;
+        }
+        if (p >= end) {
+            return FLB_ERR_JSON_PART;
+        }
+        if (*p < '0' || *p > '9') {
+            return FLB_ERR_JSON_INVAL;
+        }
+        while (p < end && *p >= '0' && *p <= '9') {
+            p++;
+        }
+    }
+
+    /* A number must be followed by a delimiter, it could continue */
+    if (p >= end) {
+        return FLB_ERR_JSON_PART;
+    }
+
+    if (is_float == FLB_TRUE || overflow == FLB_TRUE ||
+        (neg == FLB_TRUE && val > (uint64_t) INT64_MAX + 1)) {
+        len = p - start;
+        if (len >= sizeof(tmp)) {
+            return FLB_ERR_JSON_INVAL;
+        }
+        memcpy(tmp, start, len);
+        tmp[len] = '\0';
+        msgpack_pack_double(&ctx->pck, strtod(tmp, NULL));
+    }
+    else if (neg == FLB_TRUE) {
+        msgpack_pack_int64(&ctx->pck, (int64_t) (0 - val));
+    }
+    else {
+        msgpack_pack_uint64(&ctx->pck, val);
+    }
+
+    ctx->p = p;
+    return 0;
+}
+
+/* true, false and null */
+static inline int json_literal(struct json_ctx *ctx, const char *lit,
+                               size_t len)
+{
+    size_t avail;
+
+    avail = ctx->end - ctx->p;
+    if (avail < len) {
+        if (memcmp(ctx->p, lit, avail) == 0) {
+            return FLB_ERR_JSON_PART;
+        }
+        return FLB_ERR_JSON_INVAL;
+    }
+
+    if (memcmp(ctx->p, lit, len) != 0) {
+        return FLB_ERR_JSON_INVAL;
+    }
+
+    ctx->p += len;
+    return 0;
+}
+
+static int json_object(struct json_ctx *ctx, int depth)
+{
+    int ret;
+    size_t off;
+    uint32_t count = 0;
+
+    /* reserve space for the map header */
+    if (out_reserve(ctx->sbuf, 5) == -1) {
+        return -1;
+    }
+    off = ctx->sbuf->size;
+    ctx->sbuf->size += 5;
+
+    ctx->p++;
+    skip_whitespace(ctx);
+    if (ctx->p >= ctx->end) {
+        return FLB_ERR_JSON_PART;
+    }
+
+    if (*ctx->p == '}') {
+        ctx->p++;
+        container_end(ctx, off, 0, FLB_TRUE);
+        return 0;
+    }
+
+    while (1) {
+        /* key */
+        if (*ctx->p != '"') {
+            return FLB_ERR_JSON_INVAL;
+        }
+        ret = json_string(ctx);
+        if (ret != 0) {
+            return ret;
+        }
+
+        skip_whitespace(ctx);
+        if (ctx->p >= ctx->end) {
+            return FLB_ERR_JSON_PART;
+        }
+        if (*ctx->p != ':') {
+            return FLB_ERR_JSON_INVAL;
+        }
+        ctx->p++;
+
+        /* value */
+        ret = json_value(ctx, depth + 1);
+        if (ret != 0) {
+            return ret;
+        }
+        count++;
+
+        skip_whitespace(ctx);
+        if (ctx->p >= ctx->end) {
+            return FLB_ERR_JSON_PART;
+        }
+
+        if (*ctx->p == ',') {
+            ctx->p++;
+            skip_whitespace(ctx);
+            if (ctx->p >= ctx->end) {
+                return FLB_ERR_JSON_PART;
+            }
+            continue;
+        }
+        else if (*ctx->p == '}') {
+            ctx->p++;
+            break;
+        }
+        return FLB_ERR_JSON_INVAL;
+    }
+
+    container_end(ctx, off, count, FLB_TRUE);
+    return 0;
+}
+
+static int json_array(struct json_ctx *ctx, int depth)
+{
+    int ret;
+    size_t off;
+    uint32_t count = 0;
+
+    /* reserve space for the array header */
+    if (out_reserve(ctx->sbuf, 5) == -1) {
+        return -1;
+    }
+    off = ctx->sbuf->size;
+    ctx->sbuf->size += 5;
+
+    ctx->p++;
+    skip_whitespace(ctx);
+    if (ctx->p >= ctx->end) {
+        return FLB_ERR_JSON_PART;
+    }
+
+    if (*ctx->p == ']') {
+        ctx->p++;
+        container_end(ctx, off, 0, FLB_FALSE);
+        return 0;
+    }
+
+    while (1) {
+        ret = json_value(ctx, depth + 1);
+        if (ret != 0) {
+            return ret;
+        }
+        count++;
+
+        skip_whitespace(ctx);
+        if (ctx->p >= ctx->end) {
+            return FLB_ERR_JSON_PART;
+        }
+
+        if (*ctx->p == ',') {
+            ctx->p++;
+            continue;
+        }
+        else if (*ctx->p == ']') {
+            ctx->p++;
+            break;
+        }
+        return FLB_ERR_JSON_INVAL;
+    }
+
+    container_end(ctx, off, count, FLB_FALSE);
+    return 0;
+}
+
+static int json_value(struct json_ctx *ctx, int depth)
+{
+    int ret;
+
+    if (depth > JSON_MAX_DEPTH) {
+        return FLB_ERR_JSON_INVAL;
+    }
+
+    skip_whitespace(ctx);
+    if (ctx->p >= ctx->end) {
+        return FLB_ERR_JSON_PART;
+    }
+
+    switch (*ctx->p) {
+    case '{':
+        return json_object(ctx, depth);
+    case '[':
+        return json_array(ctx, depth);
+    case '"':
+        return json_string(ctx);
+    case 't':
+        ret = json_literal(ctx, "true", 4);
+        if (ret == 0) {
+            msgpack_pack_true(&ctx->pck);
+        }
+        return ret;
+    case 'f':
+        ret = json_literal(ctx, "false", 5);
+        if (ret == 0) {
+            msgpack_pack_false(&ctx->pck);
+        }
+        return ret;
+    case 'n':
+        ret = json_literal(ctx, "null", 4);
+        if (ret == 0) {
+            msgpack_pack_nil(&ctx->pck);
+        }
+        return ret;
+    default:
+        if (*ctx->p == '-' || (*ctx->p >= '0' && *ctx->p <= '9')) {
+            return json_number(ctx);
+        }
+    }
+
+    return FLB_ERR_JSON_INVAL;
+}
+
+/*
+ * Convert the JSON messages found in 'js' and append them to 'sbuf'. The
+ * number of bytes of the complete messages processed is set in 'consumed'
+ * and 'count' gets the number of messages.
+ *
+ * If the last message is incomplete, it's not packed and the return value
+ * is FLB_ERR_JSON_PART. On invalid content FLB_ERR_JSON_INVAL is returned,
+ * in both cases the messages before are kept in the output buffer.
+ */
+static int json_pack(const char *js, size_t len, msgpack_sbuffer *sbuf,
+                     size_t *consumed, int *count)
+{
+    int ret = 0;
+    size_t mark;
+    struct json_ctx ctx;
+
+    ctx.p    = js;
+    ctx.end  = js + len;
+    ctx.sbuf = sbuf;
+    msgpack_packer_init(&ctx.pck, sbuf, msgpack_sbuffer_write);
+
+    *consumed = 0;
+    *count = 0;
+
+    while (1) {
+        skip_whitespace(&ctx);
+        *consumed = (ctx.p - js);
+        if (ctx.p >= ctx.end) {
+            break;
+        }
+
+        mark = sbuf->size;
+        ret = json_value(&ctx, 0);
+        if (ret != 0) {
+            /* discard the incomplete or invalid message */
+            sbuf->size = mark;
+            break;
+        }
+        (*count)++;
+    }
+
+    if (ret == 0 && *count == 0) {
+        /* nothing but whitespaces */
+        return FLB_ERR_JSON_PART;
+    }
+
+    return ret;
+}
+
+/* Convert JSON messages and append the MessagePack output to 'sbuf' */
+int flb_pack_json_sbuffer(char *js, size_t len, msgpack_sbuffer *sbuf,
+                          size_t *consumed)
 {
     int ret;
-    int n;
-    void *tmp;
+    int count;
+    size_t size;
 
-    ret = jsmn_parse(&state->parser, js, len,
-                     state->tokens, state->tokens_size);
+    size = sbuf->size;
+    ret = json_pack(js, len, sbuf, consumed, &count);
+    if (ret != 0 && count > 0 && ret == FLB_ERR_JSON_PART) {
+        /* some messages were complete */
+        return 0;
+    }
+    else if (ret != 0) {
+        sbuf->size = size;
+    }
 
-    while (ret == JSMN_ERROR_NOMEM) {
-        n = state->tokens_size += 256;
-        tmp = realloc(state->tokens, sizeof(jsmntok_t) * n);
-        if (!tmp) {
-            perror("realloc");
-            return -1;
+    return ret;
+}
+
+/*
+ * It parse a JSON string and convert it to MessagePack format, this packer is
+ * useful when a complete JSON message exists, otherwise it will fail until
+ * the message is complete.
+ *
+ * The returned buffer is the one used by the encoder, no copies.
+ */
+int flb_pack_json(char *js, size_t len, char **buffer, int *size)
+{
+    int ret;
+    int count;
+    size_t consumed;
+    msgpack_sbuffer sbuf;
+
+    msgpack_sbuffer_init(&sbuf);
+    ret = json_pack(js, len, &sbuf, &consumed, &count);
+    if (ret != 0) {
+        msgpack_sbuffer_destroy(&sbuf);
+        return ret;
+    }
+
+    *size = sbuf.size;
+    *buffer = sbuf.data;
+
+    return 0;
+}
+
+/* Initialize a JSON packer state */
+int flb_pack_state_init(struct flb_pack_state *s)
+{
+    s->multiple = FLB_FALSE;
+    flb_pack_state_reset(s);
+
+    return 0;
+}
+
+/* Discard the scanner state, the buffer will be scanned from the start */
+void flb_pack_state_reset(struct flb_pack_state *s)
+{
+    s->consumed = 0;
+    s->offset = 0;
+    s->depth = 0;
+    s->in_string = FLB_FALSE;
+    s->in_escape = FLB_FALSE;
+    s->in_primitive = FLB_FALSE;
+}
+
+static inline int is_delimiter(char c)
+{
+    switch (c) {
+    case ' ':
+    case '\t':
+    case '\r':
+    case '\n':
+    case ',':
+    case ':':
+    case '"':
+    case '{':
+    case '}':
+    case '[':
+    case ']':
+        return FLB_TRUE;
+    }
+    return FLB_FALSE;
+}
+
+/*
+ * Scan the bytes not seen by previous calls looking for the end of the
+ * top level messages. The structure is only tracked (depth and strings),
+ * the content is validated later by the encoder. It returns the position
+ * where the last complete message ends or zero if none was found.
+ */
+static int pack_state_scan(char *js, size_t len, struct flb_pack_state *s,
+                           size_t *last_end)
+{
+    const char *p;
+    const char *end = js + len;
+
+    *last_end = 0;
+    p = js + s->offset;
+
+    while (p < end) {
+        if (s->in_string == FLB_TRUE) {
+            if (s->in_escape == FLB_TRUE) {
+                s->in_escape = FLB_FALSE;
+                p++;
+                continue;
+            }
+
+            p = scan_string(p, end);
+            if (p >= end) {
+                break;
+            }
+
+            if (*p == '\\') {
+                s->in_escape = FLB_TRUE;
+            }
+            else if (*p == '"') {
+                s->in_string = FLB_FALSE;
+                if (s->depth == 0) {
+                    *last_end = (p - js) + 1;
+                }
+            }
+            /* control characters are reported by the encoder */
+            p++;
+            continue;
+        }
+
+        if (s->in_primitive == FLB_TRUE) {
+            if (is_delimiter(*p) == FLB_FALSE) {
+                p++;
+                continue;
+            }
+
+            /*
+             * The delimiter is included so the encoder knows the number
+             * is complete, it's not consumed.
+             */
+            s->in_primitive = FLB_FALSE;
+            *last_end = (p - js) + 1;
+        }
+
+        switch (*p) {
+        case '"':
+            s->in_string = FLB_TRUE;
+            break;
+        case '{':
+        case '[':
+            s->depth++;
+            break;
+        case '}':
+        case ']':
+            s->depth--;
+            if (s->depth < 0) {
+                return FLB_ERR_JSON_INVAL;
+            }
+            else if (s->depth == 0) {
+                *last_end = (p - js) + 1;
+            }
+            break;
+        case ' ':
+        case '\t':
+        case '\r':
+        case '\n':
+        case ',':
+        case ':':
+            break;
+        default:
+            /* numbers and literals only matter at the top level */
+            if (s->depth == 0) {
+                s->in_primitive = FLB_TRUE;
+            }
         }
-        state->tokens = tmp;
-        state->tokens_size = n;
-        ret = jsmn_parse(&state->parser, js, len,
-                         state->tokens, state->tokens_size);
+        p++;
     }
 
-    if (ret == JSMN_ERROR_INVAL) {
-        return FLB_ERR_JSON_INVAL;
+    s->offset = len;
+    return 0;
+}
+
+/*
+ * It parse a JSON string and convert it to MessagePack format. The main
+ * difference of this function and the previous flb_pack_json() is that the
+ * incoming buffer may have multiple messages concatenated and likely the
+ * last one is incomplete: all the complete messages are packed and the
+ * number of bytes used is set in 'state->consumed'.
+ *
+ * The state remembers how far the buffer was scanned, so the caller must
+ * remove the consumed bytes and append new data after the remaining ones,
+ * then only the new bytes are scanned in the next call.
+ */
+int flb_pack_json_state(char *js, size_t len,
+                        char **buffer, int *size,
+                        struct flb_pack_state *state)
+{
+    int ret;
+    size_t last_end;
+    msgpack_sbuffer sbuf;
+
+    state->consumed = 0;
+    if (state->offset > len) {
+        /* the caller changed the buffer, start over */
+        flb_pack_state_reset(state);
+    }
+
+    ret = pack_state_scan(js, len, state, &last_end);
+    if (ret != 0) {
+        return ret;
     }
 
-    if (ret == JSMN_ERROR_PART) {
-        /* This is a partial JSON message, just stop */
-        flb_trace("[json tokenise] incomplete");
+    if (last_end == 0) {
+        flb_trace("[json pack] incomplete");
         return FLB_ERR_JSON_PART;
     }
 
-    state->tokens_count += ret;
+    msgpack_sbuffer_init(&sbuf);
+    ret = flb_pack_json_sbuffer(js, last_end, &sbuf, &state->consumed);
+    if (ret != 0) {
+        msgpack_sbuffer_destroy(&sbuf);
+        return ret;
+    }
+
+    /* whitespaces after the last message are consumed too */
+    while (state->consumed < len &&
+           (js[state->consumed] == ' ' || js[state->consumed] == '\n' ||
+            js[state->consumed] == '\r' || js[state->consumed] == '\t')) {
+        state->consumed++;
+    }
+
+    /* bytes of the remaining data already scanned */
+    state->offset = len - state->consumed;
+
+    *size = sbuf.size;
+    *buffer = sbuf.data;
+
     return 0;
 }
 
-static inline int is_float(char *buf, int len)
+/*
+ * MessagePack to JSON serializer
+ * ==============================
+ * The objects are written straight into a growable buffer, strings are
+ * escaped using the same scanner of the JSON encoder.
+ */
+
+static inline int json_write(msgpack_sbuffer *out, const char *buf, size_t len)
 {
-    char *end = buf + len;
-    char *p = buf;
+    if (out_reserve(out, len) == -1) {
+        return -1;
+    }
+    memcpy(out->data + out->size, buf, len);
+    out->size += len;
+    return 0;
+}
 
-    while (p <= end) {
-        if (*p == '.') {
-            return 1;
-        }
-        p++;
+static inline int json_write_char(msgpack_sbuffer *out, char c)
+{
+    if (out->size == out->alloc && out_reserve(out, 1) == -1) {
+        return -1;
     }
+    out->data[out->size++] = c;
     return 0;
 }
 
-/* Receive a tokenized JSON message and convert it to MsgPack */
-static char *tokens_to_msgpack(char *js,
-                               jsmntok_t *tokens, int arr_size, int *out_size)
+static int json_write_u64(msgpack_sbuffer *out, uint64_t val)
+{
+    int len;
+    char tmp[24];
+    char *p = tmp + sizeof(tmp);
+
+    do {
+        *--p = '0' + (val % 10);
+        val /= 10;
+    } while (val > 0);
+
+    len = (tmp + sizeof(tmp)) - p;
+    return json_write(out, p, len);
+}
+
+static int json_write_i64(msgpack_sbuffer *out, int64_t val)
+{
+    if (val < 0) {
+        if (json_write_char(out, '-') == -1) {
+            return -1;
+        }
+        return json_write_u64(out, (uint64_t) 0 - (uint64_t) val);
+    }
+    return json_write_u64(out, val);
+}
+
+static int json_write_double(msgpack_sbuffer *out, double val)
+{
+    int len;
+    char tmp[32];
+
+    /* NaN and Infinity are not valid JSON numbers */
+    if (val != val || val > DBL_MAX || val < -DBL_MAX) {
+        return json_write(out, "null", 4);
+    }
+
+    len = snprintf(tmp, sizeof(tmp), "%.16g", val);
+    return json_write(out, tmp, len);
+}
+
+/* Write the first 'digits' digits of a nanoseconds value, zero padded */
+static int json_write_frac(msgpack_sbuffer *out, long nsec, int digits)
 {
     int i;
-    int flen;
-    char *p;
-    char *buf;
-    jsmntok_t *t;
-    msgpack_packer pck;
-    msgpack_sbuffer sbuf;
+    char tmp[10];
 
-    /* initialize buffers */
-    msgpack_sbuffer_init(&sbuf);
-    msgpack_packer_init(&pck, &sbuf, msgpack_sbuffer_write);
+    tmp[0] = '.';
+    for (i = 9; i > digits; i--) {
+        nsec /= 10;
+    }
+    for (i = digits; i > 0; i--) {
+        tmp[i] = '0' + (nsec % 10);
+        nsec /= 10;
+    }
+
+    return json_write(out, tmp, digits + 1);
+}
+
+/* Write an escaped and quoted string, optionally replacing dots by '_' */
+static int json_write_string(msgpack_sbuffer *out, const char *str,
+                             size_t len, int sanitize)
+{
+    size_t n;
+    char *dot;
+    const char *p = str;
+    const char *q;
+    const char *end = str + len;
+    unsigned char c;
+    static const char hex[] = "0123456789abcdef";
 
-    for (i = 0; i < arr_size ; i++) {
-        t = &tokens[i];
+    /*
+     * Room for the string without escapes and its quotes, every segment
+     * reserves its escape sequence below.
+     */
+    if (out_reserve(out, len + 2) == -1) {
+        return -1;
+    }
+    out->data[out->size++] = '"';
+
+    while (p < end) {
+        q = scan_string(p, end);
+        n = q - p;
+
+        /* the plain bytes, an escape up to \u00XX and the closing quote */
+        if (out_reserve(out, n + 7) == -1) {
+            return -1;
+        }
+
+        if (n > 0) {
+            memcpy(out->data + out->size, p, n);
+            if (sanitize == FLB_TRUE) {
+                dot = out->data + out->size;
+                while ((dot = memchr(dot, '.',
+                                     (out->data + out->size + n) - dot))) {
+                    *dot++ = '_';
+                }
+            }
+            out->size += n;
+        }
 
-        if (t->start == -1 || t->end == -1 || (t->start == 0 && t->end == 0)) {
+        if (q >= end) {
             break;
         }
-        flen = (t->end - t->start);
 
-        switch (t->type) {
-        case JSMN_OBJECT:
-            msgpack_pack_map(&pck, t->size);
+        c = (unsigned char) *q;
+        out->data[out->size++] = '\\';
+        switch (c) {
+        case '"':
+        case '\\':
+            out->data[out->size++] = c;
+            break;
+        case '\b':
+            out->data[out->size++] = 'b';
+            break;
+        case '\f':
+            out->data[out->size++] = 'f';
             break;
-        case JSMN_ARRAY:
-            msgpack_pack_array(&pck, t->size);
+        case '\n':
+            out->data[out->size++] = 'n';
             break;
-        case JSMN_STRING:
-            msgpack_pack_bin(&pck, flen);
-            msgpack_pack_bin_body(&pck, js + t->start, flen);
+        case '\r':
+            out->data[out->size++] = 'r';
             break;
-        case JSMN_PRIMITIVE:
-            p = js + t->start;
-            if (*p == 'f') {
-                msgpack_pack_false(&pck);
+        case '\t':
+            out->data[out->size++] = 't';
+            break;
+        default:
+            out->data[out->size++] = 'u';
+            out->data[out->size++] = '0';
+            out->data[out->size++] = '0';
+            out->data[out->size++] = hex[c >> 4];
+            out->data[out->size++] = hex[c & 0xf];
+        }
+        p = q + 1;
+    }
+
+    return json_write_char(out, '"');
+}
+
+static int msgpack_object_to_json(msgpack_sbuffer *out, msgpack_object *o,
+                                  int sanitize)
+{
+    int ret = 0;
+    uint32_t i;
+    msgpack_object *k;
+    struct flb_time t;
+
+    switch (o->type) {
+    case MSGPACK_OBJECT_NIL:
+        return json_write(out, "null", 4);
+    case MSGPACK_OBJECT_BOOLEAN:
+        if (o->via.boolean) {
+            return json_write(out, "true", 4);
+        }
+        return json_write(out, "false", 5);
+    case MSGPACK_OBJECT_POSITIVE_INTEGER:
+        return json_write_u64(out, o->via.u64);
+    case MSGPACK_OBJECT_NEGATIVE_INTEGER:
+        return json_write_i64(out, o->via.i64);
+    case MSGPACK_OBJECT_FLOAT:
+        return json_write_double(out, o->via.f64);
+    case MSGPACK_OBJECT_STR:
+        return json_write_string(out, o->via.str.ptr, o->via.str.size,
+                                 FLB_FALSE);
+    case MSGPACK_OBJECT_BIN:
+        return json_write_string(out, o->via.bin.ptr, o->via.bin.size,
+                                 FLB_FALSE);
+    case MSGPACK_OBJECT_ARRAY:
+        ret = json_write_char(out, '[');
+        for (i = 0; i < o->via.array.size && ret == 0; i++) {
+            if (i > 0) {
+                json_write_char(out, ',');
             }
-            else if (*p == 't') {
-                msgpack_pack_true(&pck);
+            ret = msgpack_object_to_json(out, &o->via.array.ptr[i],
+                                         FLB_FALSE);
+        }
+        if (ret == 0) {
+            ret = json_write_char(out, ']');
+        }
+        return ret;
+    case MSGPACK_OBJECT_MAP:
+        ret = json_write_char(out, '{');
+        for (i = 0; i < o->via.map.size && ret == 0; i++) {
+            if (i > 0) {
+                json_write_char(out, ',');
             }
-            else if (*p == 'n') {
-                msgpack_pack_nil(&pck);
+
+            /* JSON keys must be strings */
+            k = &o->via.map.ptr[i].key;
+            if (k->type == MSGPACK_OBJECT_STR || k->type == MSGPACK_OBJECT_BIN) {
+                ret = json_write_string(out, k->via.str.ptr, k->via.str.size,
+                                        sanitize);
             }
             else {
-                if (is_float(p, flen)) {
-                    msgpack_pack_double(&pck, atof(p));
-                }
-                else {
-                    msgpack_pack_int64(&pck, atol(p));
-                }
+                json_write_char(out, '"');
+                ret = msgpack_object_to_json(out, k, FLB_FALSE);
+                json_write_char(out, '"');
             }
-            break;
-        case JSMN_UNDEFINED:
-            msgpack_sbuffer_destroy(&sbuf);
-            return NULL;
+            json_write_char(out, ':');
+            if (ret == 0) {
+                ret = msgpack_object_to_json(out, &o->via.map.ptr[i].val,
+                                             FLB_FALSE);
+            }
+        }
+        if (ret == 0) {
+            ret = json_write_char(out, '}');
+        }
+        return ret;
+    case MSGPACK_OBJECT_EXT:
+        /* EventTime timestamps are written as seconds with a fraction */
+        if (o->via.ext.type == FLB_TIME_EVENTTIME_TYPE &&
+            flb_time_pop_from_msgpack(&t, o) == 0) {
+            ret = json_write_i64(out, t.tm.tv_sec);
+            if (ret == 0) {
+                ret = json_write_frac(out, t.tm.tv_nsec, 9);
+            }
+            return ret;
         }
+
+        /* other extension types have no JSON representation */
+        return json_write(out, "null", 4);
+    default:
+        return json_write(out, "null", 4);
     }
 
-    /* dump data back to a new buffer */
-    *out_size = sbuf.size;
-    buf = malloc(sbuf.size);
-    memcpy(buf, sbuf.data, sbuf.size);
-    msgpack_sbuffer_destroy(&sbuf);
+    return ret;
+}
+
+/* Convert a MessagePack object to JSON and append it to 'out' */
+int flb_msgpack_to_json(msgpack_sbuffer *out, msgpack_object *o)
+{
+    return msgpack_object_to_json(out, o, FLB_FALSE);
+}
 
-    return buf;
+/* Initialize the record formatting options */
+void flb_pack_json_fmt_init(struct flb_pack_json_fmt *fmt)
+{
+    memset(fmt, '\0', sizeof(struct flb_pack_json_fmt));
+    fmt->date_key = "date";
+    fmt->date_format = FLB_PACK_JSON_DATE_EPOCH;
+    fmt->date_cache = -1;
 }
 
 /*
- * It parse a JSON string and convert it to MessagePack format, this packer is
- * useful when a complete JSON message exists, otherwise it will fail until
- * the message is complete.
- *
- * This routine do not keep a state in the parser, do not use it for big
- * JSON messages.
+ * Write the date value with 'date_precision' fraction digits. For ISO8601
+ * the formatted seconds of the last date are cached, only the fraction
+ * changes between records of the same second.
  */
-int flb_pack_json(char *js, size_t len, char **buffer, int *size)
+static int json_write_date(msgpack_sbuffer *out, struct flb_time *time,
+                           struct flb_pack_json_fmt *fmt)
 {
     int ret;
-    int out;
-    char *buf;
-    struct flb_pack_state state;
+    struct tm tm;
 
-    ret = flb_pack_state_init(&state);
-    if (ret != 0) {
-        return -1;
-    }
-    ret = json_tokenise(js, len, &state);
-    if (ret != 0) {
-        goto flb_pack_json_end;
+    if (fmt->date_format == FLB_PACK_JSON_DATE_EPOCH) {
+        ret = json_write_i64(out, time->tm.tv_sec);
+        if (ret == 0 && fmt->date_precision > 0) {
+            ret = json_write_frac(out, time->tm.tv_nsec, fmt->date_precision);
+        }
+        return ret;
     }
 
-    buf = tokens_to_msgpack(js, state.tokens, state.tokens_count, &out);
-    if (!buf) {
-        ret = -1;
-        goto flb_pack_json_end;
+    if (time->tm.tv_sec != fmt->date_cache) {
+        gmtime_r(&time->tm.tv_sec, &tm);
+        fmt->date_len = strftime(fmt->date_buf, sizeof(fmt->date_buf),
+                                 "\"%Y-%m-%dT%H:%M:%S", &tm);
+        fmt->date_cache = time->tm.tv_sec;
     }
 
-    *size = out;
-    *buffer = buf;
-
-    ret = 0;
- flb_pack_json_end:
-    flb_pack_state_reset(&state);
+    ret = json_write(out, fmt->date_buf, fmt->date_len);
+    if (ret == 0 && fmt->date_precision > 0) {
+        ret = json_write_frac(out, time->tm.tv_nsec, fmt->date_precision);
+    }
+    if (ret == 0) {
+        ret = json_write(out, "Z\"", 2);
+    }
     return ret;
 }
 
-/* Initialize a JSON packer state */
-int flb_pack_state_init(struct flb_pack_state *s)
+/*
+ * Convert a record (the time and the map of a Fluent Bit entry) into a
+ * JSON map and append it to 'out'. Depending of the options, the 'date'
+ * and 'tag' fields are prepended and dots in keys are replaced.
+ */
+int flb_msgpack_record_to_json(msgpack_sbuffer *out, struct flb_time *time,
+                               msgpack_object *map,
+                               struct flb_pack_json_fmt *fmt)
 {
-    int size = 256;
+    int ret = 0;
+    int count = 0;
+    uint32_t i;
+    msgpack_object *k;
 
-    jsmn_init(&s->parser);
-    s->tokens = calloc(1, sizeof(jsmntok_t) * size);
-    if (!s->tokens) {
-        perror("calloc");
-        return -1;
+    json_write_char(out, '{');
+
+    if (fmt->date_key) {
+        json_write_string(out, fmt->date_key, strlen(fmt->date_key),
+                          FLB_FALSE);
+        json_write_char(out, ':');
+        json_write_date(out, time, fmt);
+        count++;
     }
-    s->tokens_size  = size;
-    s->tokens_count = 0;
 
-    return 0;
+    if (fmt->tag_key && fmt->tag) {
+        if (count > 0) {
+            json_write_char(out, ',');
+        }
+        json_write_string(out, fmt->tag_key, strlen(fmt->tag_key), FLB_FALSE);
+        json_write_char(out, ':');
+        json_write_string(out, fmt->tag, fmt->tag_len, FLB_FALSE);
+        count++;
+    }
+
+    if (map->type == MSGPACK_OBJECT_MAP) {
+        for (i = 0; i < map->via.map.size; i++) {
+            k = &map->via.map.ptr[i].key;
+            if (k->type != MSGPACK_OBJECT_BIN && k->type != MSGPACK_OBJECT_STR) {
+                continue;
+            }
+
+            if (count > 0) {
+                json_write_char(out, ',');
+            }
+            json_write_string(out, k->via.str.ptr, k->via.str.size,
+                              fmt->sanitize_keys);
+            json_write_char(out, ':');
+            ret = msgpack_object_to_json(out, &map->via.map.ptr[i].val,
+                                         FLB_FALSE);
+            if (ret == -1) {
+                return -1;
+            }
+            count++;
+        }
+    }
+
+    return json_write_char(out, '}');
 }
 
-void flb_pack_state_reset(struct flb_pack_state *s)
+static inline uint32_t mp_load(const unsigned char *p, int size)
 {
-    free(s->tokens);
-    s->tokens_size  = 0;
-    s->tokens_count = 0;
-}
+    int i;
+    uint32_t val = 0;
 
+    for (i = 0; i < size; i++) {
+        val = (val << 8) | p[i];
+    }
+    return val;
+}
 
 /*
- * It parse a JSON string and convert it to MessagePack format. The main
- * difference of this function and the previous flb_pack_json() is that it
- * keeps a parser and tokens state, allowing to process big messages and
- * resume the parsing process instead of start from zero.
+ * Count the complete MessagePack objects in the buffer without unpacking
+ * them: every object is skipped by its format byte and the nested items are
+ * tracked with a counter, no memory is allocated. Returns -1 if the buffer
+ * is corrupted, a truncated object at the end is not counted.
  */
-int flb_pack_json_state(char *js, size_t len,
-                        char **buffer, int *size,
-                        struct flb_pack_state *state)
+int flb_mp_count(const void *data, size_t bytes)
 {
-    int ret;
-    int out;
-    int delim = 0;
-    char *buf;
-    jsmntok_t *t;
-
-    ret = json_tokenise(js, len, state);
-    state->multiple = FLB_TRUE;
-    if (ret == FLB_ERR_JSON_PART && state->multiple == FLB_TRUE) {
-        /*
-         * If the caller enabled 'multiple' flag, it means that the incoming
-         * JSON message may have multiple messages concatenated and likely
-         * the last one is only incomplete.
-         *
-         * The following routine aims to determinate how many JSON messages
-         * are OK in the array of tokens, if any, process them and adjust
-         * the JSMN context/buffers.
-         */
-        int i;
-        int found = 0;
-
-        for (i = 1; i < state->tokens_size; i++) {
-            t = &state->tokens[i];
-            if (t->start < (state->tokens[i - 1]).start) {
-                break;
+    int count = 0;
+    int hlen;
+    size_t skip;
+    uint64_t pending = 0;
+    const unsigned char *p = data;
+    const unsigned char *end = p + bytes;
+    unsigned char c;
+
+    while (p < end) {
+        c = *p++;
+        hlen = 0;
+        skip = 0;
+
+        /* Nested item of a container */
+        if (pending > 0) {
+            pending--;
+        }
+
+        if (c <= 0x7f || c >= 0xe0 || c == 0xc0 || c == 0xc2 || c == 0xc3) {
+            /* fixint, nil, bool: the format byte is the object */
+        }
+        else if (c >= 0x80 && c <= 0x8f) {
+            pending += (c & 0x0f) * 2;
+        }
+        else if (c >= 0x90 && c <= 0x9f) {
+            pending += (c & 0x0f);
+        }
+        else if (c >= 0xa0 && c <= 0xbf) {
+            skip = (c & 0x1f);
+        }
+        else {
+            switch (c) {
+            case 0xc4: case 0xd9: hlen = 1; break;       /* bin 8, str 8   */
+            case 0xc5: case 0xda: hlen = 2; break;       /* bin 16, str 16 */
+            case 0xc6: case 0xdb: hlen = 4; break;       /* bin 32, str 32 */
+            case 0xc7: hlen = 1; skip = 1; break;        /* ext 8          */
+            case 0xc8: hlen = 2; skip = 1; break;        /* ext 16         */
+            case 0xc9: hlen = 4; skip = 1; break;        /* ext 32         */
+            case 0xcc: case 0xd0: skip = 1; break;
+            case 0xcd: case 0xd1: skip = 2; break;
+            case 0xca: case 0xce: case 0xd2: skip = 4; break;
+            case 0xcb: case 0xcf: case 0xd3: skip = 8; break;
+            case 0xd4: skip = 2; break;                  /* fixext 1       */
+            case 0xd5: skip = 3; break;
+            case 0xd6: skip = 5; break;
+            case 0xd7: skip = 9; break;
+            case 0xd8: skip = 17; break;
+            case 0xdc: case 0xde: hlen = 2; break;       /* array, map 16  */
+            case 0xdd: case 0xdf: hlen = 4; break;       /* array, map 32  */
+            default:
+                return -1;
+            }
+
+            if (hlen > end - p) {
+                return count;
             }
 
-            if (t->parent == -1 && (t->end != 0)) {
-                found++;
-                delim = i;
+            if (c >= 0xdc) {
+                pending += (uint64_t) mp_load(p, hlen) * (c >= 0xde ? 2 : 1);
+                skip = 0;
+            }
+            else {
+                skip += mp_load(p, hlen);
             }
+            p += hlen;
         }
 
-        if (found > 0) {
-            state->tokens_count += delim;
+        if (skip > (size_t) (end - p)) {
+            return count;
         }
-        else {
-            return ret;
+        p += skip;
+
+        /* A top level object is complete once its nested items were read */
+        if (pending == 0) {
+            count++;
         }
     }
-    else if (ret != 0) {
-        return ret;
-    }
 
-    buf = tokens_to_msgpack(js, state->tokens, state->tokens_count, &out);
-    if (!buf) {
-        return -1;
+    return count;
+}
+
+/*
+ * Print an entry, an EventTime timestamp is shown as seconds and
+ * nanoseconds instead of the raw extension bytes.
+ */
+void flb_pack_print_entry(FILE *out, msgpack_object *entry)
+{
+    struct flb_time t;
+    msgpack_object *o;
+
+    if (entry->type != MSGPACK_OBJECT_ARRAY || entry->via.array.size != 2 ||
+        entry->via.array.ptr[0].type != MSGPACK_OBJECT_EXT) {
+        msgpack_object_print(out, *entry);
+        return;
     }
 
-    *size = out;
-    *buffer = buf;
+    o = entry->via.array.ptr;
+    if (flb_time_pop_from_msgpack(&t, o) == -1) {
+        msgpack_object_print(out, *entry);
+        return;
+    }
 
-    return 0;
+    fprintf(out, "[%lu.%09lu, ",
+            (unsigned long) t.tm.tv_sec, (unsigned long) t.tm.tv_nsec);
+    msgpack_object_print(out, o[1]);
+    fprintf(out, "]");
 }
 
 void flb_pack_print(char *data, size_t bytes)
@@ -286,7 +1535,7 @@ void flb_pack_print(char *data, size_t bytes)
     msgpack_unpacked_init(&result);
     while (msgpack_unpack_next(&result, data, bytes, &off)) {
         printf("[%zd] ", cnt++);
-        msgpack_object_print(stdout, result.data);
+        flb_pack_print_entry(stdout, &result.data);
         printf("\n");
     }
     msgpack_unpacked_destroy(&result);
@@ -25,6 +25,7 @@
 #include <fluent-bit/flb_output.h>
 #include <fluent-bit/flb_router.h>
 #include <fluent-bit/flb_task.h>
+#include <fluent-bit/flb_pack.h>
 
 #ifdef FLB_HAVE_BUFFERING
 #include <fluent-bit/flb_sha1.h>
@@ -43,7 +44,7 @@ static int map_get_task_id(struct flb_config *config)
 {
     int i;
 
-    for (i = 0; i < sizeof(config->tasks_map); i++) {
+    for (i = 0; i < FLB_TASK_MAP_SIZE; i++) {
         if (config->tasks_map[i].task == NULL) {
             return i;
         }
@@ -59,11 +60,24 @@ static void map_set_task_id(int id, struct flb_task *task,
 
 }
 
+/*
+ * Get the retry of the task for the output instance, every new failure of
+ * the route reuses it and counts one more attempt.
+ */
 struct flb_task_retry *flb_task_retry_create(struct flb_task *task,
                                              struct flb_output_instance *o_ins)
 {
+    struct mk_list *head;
     struct flb_task_retry *retry;
 
+    mk_list_foreach(head, &task->retries) {
+        retry = mk_list_entry(head, struct flb_task_retry, _head);
+        if (retry->o_ins == o_ins) {
+            retry->attemps++;
+            return retry;
+        }
+    }
+
     retry = malloc(sizeof(struct flb_task_retry));
     if (!retry) {
         perror("malloc");
@@ -71,6 +85,8 @@ struct flb_task_retry *flb_task_retry_create(struct flb_task *task,
     }
 
     retry->attemps = 1;     /* It already failed once, that's why we are here */
+    retry->buf     = NULL;
+    retry->size    = 0;
     retry->o_ins   = o_ins;
     retry->parent  = task;
     mk_list_add(&retry->_head, &task->retries);
@@ -78,6 +94,21 @@ struct flb_task_retry *flb_task_retry_create(struct flb_task *task,
     return retry;
 }
 
+/*
+ * Start the latency tracing of a task, the records are considered collected
+ * on the first collection since the last flush of the input instance.
+ */
+static void task_trace(struct flb_task *task,
+                       struct flb_input_instance *i_ins)
+{
+    uint64_t now = flb_metrics_time();
+
+    task->trace = FLB_TRUE;
+    task->t_collect = i_ins->t_collect ? i_ins->t_collect : now;
+    flb_metrics_hdr_add(&i_ins->metrics.latency[FLB_METRIC_LAT_COLLECT],
+                        now - task->t_collect);
+}
+
 /* Create an engine task to handle the output plugin flushing work */
 struct flb_task *flb_task_create(char *buf,
                                  size_t size,
@@ -119,6 +150,7 @@ struct flb_task *flb_task_create(char *buf,
     task->tag       = strdup(tag);
     task->buf       = buf;
     task->size      = size;
+    task->records   = flb_mp_count(buf, size);
     task->i_ins     = i_ins;
     task->dt        = dt;
     task->config    = config;
@@ -127,6 +159,18 @@ struct flb_task *flb_task_create(char *buf,
     mk_list_init(&task->retries);
     mk_list_add(&task->_head, &i_ins->tasks);
 
+    /* Records are accounted once, when they leave the input instance */
+    if (task->records > 0) {
+        flb_metrics_add(&i_ins->metrics, FLB_METRIC_RECORDS, task->records);
+    }
+    flb_metrics_add(&i_ins->metrics, FLB_METRIC_BYTES, size);
+
+    /* Latency tracing, sample 1 of every N tasks */
+    if (config->latency_sampling > 0 &&
+        config->latency_count++ % config->latency_sampling == 0) {
+        task_trace(task, i_ins);
+    }
+
     /* Routes */
     if (!dt) {
         /* A non-dynamic tag input plugin have static routes */
@@ -204,6 +248,7 @@ void flb_task_destroy(struct flb_task *task)
     struct mk_list *tmp;
     struct mk_list *head;
     struct flb_task_route *route;
+    struct flb_task_retry *retry;
 
     flb_trace("[engine] destroy task_id=%i", task->id);
 
@@ -221,6 +266,14 @@ void flb_task_destroy(struct flb_task *task)
         free(route);
     }
 
+    /* Remove retries */
+    mk_list_foreach_safe(head, tmp, &task->retries) {
+        retry = mk_list_entry(head, struct flb_task_retry, _head);
+        mk_list_del(&retry->_head);
+        free(retry->buf);
+        free(retry);
+    }
+
     /* Unlink and release */
     mk_list_del(&task->_head);
     free(task->buf);
@@ -228,6 +281,20 @@ void flb_task_destroy(struct flb_task *task)
     free(task);
 }
 
+/*
+ * Hand the task buffer over to an output plugin that keeps it, only if
+ * 'buf' is that buffer and no other route uses it. Returns NULL otherwise.
+ */
+void *flb_task_buffer_take(struct flb_task *task, void *buf)
+{
+    if (buf != task->buf || mk_list_size(&task->routes) != 1) {
+        return NULL;
+    }
+
+    task->buf = NULL;
+    return buf;
+}
+
 /* Register a thread into the tasks list */
 void flb_task_add_thread(struct flb_thread *thread,
                          struct flb_task *task)
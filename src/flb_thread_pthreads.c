@@ -35,6 +35,9 @@ static void worker_init(void *data)
     p = o_ins->p;
 
     log = flb_log_init(0, th->config->verbose, NULL);
+    if (th->trace) {
+        th->t_start = flb_metrics_time();
+    }
 
     flb_trace("[pthread flush]");
     p->cb_flush(th->pth_cb.buf,
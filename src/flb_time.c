@@ -0,0 +1,109 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Fluent Bit
+ *  ==========
+ *  Copyright (C) 2015-2016 Treasure Data Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <msgpack.h>
+
+#include <fluent-bit/flb_time.h>
+
+int flb_time_get(struct flb_time *t)
+{
+    return clock_gettime(CLOCK_REALTIME, &t->tm);
+}
+
+/* Pack the timestamp, as an EventTime or as integer seconds */
+int flb_time_append_to_msgpack(struct flb_time *t, msgpack_packer *pck,
+                               int fmt)
+{
+    uint32_t tmp;
+    char ext[FLB_TIME_EVENTTIME_SIZE];
+
+    if (fmt == FLB_TIME_FMT_INT) {
+        return msgpack_pack_uint64(pck, t->tm.tv_sec);
+    }
+
+    tmp = htonl((uint32_t) t->tm.tv_sec);
+    memcpy(ext, &tmp, 4);
+    tmp = htonl((uint32_t) t->tm.tv_nsec);
+    memcpy(ext + 4, &tmp, 4);
+
+    msgpack_pack_ext(pck, FLB_TIME_EVENTTIME_SIZE, FLB_TIME_EVENTTIME_TYPE);
+    return msgpack_pack_ext_body(pck, ext, FLB_TIME_EVENTTIME_SIZE);
+}
+
+/* Read the timestamp of a record: integer, float or EventTime */
+int flb_time_pop_from_msgpack(struct flb_time *t, msgpack_object *obj)
+{
+    uint32_t tmp;
+    double d;
+
+    switch (obj->type) {
+    case MSGPACK_OBJECT_POSITIVE_INTEGER:
+        flb_time_set(t, (time_t) obj->via.u64, 0);
+        return 0;
+    case MSGPACK_OBJECT_NEGATIVE_INTEGER:
+        flb_time_set(t, (time_t) obj->via.i64, 0);
+        return 0;
+    case MSGPACK_OBJECT_FLOAT:
+        d = obj->via.f64;
+        t->tm.tv_sec  = (time_t) d;
+        t->tm.tv_nsec = (long) ((d - (double) t->tm.tv_sec) * 1000000000.0);
+        return 0;
+    case MSGPACK_OBJECT_EXT:
+        if (obj->via.ext.type != FLB_TIME_EVENTTIME_TYPE ||
+            obj->via.ext.size != FLB_TIME_EVENTTIME_SIZE) {
+            break;
+        }
+        memcpy(&tmp, obj->via.ext.ptr, 4);
+        t->tm.tv_sec = ntohl(tmp);
+        memcpy(&tmp, obj->via.ext.ptr + 4, 4);
+        t->tm.tv_nsec = ntohl(tmp);
+        return 0;
+    default:
+        break;
+    }
+
+    flb_time_set(t, 0, 0);
+    return -1;
+}
+
+/*
+ * Map a precision name to the number of fraction digits used when a
+ * timestamp is formatted: s, ms, us or ns. Returns -1 if unknown.
+ */
+int flb_time_precision(char *str)
+{
+    if (strcasecmp(str, "s") == 0) {
+        return 0;
+    }
+    else if (strcasecmp(str, "ms") == 0) {
+        return 3;
+    }
+    else if (strcasecmp(str, "us") == 0) {
+        return 6;
+    }
+    else if (strcasecmp(str, "ns") == 0) {
+        return 9;
+    }
+
+    return -1;
+}
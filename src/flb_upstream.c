@@ -18,13 +18,186 @@
  */
 
 #include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/socket.h>
 
 #include <mk_core.h>
+#include <fluent-bit/flb_engine.h>
+#include <fluent-bit/flb_thread.h>
 #include <fluent-bit/flb_upstream.h>
 #include <fluent-bit/flb_io.h>
 #include <fluent-bit/flb_io_tls.h>
 #include <fluent-bit/flb_tls.h>
 
+/* A caller waiting for a connection slot */
+struct flb_upstream_waiter {
+    void *thread;
+    struct mk_list _head;
+};
+
+static inline void queue_lock(struct flb_upstream *u)
+{
+#ifdef FLB_HAVE_FLUSH_PTHREADS
+    pthread_mutex_lock(&u->mutex_queue);
+#endif
+}
+
+static inline void queue_unlock(struct flb_upstream *u)
+{
+#ifdef FLB_HAVE_FLUSH_PTHREADS
+    pthread_mutex_unlock(&u->mutex_queue);
+#endif
+}
+
+#ifdef FLB_HAVE_FLUSH_UCONTEXT
+/*
+ * Event loop handler for the notification channel: every byte written
+ * represents a released slot, so resume as many waiters (in order).
+ */
+static int cb_upstream_notify(void *data)
+{
+    int i;
+    ssize_t bytes;
+    char buf[64];
+    struct mk_event *event = data;
+    struct flb_upstream *u;
+    struct flb_upstream_waiter *w;
+
+    u = mk_list_entry(event, struct flb_upstream, ev_notify);
+
+    bytes = read(u->ch_notify[0], buf, sizeof(buf));
+    if (bytes <= 0) {
+        return 0;
+    }
+
+    for (i = 0; i < bytes; i++) {
+        if (mk_list_is_empty(&u->waiters) == 0) {
+            break;
+        }
+        w = mk_list_entry_first(&u->waiters, struct flb_upstream_waiter, _head);
+        mk_list_del(&w->_head);
+
+        flb_trace("[upstream] resuming waiter thread=%p", w->thread);
+        flb_thread_resume(w->thread);
+    }
+
+    return 0;
+}
+#endif
+
+/* Let waiters know a connection slot or an idle connection is available */
+static void upstream_notify(struct flb_upstream *u)
+{
+#ifdef FLB_HAVE_FLUSH_PTHREADS
+    pthread_mutex_lock(&u->mutex_queue);
+    if (mk_list_is_empty(&u->waiters) != 0) {
+        pthread_cond_signal(&u->cond_queue);
+    }
+    pthread_mutex_unlock(&u->mutex_queue);
+#else
+    ssize_t bytes;
+
+    if (mk_list_is_empty(&u->waiters) == 0 || u->ch_notify[1] == -1) {
+        return;
+    }
+
+    bytes = write(u->ch_notify[1], "", 1);
+    if (bytes == -1) {
+        perror("write");
+    }
+#endif
+}
+
+/*
+ * Upstream timer handler: shut down the sockets of the connections waiting
+ * for longer than their deadline. The co-routine waiting on the socket is
+ * resumed by the event loop and the operation fails.
+ */
+static int cb_upstream_timeout(void *data)
+{
+    time_t now;
+    uint64_t val;
+    ssize_t bytes;
+    struct mk_list *tmp;
+    struct mk_list *head;
+    struct mk_event *event = data;
+    struct flb_upstream *u;
+    struct flb_upstream_conn *u_conn;
+
+    u = mk_list_entry(event, struct flb_upstream, ev_timeout);
+
+    bytes = read(u->timeout_fd, &val, sizeof(val));
+    if (bytes <= 0) {
+        return 0;
+    }
+
+    now = time(NULL);
+    mk_list_foreach_safe(head, tmp, &u->io_waits) {
+        u_conn = mk_list_entry(head, struct flb_upstream_conn, _head_io);
+        if (now < u_conn->io_deadline) {
+            continue;
+        }
+
+        flb_debug("[upstream] [fd=%i] %s:%i I/O timeout",
+                  u_conn->fd, u->tcp_host, u->tcp_port);
+        mk_list_del(&u_conn->_head_io);
+        u_conn->io_deadline = 0;
+        u_conn->io_timeout = FLB_TRUE;
+        u_conn->recycle = FLB_FALSE;
+        u->stats.timeouts++;
+        shutdown(u_conn->fd, SHUT_RDWR);
+    }
+
+    return 0;
+}
+
+/*
+ * Set the deadline of a socket wait, the connection is checked by the
+ * upstream timer (created on first use) until the deadline is cleared.
+ * Only used by co-routines in async mode.
+ */
+int flb_upstream_conn_timeout_set(struct flb_upstream_conn *u_conn,
+                                  int timeout)
+{
+    int fd;
+    struct mk_event *event;
+    struct flb_upstream *u = u_conn->u;
+
+    if (timeout <= 0 || !(u->flags & FLB_IO_ASYNC)) {
+        return 0;
+    }
+
+    if (u->timeout_fd == -1) {
+        event = &u->ev_timeout;
+        MK_EVENT_INIT(event, -1, u, cb_upstream_timeout);
+        fd = mk_event_timeout_create(u->evl, 1, 0, event);
+        if (fd == -1) {
+            flb_error("[upstream] could not create timeout timer");
+            return -1;
+        }
+
+        /* see flb_sched_request_create() */
+        event->type = FLB_ENGINE_EV_CUSTOM;
+        u->timeout_fd = fd;
+    }
+
+    if (u_conn->io_deadline == 0) {
+        mk_list_add(&u_conn->_head_io, &u->io_waits);
+    }
+    u_conn->io_deadline = time(NULL) + timeout;
+
+    return 0;
+}
+
+void flb_upstream_conn_timeout_clear(struct flb_upstream_conn *u_conn)
+{
+    if (u_conn->io_deadline > 0) {
+        mk_list_del(&u_conn->_head_io);
+        u_conn->io_deadline = 0;
+    }
+}
+
 /* Creates a new upstream context */
 struct flb_upstream *flb_upstream_create(struct flb_config *config,
                                          char *host, int port, int flags,
@@ -43,8 +216,21 @@ struct flb_upstream *flb_upstream_create(struct flb_config *config,
     u->flags         = flags;
     u->evl           = config->evl;
     u->n_connections = 0;
+    u->keepalive     = FLB_TRUE;
+    u->keepalive_idle_timeout = FLB_UPSTREAM_KA_IDLE_TIMEOUT;
+    u->keepalive_max_lifetime = FLB_UPSTREAM_KA_MAX_LIFETIME;
+    u->ch_notify[0]  = -1;
+    u->ch_notify[1]  = -1;
+    u->connect_timeout = FLB_UPSTREAM_CONNECT_TIMEOUT;
+    u->write_timeout   = FLB_UPSTREAM_WRITE_TIMEOUT;
+    u->read_timeout    = FLB_UPSTREAM_READ_TIMEOUT;
+    u->timeout_fd      = -1;
     mk_list_init(&u->av_queue);
     mk_list_init(&u->busy_queue);
+    mk_list_init(&u->waiters);
+    mk_list_init(&u->io_waits);
+    mk_list_init(&u->_head_ins);
+    flb_dns_cache_init(&u->dns);
 
     /*
      * If Fluent Bit was built with FLUSH_PTHREADS, means each operation inside
@@ -66,11 +252,44 @@ struct flb_upstream *flb_upstream_create(struct flb_config *config,
 
 #ifdef FLB_HAVE_FLUSH_PTHREADS
     pthread_mutex_init(&u->mutex_queue, NULL);
+    pthread_cond_init(&u->cond_queue, NULL);
 #endif
 
     return u;
 }
 
+/* Close the socket and release the connection resources */
+static void destroy_conn(struct flb_upstream_conn *u_conn)
+{
+    struct flb_upstream *u = u_conn->u;
+
+    if ((u->flags & FLB_IO_ASYNC) &&
+        (u_conn->event.status & MK_EVENT_REGISTERED)) {
+        mk_event_del(u->evl, &u_conn->event);
+    }
+
+#ifdef FLB_HAVE_TLS
+    if (u_conn->tls_session) {
+        tls_session_destroy(u_conn->tls_session);
+        u_conn->tls_session = NULL;
+    }
+#endif
+
+    flb_upstream_conn_timeout_clear(u_conn);
+
+    if (u_conn->fd > 0) {
+        close(u_conn->fd);
+    }
+    free(u_conn->http_buf);
+
+    queue_lock(u);
+    mk_list_del(&u_conn->_head);
+    u->n_connections--;
+    queue_unlock(u);
+
+    free(u_conn);
+}
+
 int flb_upstream_destroy(struct flb_upstream *u)
 {
     struct mk_list *tmp;
@@ -79,20 +298,62 @@ int flb_upstream_destroy(struct flb_upstream *u)
 
     mk_list_foreach_safe(head, tmp, &u->av_queue) {
         u_conn = mk_list_entry(head, struct flb_upstream_conn, _head);
-        flb_upstream_conn_release(u_conn);
+        destroy_conn(u_conn);
     }
 
     mk_list_foreach_safe(head, tmp, &u->busy_queue) {
         u_conn = mk_list_entry(head, struct flb_upstream_conn, _head);
-        flb_upstream_conn_release(u_conn);
+        destroy_conn(u_conn);
+    }
+
+    flb_debug("[upstream] %s:%i pool hits=%lu misses=%lu evictions=%lu "
+              "waits=%lu timeouts=%lu",
+              u->tcp_host, u->tcp_port,
+              u->stats.hits, u->stats.misses, u->stats.evictions,
+              u->stats.waits, u->stats.timeouts);
+
+#ifdef FLB_HAVE_TLS
+    if (u->flags & FLB_IO_TLS) {
+        flb_debug("[upstream] %s:%i tls handshakes full=%lu resumed=%lu",
+                  u->tcp_host, u->tcp_port,
+                  u->stats.tls_full, u->stats.tls_resumed);
     }
+    flb_tls_resume_destroy(u->tls_resume);
+#endif
 
+    if (u->dns_req) {
+        flb_dns_request_put(u->dns_req);
+    }
+
+    if (u->ch_notify[0] != -1) {
+        if (u->ev_notify.status & MK_EVENT_REGISTERED) {
+            mk_event_del(u->evl, &u->ev_notify);
+        }
+        close(u->ch_notify[0]);
+        close(u->ch_notify[1]);
+    }
+
+    if (u->timeout_fd != -1) {
+        mk_event_del(u->evl, &u->ev_timeout);
+        close(u->timeout_fd);
+    }
+
+#ifdef FLB_HAVE_FLUSH_PTHREADS
+    pthread_cond_destroy(&u->cond_queue);
+    pthread_mutex_destroy(&u->mutex_queue);
+#endif
+
+    mk_list_del(&u->_head_ins);
     free(u->tcp_host);
     free(u);
 
     return 0;
 }
 
+/*
+ * Create and connect a new connection. The caller already accounted
+ * the slot in 'n_connections'.
+ */
 static struct flb_upstream_conn *create_conn(struct flb_upstream *u)
 {
     int ret;
@@ -111,6 +372,13 @@ static struct flb_upstream_conn *create_conn(struct flb_upstream *u)
     conn->u             = u;
     conn->fd            = -1;
     conn->connect_count = 0;
+    conn->recycle       = FLB_TRUE;
+    conn->handshake     = FLB_FALSE;
+    conn->thread        = NULL;
+    conn->http_buf      = NULL;
+    conn->http_buf_size = 0;
+    conn->io_deadline   = 0;
+    conn->io_timeout    = FLB_FALSE;
 #ifdef FLB_HAVE_TLS
     conn->tls_session   = NULL;
 #endif
@@ -120,75 +388,225 @@ static struct flb_upstream_conn *create_conn(struct flb_upstream *u)
     /* Start connection */
     ret = flb_io_net_connect(conn, th);
     if (ret == -1) {
+#ifdef FLB_HAVE_TLS
+        if (conn->tls_session) {
+            tls_session_destroy(conn->tls_session);
+        }
+#endif
         free(conn);
         return NULL;
     }
+    conn->ts_created   = time(NULL);
+    conn->ts_available = conn->ts_created;
 
-#ifdef FLB_HAVE_FLUSH_PTHREADS
-    pthread_mutex_lock(&u->mutex_queue);
-#endif
+    queue_lock(u);
 
     /* Link new connection to the busy queue */
     mk_list_add(&conn->_head, &u->busy_queue);
 
-#ifdef FLB_HAVE_FLUSH_PTHREADS
-    pthread_mutex_unlock(&u->mutex_queue);
-#endif
-
-    u->n_connections++;
+    queue_unlock(u);
 
     return conn;
 }
 
+/*
+ * Check an idle connection before handing it out: the peer may have
+ * closed it (FIN or RST) while it was sitting in the pool. An idle
+ * connection must not have any data pending either, otherwise it's
+ * something we don't expect (e.g: leftovers of a previous response).
+ */
+static int conn_is_alive(struct flb_upstream_conn *u_conn)
+{
+    char c;
+    ssize_t ret;
+
+    if (u_conn->fd <= 0) {
+        return FLB_FALSE;
+    }
+
+    ret = recv(u_conn->fd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+    if (ret == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        return FLB_TRUE;
+    }
+
+    return FLB_FALSE;
+}
+
+static int conn_is_expired(struct flb_upstream_conn *u_conn, time_t now)
+{
+    struct flb_upstream *u = u_conn->u;
+
+    if (u->keepalive_idle_timeout > 0 &&
+        now - u_conn->ts_available >= u->keepalive_idle_timeout) {
+        return FLB_TRUE;
+    }
+
+    if (u->keepalive_max_lifetime > 0 &&
+        now - u_conn->ts_created >= u->keepalive_max_lifetime) {
+        return FLB_TRUE;
+    }
+
+    return FLB_FALSE;
+}
+
+/*
+ * Take a connection from the 'av_queue'. Released connections are appended
+ * so the queue is sorted by idle time: expired ones are dropped from the
+ * head and the most recently used one is taken from the tail. Must be
+ * called with the queue lock held.
+ */
 static struct flb_upstream_conn *get_conn(struct flb_upstream *u)
 {
+    int alive;
+    time_t now;
     struct flb_upstream_conn *conn;
 
-#ifdef FLB_HAVE_FLUSH_PTHREADS
-    pthread_mutex_lock(&u->mutex_queue);
-#endif
-    /* Get the first available connection and increase the counter */
-    conn = mk_list_entry_first(&u->av_queue,
-                               struct flb_upstream_conn, _head);
-    u->n_connections++;
+    now = time(NULL);
+    while (mk_list_is_empty(&u->av_queue) != 0) {
+        conn = mk_list_entry_first(&u->av_queue,
+                                   struct flb_upstream_conn, _head);
+        if (conn_is_expired(conn, now) == FLB_FALSE) {
+            break;
+        }
+        mk_list_del(&conn->_head);
+        mk_list_add(&conn->_head, &u->busy_queue);
+        u->stats.evictions++;
+
+        flb_debug("[upstream] [fd=%i] idle connection to %s:%i expired",
+                  conn->fd, u->tcp_host, u->tcp_port);
+        queue_unlock(u);
+        destroy_conn(conn);
+        queue_lock(u);
+    }
 
-    /* Move it to the busy queue */
-    mk_list_del(&conn->_head);
-    mk_list_add(&conn->_head, &u->busy_queue);
+    while (mk_list_is_empty(&u->av_queue) != 0) {
+        conn = mk_list_entry_last(&u->av_queue,
+                                  struct flb_upstream_conn, _head);
 
-#ifdef FLB_HAVE_FLUSH_PTHREADS
-    pthread_mutex_unlock(&u->mutex_queue);
-#endif
+        /* Move it to the busy queue */
+        mk_list_del(&conn->_head);
+        mk_list_add(&conn->_head, &u->busy_queue);
 
-    return conn;
+        alive = conn_is_alive(conn);
+        if (alive == FLB_TRUE) {
+            conn->recycle = FLB_TRUE;
+            u->stats.hits++;
+            return conn;
+        }
+        u->stats.evictions++;
+
+        flb_debug("[upstream] [fd=%i] idle connection to %s:%i closed "
+                  "by peer", conn->fd, u->tcp_host, u->tcp_port);
+        queue_unlock(u);
+        destroy_conn(conn);
+        queue_lock(u);
+    }
+
+    return NULL;
+}
+
+/*
+ * Wait until a connection is released. Returns -1 if the caller cannot
+ * wait (not running inside a co-routine). Must be called with the queue
+ * lock held.
+ */
+static int wait_conn(struct flb_upstream *u)
+{
+    int ret;
+    struct flb_upstream_waiter w;
+
+#ifdef FLB_HAVE_FLUSH_UCONTEXT
+    w.thread = pthread_getspecific(flb_thread_key);
+    if (!w.thread || !(u->flags & FLB_IO_ASYNC)) {
+        return -1;
+    }
+
+    /* Lazy creation of the notification channel */
+    if (u->ch_notify[0] == -1) {
+        ret = pipe(u->ch_notify);
+        if (ret == -1) {
+            perror("pipe");
+            return -1;
+        }
+        fcntl(u->ch_notify[0], F_SETFL, O_NONBLOCK);
+        fcntl(u->ch_notify[1], F_SETFL, O_NONBLOCK);
+
+        MK_EVENT_INIT(&u->ev_notify, u->ch_notify[0], u, cb_upstream_notify);
+        ret = mk_event_add(u->evl, u->ch_notify[0],
+                           FLB_ENGINE_EV_CUSTOM, MK_EVENT_READ,
+                           &u->ev_notify);
+        if (ret == -1) {
+            close(u->ch_notify[0]);
+            close(u->ch_notify[1]);
+            u->ch_notify[0] = -1;
+            u->ch_notify[1] = -1;
+            return -1;
+        }
+    }
+
+    u->stats.waits++;
+    mk_list_add(&w._head, &u->waiters);
+    flb_trace("[upstream] thread=%p waiting for a connection to %s:%i",
+              w.thread, u->tcp_host, u->tcp_port);
+    flb_thread_yield(w.thread, FLB_FALSE);
+    return 0;
+#elif defined FLB_HAVE_FLUSH_PTHREADS
+    (void) ret;
+
+    w.thread = NULL;
+    u->stats.waits++;
+    mk_list_add(&w._head, &u->waiters);
+    pthread_cond_wait(&u->cond_queue, &u->mutex_queue);
+    mk_list_del(&w._head);
+    return 0;
+#else
+    (void) ret;
+    (void) w;
+    return -1;
+#endif
 }
 
 struct flb_upstream_conn *flb_upstream_conn_get(struct flb_upstream *u)
 {
+    int ret;
     struct flb_upstream_conn *u_conn = NULL;
 
-    /*
-     * FIXME: for 0.9 series the keep alive mode will be enabled, useless
-     * check now as the available queue is always empty.
-     */
-    if (mk_list_is_empty(&u->av_queue) == 0) {
+    queue_lock(u);
 
-        if (u->max_connections <= 0) {
-            u_conn = create_conn(u);
+    while (1) {
+        /* Reuse an idle connection if any */
+        u_conn = get_conn(u);
+        if (u_conn) {
+            queue_unlock(u);
+            flb_trace("[upstream] [fd=%i] reusing connection %p",
+                      u_conn->fd, u_conn);
+            return u_conn;
         }
-        else if (u->n_connections < u->max_connections) {
-            u_conn = create_conn(u);
+
+        if (u->max_connections <= 0 ||
+            u->n_connections < u->max_connections) {
+            break;
         }
-        else {
+
+        /* Limit reached, wait for a connection to be released */
+        ret = wait_conn(u);
+        if (ret == -1) {
+            queue_unlock(u);
             return NULL;
         }
     }
-    else {
-        /* Get an available connection */
-        u_conn = get_conn(u);
-    }
 
+    /* Reserve the slot before connecting, other callers may run meanwhile */
+    u->n_connections++;
+    u->stats.misses++;
+    queue_unlock(u);
+
+    u_conn = create_conn(u);
     if (!u_conn) {
+        queue_lock(u);
+        u->n_connections--;
+        queue_unlock(u);
+        upstream_notify(u);
         return NULL;
     }
 
@@ -199,30 +617,35 @@ int flb_upstream_conn_release(struct flb_upstream_conn *u_conn)
 {
     struct flb_upstream *u = u_conn->u;
 
-    flb_trace("[upstream] [fd=%i] releasing connection %p",
-              u_conn->fd, u_conn);
-
-    if (u->flags & FLB_IO_ASYNC) {
+    if ((u->flags & FLB_IO_ASYNC) &&
+        (u_conn->event.status & MK_EVENT_REGISTERED)) {
         mk_event_del(u->evl, &u_conn->event);
+        MK_EVENT_NEW(&u_conn->event);
     }
 
-    if (u_conn->fd > 0) {
-        close(u_conn->fd);
+    /* Keep the connection for a later use */
+    if (u->keepalive == FLB_TRUE && u_conn->recycle == FLB_TRUE &&
+        u_conn->fd > 0) {
+        u_conn->ts_available = time(NULL);
+        if (conn_is_expired(u_conn, u_conn->ts_available) == FLB_FALSE) {
+            flb_trace("[upstream] [fd=%i] keepalive connection %p",
+                      u_conn->fd, u_conn);
+
+            queue_lock(u);
+            mk_list_del(&u_conn->_head);
+            mk_list_add(&u_conn->_head, &u->av_queue);
+            queue_unlock(u);
+
+            upstream_notify(u);
+            return 0;
+        }
     }
 
-#ifdef FLB_HAVE_FLUSH_PTHREADS
-    pthread_mutex_lock(&u->mutex_queue);
-#endif
-
-    /* remove connection from the queue */
-    mk_list_del(&u_conn->_head);
-
-#ifdef FLB_HAVE_FLUSH_PTHREADS
-    pthread_mutex_unlock(&u->mutex_queue);
-#endif
+    flb_trace("[upstream] [fd=%i] releasing connection %p",
+              u_conn->fd, u_conn);
 
-    u->n_connections--;
-    free(u_conn);
+    destroy_conn(u_conn);
+    upstream_notify(u);
 
     return 0;
 }
@@ -0,0 +1,476 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Fluent Bit
+ *  ==========
+ *  Copyright (C) 2015-2016 Treasure Data Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+/*
+ * Upstream HA
+ * ===========
+ * An upstream group is a set of nodes (each one with its own upstream
+ * handler and connections pool) that can take the same data. A plugin asks
+ * the group for a node on every flush; if the flush fails it reports the
+ * error and asks again excluding the nodes already tried, so the data
+ * fails over to another node before the engine schedules a retry.
+ *
+ * The group is described in a file:
+ *
+ *   [UPSTREAM]
+ *       Name          forward-balancing
+ *       Policy        round_robin | least_inflight | weighted
+ *       Max_Failures  1
+ *       Backoff_Base  1
+ *       Backoff_Max   60
+ *
+ *   [NODE]
+ *       Name    node-1
+ *       Host    127.0.0.1
+ *       Port    24224
+ *       Weight  1
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include <mk_core.h>
+#include <fluent-bit/flb_info.h>
+#include <fluent-bit/flb_log.h>
+#include <fluent-bit/flb_macros.h>
+#include <fluent-bit/flb_upstream.h>
+#include <fluent-bit/flb_upstream_ha.h>
+
+#define get_key(a, b, c)   mk_rconf_section_get_key(a, b, c)
+#define n_get_key(a, b, c) (intptr_t) get_key(a, b, c)
+#define s_get_key(a, b, c) (char *) get_key(a, b, c)
+
+static inline void ha_lock(struct flb_upstream_ha *ha)
+{
+#ifdef FLB_HAVE_FLUSH_PTHREADS
+    pthread_mutex_lock(&ha->mutex);
+#endif
+}
+
+static inline void ha_unlock(struct flb_upstream_ha *ha)
+{
+#ifdef FLB_HAVE_FLUSH_PTHREADS
+    pthread_mutex_unlock(&ha->mutex);
+#endif
+}
+
+struct flb_upstream_ha *flb_upstream_ha_create(char *name)
+{
+    struct flb_upstream_ha *ha;
+
+    ha = calloc(1, sizeof(struct flb_upstream_ha));
+    if (!ha) {
+        perror("calloc");
+        return NULL;
+    }
+
+    ha->name = strdup(name);
+    ha->policy = FLB_UPSTREAM_HA_ROUND_ROBIN;
+    ha->max_failures = FLB_UPSTREAM_HA_MAX_FAILURES;
+    ha->backoff_base = FLB_UPSTREAM_HA_BACKOFF_BASE;
+    ha->backoff_max  = FLB_UPSTREAM_HA_BACKOFF_MAX;
+    mk_list_init(&ha->nodes);
+
+#ifdef FLB_HAVE_FLUSH_PTHREADS
+    pthread_mutex_init(&ha->mutex, NULL);
+#endif
+
+    return ha;
+}
+
+static void node_destroy(struct flb_upstream_node *node)
+{
+    if (node->u) {
+        flb_upstream_destroy(node->u);
+    }
+    free(node->name);
+    free(node->host);
+    free(node);
+}
+
+void flb_upstream_ha_destroy(struct flb_upstream_ha *ha)
+{
+    struct mk_list *tmp;
+    struct mk_list *head;
+    struct flb_upstream_node *node;
+
+    mk_list_foreach_safe(head, tmp, &ha->nodes) {
+        node = mk_list_entry(head, struct flb_upstream_node, _head);
+        mk_list_del(&node->_head);
+        node_destroy(node);
+    }
+
+#ifdef FLB_HAVE_FLUSH_PTHREADS
+    pthread_mutex_destroy(&ha->mutex);
+#endif
+
+    free(ha->name);
+    free(ha);
+}
+
+/* Convert a policy name to it numeric value, -1 if unknown */
+int flb_upstream_ha_policy(char *str)
+{
+    if (strcasecmp(str, "round_robin") == 0) {
+        return FLB_UPSTREAM_HA_ROUND_ROBIN;
+    }
+    else if (strcasecmp(str, "least_inflight") == 0) {
+        return FLB_UPSTREAM_HA_LEAST_INFLIGHT;
+    }
+    else if (strcasecmp(str, "weighted") == 0) {
+        return FLB_UPSTREAM_HA_WEIGHTED;
+    }
+
+    return -1;
+}
+
+struct flb_upstream_node *flb_upstream_node_create(char *name,
+                                                   char *host, int port,
+                                                   int weight,
+                                                   struct flb_config *config,
+                                                   int flags, void *tls)
+{
+    struct flb_upstream_node *node;
+
+    node = calloc(1, sizeof(struct flb_upstream_node));
+    if (!node) {
+        perror("calloc");
+        return NULL;
+    }
+
+    node->name   = strdup(name);
+    node->host   = strdup(host);
+    node->port   = port;
+    node->weight = weight > 0 ? weight : 1;
+
+    node->u = flb_upstream_create(config, host, port, flags, tls);
+    if (!node->u) {
+        node_destroy(node);
+        return NULL;
+    }
+
+    return node;
+}
+
+int flb_upstream_ha_node_add(struct flb_upstream_ha *ha,
+                             struct flb_upstream_node *node)
+{
+    if (ha->count >= FLB_UPSTREAM_HA_MAX_NODES) {
+        flb_error("[upstream_ha] '%s' max number of nodes is %i",
+                  ha->name, FLB_UPSTREAM_HA_MAX_NODES);
+        return -1;
+    }
+
+    node->id = ha->count++;
+    mk_list_add(&node->_head, &ha->nodes);
+    return 0;
+}
+
+static inline int node_available(struct flb_upstream_node *node,
+                                 uint64_t tried, time_t now)
+{
+    if (tried & (1ULL << node->id)) {
+        return FLB_FALSE;
+    }
+    if (node->ejected_until > now) {
+        return FLB_FALSE;
+    }
+    return FLB_TRUE;
+}
+
+/*
+ * Pick the first available node starting from the round-robin position,
+ * if 'inflight' is not negative only nodes with that number of flushes in
+ * progress are considered.
+ */
+static struct flb_upstream_node *ha_next(struct flb_upstream_ha *ha,
+                                         uint64_t tried, time_t now,
+                                         int inflight)
+{
+    struct mk_list *head;
+    struct flb_upstream_node *node;
+    struct flb_upstream_node *after = NULL;
+    struct flb_upstream_node *before = NULL;
+
+    mk_list_foreach(head, &ha->nodes) {
+        node = mk_list_entry(head, struct flb_upstream_node, _head);
+        if (node_available(node, tried, now) == FLB_FALSE) {
+            continue;
+        }
+        if (inflight >= 0 && node->inflight != inflight) {
+            continue;
+        }
+
+        if (node->id >= ha->index) {
+            after = node;
+            break;
+        }
+        else if (!before) {
+            before = node;
+        }
+    }
+
+    return after ? after : before;
+}
+
+static struct flb_upstream_node *ha_least_inflight(struct flb_upstream_ha *ha,
+                                                   uint64_t tried, time_t now)
+{
+    int min = -1;
+    struct mk_list *head;
+    struct flb_upstream_node *node;
+
+    mk_list_foreach(head, &ha->nodes) {
+        node = mk_list_entry(head, struct flb_upstream_node, _head);
+        if (node_available(node, tried, now) == FLB_FALSE) {
+            continue;
+        }
+        if (min == -1 || node->inflight < min) {
+            min = node->inflight;
+        }
+    }
+
+    if (min == -1) {
+        return NULL;
+    }
+
+    /* Ties are resolved in round-robin */
+    return ha_next(ha, tried, now, min);
+}
+
+/* Smooth weighted round-robin (as used by nginx) */
+static struct flb_upstream_node *ha_weighted(struct flb_upstream_ha *ha,
+                                             uint64_t tried, time_t now)
+{
+    int total = 0;
+    struct mk_list *head;
+    struct flb_upstream_node *node;
+    struct flb_upstream_node *best = NULL;
+
+    mk_list_foreach(head, &ha->nodes) {
+        node = mk_list_entry(head, struct flb_upstream_node, _head);
+        if (node_available(node, tried, now) == FLB_FALSE) {
+            continue;
+        }
+
+        node->current_weight += node->weight;
+        total += node->weight;
+        if (!best || node->current_weight > best->current_weight) {
+            best = node;
+        }
+    }
+
+    if (best) {
+        best->current_weight -= total;
+    }
+    return best;
+}
+
+/*
+ * Get a node to flush the data. 'tried' is a bitmask of the nodes already
+ * used by the caller for the same data, the returned node is added to it.
+ * Returns NULL if no healthy node is left.
+ */
+struct flb_upstream_node *flb_upstream_ha_node_get(struct flb_upstream_ha *ha,
+                                                   uint64_t *tried)
+{
+    time_t now;
+    struct flb_upstream_node *node;
+
+    now = time(NULL);
+
+    ha_lock(ha);
+    switch (ha->policy) {
+    case FLB_UPSTREAM_HA_LEAST_INFLIGHT:
+        node = ha_least_inflight(ha, *tried, now);
+        break;
+    case FLB_UPSTREAM_HA_WEIGHTED:
+        node = ha_weighted(ha, *tried, now);
+        break;
+    default:
+        node = ha_next(ha, *tried, now, -1);
+        break;
+    }
+
+    if (node) {
+        ha->index = node->id + 1;
+        node->inflight++;
+        *tried |= (1ULL << node->id);
+    }
+    ha_unlock(ha);
+
+    if (node) {
+        flb_trace("[upstream_ha] '%s' using node '%s'", ha->name, node->name);
+    }
+    return node;
+}
+
+/* Report the result of a flush done through 'node' */
+void flb_upstream_ha_node_done(struct flb_upstream_ha *ha,
+                               struct flb_upstream_node *node, int ok)
+{
+    int secs;
+
+    ha_lock(ha);
+    node->inflight--;
+
+    if (ok == FLB_TRUE) {
+        if (node->ejections > 0) {
+            flb_info("[upstream_ha] '%s' node '%s' recovered",
+                     ha->name, node->name);
+        }
+        node->failures  = 0;
+        node->ejections = 0;
+        ha_unlock(ha);
+        return;
+    }
+
+    /* A node back from an ejection is ejected again on the first error */
+    node->failures++;
+    if (node->failures < ha->max_failures && node->ejections == 0) {
+        ha_unlock(ha);
+        return;
+    }
+
+    secs = ha->backoff_base;
+    if (node->ejections < 16) {
+        secs = ha->backoff_base << node->ejections;
+    }
+    if (secs > ha->backoff_max || secs <= 0) {
+        secs = ha->backoff_max;
+    }
+
+    node->failures = 0;
+    node->ejections++;
+    node->ejected_until = time(NULL) + secs;
+    ha_unlock(ha);
+
+    flb_warn("[upstream_ha] '%s' node '%s' (%s:%i) ejected for %i seconds",
+             ha->name, node->name, node->host, node->port, secs);
+}
+
+/* Create an upstream group from a configuration file */
+struct flb_upstream_ha *flb_upstream_ha_from_file(char *file,
+                                                  struct flb_config *config,
+                                                  int flags, void *tls)
+{
+    int port;
+    int weight;
+    char *tmp;
+    char *name;
+    char *host;
+    struct mk_list *head;
+    struct mk_rconf *fconf;
+    struct mk_rconf_section *section;
+    struct flb_upstream_ha *ha = NULL;
+    struct flb_upstream_node *node;
+
+    fconf = mk_rconf_open(file);
+    if (!fconf) {
+        flb_error("[upstream_ha] cannot open file %s", file);
+        return NULL;
+    }
+
+    section = mk_rconf_section_get(fconf, "UPSTREAM");
+    if (!section) {
+        flb_error("[upstream_ha] missing [UPSTREAM] section in %s", file);
+        goto error;
+    }
+
+    name = s_get_key(section, "Name", MK_RCONF_STR);
+    if (!name) {
+        flb_error("[upstream_ha] missing Name in [UPSTREAM] section");
+        goto error;
+    }
+    ha = flb_upstream_ha_create(name);
+    free(name);
+    if (!ha) {
+        goto error;
+    }
+
+    tmp = s_get_key(section, "Policy", MK_RCONF_STR);
+    if (tmp) {
+        ha->policy = flb_upstream_ha_policy(tmp);
+        if (ha->policy == -1) {
+            flb_error("[upstream_ha] '%s' invalid policy '%s'", ha->name, tmp);
+            free(tmp);
+            goto error;
+        }
+        free(tmp);
+    }
+
+    if (n_get_key(section, "Max_Failures", MK_RCONF_NUM) > 0) {
+        ha->max_failures = n_get_key(section, "Max_Failures", MK_RCONF_NUM);
+    }
+    if (n_get_key(section, "Backoff_Base", MK_RCONF_NUM) > 0) {
+        ha->backoff_base = n_get_key(section, "Backoff_Base", MK_RCONF_NUM);
+    }
+    if (n_get_key(section, "Backoff_Max", MK_RCONF_NUM) > 0) {
+        ha->backoff_max = n_get_key(section, "Backoff_Max", MK_RCONF_NUM);
+    }
+
+    /* Read all [NODE] sections */
+    mk_list_foreach(head, &fconf->sections) {
+        section = mk_list_entry(head, struct mk_rconf_section, _head);
+        if (strcasecmp(section->name, "NODE") != 0) {
+            continue;
+        }
+
+        host = s_get_key(section, "Host", MK_RCONF_STR);
+        port = n_get_key(section, "Port", MK_RCONF_NUM);
+        if (!host || port <= 0) {
+            flb_error("[upstream_ha] '%s' node requires Host and Port",
+                      ha->name);
+            free(host);
+            goto error;
+        }
+
+        name = s_get_key(section, "Name", MK_RCONF_STR);
+        weight = n_get_key(section, "Weight", MK_RCONF_NUM);
+
+        node = flb_upstream_node_create(name ? name : host, host, port,
+                                        weight, config, flags, tls);
+        free(name);
+        free(host);
+        if (!node) {
+            goto error;
+        }
+
+        if (flb_upstream_ha_node_add(ha, node) == -1) {
+            node_destroy(node);
+            goto error;
+        }
+    }
+
+    if (ha->count == 0) {
+        flb_error("[upstream_ha] '%s' has no [NODE] sections", ha->name);
+        goto error;
+    }
+
+    mk_rconf_free(fconf);
+    return ha;
+
+ error:
+    if (ha) {
+        flb_upstream_ha_destroy(ha);
+    }
+    mk_rconf_free(fconf);
+    return NULL;
+}
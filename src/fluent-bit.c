@@ -265,6 +265,12 @@ static int flb_service_conf(struct flb_config *config, char *file)
         }
         free(v_str);
 
+        /* Latency tracing, 1 of every N tasks */
+        v_num = n_get_key(section, "Latency_Sampling", MK_RCONF_NUM);
+        if (v_num > 0) {
+            config->latency_sampling = v_num;
+        }
+
 #ifdef FLB_HAVE_HTTP
         /* HTTP Monitoring Server */
         v_num = n_get_key(section, "HTTP_Monitor", MK_RCONF_BOOL);
@@ -0,0 +1,253 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#ifndef FLB_TEST_DNS_STUB_H
+#define FLB_TEST_DNS_STUB_H
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <arpa/nameser.h>
+#include <strings.h>
+#include <unistd.h>
+#include <poll.h>
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*
+ * UDP name server on the loopback interface answering from a static zone
+ * of A, AAAA and CNAME records. A query following a CNAME gets the alias
+ * record plus the records of the target, the owner name of the records of
+ * the name asked uses a compression pointer to the question. Names not in
+ * the zone get NXDOMAIN. The records must be added before start().
+ */
+class DnsStub {
+public:
+    int fd;
+    int port;
+    std::atomic<int> queries;
+
+    DnsStub() : fd(-1), port(0), queries(0), running(false) {}
+
+    ~DnsStub() {
+        stop();
+    }
+
+    void add(const char *name, int type, int ttl, const char *data) {
+        struct record r;
+        unsigned char raw[16];
+
+        r.name = name;
+        r.type = type;
+        r.ttl  = ttl;
+        if (type == ns_t_a) {
+            inet_pton(AF_INET, data, raw);
+            r.data.assign((char *) raw, 4);
+        }
+        else if (type == ns_t_aaaa) {
+            inet_pton(AF_INET6, data, raw);
+            r.data.assign((char *) raw, 16);
+        }
+        else {
+            r.data = encode_name(data);
+        }
+        zone.push_back(r);
+    }
+
+    int start() {
+        struct sockaddr_in addr = server();
+        socklen_t len = sizeof(addr);
+
+        fd = socket(AF_INET, SOCK_DGRAM, 0);
+        if (fd == -1) {
+            return -1;
+        }
+        if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0) {
+            return -1;
+        }
+        getsockname(fd, (struct sockaddr *) &addr, &len);
+        port = ntohs(addr.sin_port);
+
+        running = true;
+        worker = std::thread(&DnsStub::serve, this);
+        return 0;
+    }
+
+    void stop() {
+        if (running) {
+            running = false;
+            worker.join();
+        }
+        if (fd != -1) {
+            close(fd);
+            fd = -1;
+        }
+    }
+
+    /* Address to hand to the resolver */
+    struct sockaddr_in server() {
+        struct sockaddr_in addr;
+
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = htons(port);
+        return addr;
+    }
+
+private:
+    struct record {
+        std::string name;
+        int type;
+        int ttl;
+        std::string data;
+    };
+
+    std::vector<struct record> zone;
+    std::atomic<bool> running;
+    std::thread worker;
+
+    static std::string encode_name(const std::string &name) {
+        size_t s = 0;
+        size_t e;
+        std::string out;
+
+        while (s < name.size()) {
+            e = name.find('.', s);
+            if (e == std::string::npos) {
+                e = name.size();
+            }
+            out += (char) (e - s);
+            out += name.substr(s, e - s);
+            s = e + 1;
+        }
+        out += '\0';
+        return out;
+    }
+
+    static void put16(std::string &out, int v) {
+        out += (char) ((v >> 8) & 0xff);
+        out += (char) (v & 0xff);
+    }
+
+    static void put_rr(std::string &out, const std::string &owner,
+                       const struct record &r) {
+        out += owner;
+        put16(out, r.type);
+        put16(out, ns_c_in);
+        put16(out, (r.ttl >> 16) & 0xffff);
+        put16(out, r.ttl & 0xffff);
+        put16(out, r.data.size());
+        out += r.data;
+    }
+
+    /* Build the answer for a query, an empty string drops it */
+    std::string answer(unsigned char *buf, int len) {
+        int i;
+        int ancount = 0;
+        int qtype;
+        int found = 0;
+        int aliased;
+        unsigned char *p = buf + NS_HFIXEDSZ;
+        unsigned char *end = buf + len;
+        std::string qname;
+        std::string name;
+        std::string body;
+        std::string out;
+
+        if (len < NS_HFIXEDSZ) {
+            return out;
+        }
+
+        /* Question: uncompressed labels, type and class */
+        while (p < end && *p != 0) {
+            if (!qname.empty()) {
+                qname += '.';
+            }
+            qname.append((char *) p + 1, *p);
+            p += *p + 1;
+        }
+        if (p + 1 + NS_QFIXEDSZ > end) {
+            return out;
+        }
+        p++;
+        qtype = (p[0] << 8) | p[1];
+        p += NS_QFIXEDSZ;
+
+        /* Follow the aliases, the first owner points to the question */
+        name = qname;
+        do {
+            aliased = 0;
+            for (i = 0; i < (int) zone.size(); i++) {
+                if (strcasecmp(zone[i].name.c_str(), name.c_str()) != 0) {
+                    continue;
+                }
+                found++;
+                if (zone[i].type == ns_t_cname ||
+                    zone[i].type == qtype) {
+                    put_rr(body, (name == qname) ?
+                           std::string("\xc0\x0c", 2) : encode_name(name),
+                           zone[i]);
+                    ancount++;
+                }
+                if (zone[i].type == ns_t_cname) {
+                    name = std::string();
+                    for (size_t s = 0; s < zone[i].data.size() - 1;
+                         s += zone[i].data[s] + 1) {
+                        if (!name.empty()) {
+                            name += '.';
+                        }
+                        name.append(zone[i].data, s + 1, zone[i].data[s]);
+                    }
+                    aliased = 1;
+                    break;
+                }
+            }
+        } while (aliased);
+
+        /* Header: same id, response, recursion available */
+        out.append((char *) buf, 2);
+        out += (char) (0x80 | (buf[2] & 0x01));
+        out += (char) (0x80 | (found ? 0 : ns_r_nxdomain));
+        put16(out, 1);
+        put16(out, ancount);
+        put16(out, 0);
+        put16(out, 0);
+        out.append((char *) buf + NS_HFIXEDSZ, p - (buf + NS_HFIXEDSZ));
+        out += body;
+        return out;
+    }
+
+    void serve() {
+        int n;
+        unsigned char buf[512];
+        std::string out;
+        struct pollfd pfd;
+        struct sockaddr_storage peer;
+        socklen_t len;
+
+        pfd.fd = fd;
+        pfd.events = POLLIN;
+        while (running) {
+            if (poll(&pfd, 1, 100) <= 0) {
+                continue;
+            }
+            len = sizeof(peer);
+            n = recvfrom(fd, buf, sizeof(buf), 0,
+                         (struct sockaddr *) &peer, &len);
+            if (n <= 0) {
+                continue;
+            }
+            queries++;
+            out = answer(buf, n);
+            if (!out.empty()) {
+                sendto(fd, out.data(), out.size(), 0,
+                       (struct sockaddr *) &peer, len);
+            }
+        }
+    }
+};
+
+#endif
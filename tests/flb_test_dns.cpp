@@ -0,0 +1,294 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#include <gtest/gtest.h>
+#include <fluent-bit.h>
+
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <string>
+
+extern "C" {
+#include <fluent-bit/flb_log.h>
+#include <fluent-bit/flb_dns.h>
+}
+
+#include "dns_stub.h"
+
+static int addr_port(struct sockaddr_storage *ss)
+{
+    if (ss->ss_family == AF_INET) {
+        return ntohs(((struct sockaddr_in *) ss)->sin_port);
+    }
+    return ntohs(((struct sockaddr_in6 *) ss)->sin6_port);
+}
+
+static std::string addr_str(struct sockaddr_storage *ss)
+{
+    char buf[INET6_ADDRSTRLEN];
+
+    if (ss->ss_family == AF_INET) {
+        inet_ntop(AF_INET, &((struct sockaddr_in *) ss)->sin_addr,
+                  buf, sizeof(buf));
+    }
+    else {
+        inet_ntop(AF_INET6, &((struct sockaddr_in6 *) ss)->sin6_addr,
+                  buf, sizeof(buf));
+    }
+    return std::string(buf);
+}
+
+TEST(DNS, numeric) {
+    int ret;
+    struct flb_dns_addrs addrs;
+
+    ret = flb_dns_numeric((char *) "10.1.2.3", 24224, &addrs);
+    ASSERT_EQ(ret, 0);
+    ASSERT_EQ(addrs.count, 1);
+    EXPECT_EQ(addrs.ttl, -1);
+    EXPECT_EQ(addrs.addr[0].ss_family, AF_INET);
+    EXPECT_EQ(addr_port(&addrs.addr[0]), 24224);
+
+    ret = flb_dns_numeric((char *) "::1", 80, &addrs);
+    ASSERT_EQ(ret, 0);
+    ASSERT_EQ(addrs.count, 1);
+    EXPECT_EQ(addrs.addr[0].ss_family, AF_INET6);
+    EXPECT_EQ(addrs.addr_len[0], sizeof(struct sockaddr_in6));
+    EXPECT_EQ(addr_port(&addrs.addr[0]), 80);
+
+    ret = flb_dns_numeric((char *) "localhost", 80, &addrs);
+    EXPECT_EQ(ret, -1);
+}
+
+TEST(DNS, resolve_localhost) {
+    int ret;
+    struct flb_dns_addrs addrs;
+
+    flb_log_init(FLB_LOG_STDERR, FLB_LOG_ERROR, NULL);
+
+    ret = flb_dns_resolve((char *) "localhost", 8080, &addrs);
+    ASSERT_EQ(ret, 0);
+    ASSERT_GE(addrs.count, 1);
+    EXPECT_GT(addrs.ttl, 0);
+    EXPECT_EQ(addr_port(&addrs.addr[0]), 8080);
+}
+
+TEST(DNS, request_async) {
+    int ret;
+    struct flb_dns_request *req;
+
+    flb_log_init(FLB_LOG_STDERR, FLB_LOG_ERROR, NULL);
+
+    req = flb_dns_request_create((char *) "127.0.0.1", 24224);
+    ASSERT_TRUE(req != NULL);
+
+    /* a second waiter on the same request */
+    flb_dns_request_get(req);
+    ret = flb_dns_request_wait(req);
+    EXPECT_EQ(ret, 0);
+    EXPECT_EQ(req->addrs.count, 1);
+    flb_dns_request_put(req);
+
+    ret = flb_dns_request_wait(req);
+    EXPECT_EQ(ret, 0);
+    flb_dns_request_put(req);
+}
+
+TEST(DNS, cache_rotation) {
+    int i;
+    socklen_t len;
+    struct sockaddr *addr;
+    struct flb_dns_addrs addrs;
+    struct flb_dns_addrs tmp;
+    struct flb_dns_cache cache;
+    const char *hosts[] = {"10.0.0.1", "10.0.0.2", "::1"};
+
+    memset(&addrs, 0, sizeof(addrs));
+    for (i = 0; i < 3; i++) {
+        flb_dns_numeric((char *) hosts[i], 80, &tmp);
+        memcpy(&addrs.addr[i], &tmp.addr[0], sizeof(struct sockaddr_storage));
+        addrs.addr_len[i] = tmp.addr_len[0];
+    }
+    addrs.count = 3;
+    addrs.ttl   = 5;
+
+    flb_dns_cache_init(&cache);
+    EXPECT_EQ(flb_dns_cache_valid(&cache, 1000), FLB_FALSE);
+    EXPECT_TRUE(flb_dns_cache_next(&cache, &len) == NULL);
+
+    flb_dns_cache_set(&cache, &addrs, 1000);
+    EXPECT_EQ(flb_dns_cache_valid(&cache, 1004), FLB_TRUE);
+    EXPECT_EQ(flb_dns_cache_valid(&cache, 1005), FLB_FALSE);
+
+    /* round-robin over all the addresses */
+    for (i = 0; i < 6; i++) {
+        addr = flb_dns_cache_next(&cache, &len);
+        ASSERT_TRUE(addr != NULL);
+        EXPECT_EQ(len, addrs.addr_len[i % 3]);
+        EXPECT_EQ(memcmp(addr, &addrs.addr[i % 3], len), 0);
+    }
+
+    /* a refresh keeps the rotation position */
+    flb_dns_cache_next(&cache, &len);
+    flb_dns_cache_set(&cache, &addrs, 2000);
+    addr = flb_dns_cache_next(&cache, &len);
+    EXPECT_EQ(memcmp(addr, &addrs.addr[1], len), 0);
+
+    flb_dns_cache_invalidate(&cache);
+    EXPECT_EQ(flb_dns_cache_valid(&cache, 2000), FLB_FALSE);
+}
+
+#ifdef FLB_HAVE_RES_QUERY
+
+/*
+ * The lookups are answered by a stub name server on the loopback
+ * interface, the resolver of every thread is pointed to it.
+ */
+class Resolver : public ::testing::Test {
+protected:
+    DnsStub stub;
+
+    virtual void SetUp() {
+        struct sockaddr_in addr;
+
+        flb_log_init(FLB_LOG_STDERR, FLB_LOG_ERROR, NULL);
+
+        stub.add("svc.flb.test", ns_t_a, 300, "10.0.0.1");
+        stub.add("svc.flb.test", ns_t_a, 120, "10.0.0.2");
+        stub.add("svc.flb.test", ns_t_aaaa, 600, "2001:db8::1");
+        stub.add("www.flb.test", ns_t_cname, 3600, "svc.flb.test");
+        stub.add("v6.flb.test", ns_t_aaaa, 50, "2001:db8::2");
+        stub.add("short.flb.test", ns_t_a, 0, "10.0.0.9");
+        ASSERT_EQ(stub.start(), 0);
+
+        addr = stub.server();
+        ASSERT_EQ(flb_dns_servers_set(&addr, 1), 0);
+    }
+
+    virtual void TearDown() {
+        flb_dns_servers_set(NULL, 0);
+        stub.stop();
+    }
+
+    /* The addresses of svc.flb.test in the answers order */
+    void expect_svc(struct flb_dns_addrs *addrs, int port) {
+        int i;
+        const char *ips[] = {"10.0.0.1", "10.0.0.2", "2001:db8::1"};
+
+        ASSERT_EQ(addrs->count, 3);
+        for (i = 0; i < 3; i++) {
+            EXPECT_EQ(addr_str(&addrs->addr[i]), ips[i]);
+            EXPECT_EQ(addr_port(&addrs->addr[i]), port);
+        }
+        EXPECT_EQ(addrs->addr_len[0], sizeof(struct sockaddr_in));
+        EXPECT_EQ(addrs->addr_len[2], sizeof(struct sockaddr_in6));
+
+        /* the smallest TTL of the answers */
+        EXPECT_EQ(addrs->ttl, 120);
+    }
+};
+
+TEST_F(Resolver, records) {
+    int ret;
+    struct flb_dns_addrs addrs;
+
+    ret = flb_dns_resolve((char *) "svc.flb.test", 24224, &addrs);
+    ASSERT_EQ(ret, 0);
+    expect_svc(&addrs, 24224);
+
+    /* one query for the A records and one for the AAAA ones */
+    EXPECT_EQ(stub.queries, 2);
+}
+
+TEST_F(Resolver, cname) {
+    int ret;
+    struct flb_dns_addrs addrs;
+
+    /* the alias record is skipped */
+    ret = flb_dns_resolve((char *) "www.flb.test", 80, &addrs);
+    ASSERT_EQ(ret, 0);
+    expect_svc(&addrs, 80);
+}
+
+TEST_F(Resolver, ipv6_only) {
+    int ret;
+    struct flb_dns_addrs addrs;
+
+    ret = flb_dns_resolve((char *) "v6.flb.test", 80, &addrs);
+    ASSERT_EQ(ret, 0);
+    ASSERT_EQ(addrs.count, 1);
+    EXPECT_EQ(addrs.addr[0].ss_family, AF_INET6);
+    EXPECT_EQ(addr_str(&addrs.addr[0]), "2001:db8::2");
+    EXPECT_EQ(addrs.ttl, 50);
+}
+
+TEST_F(Resolver, ttl_min) {
+    int ret;
+    struct flb_dns_addrs addrs;
+
+    ret = flb_dns_resolve((char *) "short.flb.test", 80, &addrs);
+    ASSERT_EQ(ret, 0);
+    ASSERT_EQ(addrs.count, 1);
+    EXPECT_EQ(addrs.ttl, FLB_DNS_TTL_MIN);
+}
+
+TEST_F(Resolver, nxdomain) {
+    int ret;
+    struct flb_dns_addrs addrs;
+
+    flb_log_init(FLB_LOG_STDERR, FLB_LOG_OFF, NULL);
+
+    ret = flb_dns_resolve((char *) "missing.flb.test", 80, &addrs);
+    EXPECT_EQ(ret, -1);
+    EXPECT_EQ(addrs.count, 0);
+}
+
+TEST_F(Resolver, cache) {
+    int i;
+    int ret;
+    time_t now;
+    socklen_t len;
+    struct sockaddr *addr;
+    struct flb_dns_addrs addrs;
+    struct flb_dns_cache cache;
+    const char *order[] = {"10.0.0.1", "10.0.0.2", "2001:db8::1",
+                           "10.0.0.1", "10.0.0.2"};
+
+    ret = flb_dns_resolve((char *) "svc.flb.test", 80, &addrs);
+    ASSERT_EQ(ret, 0);
+
+    now = time(NULL);
+    flb_dns_cache_init(&cache);
+    flb_dns_cache_set(&cache, &addrs, now);
+    EXPECT_EQ(cache.expire, now + 120);
+    EXPECT_EQ(flb_dns_cache_valid(&cache, now + 119), FLB_TRUE);
+    EXPECT_EQ(flb_dns_cache_valid(&cache, now + 120), FLB_FALSE);
+
+    for (i = 0; i < 5; i++) {
+        addr = flb_dns_cache_next(&cache, &len);
+        ASSERT_TRUE(addr != NULL);
+        EXPECT_EQ(addr_str((struct sockaddr_storage *) addr), order[i]);
+    }
+
+    /* refreshed from a new lookup, the rotation goes on */
+    ret = flb_dns_resolve((char *) "www.flb.test", 80, &addrs);
+    ASSERT_EQ(ret, 0);
+    flb_dns_cache_set(&cache, &addrs, now + 200);
+    EXPECT_EQ(cache.expire, now + 320);
+    addr = flb_dns_cache_next(&cache, &len);
+    EXPECT_EQ(addr_str((struct sockaddr_storage *) addr), "2001:db8::1");
+}
+
+TEST_F(Resolver, request_async) {
+    int ret;
+    struct flb_dns_request *req;
+
+    /* the helper thread uses the stub too */
+    req = flb_dns_request_create((char *) "www.flb.test", 443);
+    ASSERT_TRUE(req != NULL);
+    ret = flb_dns_request_wait(req);
+    EXPECT_EQ(ret, 0);
+    expect_svc(&req->addrs, 443);
+    flb_dns_request_put(req);
+}
+
+#endif
@@ -4,6 +4,21 @@
 #include <fluent-bit.h>
 #include "data/json_es.h"
 
+extern "C" {
+#include <fluent-bit/flb_http_client.h>
+}
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <unistd.h>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
 TEST(Outputs, json_es) {
     int ret;
     int size = sizeof(JSON_ES) - 1;
@@ -30,3 +45,313 @@ TEST(Outputs, json_es) {
     flb_stop(ctx);
     flb_destroy(ctx);
 }
+
+/* Bulk responses, the first one has a rejected item (429) and a bad one */
+static const char *bulk_partial =
+    "{\"took\":3,\"errors\":true,\"items\":["
+    "{\"index\":{\"_id\":\"a\",\"status\":201}},"
+    "{\"index\":{\"_id\":\"b\",\"status\":429,"
+    "\"error\":{\"type\":\"es_rejected_execution_exception\","
+    "\"reason\":\"queue [200] full, \\\"bulk\\\"\"}}},"
+    "{\"index\":{\"_id\":\"c\",\"status\":400,"
+    "\"error\":{\"type\":\"mapper_parsing_exception\"}}}]}";
+
+static const char *bulk_rejected =
+    "{\"took\":1,\"errors\":true,\"items\":["
+    "{\"index\":{\"_id\":\"b\",\"status\":429}}]}";
+
+/* A response cut in the middle of the items */
+static const char *bulk_truncated =
+    "{\"took\":3,\"errors\":true,\"items\":["
+    "{\"index\":{\"_id\":\"a\",\"status\":201}},"
+    "{\"index\":{\"_id\":\"b\",\"sta";
+
+static const char *bulk_ok =
+    "{\"took\":1,\"errors\":false,\"items\":["
+    "{\"index\":{\"_id\":\"d\",\"status\":201}}]}";
+
+/*
+ * A local Bulk API endpoint: request 'i' gets the reply 'i' with an HTTP
+ * 200, the last one is used for the next requests.
+ */
+class BulkServer {
+public:
+    int lfd;
+    int port;
+    std::atomic<bool> done;
+    std::vector<std::string> replies;
+    std::mutex lock;
+    std::vector<std::string> bodies;
+    std::vector<std::string> uris;
+    std::thread th;
+
+    BulkServer(std::vector<std::string> r = {bulk_partial, bulk_ok})
+        : done(false), replies(r) {
+        int on = 1;
+        struct sockaddr_in addr;
+        socklen_t len = sizeof(addr);
+
+        lfd = socket(AF_INET, SOCK_STREAM, 0);
+        setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        bind(lfd, (struct sockaddr *) &addr, sizeof(addr));
+        listen(lfd, 16);
+        getsockname(lfd, (struct sockaddr *) &addr, &len);
+        port = ntohs(addr.sin_port);
+
+        th = std::thread([this]() { serve(); });
+    }
+
+    ~BulkServer() {
+        done = true;
+        th.join();
+        close(lfd);
+    }
+
+    size_t requests() {
+        std::lock_guard<std::mutex> g(lock);
+        return bodies.size();
+    }
+
+    std::string body(size_t i) {
+        std::lock_guard<std::mutex> g(lock);
+        return bodies[i];
+    }
+
+    std::string uri(size_t i) {
+        std::lock_guard<std::mutex> g(lock);
+        return uris[i];
+    }
+
+private:
+    /*
+     * Read one request, returns the URI and the body or false if the peer
+     * closed.
+     */
+    bool request(int fd, std::string &buf, std::string &uri,
+                 std::string &body) {
+        char tmp[4096];
+        size_t hdr;
+        size_t clen;
+        size_t pos;
+        ssize_t r;
+        struct pollfd pfd = {fd, POLLIN, 0};
+
+        while ((hdr = buf.find("\r\n\r\n")) == std::string::npos ||
+               buf.size() < hdr + 4 + content_length(buf)) {
+            if (done || poll(&pfd, 1, 100) < 0) {
+                return false;
+            }
+            if (!(pfd.revents & (POLLIN | POLLHUP))) {
+                continue;
+            }
+            r = read(fd, tmp, sizeof(tmp));
+            if (r <= 0) {
+                return false;
+            }
+            buf.append(tmp, r);
+        }
+
+        pos = buf.find(' ');
+        uri = buf.substr(pos + 1, buf.find(' ', pos + 1) - pos - 1);
+        clen = content_length(buf);
+        pos = hdr + 4;
+        body = buf.substr(pos, clen);
+        buf.erase(0, pos + clen);
+        return true;
+    }
+
+    size_t content_length(std::string &buf) {
+        size_t pos = buf.find("Content-Length: ");
+        if (pos == std::string::npos) {
+            return 0;
+        }
+        return strtoul(buf.c_str() + pos + 16, NULL, 10);
+    }
+
+    void serve() {
+        int fd;
+        std::string buf;
+        std::string uri;
+        std::string body;
+        std::string resp;
+        struct pollfd pfd = {lfd, POLLIN, 0};
+
+        while (!done) {
+            if (poll(&pfd, 1, 100) <= 0) {
+                continue;
+            }
+            fd = accept(lfd, NULL, NULL);
+            buf.clear();
+            while (request(fd, buf, uri, body)) {
+                {
+                    std::lock_guard<std::mutex> g(lock);
+                    uris.push_back(uri);
+                    bodies.push_back(body);
+                    resp = replies[std::min(bodies.size(), replies.size()) - 1];
+                }
+                resp = "HTTP/1.1 200 OK\r\nContent-Length: " +
+                    std::to_string(resp.size()) + "\r\n\r\n" + resp;
+                write(fd, resp.data(), resp.size());
+            }
+            close(fd);
+        }
+    }
+};
+
+/*
+ * Send 'count' records to the server in a single chunk and wait for
+ * 'requests' requests, returns the number of records the output dropped.
+ * The first three records are named "first", "second" and "third".
+ */
+static uint64_t es_run(BulkServer &srv, const char *retry_limit,
+                       size_t requests, int count = 3)
+{
+    int i;
+    uint64_t dropped;
+    flb_ctx_t *ctx;
+    flb_input_t *input;
+    flb_output_t *output;
+    msgpack_sbuffer sbuf;
+    msgpack_packer pck;
+    std::string name;
+    std::string port = std::to_string(srv.port);
+    const char *names[] = {"first", "second", "third"};
+
+    ctx = flb_create();
+    flb_service_set(ctx, "Flush", "1", NULL);
+
+    input = flb_input(ctx, (char *) "lib", NULL);
+    EXPECT_TRUE(input != NULL);
+    flb_input_set(input, "tag", "test", NULL);
+
+    output = flb_output(ctx, (char *) "es", NULL);
+    EXPECT_TRUE(output != NULL);
+    flb_output_set(output, "match", "test", "host", "127.0.0.1",
+                   "port", port.c_str(), "retry_limit", retry_limit, NULL);
+
+    EXPECT_EQ(flb_start(ctx), 0);
+
+    msgpack_sbuffer_init(&sbuf);
+    msgpack_packer_init(&pck, &sbuf, msgpack_sbuffer_write);
+    for (i = 0; i < count; i++) {
+        name = (i < 3) ? names[i] : "r" + std::to_string(i);
+        msgpack_pack_array(&pck, 2);
+        msgpack_pack_uint64(&pck, 1448403340 + i);
+        msgpack_pack_map(&pck, 1);
+        msgpack_pack_str(&pck, 1);
+        msgpack_pack_str_body(&pck, "n", 1);
+        msgpack_pack_str(&pck, name.size());
+        msgpack_pack_str_body(&pck, name.data(), name.size());
+    }
+    EXPECT_EQ(flb_lib_push_msgpack(input, sbuf.data, sbuf.size),
+              (int) sbuf.size);
+    msgpack_sbuffer_destroy(&sbuf);
+
+    /* retries are scheduled in a few seconds (backoff with jitter) */
+    for (i = 0; i < 600 && srv.requests() < requests; i++) {
+        usleep(100000);
+    }
+
+    /* the engine handles the return of the last request */
+    sleep(1);
+    dropped = flb_metrics_get(&output->metrics, FLB_METRIC_DROPPED);
+
+    flb_stop(ctx);
+    flb_destroy(ctx);
+
+    return dropped;
+}
+
+TEST(Outputs, es_partial_retry) {
+    BulkServer srv;
+
+    es_run(srv, "3", 2);
+
+    ASSERT_GE(srv.requests(), 2);
+    EXPECT_NE(srv.body(0).find("first"), std::string::npos);
+    EXPECT_NE(srv.body(0).find("second"), std::string::npos);
+    EXPECT_NE(srv.body(0).find("third"), std::string::npos);
+
+    /* only the record rejected with 429 is sent again */
+    EXPECT_EQ(srv.body(1).find("first"), std::string::npos);
+    EXPECT_NE(srv.body(1).find("second"), std::string::npos);
+    EXPECT_EQ(srv.body(1).find("third"), std::string::npos);
+}
+
+TEST(Outputs, es_partial_retry_again) {
+    size_t i;
+    BulkServer srv({bulk_partial, bulk_truncated, bulk_ok});
+
+    /*
+     * The retry of the rejected record fails again without telling which
+     * records to retry, the next retry still carries only that record.
+     */
+    EXPECT_EQ(es_run(srv, "3", 3), 0);
+
+    ASSERT_EQ(srv.requests(), 3);
+    for (i = 1; i < 3; i++) {
+        EXPECT_EQ(srv.body(i).find("first"), std::string::npos);
+        EXPECT_NE(srv.body(i).find("second"), std::string::npos);
+        EXPECT_EQ(srv.body(i).find("third"), std::string::npos);
+    }
+}
+
+TEST(Outputs, es_retry_limit) {
+    BulkServer srv({bulk_partial, bulk_rejected});
+
+    /* one retry allowed: the record is dropped when it fails again */
+    EXPECT_EQ(es_run(srv, "1", 2), 1);
+    EXPECT_EQ(srv.requests(), 2);
+}
+
+TEST(Outputs, es_invalid_response_retry) {
+    BulkServer srv({bulk_truncated, bulk_ok});
+
+    es_run(srv, "3", 2);
+
+    /* nothing tells which records were indexed, all of them are retried */
+    ASSERT_GE(srv.requests(), 2);
+    EXPECT_NE(srv.body(1).find("first"), std::string::npos);
+    EXPECT_NE(srv.body(1).find("second"), std::string::npos);
+    EXPECT_NE(srv.body(1).find("third"), std::string::npos);
+}
+
+TEST(Outputs, es_large_bulk_response) {
+    int i;
+    int count = 30000;
+    std::string reply;
+    std::string item = "{\"index\":{\"_index\":\"fluent-bit\","
+        "\"_type\":\"test\",\"_id\":\"AVx2aCvIq2eGr5Tq9b0X\","
+        "\"_version\":1,\"result\":\"created\",\"_shards\":{"
+        "\"total\":2,\"successful\":1,\"failed\":0},"
+        "\"created\":true,\"status\":";
+
+    /*
+     * A server that ignores filter_path replies with every item in full,
+     * the response is larger than the default limit of the HTTP client.
+     */
+    reply = "{\"took\":30,\"errors\":true,\"items\":[";
+    for (i = 0; i < count; i++) {
+        reply += item + (i == 1 ? "429}}" : "201}}");
+        if (i + 1 < count) {
+            reply += ",";
+        }
+    }
+    reply += "]}";
+    ASSERT_GT(reply.size(), (size_t) FLB_HTTP_DATA_SIZE_MAX);
+
+    BulkServer srv({reply, bulk_ok});
+
+    EXPECT_EQ(es_run(srv, "3", 2, count), 0);
+
+    ASSERT_EQ(srv.requests(), 2);
+    EXPECT_NE(srv.uri(0).find("filter_path="), std::string::npos);
+
+    /* the response was parsed: only the rejected record is sent again */
+    EXPECT_EQ(srv.body(1).find("first"), std::string::npos);
+    EXPECT_NE(srv.body(1).find("second"), std::string::npos);
+    EXPECT_EQ(srv.body(1).find("\"n\":\"r"), std::string::npos);
+}
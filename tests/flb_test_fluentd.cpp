@@ -4,6 +4,12 @@
 #include <fluent-bit.h>
 #include "data/json_long.h"
 
+extern "C" {
+#include <fluent-bit/flb_dns.h>
+}
+
+#include "dns_stub.h"
+
 TEST(Outputs, json_long_fluentd) {
     int ret;
     int size = sizeof(JSON_LONG) - 1;
@@ -29,3 +35,77 @@ TEST(Outputs, json_long_fluentd) {
     flb_stop(ctx);
     flb_destroy(ctx);
 }
+
+#ifdef FLB_HAVE_RES_QUERY
+/*
+ * The upstream host name is only known by the stub name server: the flush
+ * co-routine resolves it (from the helper thread when the event loop is
+ * used) before connecting to the local listener.
+ */
+TEST(Outputs, forward_resolve) {
+    int on = 1;
+    int fd;
+    int lfd;
+    int ret;
+    char buf[256];
+    char port[16];
+    char json[] = "[1448403340, {\"key\": \"value\"}]";
+    flb_ctx_t *ctx;
+    flb_input_t *input;
+    flb_output_t *output;
+    DnsStub stub;
+    struct pollfd pfd;
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+
+    lfd = socket(AF_INET, SOCK_STREAM, 0);
+    ASSERT_NE(lfd, -1);
+    setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    ASSERT_EQ(bind(lfd, (struct sockaddr *) &addr, sizeof(addr)), 0);
+    ASSERT_EQ(listen(lfd, 16), 0);
+    getsockname(lfd, (struct sockaddr *) &addr, &len);
+    snprintf(port, sizeof(port), "%i", ntohs(addr.sin_port));
+
+    stub.add("fwd.flb.test", ns_t_a, 60, "127.0.0.1");
+    ASSERT_EQ(stub.start(), 0);
+    addr = stub.server();
+    ASSERT_EQ(flb_dns_servers_set(&addr, 1), 0);
+
+    ctx = flb_create();
+
+    input = flb_input(ctx, (char *) "lib", NULL);
+    EXPECT_TRUE(input != NULL);
+    flb_input_set(input, "tag", "test", NULL);
+
+    output = flb_output(ctx, (char *) "forward", NULL);
+    EXPECT_TRUE(output != NULL);
+    flb_output_set(output, "match", "test", "host", "fwd.flb.test",
+                   "port", port, NULL);
+
+    ret = flb_start(ctx);
+    EXPECT_EQ(ret, 0);
+
+    flb_lib_push(input, json, strlen(json));
+
+    /* the records arrive once the name got resolved */
+    pfd.fd = lfd;
+    pfd.events = POLLIN;
+    ASSERT_EQ(poll(&pfd, 1, 10000), 1);
+    fd = accept(lfd, NULL, NULL);
+    ASSERT_NE(fd, -1);
+    pfd.fd = fd;
+    ASSERT_EQ(poll(&pfd, 1, 10000), 1);
+    EXPECT_GT(read(fd, buf, sizeof(buf)), 0);
+    EXPECT_GE(stub.queries, 1);
+
+    flb_stop(ctx);
+    flb_destroy(ctx);
+
+    close(fd);
+    close(lfd);
+    flb_dns_servers_set(NULL, 0);
+}
+#endif
@@ -0,0 +1,141 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#include <gtest/gtest.h>
+#include <fluent-bit.h>
+
+#include <zlib.h>
+#include <string>
+
+extern "C" {
+#include <fluent-bit/flb_gzip.h>
+}
+
+/* Decompress a gzip member with zlib */
+static std::string gunzip(void *data, size_t len)
+{
+    int ret;
+    char buf[4096];
+    z_stream strm;
+    std::string out;
+
+    memset(&strm, 0, sizeof(strm));
+    inflateInit2(&strm, 15 + 16);
+    strm.next_in  = (Bytef *) data;
+    strm.avail_in = len;
+
+    do {
+        strm.next_out  = (Bytef *) buf;
+        strm.avail_out = sizeof(buf);
+        ret = inflate(&strm, Z_NO_FLUSH);
+        out.append(buf, sizeof(buf) - strm.avail_out);
+    } while (ret == Z_OK);
+    inflateEnd(&strm);
+
+    EXPECT_EQ(ret, Z_STREAM_END);
+    return out;
+}
+
+static std::string records(size_t size)
+{
+    std::string s;
+
+    while (s.size() < size) {
+        s += "{\"time\": 1448403340, \"log\": \"GET /index.html 200 "
+            + std::to_string(s.size()) + "\"}\n";
+    }
+    return s;
+}
+
+TEST(Gzip, level) {
+    EXPECT_EQ(flb_gzip_level((char *) "1"), 1);
+    EXPECT_EQ(flb_gzip_level((char *) "9"), 9);
+    EXPECT_EQ(flb_gzip_level((char *) "0"), -1);
+    EXPECT_EQ(flb_gzip_level((char *) "10"), -1);
+    EXPECT_EQ(flb_gzip_level((char *) "fast"), -1);
+}
+
+TEST(Gzip, round_trip) {
+    int i;
+    int ret;
+    void *gz;
+    size_t gz_len;
+    std::string in = records(256 * 1024);
+
+    /* every level, twice to use a recycled stream */
+    for (i = FLB_GZIP_LEVEL_DEFAULT; i <= FLB_GZIP_LEVEL_MAX; i++) {
+        if (i == 0) {
+            continue;
+        }
+        ret = flb_gzip_compress((void *) in.data(), in.size(), i,
+                                &gz, &gz_len);
+        ASSERT_EQ(ret, 0);
+        EXPECT_LT(gz_len, in.size() / 4);
+        EXPECT_EQ(gunzip(gz, gz_len), in);
+        free(gz);
+
+        ret = flb_gzip_compress((void *) in.data(), in.size(), i,
+                                &gz, &gz_len);
+        ASSERT_EQ(ret, 0);
+        EXPECT_EQ(gunzip(gz, gz_len), in);
+        free(gz);
+    }
+}
+
+TEST(Gzip, compressv) {
+    int ret;
+    void *gz;
+    size_t gz_len;
+    std::string a = records(1000);
+    std::string b = records(70000);
+    struct iovec iov[4];
+
+    iov[0].iov_base = (void *) a.data();
+    iov[0].iov_len  = a.size();
+    iov[1].iov_base = NULL;
+    iov[1].iov_len  = 0;
+    iov[2].iov_base = (void *) b.data();
+    iov[2].iov_len  = b.size();
+    iov[3].iov_base = NULL;
+    iov[3].iov_len  = 0;
+
+    ret = flb_gzip_compressv(iov, 4, 6, &gz, &gz_len);
+    ASSERT_EQ(ret, 0);
+    EXPECT_EQ(gunzip(gz, gz_len), a + b);
+    free(gz);
+
+    /* empty input is a valid gzip member */
+    ret = flb_gzip_compressv(iov + 1, 1, 6, &gz, &gz_len);
+    ASSERT_EQ(ret, 0);
+    EXPECT_EQ(gunzip(gz, gz_len), "");
+    free(gz);
+}
+
+TEST(Gzip, incompressible) {
+    int ret;
+    void *gz;
+    size_t i;
+    size_t gz_len;
+    std::string in(300000, '\0');
+
+    /* the output buffer has to grow past the expected ratio */
+    srand(1);
+    for (i = 0; i < in.size(); i++) {
+        in[i] = rand() & 0xff;
+    }
+
+    ret = flb_gzip_compress((void *) in.data(), in.size(), 1, &gz, &gz_len);
+    ASSERT_EQ(ret, 0);
+    EXPECT_GT(gz_len, in.size());
+    EXPECT_EQ(gunzip(gz, gz_len), in);
+    free(gz);
+}
+
+TEST(Gzip, invalid) {
+    void *gz;
+    size_t gz_len;
+    char data[] = "data";
+
+    EXPECT_EQ(flb_gzip_compress(data, 4, 0, &gz, &gz_len), -1);
+    EXPECT_EQ(flb_gzip_compress(data, 4, 10, &gz, &gz_len), -1);
+    EXPECT_EQ(flb_gzip_compressv(NULL, 0, 1, &gz, &gz_len), -1);
+}
@@ -0,0 +1,330 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#include <gtest/gtest.h>
+#include <fluent-bit.h>
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+extern "C" {
+#include <fluent-bit/flb_log.h>
+#include <fluent-bit/flb_config.h>
+#include <fluent-bit/flb_upstream.h>
+#include <fluent-bit/flb_http_client.h>
+}
+
+/*
+ * A local server answers every request with a canned response written in
+ * separate parts, so the client gets them in different reads.
+ */
+class HttpClient : public ::testing::Test {
+protected:
+    int lfd;
+    int port;
+    struct flb_config config;
+    struct flb_upstream *u;
+    std::thread server;
+
+    virtual void SetUp() {
+        int on = 1;
+        struct sockaddr_in addr;
+        socklen_t len = sizeof(addr);
+
+        flb_log_init(FLB_LOG_STDERR, FLB_LOG_ERROR, NULL);
+
+        lfd = socket(AF_INET, SOCK_STREAM, 0);
+        ASSERT_NE(lfd, -1);
+        setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = 0;
+        ASSERT_EQ(bind(lfd, (struct sockaddr *) &addr, sizeof(addr)), 0);
+        ASSERT_EQ(listen(lfd, 16), 0);
+        getsockname(lfd, (struct sockaddr *) &addr, &len);
+        port = ntohs(addr.sin_port);
+
+        memset(&config, 0, sizeof(config));
+        config.flush_method = FLB_FLUSH_PTHREADS;
+        u = flb_upstream_create(&config, (char *) "127.0.0.1", port,
+                                FLB_IO_TCP, NULL);
+        ASSERT_TRUE(u != NULL);
+    }
+
+    virtual void TearDown() {
+        if (server.joinable()) {
+            server.join();
+        }
+        flb_upstream_destroy(u);
+        close(lfd);
+    }
+
+    /* Serve 'requests' requests on a single connection */
+    void serve(std::vector<std::string> parts, int requests, bool close_conn) {
+        server = std::thread([this, parts, requests, close_conn]() {
+            int i;
+            int fd;
+            ssize_t ret;
+            char buf[4096];
+            std::string req;
+
+            fd = accept(lfd, NULL, NULL);
+            for (i = 0; i < requests; i++) {
+                req.clear();
+                while (req.find("\r\n\r\n") == std::string::npos) {
+                    ret = read(fd, buf, sizeof(buf));
+                    if (ret <= 0) {
+                        close(fd);
+                        return;
+                    }
+                    req.append(buf, ret);
+                }
+                for (const std::string &p : parts) {
+                    ret = write(fd, p.data(), p.size());
+                    usleep(20000);
+                }
+            }
+            if (close_conn) {
+                close(fd);
+            }
+            else {
+                /* wait for the client to close (tests do not recycle it) */
+                while (read(fd, buf, sizeof(buf)) > 0);
+                close(fd);
+            }
+        });
+    }
+
+    struct flb_http_client *request(struct flb_upstream_conn *conn,
+                                    int method, int *ret) {
+        size_t bytes;
+        struct flb_http_client *c;
+
+        c = flb_http_client(conn, method, (char *) "/", NULL, 0,
+                            NULL, 0, NULL);
+        if (c) {
+            *ret = flb_http_do(c, &bytes);
+        }
+        return c;
+    }
+};
+
+TEST_F(HttpClient, content_length) {
+    int ret;
+    struct flb_http_client *c;
+    struct flb_upstream_conn *conn;
+
+    serve({"HTTP/1.1 200 OK\r\nContent-Len",
+           "gth: 11\r\n\r\nhello",
+           " world"}, 1, false);
+
+    conn = flb_upstream_conn_get(u);
+    ASSERT_TRUE(conn != NULL);
+    c = request(conn, FLB_HTTP_GET, &ret);
+    ASSERT_TRUE(c != NULL);
+
+    EXPECT_EQ(ret, 0);
+    EXPECT_EQ(c->resp.status, 200);
+    EXPECT_EQ(c->resp.content_length, 11);
+    EXPECT_EQ(c->resp.complete, FLB_TRUE);
+    EXPECT_EQ(c->resp.payload_size, 11);
+    EXPECT_STREQ(c->resp.payload, "hello world");
+    EXPECT_EQ(conn->recycle, FLB_TRUE);
+
+    flb_http_client_destroy(c);
+    conn->recycle = FLB_FALSE;
+    flb_upstream_conn_release(conn);
+}
+
+TEST_F(HttpClient, chunked) {
+    int ret;
+    struct flb_http_client *c;
+    struct flb_upstream_conn *conn;
+
+    serve({"HTTP/1.1 201 Created\r\nTransfer-Encoding: chunked\r\n\r\n5\r\nhel",
+           "lo\r\n6;ext=1\r\n world\r",
+           "\n0\r\nX-Trailer: 1\r\n",
+           "\r\n"}, 1, false);
+
+    conn = flb_upstream_conn_get(u);
+    ASSERT_TRUE(conn != NULL);
+    c = request(conn, FLB_HTTP_POST, &ret);
+    ASSERT_TRUE(c != NULL);
+
+    EXPECT_EQ(ret, 0);
+    EXPECT_EQ(c->resp.status, 201);
+    EXPECT_EQ(c->resp.body_type, FLB_HTTP_BODY_CHUNKED);
+    EXPECT_EQ(c->resp.complete, FLB_TRUE);
+    EXPECT_EQ(c->resp.payload_size, 11);
+    EXPECT_STREQ(c->resp.payload, "hello world");
+    EXPECT_EQ(conn->recycle, FLB_TRUE);
+
+    flb_http_client_destroy(c);
+    conn->recycle = FLB_FALSE;
+    flb_upstream_conn_release(conn);
+}
+
+TEST_F(HttpClient, connection_close) {
+    int ret;
+    struct flb_http_client *c;
+    struct flb_upstream_conn *conn;
+
+    serve({"HTTP/1.1 200 OK\r\nConnection: close\r\n"
+           "Content-Length: 2\r\n\r\n{}"}, 1, true);
+
+    conn = flb_upstream_conn_get(u);
+    ASSERT_TRUE(conn != NULL);
+    c = request(conn, FLB_HTTP_POST, &ret);
+    ASSERT_TRUE(c != NULL);
+
+    EXPECT_EQ(ret, 0);
+    EXPECT_EQ(c->resp.complete, FLB_TRUE);
+    EXPECT_STREQ(c->resp.payload, "{}");
+    EXPECT_EQ(conn->recycle, FLB_FALSE);
+
+    flb_http_client_destroy(c);
+    flb_upstream_conn_release(conn);
+    EXPECT_EQ(u->n_connections, 0);
+}
+
+TEST_F(HttpClient, body_until_eof) {
+    int ret;
+    struct flb_http_client *c;
+    struct flb_upstream_conn *conn;
+
+    serve({"HTTP/1.0 200 OK\r\n\r\nab", "c"}, 1, true);
+
+    conn = flb_upstream_conn_get(u);
+    ASSERT_TRUE(conn != NULL);
+    c = request(conn, FLB_HTTP_GET, &ret);
+    ASSERT_TRUE(c != NULL);
+
+    EXPECT_EQ(ret, 0);
+    EXPECT_EQ(c->resp.body_type, FLB_HTTP_BODY_EOF);
+    EXPECT_EQ(c->resp.complete, FLB_TRUE);
+    EXPECT_STREQ(c->resp.payload, "abc");
+    EXPECT_EQ(conn->recycle, FLB_FALSE);
+
+    flb_http_client_destroy(c);
+    flb_upstream_conn_release(conn);
+}
+
+TEST_F(HttpClient, head) {
+    int ret;
+    struct flb_http_client *c;
+    struct flb_upstream_conn *conn;
+
+    serve({"HTTP/1.1 200 OK\r\nContent-Length: 100\r\n\r\n"}, 1, false);
+
+    conn = flb_upstream_conn_get(u);
+    ASSERT_TRUE(conn != NULL);
+    c = request(conn, FLB_HTTP_HEAD, &ret);
+    ASSERT_TRUE(c != NULL);
+
+    EXPECT_EQ(ret, 0);
+    EXPECT_EQ(c->resp.complete, FLB_TRUE);
+    EXPECT_EQ(c->resp.payload_size, 0);
+    EXPECT_EQ(conn->recycle, FLB_TRUE);
+
+    flb_http_client_destroy(c);
+    conn->recycle = FLB_FALSE;
+    flb_upstream_conn_release(conn);
+}
+
+TEST_F(HttpClient, large_body) {
+    int ret;
+    size_t size = 1024 * 1024;
+    std::string body(size, 'x');
+    struct flb_http_client *c;
+    struct flb_upstream_conn *conn;
+
+    serve({"HTTP/1.1 200 OK\r\nContent-Length: " + std::to_string(size) +
+           "\r\n\r\n" + body}, 1, false);
+
+    conn = flb_upstream_conn_get(u);
+    ASSERT_TRUE(conn != NULL);
+    c = request(conn, FLB_HTTP_GET, &ret);
+    ASSERT_TRUE(c != NULL);
+
+    EXPECT_EQ(ret, 0);
+    EXPECT_EQ(c->resp.complete, FLB_TRUE);
+    EXPECT_EQ(c->resp.payload_size, size);
+    EXPECT_EQ(memcmp(c->resp.payload, body.data(), size), 0);
+    EXPECT_EQ(conn->recycle, FLB_TRUE);
+
+    flb_http_client_destroy(c);
+    conn->recycle = FLB_FALSE;
+    flb_upstream_conn_release(conn);
+}
+
+TEST_F(HttpClient, truncated) {
+    int ret;
+    size_t bytes;
+    std::string body(100000, 'x');
+    struct flb_http_client *c;
+    struct flb_upstream_conn *conn;
+
+    serve({"HTTP/1.1 200 OK\r\nContent-Length: 100000\r\n\r\n" + body},
+          1, false);
+
+    conn = flb_upstream_conn_get(u);
+    ASSERT_TRUE(conn != NULL);
+    c = flb_http_client(conn, FLB_HTTP_GET, (char *) "/", NULL, 0,
+                        NULL, 0, NULL);
+    ASSERT_TRUE(c != NULL);
+    EXPECT_EQ(flb_http_buffer_size(c, 8192), 0);
+    ret = flb_http_do(c, &bytes);
+
+    EXPECT_EQ(ret, 0);
+    EXPECT_EQ(c->resp.status, 200);
+    EXPECT_EQ(c->resp.complete, FLB_FALSE);
+    EXPECT_LE(c->resp.data_size, 8192);
+    EXPECT_EQ(conn->recycle, FLB_FALSE);
+
+    flb_http_client_destroy(c);
+    flb_upstream_conn_release(conn);
+}
+
+TEST_F(HttpClient, keepalive_reuse) {
+    int i;
+    int fd;
+    int ret;
+    char *buf = NULL;
+    struct flb_http_client *c;
+    struct flb_upstream_conn *conn;
+
+    serve({"HTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\n", "ok"}, 2, false);
+
+    for (i = 0; i < 2; i++) {
+        conn = flb_upstream_conn_get(u);
+        ASSERT_TRUE(conn != NULL);
+        if (i == 0) {
+            fd = conn->fd;
+        }
+        else {
+            EXPECT_EQ(conn->fd, fd);
+            EXPECT_EQ(conn->http_buf, buf);
+        }
+
+        c = request(conn, FLB_HTTP_POST, &ret);
+        ASSERT_TRUE(c != NULL);
+        EXPECT_EQ(ret, 0);
+        EXPECT_STREQ(c->resp.payload, "ok");
+        EXPECT_EQ(conn->recycle, FLB_TRUE);
+        buf = conn->http_buf;
+
+        flb_http_client_destroy(c);
+        if (i == 1) {
+            conn->recycle = FLB_FALSE;
+        }
+        flb_upstream_conn_release(conn);
+    }
+
+    EXPECT_EQ(u->stats.hits, 1);
+}
@@ -0,0 +1,690 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#include <gtest/gtest.h>
+#include <fluent-bit.h>
+#include <pthread.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <atomic>
+#include <string>
+#include <thread>
+
+extern "C" {
+#include <fluent-bit/flb_gzip.h>
+}
+
+#define FW_TEST_HOST  "127.0.0.1"
+#define FW_TEST_PORT  24299
+
+/* What the output got, checked once the engine is stopped */
+struct fw_result {
+    pthread_mutex_t mutex;
+    int records;
+    int eventtime;
+    std::string tag;
+};
+
+static struct fw_result result;
+
+static void result_reset()
+{
+    pthread_mutex_init(&result.mutex, NULL);
+    result.records = 0;
+    result.eventtime = 0;
+    result.tag.clear();
+}
+
+static int cb_chunk(char *tag, void *buf, size_t size, void *data)
+{
+    void *record;
+    size_t len;
+    struct flb_time tm;
+    struct flb_lib_iter it;
+    (void) data;
+
+    pthread_mutex_lock(&result.mutex);
+    result.tag = tag;
+    flb_lib_iter_init(&it, buf, size);
+    while (flb_lib_iter_next(&it, &record, &len)) {
+        EXPECT_EQ(it.result.data.type, MSGPACK_OBJECT_ARRAY);
+        EXPECT_EQ(it.result.data.via.array.size, 2);
+        result.records++;
+
+        /* EventTime values are kept with their nanoseconds */
+        if (it.result.data.via.array.ptr[0].type == MSGPACK_OBJECT_EXT) {
+            flb_time_pop_from_msgpack(&tm, &it.result.data.via.array.ptr[0]);
+            EXPECT_EQ(tm.tm.tv_nsec, 123456789);
+            result.eventtime++;
+        }
+    }
+    flb_lib_iter_destroy(&it);
+    pthread_mutex_unlock(&result.mutex);
+
+    return FLB_LIB_OK;
+}
+
+/* Start the engine with a forward input feeding a lib output */
+static flb_ctx_t *fw_start(const char *workers)
+{
+    int ret;
+    flb_ctx_t *ctx;
+    flb_input_t *input;
+    flb_output_t *output;
+    static struct flb_lib_out_cb cb = {cb_chunk, NULL};
+    std::string uri;
+
+    ctx = flb_create();
+    flb_service_set(ctx, "Flush", "1", NULL);
+
+    uri = "forward://" FW_TEST_HOST ":" + std::to_string(FW_TEST_PORT);
+    input = flb_input(ctx, (char *) uri.c_str(), NULL);
+    EXPECT_TRUE(input != NULL);
+    flb_input_set(input, "workers", workers, NULL);
+
+    output = flb_output(ctx, (char *) "lib", &cb);
+    EXPECT_TRUE(output != NULL);
+    flb_output_set(output, "match", "*", "mode", "chunk", NULL);
+
+    ret = flb_start(ctx);
+    EXPECT_EQ(ret, 0);
+
+    return ctx;
+}
+
+static void fw_stop(flb_ctx_t *ctx)
+{
+    /* let the engine flush what was received */
+    sleep(2);
+    flb_stop(ctx);
+    flb_destroy(ctx);
+}
+
+static int fw_connect()
+{
+    int i;
+    int fd;
+    struct sockaddr_in addr;
+
+    memset(&addr, '\0', sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(FW_TEST_PORT);
+    inet_pton(AF_INET, FW_TEST_HOST, &addr.sin_addr);
+
+    /* the server socket is created by the engine thread */
+    for (i = 0; i < 50; i++) {
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd == -1) {
+            return -1;
+        }
+        if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) == 0) {
+            return fd;
+        }
+        close(fd);
+        usleep(100000);
+    }
+
+    return -1;
+}
+
+/* Write the buffer, 'step' bytes at a time if it's greater than zero */
+static void fw_send(int fd, const char *buf, size_t size, size_t step)
+{
+    ssize_t ret;
+    size_t off = 0;
+    size_t len;
+
+    if (step == 0) {
+        step = size;
+    }
+
+    while (off < size) {
+        len = size - off;
+        if (len > step) {
+            len = step;
+        }
+        ret = write(fd, buf + off, len);
+        ASSERT_EQ(ret, (ssize_t) len);
+        off += len;
+        if (off < size) {
+            usleep(10000);
+        }
+    }
+}
+
+static void pack_str(msgpack_packer *mp_pck, const char *str)
+{
+    msgpack_pack_str(mp_pck, strlen(str));
+    msgpack_pack_str_body(mp_pck, str, strlen(str));
+}
+
+/* A {"n": n} record */
+static void pack_map(msgpack_packer *mp_pck, int n)
+{
+    msgpack_pack_map(mp_pck, 1);
+    pack_str(mp_pck, "n");
+    msgpack_pack_int(mp_pck, n);
+}
+
+/* [tag, time, map] messages */
+static void pack_message(msgpack_sbuffer *mp_sbuf, int count)
+{
+    int i;
+    msgpack_packer mp_pck;
+
+    msgpack_packer_init(&mp_pck, mp_sbuf, msgpack_sbuffer_write);
+    for (i = 0; i < count; i++) {
+        msgpack_pack_array(&mp_pck, 3);
+        pack_str(&mp_pck, "test.fw");
+        msgpack_pack_uint64(&mp_pck, 1448403340 + i);
+        pack_map(&mp_pck, i);
+    }
+}
+
+/* [tag, EventTime, map] messages */
+static void pack_message_eventtime(msgpack_sbuffer *mp_sbuf, int count)
+{
+    int i;
+    struct flb_time tm;
+    msgpack_packer mp_pck;
+
+    msgpack_packer_init(&mp_pck, mp_sbuf, msgpack_sbuffer_write);
+    for (i = 0; i < count; i++) {
+        flb_time_set(&tm, 1448403340 + i, 123456789);
+        msgpack_pack_array(&mp_pck, 3);
+        pack_str(&mp_pck, "test.fw");
+        flb_time_append_to_msgpack(&tm, &mp_pck, FLB_TIME_FMT_EVENTTIME);
+        pack_map(&mp_pck, i);
+    }
+}
+
+/* [tag, [[time, map], ...]] */
+static void pack_forward(msgpack_sbuffer *mp_sbuf, int count)
+{
+    int i;
+    msgpack_packer mp_pck;
+
+    msgpack_packer_init(&mp_pck, mp_sbuf, msgpack_sbuffer_write);
+    msgpack_pack_array(&mp_pck, 2);
+    pack_str(&mp_pck, "test.fw");
+    msgpack_pack_array(&mp_pck, count);
+    for (i = 0; i < count; i++) {
+        msgpack_pack_array(&mp_pck, 2);
+        msgpack_pack_uint64(&mp_pck, 1448403340 + i);
+        pack_map(&mp_pck, i);
+    }
+}
+
+/* Concatenated [time, map] entries */
+static void pack_entries(msgpack_sbuffer *mp_sbuf, int count)
+{
+    int i;
+    msgpack_packer mp_pck;
+
+    msgpack_packer_init(&mp_pck, mp_sbuf, msgpack_sbuffer_write);
+    for (i = 0; i < count; i++) {
+        msgpack_pack_array(&mp_pck, 2);
+        msgpack_pack_uint64(&mp_pck, 1448403340 + i);
+        pack_map(&mp_pck, i);
+    }
+}
+
+/* [tag, <entries>, option], 'compressed' and 'chunk' may be NULL */
+static void pack_packed(msgpack_sbuffer *mp_sbuf,
+                        const char *entries, size_t size,
+                        const char *compressed, const char *chunk)
+{
+    int n = 0;
+    msgpack_packer mp_pck;
+
+    msgpack_packer_init(&mp_pck, mp_sbuf, msgpack_sbuffer_write);
+    msgpack_pack_array(&mp_pck, 3);
+    pack_str(&mp_pck, "test.fw");
+    msgpack_pack_bin(&mp_pck, size);
+    msgpack_pack_bin_body(&mp_pck, entries, size);
+
+    if (compressed) {
+        n++;
+    }
+    if (chunk) {
+        n++;
+    }
+    msgpack_pack_map(&mp_pck, n);
+    if (compressed) {
+        pack_str(&mp_pck, "compressed");
+        pack_str(&mp_pck, compressed);
+    }
+    if (chunk) {
+        pack_str(&mp_pck, "chunk");
+        pack_str(&mp_pck, chunk);
+    }
+}
+
+/* Read a reply for up to one second, return the bytes read */
+static ssize_t fw_recv(int fd, char *buf, size_t size)
+{
+    int ret;
+    struct pollfd pfd;
+
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    ret = poll(&pfd, 1, 1000);
+    if (ret <= 0) {
+        return -1;
+    }
+
+    return read(fd, buf, size);
+}
+
+TEST(InForward, message_mode) {
+    int fd;
+    flb_ctx_t *ctx;
+    msgpack_sbuffer mp_sbuf;
+
+    result_reset();
+    ctx = fw_start("0");
+
+    fd = fw_connect();
+    ASSERT_NE(fd, -1);
+    msgpack_sbuffer_init(&mp_sbuf);
+    pack_message(&mp_sbuf, 10);
+    fw_send(fd, mp_sbuf.data, mp_sbuf.size, 0);
+    msgpack_sbuffer_destroy(&mp_sbuf);
+
+    fw_stop(ctx);
+    close(fd);
+
+    EXPECT_EQ(result.records, 10);
+    EXPECT_EQ(result.tag, "test.fw");
+}
+
+TEST(InForward, message_mode_eventtime) {
+    int fd;
+    flb_ctx_t *ctx;
+    msgpack_sbuffer mp_sbuf;
+
+    result_reset();
+    ctx = fw_start("0");
+
+    fd = fw_connect();
+    ASSERT_NE(fd, -1);
+    msgpack_sbuffer_init(&mp_sbuf);
+    pack_message_eventtime(&mp_sbuf, 10);
+    pack_message(&mp_sbuf, 5);
+    fw_send(fd, mp_sbuf.data, mp_sbuf.size, 0);
+    msgpack_sbuffer_destroy(&mp_sbuf);
+
+    fw_stop(ctx);
+    close(fd);
+
+    EXPECT_EQ(result.records, 15);
+    EXPECT_EQ(result.eventtime, 10);
+}
+
+TEST(InForward, forward_mode) {
+    int fd;
+    flb_ctx_t *ctx;
+    msgpack_sbuffer mp_sbuf;
+
+    result_reset();
+    ctx = fw_start("0");
+
+    fd = fw_connect();
+    ASSERT_NE(fd, -1);
+    msgpack_sbuffer_init(&mp_sbuf);
+    pack_forward(&mp_sbuf, 20);
+    fw_send(fd, mp_sbuf.data, mp_sbuf.size, 0);
+    msgpack_sbuffer_destroy(&mp_sbuf);
+
+    fw_stop(ctx);
+    close(fd);
+
+    EXPECT_EQ(result.records, 20);
+    EXPECT_EQ(result.tag, "test.fw");
+}
+
+TEST(InForward, fragmented_write) {
+    int fd;
+    flb_ctx_t *ctx;
+    msgpack_sbuffer mp_sbuf;
+
+    result_reset();
+    ctx = fw_start("0");
+
+    /* messages are split at every 7 bytes, the unpacker resumes on each */
+    fd = fw_connect();
+    ASSERT_NE(fd, -1);
+    msgpack_sbuffer_init(&mp_sbuf);
+    pack_message(&mp_sbuf, 5);
+    pack_forward(&mp_sbuf, 5);
+    fw_send(fd, mp_sbuf.data, mp_sbuf.size, 7);
+    msgpack_sbuffer_destroy(&mp_sbuf);
+
+    fw_stop(ctx);
+    close(fd);
+
+    EXPECT_EQ(result.records, 10);
+}
+
+TEST(InForward, packed_forward) {
+    int fd;
+    flb_ctx_t *ctx;
+    msgpack_sbuffer entries;
+    msgpack_sbuffer mp_sbuf;
+
+    result_reset();
+    ctx = fw_start("0");
+
+    fd = fw_connect();
+    ASSERT_NE(fd, -1);
+    msgpack_sbuffer_init(&entries);
+    msgpack_sbuffer_init(&mp_sbuf);
+    pack_entries(&entries, 30);
+    pack_packed(&mp_sbuf, entries.data, entries.size, NULL, NULL);
+    fw_send(fd, mp_sbuf.data, mp_sbuf.size, 0);
+    msgpack_sbuffer_destroy(&mp_sbuf);
+    msgpack_sbuffer_destroy(&entries);
+
+    fw_stop(ctx);
+    close(fd);
+
+    EXPECT_EQ(result.records, 30);
+    EXPECT_EQ(result.tag, "test.fw");
+}
+
+TEST(InForward, compressed_packed_forward) {
+    int fd;
+    int ret;
+    void *gz_data;
+    size_t gz_size;
+    flb_ctx_t *ctx;
+    msgpack_sbuffer entries;
+    msgpack_sbuffer mp_sbuf;
+
+    result_reset();
+    ctx = fw_start("0");
+
+    fd = fw_connect();
+    ASSERT_NE(fd, -1);
+    msgpack_sbuffer_init(&entries);
+    msgpack_sbuffer_init(&mp_sbuf);
+    pack_entries(&entries, 30);
+    ret = flb_gzip_compress(entries.data, entries.size,
+                            FLB_GZIP_LEVEL_DEFAULT, &gz_data, &gz_size);
+    ASSERT_EQ(ret, 0);
+    pack_packed(&mp_sbuf, (char *) gz_data, gz_size, "gzip", NULL);
+    fw_send(fd, mp_sbuf.data, mp_sbuf.size, 0);
+    free(gz_data);
+    msgpack_sbuffer_destroy(&mp_sbuf);
+    msgpack_sbuffer_destroy(&entries);
+
+    fw_stop(ctx);
+    close(fd);
+
+    EXPECT_EQ(result.records, 30);
+    EXPECT_EQ(result.tag, "test.fw");
+}
+
+TEST(InForward, chunk_ack) {
+    int fd;
+    ssize_t bytes;
+    size_t off = 0;
+    char buf[256];
+    flb_ctx_t *ctx;
+    msgpack_object *kv;
+    msgpack_sbuffer entries;
+    msgpack_sbuffer mp_sbuf;
+    msgpack_unpacked reply;
+
+    result_reset();
+    ctx = fw_start("0");
+
+    fd = fw_connect();
+    ASSERT_NE(fd, -1);
+    msgpack_sbuffer_init(&entries);
+    msgpack_sbuffer_init(&mp_sbuf);
+    pack_entries(&entries, 5);
+    pack_packed(&mp_sbuf, entries.data, entries.size, NULL, "p8n9gmxTQVC8");
+    fw_send(fd, mp_sbuf.data, mp_sbuf.size, 0);
+    msgpack_sbuffer_destroy(&mp_sbuf);
+    msgpack_sbuffer_destroy(&entries);
+
+    /* the reply is {"ack": chunk} */
+    bytes = fw_recv(fd, buf, sizeof(buf));
+    ASSERT_GT(bytes, 0);
+
+    msgpack_unpacked_init(&reply);
+    ASSERT_EQ(msgpack_unpack_next(&reply, buf, bytes, &off),
+              MSGPACK_UNPACK_SUCCESS);
+    EXPECT_EQ(off, (size_t) bytes);
+    ASSERT_EQ(reply.data.type, MSGPACK_OBJECT_MAP);
+    ASSERT_EQ(reply.data.via.map.size, 1);
+    kv = &reply.data.via.map.ptr[0].key;
+    EXPECT_EQ(std::string(kv->via.str.ptr, kv->via.str.size), "ack");
+    kv = &reply.data.via.map.ptr[0].val;
+    EXPECT_EQ(std::string(kv->via.str.ptr, kv->via.str.size),
+              "p8n9gmxTQVC8");
+    msgpack_unpacked_destroy(&reply);
+
+    fw_stop(ctx);
+    close(fd);
+
+    EXPECT_EQ(result.records, 5);
+}
+
+TEST(InForward, chunk_ack_not_read) {
+    int i;
+    int fd;
+    int flood;
+    ssize_t ret;
+    size_t total = 0;
+    char buf[256];
+    flb_ctx_t *ctx;
+    std::string chunk(100, 'c');
+    struct timeval tv = {10, 0};
+    msgpack_sbuffer entries;
+    msgpack_sbuffer mp_sbuf;
+    msgpack_sbuffer flood_sbuf;
+
+    result_reset();
+    ctx = fw_start("0");
+
+    fd = fw_connect();
+    ASSERT_NE(fd, -1);
+    flood = fw_connect();
+    ASSERT_NE(flood, -1);
+    setsockopt(flood, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+    msgpack_sbuffer_init(&entries);
+    msgpack_sbuffer_init(&flood_sbuf);
+    pack_entries(&entries, 1);
+    for (i = 0; i < 4096; i++) {
+        pack_packed(&flood_sbuf, entries.data, entries.size, NULL,
+                    chunk.c_str());
+    }
+
+    /* the peer never reads its acks: it's dropped, nothing blocks */
+    while (total < 256 * 1024 * 1024) {
+        ret = send(flood, flood_sbuf.data, flood_sbuf.size, MSG_NOSIGNAL);
+        if (ret <= 0) {
+            break;
+        }
+        total += ret;
+    }
+    EXPECT_EQ(ret, -1);
+    msgpack_sbuffer_destroy(&flood_sbuf);
+
+    /* the other connection is still served */
+    msgpack_sbuffer_init(&mp_sbuf);
+    pack_packed(&mp_sbuf, entries.data, entries.size, NULL, "p8n9gmxTQVC8");
+    fw_send(fd, mp_sbuf.data, mp_sbuf.size, 0);
+    msgpack_sbuffer_destroy(&mp_sbuf);
+    msgpack_sbuffer_destroy(&entries);
+    EXPECT_GT(fw_recv(fd, buf, sizeof(buf)), 0);
+
+    fw_stop(ctx);
+    close(flood);
+    close(fd);
+}
+
+TEST(InForward, malformed_packed) {
+    int fd;
+    ssize_t bytes;
+    char buf[16];
+    flb_ctx_t *ctx;
+    msgpack_packer mp_pck;
+    msgpack_sbuffer entries;
+    msgpack_sbuffer mp_sbuf;
+
+    result_reset();
+    ctx = fw_start("0");
+
+    /* one valid entry followed by one with a string time */
+    fd = fw_connect();
+    ASSERT_NE(fd, -1);
+    msgpack_sbuffer_init(&entries);
+    msgpack_sbuffer_init(&mp_sbuf);
+    pack_entries(&entries, 1);
+    msgpack_packer_init(&mp_pck, &entries, msgpack_sbuffer_write);
+    msgpack_pack_array(&mp_pck, 2);
+    pack_str(&mp_pck, "now");
+    pack_map(&mp_pck, 1);
+    pack_packed(&mp_sbuf, entries.data, entries.size, NULL, NULL);
+    fw_send(fd, mp_sbuf.data, mp_sbuf.size, 0);
+    msgpack_sbuffer_destroy(&mp_sbuf);
+
+    /* the whole message is dropped and the connection closed */
+    bytes = fw_recv(fd, buf, sizeof(buf));
+    EXPECT_EQ(bytes, 0);
+    close(fd);
+
+    /* a truncated entry */
+    fd = fw_connect();
+    ASSERT_NE(fd, -1);
+    msgpack_sbuffer_init(&mp_sbuf);
+    pack_packed(&mp_sbuf, entries.data, entries.size - 2, NULL, NULL);
+    fw_send(fd, mp_sbuf.data, mp_sbuf.size, 0);
+    msgpack_sbuffer_destroy(&mp_sbuf);
+    msgpack_sbuffer_destroy(&entries);
+
+    bytes = fw_recv(fd, buf, sizeof(buf));
+    EXPECT_EQ(bytes, 0);
+    close(fd);
+
+    /* the input keeps working for the next connections */
+    fd = fw_connect();
+    ASSERT_NE(fd, -1);
+    msgpack_sbuffer_init(&mp_sbuf);
+    pack_message(&mp_sbuf, 3);
+    fw_send(fd, mp_sbuf.data, mp_sbuf.size, 0);
+    msgpack_sbuffer_destroy(&mp_sbuf);
+
+    fw_stop(ctx);
+    close(fd);
+
+    EXPECT_EQ(result.records, 3);
+}
+
+TEST(InForward, workers) {
+    int i;
+    int fd[4];
+    flb_ctx_t *ctx;
+    msgpack_sbuffer entries;
+    msgpack_sbuffer mp_sbuf;
+
+    result_reset();
+    ctx = fw_start("2");
+
+    /* connections are spread across the workers listeners */
+    msgpack_sbuffer_init(&entries);
+    pack_entries(&entries, 10);
+    for (i = 0; i < 4; i++) {
+        fd[i] = fw_connect();
+        ASSERT_NE(fd[i], -1);
+
+        msgpack_sbuffer_init(&mp_sbuf);
+        pack_message(&mp_sbuf, 5);
+        pack_forward(&mp_sbuf, 5);
+        pack_packed(&mp_sbuf, entries.data, entries.size, NULL, NULL);
+        fw_send(fd[i], mp_sbuf.data, mp_sbuf.size, 7);
+        msgpack_sbuffer_destroy(&mp_sbuf);
+    }
+    msgpack_sbuffer_destroy(&entries);
+
+    fw_stop(ctx);
+    for (i = 0; i < 4; i++) {
+        close(fd[i]);
+    }
+
+    EXPECT_EQ(result.records, 80);
+    EXPECT_EQ(result.tag, "test.fw");
+}
+
+TEST(InForward, workers_stop) {
+    int fd;
+    int acked = 0;
+    flb_ctx_t *ctx;
+    std::atomic<bool> done(false);
+    std::thread client;
+
+    result_reset();
+    ctx = fw_start("2");
+    fd = fw_connect();
+    ASSERT_NE(fd, -1);
+
+    /* one record per message, every acked record was buffered */
+    client = std::thread([&]() {
+        int i = 0;
+        size_t off;
+        ssize_t bytes;
+        char buf[4096];
+        std::string chunk;
+        struct pollfd pfd = {fd, POLLIN, 0};
+        msgpack_sbuffer entries;
+        msgpack_sbuffer mp_sbuf;
+        msgpack_unpacked reply;
+
+        msgpack_sbuffer_init(&entries);
+        pack_entries(&entries, 1);
+        msgpack_unpacked_init(&reply);
+        while (!done) {
+            chunk = "chunk" + std::to_string(i++);
+            msgpack_sbuffer_init(&mp_sbuf);
+            pack_packed(&mp_sbuf, entries.data, entries.size, NULL,
+                        chunk.c_str());
+            send(fd, mp_sbuf.data, mp_sbuf.size, MSG_NOSIGNAL);
+            msgpack_sbuffer_destroy(&mp_sbuf);
+            usleep(1000);
+
+            if (poll(&pfd, 1, 50) <= 0 || !(pfd.revents & POLLIN)) {
+                continue;
+            }
+            bytes = read(fd, buf, sizeof(buf));
+            off = 0;
+            while (bytes > 0 &&
+                   msgpack_unpack_next(&reply, buf, bytes, &off) ==
+                   MSGPACK_UNPACK_SUCCESS) {
+                acked++;
+            }
+        }
+        msgpack_unpacked_destroy(&reply);
+        msgpack_sbuffer_destroy(&entries);
+    });
+
+    /*
+     * The workers are stopped with the engine, the records they buffered
+     * are delivered by the last flush.
+     */
+    sleep(1);
+    flb_stop(ctx);
+    done = true;
+    client.join();
+    flb_destroy(ctx);
+    close(fd);
+
+    EXPECT_GT(acked, 0);
+    EXPECT_EQ(result.records, acked);
+}
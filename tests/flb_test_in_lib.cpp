@@ -0,0 +1,328 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#include <gtest/gtest.h>
+#include <fluent-bit.h>
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <string.h>
+#include <thread>
+#include <vector>
+
+#define THREADS  8
+
+/* Records delivered, 'last' is the last 'n' seen for every thread */
+struct lib_result {
+    pthread_mutex_t mutex;
+    int records;
+    int unordered;
+    int eventtime;
+    int last[THREADS];
+};
+
+static struct lib_result result;
+
+static void result_reset()
+{
+    int i;
+
+    pthread_mutex_init(&result.mutex, NULL);
+    result.records = 0;
+    result.unordered = 0;
+    result.eventtime = 0;
+    for (i = 0; i < THREADS; i++) {
+        result.last[i] = -1;
+    }
+}
+
+/* Records are [time, {"thread": t, "n": n}] */
+static int cb_chunk(char *tag, void *buf, size_t size, void *data)
+{
+    int t;
+    int n;
+    void *record;
+    size_t len;
+    msgpack_object map;
+    struct flb_lib_iter it;
+    (void) tag;
+    (void) data;
+
+    pthread_mutex_lock(&result.mutex);
+    flb_lib_iter_init(&it, buf, size);
+    while (flb_lib_iter_next(&it, &record, &len)) {
+        result.records++;
+        if (it.result.data.via.array.ptr[0].type == MSGPACK_OBJECT_EXT) {
+            result.eventtime++;
+        }
+
+        map = it.result.data.via.array.ptr[1];
+        if (map.type != MSGPACK_OBJECT_MAP || map.via.map.size != 2) {
+            continue;
+        }
+        t = map.via.map.ptr[0].val.via.u64;
+        n = map.via.map.ptr[1].val.via.u64;
+        if (t >= THREADS) {
+            continue;
+        }
+        if (n <= result.last[t]) {
+            result.unordered++;
+        }
+        result.last[t] = n;
+    }
+    flb_lib_iter_destroy(&it);
+    pthread_mutex_unlock(&result.mutex);
+
+    return FLB_LIB_OK;
+}
+
+static void pack_record(msgpack_packer *pck, int t, int n)
+{
+    msgpack_pack_str(pck, 6);
+    msgpack_pack_str_body(pck, "thread", 6);
+    msgpack_pack_int(pck, t);
+    msgpack_pack_str(pck, 1);
+    msgpack_pack_str_body(pck, "n", 1);
+    msgpack_pack_int(pck, n);
+}
+
+class InLib : public ::testing::Test {
+protected:
+    flb_ctx_t *ctx;
+    flb_input_t *input;
+    struct flb_lib_out_cb cb;
+
+    virtual void SetUp() {
+        int ret;
+        flb_output_t *output;
+
+        result_reset();
+
+        ctx = flb_create();
+        flb_service_set(ctx, "Flush", "1", NULL);
+
+        input = flb_input(ctx, (char *) "lib", NULL);
+        ASSERT_TRUE(input != NULL);
+        flb_input_set(input, "tag", "test", NULL);
+
+        cb.cb = cb_chunk;
+        cb.data = NULL;
+        output = flb_output(ctx, (char *) "lib", &cb);
+        ASSERT_TRUE(output != NULL);
+        flb_output_set(output, "match", "test", "mode", "chunk", NULL);
+
+        ret = flb_start(ctx);
+        ASSERT_EQ(ret, 0);
+    }
+
+    virtual void TearDown() {
+        flb_stop(ctx);
+        flb_destroy(ctx);
+    }
+
+    void wait(int records) {
+        int i;
+
+        for (i = 0; i < 50 && result.records < records; i++) {
+            usleep(100000);
+        }
+    }
+};
+
+TEST_F(InLib, push_msgpack) {
+    int t;
+    std::vector<std::thread> threads;
+
+    /* batches of 10 records */
+    for (t = 0; t < THREADS; t++) {
+        threads.push_back(std::thread([this, t]() {
+            int i;
+            int n;
+            msgpack_sbuffer sbuf;
+            msgpack_packer pck;
+
+            msgpack_sbuffer_init(&sbuf);
+            msgpack_packer_init(&pck, &sbuf, msgpack_sbuffer_write);
+            for (n = 0; n < 1000; n += 10) {
+                for (i = n; i < n + 10; i++) {
+                    msgpack_pack_array(&pck, 2);
+                    msgpack_pack_uint64(&pck, 1448403340);
+                    msgpack_pack_map(&pck, 2);
+                    pack_record(&pck, t, i);
+                }
+                EXPECT_EQ(flb_lib_push_msgpack(input, sbuf.data, sbuf.size),
+                          (int) sbuf.size);
+                msgpack_sbuffer_clear(&sbuf);
+            }
+            msgpack_sbuffer_destroy(&sbuf);
+        }));
+    }
+    for (auto &th : threads) {
+        th.join();
+    }
+
+    wait(THREADS * 1000);
+    EXPECT_EQ(result.records, THREADS * 1000);
+    EXPECT_EQ(result.unordered, 0);
+}
+
+TEST_F(InLib, record_builder) {
+    int t;
+    std::vector<std::thread> threads;
+
+    /* enough records to seal a few chunks on every thread */
+    for (t = 0; t < THREADS; t++) {
+        threads.push_back(std::thread([this, t]() {
+            int n;
+            msgpack_packer *pck;
+            struct flb_time tm;
+
+            flb_time_set(&tm, 1448403340, 0);
+            for (n = 0; n < 20000; n++) {
+                tm.tm.tv_nsec = n;
+                pck = flb_lib_record_begin(input, &tm, 2);
+                ASSERT_TRUE(pck != NULL);
+                pack_record(pck, t, n);
+                EXPECT_EQ(flb_lib_record_end(input), 0);
+            }
+            EXPECT_EQ(flb_lib_record_flush(input), 0);
+        }));
+    }
+    for (auto &th : threads) {
+        th.join();
+    }
+
+    wait(THREADS * 20000);
+    EXPECT_EQ(result.records, THREADS * 20000);
+    EXPECT_EQ(result.eventtime, THREADS * 20000);
+    EXPECT_EQ(result.unordered, 0);
+}
+
+TEST_F(InLib, mixed) {
+    int n;
+    char json[] = "[1448403340, {\"key\": \"value\"}]";
+    msgpack_packer *pck;
+    struct flb_time tm;
+
+    /* JSON through the channel and MessagePack from the same thread */
+    for (n = 0; n < 10; n++) {
+        flb_lib_push(input, json, strlen(json));
+        flb_time_set(&tm, 1448403340, 0);
+        pck = flb_lib_record_begin(input, &tm, 2);
+        ASSERT_TRUE(pck != NULL);
+        pack_record(pck, 0, n);
+        flb_lib_record_end(input);
+    }
+    flb_lib_record_flush(input);
+
+    wait(20);
+    EXPECT_EQ(result.records, 20);
+    EXPECT_EQ(result.eventtime, 10);
+    EXPECT_EQ(result.unordered, 0);
+}
+
+TEST_F(InLib, record_builder_restart) {
+    int n;
+    msgpack_packer *pck;
+    struct flb_time tm;
+
+    /* records left in the thread buffer when the engine goes away */
+    flb_time_set(&tm, 1448403340, 0);
+    for (n = 0; n < 5; n++) {
+        pck = flb_lib_record_begin(input, &tm, 2);
+        ASSERT_TRUE(pck != NULL);
+        pack_record(pck, 0, n);
+        flb_lib_record_end(input);
+    }
+    TearDown();
+
+    /* they are discarded, not enqueued into the new instance */
+    SetUp();
+    for (n = 0; n < 3; n++) {
+        pck = flb_lib_record_begin(input, &tm, 2);
+        ASSERT_TRUE(pck != NULL);
+        pack_record(pck, 0, n);
+        flb_lib_record_end(input);
+    }
+    flb_lib_record_flush(input);
+
+    wait(3);
+    sleep(1);
+    EXPECT_EQ(result.records, 3);
+    EXPECT_EQ(result.unordered, 0);
+}
+
+TEST(InLibQueue, queue_limit) {
+    int i;
+    int n;
+    int ret;
+    int pushed = 0;
+    int again = 0;
+    flb_ctx_t *ctx;
+    flb_input_t *input;
+    flb_output_t *output;
+    msgpack_sbuffer sbuf;
+    msgpack_packer pck;
+    struct flb_lib_out_cb cb = {cb_chunk, NULL};
+
+    result_reset();
+    ctx = flb_create();
+    flb_service_set(ctx, "Flush", "1", NULL);
+
+    /* 64 KB waiting for the engine at most */
+    input = flb_input(ctx, (char *) "lib", NULL);
+    ASSERT_TRUE(input != NULL);
+    flb_input_set(input, "tag", "test", "queue_limit", "64", NULL);
+
+    output = flb_output(ctx, (char *) "lib", &cb);
+    ASSERT_TRUE(output != NULL);
+    flb_output_set(output, "match", "test", "mode", "chunk", NULL);
+    ASSERT_EQ(flb_start(ctx), 0);
+
+    /* buffers of about 16 KB, the engine flushes once per second */
+    msgpack_sbuffer_init(&sbuf);
+    msgpack_packer_init(&pck, &sbuf, msgpack_sbuffer_write);
+    for (n = 0; n < 20; n++) {
+        for (i = 0; i < 800; i++) {
+            msgpack_pack_array(&pck, 2);
+            msgpack_pack_uint64(&pck, 1448403340);
+            msgpack_pack_map(&pck, 2);
+            pack_record(&pck, 0, n * 800 + i);
+        }
+        ret = flb_lib_push_msgpack(input, sbuf.data, sbuf.size);
+        if (ret == -1) {
+            EXPECT_EQ(errno, EAGAIN);
+            again++;
+        }
+        else {
+            pushed++;
+        }
+        msgpack_sbuffer_clear(&sbuf);
+    }
+    EXPECT_GT(pushed, 0);
+    EXPECT_LE(pushed, 5);
+    EXPECT_GT(again, 0);
+
+    /* the queue is drained by the next flush */
+    for (i = 0; i < 50 && result.records < pushed * 800; i++) {
+        usleep(100000);
+    }
+    EXPECT_EQ(result.records, pushed * 800);
+
+    for (i = 0; i < 800; i++) {
+        msgpack_pack_array(&pck, 2);
+        msgpack_pack_uint64(&pck, 1448403340);
+        msgpack_pack_map(&pck, 2);
+        pack_record(&pck, 1, i);
+    }
+    EXPECT_EQ(flb_lib_push_msgpack(input, sbuf.data, sbuf.size),
+              (int) sbuf.size);
+    msgpack_sbuffer_destroy(&sbuf);
+
+    for (i = 0; i < 50 && result.records < (pushed + 1) * 800; i++) {
+        usleep(100000);
+    }
+    EXPECT_EQ(result.records, (pushed + 1) * 800);
+
+    flb_stop(ctx);
+    flb_destroy(ctx);
+}
@@ -0,0 +1,452 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#include <gtest/gtest.h>
+#include <fluent-bit.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <string>
+
+extern "C" {
+#include <fluent-bit/flb_metrics.h>
+}
+
+static int cb_chunk(char *tag, void *buf, size_t size, void *data)
+{
+    (void) tag;
+    (void) buf;
+    (void) size;
+    (void) data;
+
+    return FLB_LIB_OK;
+}
+
+static int cb_chunk_retry(char *tag, void *buf, size_t size, void *data)
+{
+    (void) tag;
+    (void) buf;
+    (void) size;
+    (void) data;
+
+    return FLB_LIB_RETRY;
+}
+
+static int cb_chunk_error(char *tag, void *buf, size_t size, void *data)
+{
+    (void) tag;
+    (void) buf;
+    (void) size;
+    (void) data;
+
+    return FLB_LIB_ERROR;
+}
+
+/* Run a single record through an output using the chunk callback 'cb' */
+static void run_one(int (*cb)(char *, void *, size_t, void *),
+                    flb_ctx_t **out_ctx,
+                    flb_input_t **out_in, flb_output_t **out_out)
+{
+    int ret;
+    flb_ctx_t *ctx;
+    flb_input_t *input;
+    flb_output_t *output;
+    struct flb_lib_out_cb lib_cb = {cb, NULL};
+    std::string rec = "[1448403340, {\"n\": 1}]";
+
+    ctx = flb_create();
+    flb_service_set(ctx, "Flush", "1", NULL);
+
+    input = flb_input(ctx, (char *) "lib", NULL);
+    ASSERT_TRUE(input != NULL);
+    flb_input_set(input, "tag", "test", NULL);
+
+    output = flb_output(ctx, (char *) "lib", &lib_cb);
+    ASSERT_TRUE(output != NULL);
+    flb_output_set(output, "match", "test", "mode", "chunk", NULL);
+
+    ret = flb_start(ctx);
+    ASSERT_EQ(ret, 0);
+
+    flb_lib_push(input, (char *) rec.c_str(), rec.size());
+    sleep(2);
+
+    *out_ctx = ctx;
+    *out_in = input;
+    *out_out = output;
+}
+
+TEST(Metrics, counters) {
+    struct flb_metrics m;
+
+    flb_metrics_init(&m, FLB_METRICS_OUTPUT, (char *) "lib.0");
+    flb_metrics_add(&m, FLB_METRIC_RECORDS, 10);
+    flb_metrics_add(&m, FLB_METRIC_RECORDS, 5);
+    flb_metrics_add(&m, FLB_METRIC_RETRIES_PENDING, 2);
+    flb_metrics_sub(&m, FLB_METRIC_RETRIES_PENDING, 1);
+
+    EXPECT_EQ(flb_metrics_get(&m, FLB_METRIC_RECORDS), 15);
+    EXPECT_EQ(flb_metrics_get(&m, FLB_METRIC_RETRIES_PENDING), 1);
+    EXPECT_EQ(flb_metrics_get(&m, FLB_METRIC_ERRORS), 0);
+    EXPECT_STREQ(flb_metrics_name(FLB_METRIC_DROPPED), "dropped_records");
+    EXPECT_TRUE(flb_metrics_name(FLB_METRICS_SIZE) == NULL);
+
+    /* Output counters are not exposed by inputs */
+    EXPECT_TRUE(flb_metrics_enabled(&m, FLB_METRIC_RETRIES));
+    m.type = FLB_METRICS_INPUT;
+    EXPECT_FALSE(flb_metrics_enabled(&m, FLB_METRIC_RETRIES));
+    EXPECT_TRUE(flb_metrics_enabled(&m, FLB_METRIC_BYTES));
+}
+
+TEST(Metrics, histogram) {
+    struct flb_metrics_hist h;
+    struct flb_metrics_hist copy;
+
+    memset(&h, '\0', sizeof(h));
+    flb_metrics_hist_add(&h, 500);                  /* < 1us     */
+    flb_metrics_hist_add(&h, 1000);                 /* 1us       */
+    flb_metrics_hist_add(&h, 3000);                 /* 3us       */
+    flb_metrics_hist_add(&h, 1000000000000ULL);     /* overflow  */
+
+    flb_metrics_hist_get(&h, &copy);
+    EXPECT_EQ(copy.count, 4);
+    EXPECT_EQ(copy.sum, 1 + 3 + 1000000000ULL);
+    EXPECT_EQ(copy.buckets[0], 1);
+    EXPECT_EQ(copy.buckets[1], 1);
+    EXPECT_EQ(copy.buckets[2], 1);
+    EXPECT_EQ(copy.buckets[FLB_METRICS_HIST_SIZE - 1], 1);
+
+    EXPECT_EQ(flb_metrics_hist_bound(0), 1);
+    EXPECT_EQ(flb_metrics_hist_bound(2), 4);
+    EXPECT_EQ(flb_metrics_hist_bound(FLB_METRICS_HIST_SIZE - 1), 0);
+}
+
+TEST(Metrics, hdr) {
+    int i;
+    struct flb_metrics_hdr h;
+    struct flb_metrics_lat l;
+
+    /* Linear up to 16us, then 8 buckets per power of two */
+    EXPECT_EQ(flb_metrics_hdr_bound(0), 1);
+    EXPECT_EQ(flb_metrics_hdr_bound(15), 16);
+    EXPECT_EQ(flb_metrics_hdr_bound(16), 18);
+    EXPECT_EQ(flb_metrics_hdr_bound(23), 32);
+    EXPECT_EQ(flb_metrics_hdr_bound(24), 36);
+
+    memset(&h, '\0', sizeof(h));
+    for (i = 1; i <= 100; i++) {
+        flb_metrics_hdr_add(&h, i * 1000);
+    }
+
+    flb_metrics_hdr_get(&h, &l);
+    EXPECT_EQ(l.count, 100);
+    EXPECT_EQ(l.sum, 5050);
+    EXPECT_GE(l.p50, 50);
+    EXPECT_LE(l.p50, 50 + 50 / FLB_METRICS_HDR_SUB);
+    EXPECT_GE(l.p90, 90);
+    EXPECT_LE(l.p90, 90 + 90 / FLB_METRICS_HDR_SUB);
+    EXPECT_GE(l.p99, 99);
+    EXPECT_LE(l.p99, 99 + 99 / FLB_METRICS_HDR_SUB);
+    EXPECT_GE(l.max, 100);
+    EXPECT_LE(l.max, 100 + 100 / FLB_METRICS_HDR_SUB);
+
+    /* Values out of range go to the last bucket */
+    flb_metrics_hdr_add(&h, 1ULL << 60);
+    EXPECT_EQ(h.buckets[FLB_METRICS_HDR_SIZE - 1], 1);
+
+    EXPECT_STREQ(flb_metrics_lat_name(FLB_METRIC_LAT_TOTAL), "total");
+    EXPECT_TRUE(flb_metrics_lat_name(FLB_METRICS_LAT_SIZE) == NULL);
+}
+
+/* Push records through lib -> lib and check the instance counters */
+TEST(Metrics, pipeline) {
+    int i;
+    int ret;
+    flb_ctx_t *ctx;
+    flb_input_t *input;
+    flb_output_t *output;
+    msgpack_sbuffer sbuf;
+    struct flb_metrics_hist h;
+    struct flb_metrics_snapshot snap;
+    struct flb_lib_out_cb cb = {cb_chunk, NULL};
+    std::string rec;
+    std::string json;
+
+    ctx = flb_create();
+    flb_service_set(ctx, "Flush", "1", NULL);
+
+    input = flb_input(ctx, (char *) "lib", NULL);
+    ASSERT_TRUE(input != NULL);
+    flb_input_set(input, "tag", "test", NULL);
+
+    output = flb_output(ctx, (char *) "lib", &cb);
+    ASSERT_TRUE(output != NULL);
+    flb_output_set(output, "match", "test", "mode", "chunk", NULL);
+
+    ret = flb_start(ctx);
+    ASSERT_EQ(ret, 0);
+
+    for (i = 0; i < 100; i++) {
+        rec = "[1448403340, {\"n\": " + std::to_string(i) + "}]";
+        flb_lib_push(input, (char *) rec.c_str(), rec.size());
+    }
+    sleep(2);
+
+    EXPECT_EQ(flb_metrics_get(&input->metrics, FLB_METRIC_RECORDS), 100);
+    EXPECT_EQ(flb_metrics_get(&output->metrics, FLB_METRIC_RECORDS), 100);
+    EXPECT_GT(flb_metrics_get(&input->metrics, FLB_METRIC_BYTES), 0);
+    EXPECT_EQ(flb_metrics_get(&input->metrics, FLB_METRIC_BYTES),
+              flb_metrics_get(&output->metrics, FLB_METRIC_BYTES));
+    EXPECT_EQ(flb_metrics_get(&output->metrics, FLB_METRIC_ERRORS), 0);
+    EXPECT_EQ(flb_metrics_get(&output->metrics, FLB_METRIC_DROPPED), 0);
+
+    flb_metrics_hist_get(&output->metrics.flush, &h);
+    EXPECT_GE(h.count, 1);
+
+    msgpack_sbuffer_init(&sbuf);
+    flb_metrics_dump_json(ctx->config, &sbuf);
+    json.assign(sbuf.data, sbuf.size);
+    msgpack_sbuffer_destroy(&sbuf);
+
+    EXPECT_EQ(json.find("{\"input\":{\"lib.0\":{\"records\":100,"), 0);
+    EXPECT_NE(json.find("\"output\":{\"lib.0\":{\"records\":100,"),
+              std::string::npos);
+    EXPECT_NE(json.find("\"flush_latency\":{\"count\":"), std::string::npos);
+    EXPECT_NE(json.find("\"engine\":{\"tasks\":0,\"tasks_max\":"),
+              std::string::npos);
+    EXPECT_EQ(json.find("\"latency\""), std::string::npos);
+
+    /* Prometheus rendering of a snapshot */
+    ret = flb_metrics_snapshot_create(ctx->config, &snap);
+    ASSERT_EQ(ret, 0);
+    EXPECT_EQ(snap.n_ins, 2);
+    EXPECT_EQ(snap.tasks, 0);
+
+    msgpack_sbuffer_init(&sbuf);
+    flb_metrics_snapshot_prometheus(&snap, &sbuf);
+    json.assign(sbuf.data, sbuf.size);
+    msgpack_sbuffer_destroy(&sbuf);
+    flb_metrics_snapshot_destroy(&snap);
+
+    EXPECT_NE(json.find("# TYPE fluentbit_input_records_total counter\n"
+                        "fluentbit_input_records_total{name=\"lib.0\"} 100\n"),
+              std::string::npos);
+    EXPECT_NE(json.find("fluentbit_output_records_total{name=\"lib.0\"} 100\n"),
+              std::string::npos);
+    EXPECT_NE(json.find("fluentbit_output_retries_pending{name=\"lib.0\"} 0\n"),
+              std::string::npos);
+    EXPECT_NE(json.find("fluentbit_output_flush_latency_seconds_bucket"
+                        "{name=\"lib.0\",le=\"+Inf\"}"), std::string::npos);
+    EXPECT_NE(json.find("fluentbit_tasks 0\n"), std::string::npos);
+
+    flb_stop(ctx);
+    flb_destroy(ctx);
+}
+
+/* A failing output accounts its retries, an error drops the records */
+TEST(Metrics, failures) {
+    flb_ctx_t *ctx = NULL;
+    flb_input_t *input;
+    flb_output_t *output;
+
+    run_one(cb_chunk_retry, &ctx, &input, &output);
+    ASSERT_TRUE(ctx != NULL);
+    EXPECT_EQ(flb_metrics_get(&input->metrics, FLB_METRIC_RECORDS), 1);
+    EXPECT_EQ(flb_metrics_get(&output->metrics, FLB_METRIC_RECORDS), 0);
+    EXPECT_GE(flb_metrics_get(&output->metrics, FLB_METRIC_RETRIES), 1);
+    flb_stop(ctx);
+    flb_destroy(ctx);
+
+    ctx = NULL;
+    run_one(cb_chunk_error, &ctx, &input, &output);
+    ASSERT_TRUE(ctx != NULL);
+    EXPECT_EQ(flb_metrics_get(&output->metrics, FLB_METRIC_RECORDS), 0);
+    EXPECT_EQ(flb_metrics_get(&output->metrics, FLB_METRIC_ERRORS), 1);
+    EXPECT_EQ(flb_metrics_get(&output->metrics, FLB_METRIC_DROPPED), 1);
+    EXPECT_EQ(flb_metrics_get(&output->metrics, FLB_METRIC_RETRIES), 0);
+    flb_stop(ctx);
+    flb_destroy(ctx);
+}
+
+/* Trace every task and check the latency stages */
+TEST(Metrics, latency) {
+    int i;
+    int ret;
+    flb_ctx_t *ctx;
+    flb_input_t *input;
+    flb_output_t *output;
+    msgpack_sbuffer sbuf;
+    struct flb_metrics_lat l;
+    struct flb_metrics_snapshot snap;
+    struct flb_lib_out_cb cb = {cb_chunk, NULL};
+    std::string rec;
+    std::string res;
+
+    ctx = flb_create();
+    flb_service_set(ctx, "Flush", "1", "Latency_Sampling", "1", NULL);
+
+    input = flb_input(ctx, (char *) "lib", NULL);
+    ASSERT_TRUE(input != NULL);
+    flb_input_set(input, "tag", "test", NULL);
+
+    output = flb_output(ctx, (char *) "lib", &cb);
+    ASSERT_TRUE(output != NULL);
+    flb_output_set(output, "match", "test", "mode", "chunk", NULL);
+
+    ret = flb_start(ctx);
+    ASSERT_EQ(ret, 0);
+
+    for (i = 0; i < 10; i++) {
+        rec = "[1448403340, {\"n\": " + std::to_string(i) + "}]";
+        flb_lib_push(input, (char *) rec.c_str(), rec.size());
+    }
+    sleep(2);
+
+    flb_metrics_hdr_get(&input->metrics.latency[FLB_METRIC_LAT_COLLECT], &l);
+    EXPECT_GE(l.count, 1);
+    EXPECT_LE(l.max, 2000000);
+
+    flb_metrics_hdr_get(&output->metrics.latency[FLB_METRIC_LAT_START], &l);
+    EXPECT_GE(l.count, 1);
+    flb_metrics_hdr_get(&output->metrics.latency[FLB_METRIC_LAT_RETURN], &l);
+    EXPECT_GE(l.count, 1);
+    flb_metrics_hdr_get(&output->metrics.latency[FLB_METRIC_LAT_TOTAL], &l);
+    EXPECT_GE(l.count, 1);
+    EXPECT_LE(l.max, 2000000);
+
+    /* The lib output does not write to the network */
+    flb_metrics_hdr_get(&output->metrics.latency[FLB_METRIC_LAT_WRITE], &l);
+    EXPECT_EQ(l.count, 0);
+
+    msgpack_sbuffer_init(&sbuf);
+    flb_metrics_dump_json(ctx->config, &sbuf);
+    res.assign(sbuf.data, sbuf.size);
+    msgpack_sbuffer_destroy(&sbuf);
+    EXPECT_NE(res.find("\"latency\":{\"collect\":{\"count\":"),
+              std::string::npos);
+    EXPECT_NE(res.find("\"latency\":{\"start\":{\"count\":"),
+              std::string::npos);
+
+    ret = flb_metrics_snapshot_create(ctx->config, &snap);
+    ASSERT_EQ(ret, 0);
+    msgpack_sbuffer_init(&sbuf);
+    flb_metrics_snapshot_prometheus(&snap, &sbuf);
+    res.assign(sbuf.data, sbuf.size);
+    msgpack_sbuffer_destroy(&sbuf);
+    flb_metrics_snapshot_destroy(&snap);
+
+    EXPECT_NE(res.find("# TYPE fluentbit_output_latency_seconds summary\n"),
+              std::string::npos);
+    EXPECT_NE(res.find("fluentbit_output_latency_seconds{name=\"lib.0\","
+                       "stage=\"total\",quantile=\"0.99\"}"),
+              std::string::npos);
+    EXPECT_NE(res.find("fluentbit_input_latency_seconds_count{name=\"lib.0\","
+                       "stage=\"collect\"}"), std::string::npos);
+
+    flb_stop(ctx);
+    flb_destroy(ctx);
+}
+
+#ifdef FLB_HAVE_HTTP
+/*
+ * Issue a GET request to the local HTTP server, return the full response.
+ * The server keeps the connection open, the body ends at Content-Length.
+ */
+static std::string http_get(int port, const char *uri)
+{
+    int fd;
+    ssize_t n;
+    size_t hdr;
+    size_t len;
+    char buf[4096];
+    std::string req;
+    std::string res;
+    struct timeval tv = {5, 0};
+    struct sockaddr_in addr;
+
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    memset(&addr, '\0', sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+    if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0) {
+        close(fd);
+        return res;
+    }
+
+    req = std::string("GET ") + uri + " HTTP/1.0\r\n\r\n";
+    n = write(fd, req.c_str(), req.size());
+    EXPECT_EQ(n, (ssize_t) req.size());
+    while ((n = read(fd, buf, sizeof(buf))) > 0) {
+        res.append(buf, n);
+
+        hdr = res.find("\r\n\r\n");
+        len = res.find("Content-Length: ");
+        if (hdr != std::string::npos && len != std::string::npos &&
+            res.size() >= hdr + 4 + atoi(res.c_str() + len + 16)) {
+            break;
+        }
+    }
+    close(fd);
+
+    return res;
+}
+
+TEST(Metrics, http_endpoints) {
+    int i;
+    int ret;
+    flb_ctx_t *ctx;
+    flb_input_t *input;
+    flb_output_t *output;
+    struct flb_lib_out_cb cb = {cb_chunk, NULL};
+    std::string rec;
+    std::string res;
+
+    ctx = flb_create();
+    flb_service_set(ctx, "Flush", "1", "HTTP_Monitor", "On",
+                    "HTTP_Port", "2029", NULL);
+
+    input = flb_input(ctx, (char *) "lib", NULL);
+    ASSERT_TRUE(input != NULL);
+    flb_input_set(input, "tag", "test", NULL);
+
+    output = flb_output(ctx, (char *) "lib", &cb);
+    ASSERT_TRUE(output != NULL);
+    flb_output_set(output, "match", "test", "mode", "chunk", NULL);
+
+    ret = flb_start(ctx);
+    ASSERT_EQ(ret, 0);
+
+    for (i = 0; i < 10; i++) {
+        rec = "[1448403340, {\"n\": " + std::to_string(i) + "}]";
+        flb_lib_push(input, (char *) rec.c_str(), rec.size());
+    }
+    sleep(2);
+
+    res = http_get(2029, "/api/v1/metrics");
+    EXPECT_NE(res.find("200 OK"), std::string::npos);
+    EXPECT_NE(res.find("application/json"), std::string::npos);
+    EXPECT_NE(res.find("{\"input\":{\"lib.0\":{\"records\":10,"),
+              std::string::npos);
+
+    res = http_get(2029, "/api/v1/metrics/prometheus");
+    EXPECT_NE(res.find("200 OK"), std::string::npos);
+    EXPECT_NE(res.find("text/plain; version=0.0.4"), std::string::npos);
+    EXPECT_NE(res.find("fluentbit_output_records_total{name=\"lib.0\"} 10\n"),
+              std::string::npos);
+
+    /* Anything else gets the service banner */
+    res = http_get(2029, "/");
+    EXPECT_NE(res.find("\"service\""), std::string::npos);
+
+    flb_stop(ctx);
+
+    /* the instances are gone, the server keeps running without metrics */
+    res = http_get(2029, "/api/v1/metrics");
+    EXPECT_NE(res.find("503"), std::string::npos);
+
+    flb_destroy(ctx);
+}
+#endif
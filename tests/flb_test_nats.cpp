@@ -0,0 +1,297 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#include <gtest/gtest.h>
+#include <fluent-bit.h>
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <unistd.h>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*
+ * A minimal NATS server: it greets with INFO, stores the PUB payloads and
+ * answers PING with PONG. It can also PING the client before answering.
+ */
+class NatsStub {
+public:
+    int lfd;
+    int port;
+    size_t max_payload;
+    bool server_ping;
+    std::atomic<bool> done;
+    std::mutex lock;
+    int connections;
+    int connects;
+    int pongs;
+    int pings;
+    std::vector<std::string> subjects;
+    std::vector<std::string> payloads;
+    std::thread th;
+
+    NatsStub(size_t max, bool ping)
+        : max_payload(max), server_ping(ping), done(false),
+          connections(0), connects(0), pongs(0), pings(0) {
+        int on = 1;
+        struct sockaddr_in addr;
+        socklen_t len = sizeof(addr);
+
+        lfd = socket(AF_INET, SOCK_STREAM, 0);
+        setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        bind(lfd, (struct sockaddr *) &addr, sizeof(addr));
+        listen(lfd, 16);
+        getsockname(lfd, (struct sockaddr *) &addr, &len);
+        port = ntohs(addr.sin_port);
+
+        th = std::thread([this]() { serve(); });
+    }
+
+    ~NatsStub() {
+        done = true;
+        th.join();
+        close(lfd);
+    }
+
+    int flushes() {
+        std::lock_guard<std::mutex> g(lock);
+        return pings;
+    }
+
+private:
+    /* Wait until 'n' bytes are buffered */
+    bool fill(int fd, std::string &buf, size_t n) {
+        char tmp[4096];
+        ssize_t r;
+        struct pollfd pfd = {fd, POLLIN, 0};
+
+        while (buf.size() < n) {
+            if (done || poll(&pfd, 1, 100) < 0) {
+                return false;
+            }
+            if (!(pfd.revents & (POLLIN | POLLHUP))) {
+                continue;
+            }
+            r = read(fd, tmp, sizeof(tmp));
+            if (r <= 0) {
+                return false;
+            }
+            buf.append(tmp, r);
+        }
+        return true;
+    }
+
+    bool line(int fd, std::string &buf, std::string &out) {
+        size_t pos;
+
+        while ((pos = buf.find("\r\n")) == std::string::npos) {
+            if (!fill(fd, buf, buf.size() + 1)) {
+                return false;
+            }
+        }
+        out = buf.substr(0, pos);
+        buf.erase(0, pos + 2);
+        return true;
+    }
+
+    void reply(int fd, std::string msg) {
+        write(fd, msg.data(), msg.size());
+    }
+
+    void session(int fd) {
+        size_t len;
+        char subject[256];
+        std::string buf;
+        std::string l;
+
+        reply(fd, "INFO {\"server_id\":\"stub\",\"version\":\"0.9.4\","
+              "\"max_payload\":" + std::to_string(max_payload) + "}\r\n");
+
+        while (line(fd, buf, l)) {
+            std::lock_guard<std::mutex> g(lock);
+            if (l.compare(0, 8, "CONNECT ") == 0) {
+                connects++;
+            }
+            else if (l.compare(0, 4, "PUB ") == 0) {
+                sscanf(l.c_str(), "PUB %255s %zu", subject, &len);
+                lock.unlock();
+                fill(fd, buf, len + 2);
+                lock.lock();
+                subjects.push_back(subject);
+                payloads.push_back(buf.substr(0, len));
+                buf.erase(0, len + 2);
+            }
+            else if (l == "PING") {
+                if (server_ping) {
+                    reply(fd, "PING\r\n");
+                }
+                reply(fd, "PONG\r\n");
+                pings++;
+            }
+            else if (l == "PONG") {
+                pongs++;
+            }
+        }
+    }
+
+    void serve() {
+        int fd;
+        struct pollfd pfd = {lfd, POLLIN, 0};
+
+        while (!done) {
+            if (poll(&pfd, 1, 100) <= 0) {
+                continue;
+            }
+            fd = accept(lfd, NULL, NULL);
+            {
+                std::lock_guard<std::mutex> g(lock);
+                connections++;
+            }
+            session(fd);
+            close(fd);
+        }
+    }
+};
+
+static flb_ctx_t *nats_start(NatsStub &srv, const char *mode,
+                             flb_input_t **input)
+{
+    int ret;
+    flb_ctx_t *ctx;
+    flb_output_t *output;
+    std::string port = std::to_string(srv.port);
+
+    ctx = flb_create();
+    flb_service_set(ctx, "Flush", "1", NULL);
+
+    *input = flb_input(ctx, (char *) "lib", NULL);
+    flb_input_set(*input, "tag", "test.nats", NULL);
+
+    output = flb_output(ctx, (char *) "nats", NULL);
+    flb_output_set(output, "match", "test.*", "host", "127.0.0.1",
+                   "port", port.c_str(), "mode", mode, NULL);
+
+    ret = flb_start(ctx);
+    EXPECT_EQ(ret, 0);
+    return ctx;
+}
+
+static void push(flb_input_t *input, int from, int count)
+{
+    int i;
+    std::string rec;
+
+    for (i = from; i < from + count; i++) {
+        rec = "[1448403340, {\"msg\":\"record number " +
+            std::to_string(i) + "\"}]";
+        flb_lib_push(input, (char *) rec.c_str(), rec.size());
+    }
+}
+
+static void wait_flushes(NatsStub &srv, int n)
+{
+    int i;
+
+    for (i = 0; i < 100 && srv.flushes() < n; i++) {
+        usleep(100000);
+    }
+}
+
+/* Chunks are split in several PUBs within max_payload */
+TEST(Nats, chunk_max_payload) {
+    size_t i;
+    size_t records = 0;
+    size_t pos;
+    flb_ctx_t *ctx;
+    flb_input_t *input;
+    NatsStub srv(256, false);
+
+    ctx = nats_start(srv, "chunk", &input);
+    push(input, 0, 20);
+    wait_flushes(srv, 1);
+    push(input, 20, 20);
+    wait_flushes(srv, 2);
+
+    flb_stop(ctx);
+    flb_destroy(ctx);
+
+    ASSERT_GE(srv.flushes(), 2);
+    EXPECT_GT(srv.payloads.size(), 2);
+    for (i = 0; i < srv.payloads.size(); i++) {
+        EXPECT_EQ(srv.subjects[i], "test.nats");
+        EXPECT_LE(srv.payloads[i].size(), 256);
+        EXPECT_EQ(srv.payloads[i].front(), '[');
+        EXPECT_EQ(srv.payloads[i].back(), ']');
+        pos = 0;
+        while ((pos = srv.payloads[i].find("record number", pos)) !=
+               std::string::npos) {
+            records++;
+            pos++;
+        }
+    }
+    EXPECT_EQ(records, 40);
+
+    /* the connection is kept between flushes */
+    EXPECT_EQ(srv.connections, 1);
+    EXPECT_EQ(srv.connects, 1);
+}
+
+/* One PUB per record, the client answers the server PING */
+TEST(Nats, record_mode) {
+    int i;
+    flb_ctx_t *ctx;
+    flb_input_t *input;
+    NatsStub srv(1048576, true);
+
+    ctx = nats_start(srv, "record", &input);
+    push(input, 0, 5);
+    wait_flushes(srv, 1);
+
+    flb_stop(ctx);
+    flb_destroy(ctx);
+
+    ASSERT_EQ(srv.payloads.size(), 5);
+    for (i = 0; i < 5; i++) {
+        EXPECT_NE(srv.payloads[i].find("record number " + std::to_string(i)),
+                  std::string::npos);
+        EXPECT_NE(srv.payloads[i].find("\"tag\":\"test.nats\""),
+                  std::string::npos);
+    }
+    EXPECT_EQ(srv.pongs, 1);
+}
+
+/*
+ * The first chunk only has records above max_payload: nothing is sent on
+ * the new connection, the next chunk must not reuse it without INFO.
+ */
+TEST(Nats, oversized_first_chunk) {
+    flb_ctx_t *ctx;
+    flb_input_t *input;
+    std::string rec;
+    NatsStub srv(64, false);
+
+    ctx = nats_start(srv, "chunk", &input);
+    rec = "[1448403340, {\"msg\":\"" + std::string(128, 'x') + "\"}]";
+    flb_lib_push(input, (char *) rec.c_str(), rec.size());
+
+    /* the oversized record is dropped by the first flush */
+    sleep(2);
+
+    rec = "[1448403341, {\"msg\":\"small\"}]";
+    flb_lib_push(input, (char *) rec.c_str(), rec.size());
+    wait_flushes(srv, 1);
+
+    flb_stop(ctx);
+    flb_destroy(ctx);
+
+    ASSERT_EQ(srv.payloads.size(), 1);
+    EXPECT_NE(srv.payloads[0].find("small"), std::string::npos);
+    EXPECT_EQ(srv.connects, 1);
+}
@@ -0,0 +1,179 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#include <gtest/gtest.h>
+#include <fluent-bit.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+/* What the callbacks got, checked once the engine is stopped */
+struct lib_result {
+    pthread_mutex_t mutex;
+    int chunks;
+    int records;
+    std::string tag;
+    std::vector<size_t> sizes;
+    std::vector<void *> kept;
+    std::vector<size_t> kept_sizes;
+};
+
+static struct lib_result result;
+
+static void result_reset()
+{
+    pthread_mutex_init(&result.mutex, NULL);
+    result.chunks = 0;
+    result.records = 0;
+    result.tag.clear();
+    result.sizes.clear();
+    result.kept.clear();
+    result.kept_sizes.clear();
+}
+
+static int count_records(void *buf, size_t size)
+{
+    int n = 0;
+    void *record;
+    size_t len;
+    struct flb_lib_iter it;
+
+    flb_lib_iter_init(&it, buf, size);
+    while (flb_lib_iter_next(&it, &record, &len)) {
+        EXPECT_GE((char *) record, (char *) buf);
+        EXPECT_LE((char *) record + len, (char *) buf + size);
+        EXPECT_EQ(it.result.data.type, MSGPACK_OBJECT_ARRAY);
+        n++;
+    }
+    flb_lib_iter_destroy(&it);
+
+    return n;
+}
+
+static int cb_record(void *data, size_t size)
+{
+    pthread_mutex_lock(&result.mutex);
+    result.records++;
+    result.sizes.push_back(size);
+    pthread_mutex_unlock(&result.mutex);
+    free(data);
+    return 0;
+}
+
+static int cb_chunk(char *tag, void *buf, size_t size, void *data)
+{
+    (void) data;
+
+    pthread_mutex_lock(&result.mutex);
+    result.chunks++;
+    result.tag = tag;
+    result.records += count_records(buf, size);
+    pthread_mutex_unlock(&result.mutex);
+
+    return FLB_LIB_OK;
+}
+
+static int cb_chunk_keep(char *tag, void *buf, size_t size, void *data)
+{
+    cb_chunk(tag, buf, size, data);
+
+    pthread_mutex_lock(&result.mutex);
+    result.kept.push_back(buf);
+    result.kept_sizes.push_back(size);
+    pthread_mutex_unlock(&result.mutex);
+
+    return FLB_LIB_OK;
+}
+
+/* Push 'count' records in a single chunk and stop the engine */
+static void run(void *cb, const char *mode, const char *ownership,
+                int outputs, int count)
+{
+    int i;
+    int ret;
+    flb_ctx_t *ctx;
+    flb_input_t *input;
+    flb_output_t *output;
+    std::string rec;
+
+    ctx = flb_create();
+    flb_service_set(ctx, "Flush", "1", NULL);
+
+    input = flb_input(ctx, (char *) "lib", NULL);
+    ASSERT_TRUE(input != NULL);
+    flb_input_set(input, "tag", "test.lib", NULL);
+
+    for (i = 0; i < outputs; i++) {
+        output = flb_output(ctx, (char *) "lib", cb);
+        ASSERT_TRUE(output != NULL);
+        flb_output_set(output, "match", "test.*", "mode", mode,
+                       "chunk_ownership", ownership, NULL);
+    }
+
+    ret = flb_start(ctx);
+    ASSERT_EQ(ret, 0);
+
+    for (i = 0; i < count; i++) {
+        rec = "[1448403340, {\"n\": " + std::to_string(i) + "}]";
+        flb_lib_push(input, (char *) rec.c_str(), rec.size());
+    }
+    sleep(2);
+
+    flb_stop(ctx);
+    flb_destroy(ctx);
+}
+
+TEST(OutLib, record_mode) {
+    size_t i;
+
+    result_reset();
+    run((void *) cb_record, "record", "borrow", 1, 50);
+
+    /* every record is a copy of its own size, not of the chunk */
+    EXPECT_EQ(result.records, 50);
+    for (i = 0; i < result.sizes.size(); i++) {
+        EXPECT_LT(result.sizes[i], 32);
+    }
+}
+
+TEST(OutLib, chunk_borrow) {
+    struct flb_lib_out_cb cb = {cb_chunk, NULL};
+
+    result_reset();
+    run(&cb, "chunk", "borrow", 1, 50);
+
+    EXPECT_GE(result.chunks, 1);
+    EXPECT_LT(result.chunks, 50);
+    EXPECT_EQ(result.records, 50);
+    EXPECT_EQ(result.tag, "test.lib");
+}
+
+TEST(OutLib, chunk_transfer) {
+    size_t i;
+    int records = 0;
+    struct flb_lib_out_cb cb = {cb_chunk_keep, NULL};
+
+    /* single output, the task buffer is handed over */
+    result_reset();
+    run(&cb, "chunk", "transfer", 1, 50);
+
+    ASSERT_GE(result.kept.size(), 1);
+    for (i = 0; i < result.kept.size(); i++) {
+        records += count_records(result.kept[i], result.kept_sizes[i]);
+        free(result.kept[i]);
+    }
+    EXPECT_EQ(records, 50);
+
+    /* two outputs share the chunk, each one gets its own buffer */
+    result_reset();
+    run(&cb, "chunk", "transfer", 2, 10);
+
+    ASSERT_GE(result.kept.size(), 2);
+    EXPECT_NE(result.kept[0], result.kept[1]);
+    records = 0;
+    for (i = 0; i < result.kept.size(); i++) {
+        records += count_records(result.kept[i], result.kept_sizes[i]);
+        free(result.kept[i]);
+    }
+    EXPECT_EQ(records, 20);
+}
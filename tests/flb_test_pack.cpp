@@ -0,0 +1,591 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#include <gtest/gtest.h>
+#include <fluent-bit.h>
+#include <msgpack.h>
+
+extern "C" {
+#include <fluent-bit/flb_pack.h>
+}
+
+#include "data/json_es.h"
+#include "data/json_invalid.h"
+#include "data/json_long.h"
+#include "data/json_small.h"
+
+#include <string>
+
+/*
+ * Pack a JSON string and unpack the first message into 'result', the
+ * unpacked objects reference 'buf' so it must be released after use.
+ */
+static int pack_unpack(const char *json, msgpack_unpacked *result,
+                       char **buf)
+{
+    int ret;
+    int size;
+    size_t off = 0;
+
+    ret = flb_pack_json((char *) json, strlen(json), buf, &size);
+    if (ret != 0) {
+        return ret;
+    }
+
+    msgpack_unpacked_init(result);
+    ret = msgpack_unpack_next(result, *buf, size, &off);
+
+    return (ret == MSGPACK_UNPACK_SUCCESS) ? 0 : -1;
+}
+
+TEST(Pack, json_es) {
+    int ret;
+    msgpack_object o;
+    msgpack_object_kv *kv;
+    char *buf;
+    msgpack_unpacked result;
+
+    ret = pack_unpack(JSON_ES, &result, &buf);
+    ASSERT_EQ(ret, 0);
+
+    o = result.data;
+    ASSERT_EQ(o.type, MSGPACK_OBJECT_ARRAY);
+    ASSERT_EQ(o.via.array.size, 2);
+    EXPECT_EQ(o.via.array.ptr[0].type, MSGPACK_OBJECT_POSITIVE_INTEGER);
+    EXPECT_EQ(o.via.array.ptr[0].via.u64, 1448403340);
+
+    o = o.via.array.ptr[1];
+    ASSERT_EQ(o.type, MSGPACK_OBJECT_MAP);
+    ASSERT_EQ(o.via.map.size, 6);
+
+    kv = o.via.map.ptr;
+    EXPECT_EQ(kv[0].key.type, MSGPACK_OBJECT_BIN);
+    EXPECT_EQ(kv[0].val.type, MSGPACK_OBJECT_BOOLEAN);
+    EXPECT_FALSE(kv[0].val.via.boolean);
+    EXPECT_TRUE(kv[1].val.via.boolean);
+    EXPECT_EQ(kv[2].val.type, MSGPACK_OBJECT_BIN);
+    EXPECT_EQ(kv[2].val.via.bin.size, 11);
+    EXPECT_EQ(memcmp(kv[2].val.via.bin.ptr, "some string", 11), 0);
+    EXPECT_EQ(kv[3].val.type, MSGPACK_OBJECT_FLOAT);
+    EXPECT_DOUBLE_EQ(kv[3].val.via.f64, 0.12345678);
+    EXPECT_EQ(kv[4].val.type, MSGPACK_OBJECT_POSITIVE_INTEGER);
+    EXPECT_EQ(kv[4].val.via.u64, 5000);
+
+    msgpack_unpacked_destroy(&result);
+    free(buf);
+}
+
+TEST(Pack, json_escapes) {
+    int ret;
+    msgpack_object o;
+    char *buf;
+    msgpack_unpacked result;
+    const char *expected = "a\"b\\c/\b\f\n\r\t\xc3\xa9\xe2\x82\xac"
+        "\xf0\x9f\x98\x80\xef\xbf\xbd";
+
+    ret = pack_unpack("[\"a\\\"b\\\\c\\/\\b\\f\\n\\r\\t\\u00e9\\u20AC"
+                      "\\ud83d\\ude00\\udc00\"]", &result, &buf);
+    ASSERT_EQ(ret, 0);
+
+    o = result.data.via.array.ptr[0];
+    ASSERT_EQ(o.type, MSGPACK_OBJECT_BIN);
+    ASSERT_EQ(o.via.bin.size, strlen(expected));
+    EXPECT_EQ(memcmp(o.via.bin.ptr, expected, o.via.bin.size), 0);
+
+    msgpack_unpacked_destroy(&result);
+    free(buf);
+}
+
+/* Strings longer than the SIMD blocks with an escape at every position */
+TEST(Pack, json_escapes_offsets) {
+    int i;
+    int ret;
+    char json[128];
+    char expected[64];
+    msgpack_object o;
+    char *buf;
+    msgpack_unpacked result;
+
+    for (i = 0; i < 48; i++) {
+        memset(expected, 'x', 48);
+        expected[i] = '\n';
+
+        memset(json, 'x', sizeof(json));
+        json[0] = '[';
+        json[1] = '"';
+        json[2 + i] = '\\';
+        json[3 + i] = 'n';
+        memcpy(json + 2 + 49, "\"]", 3);
+
+        ret = pack_unpack(json, &result, &buf);
+        ASSERT_EQ(ret, 0);
+
+        o = result.data.via.array.ptr[0];
+        ASSERT_EQ(o.via.bin.size, 48);
+        EXPECT_EQ(memcmp(o.via.bin.ptr, expected, 48), 0);
+        msgpack_unpacked_destroy(&result);
+        free(buf);
+    }
+}
+
+TEST(Pack, json_numbers) {
+    int ret;
+    msgpack_object *o;
+    char *buf;
+    msgpack_unpacked result;
+
+    ret = pack_unpack("[0, -1, 18446744073709551615, -9223372036854775808, "
+                      "18446744073709551616, 1.5, -2e3, 1E-2]", &result, &buf);
+    ASSERT_EQ(ret, 0);
+
+    o = result.data.via.array.ptr;
+    EXPECT_EQ(o[0].type, MSGPACK_OBJECT_POSITIVE_INTEGER);
+    EXPECT_EQ(o[0].via.u64, 0);
+    EXPECT_EQ(o[1].type, MSGPACK_OBJECT_NEGATIVE_INTEGER);
+    EXPECT_EQ(o[1].via.i64, -1);
+    EXPECT_EQ(o[2].type, MSGPACK_OBJECT_POSITIVE_INTEGER);
+    EXPECT_EQ(o[2].via.u64, UINT64_MAX);
+    EXPECT_EQ(o[3].type, MSGPACK_OBJECT_NEGATIVE_INTEGER);
+    EXPECT_EQ(o[3].via.i64, INT64_MIN);
+    EXPECT_EQ(o[4].type, MSGPACK_OBJECT_FLOAT);
+    EXPECT_EQ(o[5].type, MSGPACK_OBJECT_FLOAT);
+    EXPECT_DOUBLE_EQ(o[5].via.f64, 1.5);
+    EXPECT_DOUBLE_EQ(o[6].via.f64, -2000.0);
+    EXPECT_DOUBLE_EQ(o[7].via.f64, 0.01);
+
+    msgpack_unpacked_destroy(&result);
+    free(buf);
+}
+
+/* Maps and arrays with 16+ and 65536+ entries use the wider headers */
+TEST(Pack, json_containers) {
+    int i;
+    int ret;
+    int n = 70000;
+    std::string json = "{\"a\": [";
+    msgpack_object o;
+    char *buf;
+    msgpack_unpacked result;
+
+    for (i = 0; i < n; i++) {
+        json += (i > 0) ? ",null" : "null";
+    }
+    json += "], \"b\": {";
+    for (i = 0; i < 20; i++) {
+        json += (i > 0) ? "," : "";
+        json += "\"k" + std::to_string(i) + "\": " + std::to_string(i);
+    }
+    json += "}, \"c\": [], \"d\": {}}";
+
+    ret = pack_unpack(json.c_str(), &result, &buf);
+    ASSERT_EQ(ret, 0);
+
+    o = result.data;
+    ASSERT_EQ(o.type, MSGPACK_OBJECT_MAP);
+    ASSERT_EQ(o.via.map.size, 4);
+    EXPECT_EQ(o.via.map.ptr[0].val.via.array.size, n);
+    EXPECT_EQ(o.via.map.ptr[1].val.via.map.size, 20);
+    EXPECT_EQ(o.via.map.ptr[1].val.via.map.ptr[19].val.via.u64, 19);
+    EXPECT_EQ(o.via.map.ptr[2].val.via.array.size, 0);
+    EXPECT_EQ(o.via.map.ptr[3].val.via.map.size, 0);
+
+    msgpack_unpacked_destroy(&result);
+    free(buf);
+}
+
+TEST(Pack, json_invalid) {
+    int i;
+    int ret;
+    int size;
+    char *buf;
+    const char *invalid[] = {
+        JSON_INVALID,
+        "[1,]",
+        "{\"a\" 1}",
+        "{1: 2}",
+        "[tru]",
+        "[\"a\\x\"]",
+        "[\"a\tb\"]",
+        "[01]",
+        "[-]",
+        NULL
+    };
+
+    for (i = 0; invalid[i]; i++) {
+        ret = flb_pack_json((char *) invalid[i], strlen(invalid[i]),
+                            &buf, &size);
+        EXPECT_EQ(ret, FLB_ERR_JSON_INVAL) << invalid[i];
+    }
+}
+
+TEST(Pack, json_partial) {
+    int i;
+    int ret;
+    int size;
+    char *buf;
+    size_t len = sizeof(JSON_SMALL) - 1;
+
+    for (i = 0; i < (int) len; i++) {
+        ret = flb_pack_json((char *) JSON_SMALL, i, &buf, &size);
+        EXPECT_EQ(ret, FLB_ERR_JSON_PART);
+    }
+
+    ret = flb_pack_json((char *) JSON_SMALL, len, &buf, &size);
+    EXPECT_EQ(ret, 0);
+    free(buf);
+}
+
+/* Concatenated messages, the incomplete tail is not consumed */
+TEST(Pack, json_state) {
+    int ret;
+    int size;
+    char *buf;
+    size_t off = 0;
+    const char *json = "[1, {\"a\": 1}] [2, {\"b\": 2}]\n[3, {\"c\"";
+    msgpack_unpacked result;
+    struct flb_pack_state state;
+
+    flb_pack_state_init(&state);
+    ret = flb_pack_json_state((char *) json, strlen(json), &buf, &size,
+                              &state);
+    ASSERT_EQ(ret, 0);
+    EXPECT_EQ(state.consumed, strchr(json, '\n') - json + 1);
+
+    msgpack_unpacked_init(&result);
+    EXPECT_TRUE(msgpack_unpack_next(&result, buf, size, &off));
+    EXPECT_EQ(result.data.via.array.ptr[0].via.u64, 1);
+    EXPECT_TRUE(msgpack_unpack_next(&result, buf, size, &off));
+    EXPECT_EQ(result.data.via.array.ptr[0].via.u64, 2);
+    EXPECT_EQ(off, (size_t) size);
+    msgpack_unpacked_destroy(&result);
+    free(buf);
+
+    ret = flb_pack_json_state((char *) json + state.consumed,
+                              strlen(json) - state.consumed, &buf, &size,
+                              &state);
+    EXPECT_EQ(ret, FLB_ERR_JSON_PART);
+    flb_pack_state_reset(&state);
+}
+
+/*
+ * Behave like the input plugins: append the new data to a buffer, pack the
+ * complete messages and keep the remaining bytes.
+ */
+static int state_feed(struct flb_pack_state *state, std::string &buf,
+                      const char *data, size_t len, std::string &out)
+{
+    int ret;
+    int size;
+    char *pack;
+
+    buf.append(data, len);
+    ret = flb_pack_json_state((char *) buf.data(), buf.size(),
+                              &pack, &size, state);
+    if (ret == FLB_ERR_JSON_PART) {
+        return 0;
+    }
+    else if (ret != 0) {
+        return ret;
+    }
+
+    out.append(pack, size);
+    free(pack);
+    buf.erase(0, state->consumed);
+
+    return 0;
+}
+
+#define JSON_STREAM  JSON_ES "\n" JSON_SMALL "\n"                        \
+    "{\"log\": \"a \\\"quoted\\\" \\u00e9 [value] {x}\"}"              \
+    "[1, -2.5e3, null]  123 \"top level\" true\n"
+
+/* Split the stream in two parts at every byte */
+TEST(Pack, json_state_split) {
+    int i;
+    int ret;
+    int size;
+    char *pack;
+    size_t len = sizeof(JSON_STREAM) - 1;
+    std::string expected;
+    struct flb_pack_state state;
+
+    ret = flb_pack_json((char *) JSON_STREAM, len, &pack, &size);
+    ASSERT_EQ(ret, 0);
+    expected.assign(pack, size);
+    free(pack);
+
+    for (i = 0; i <= (int) len; i++) {
+        std::string buf;
+        std::string out;
+
+        flb_pack_state_init(&state);
+        ret = state_feed(&state, buf, JSON_STREAM, i, out);
+        ASSERT_EQ(ret, 0);
+        ret = state_feed(&state, buf, JSON_STREAM + i, len - i, out);
+        ASSERT_EQ(ret, 0);
+
+        EXPECT_TRUE(out == expected) << "split at " << i;
+        EXPECT_EQ(buf.size(), 0);
+        flb_pack_state_reset(&state);
+    }
+}
+
+/* Feed the stream one byte at a time */
+TEST(Pack, json_state_bytes) {
+    int ret;
+    int size;
+    char *pack;
+    size_t i;
+    size_t len;
+    std::string buf;
+    std::string out;
+    std::string expected;
+    std::string stream = JSON_STREAM JSON_LONG "\n";
+    struct flb_pack_state state;
+
+    len = stream.size();
+    ret = flb_pack_json((char *) stream.data(), len, &pack, &size);
+    ASSERT_EQ(ret, 0);
+    expected.assign(pack, size);
+    free(pack);
+
+    flb_pack_state_init(&state);
+    for (i = 0; i < len; i++) {
+        ret = state_feed(&state, buf, stream.data() + i, 1, out);
+        ASSERT_EQ(ret, 0);
+    }
+
+    EXPECT_TRUE(out == expected);
+
+    /* only the last line feed remains */
+    EXPECT_TRUE(buf == "\n");
+    flb_pack_state_reset(&state);
+}
+
+TEST(Pack, json_state_invalid) {
+    int ret;
+    std::string buf;
+    std::string out;
+    struct flb_pack_state state;
+
+    flb_pack_state_init(&state);
+    ret = state_feed(&state, buf, "[1, {\"a\": ", 10, out);
+    EXPECT_EQ(ret, 0);
+    ret = state_feed(&state, buf, "}]", 2, out);
+    EXPECT_EQ(ret, FLB_ERR_JSON_INVAL);
+
+    flb_pack_state_reset(&state);
+    buf.clear();
+    ret = state_feed(&state, buf, "[1]]", 4, out);
+    EXPECT_EQ(ret, FLB_ERR_JSON_INVAL);
+}
+
+/* Pack a JSON record and convert it back with the record formatter */
+static std::string record_to_json(const char *json,
+                                  struct flb_pack_json_fmt *fmt)
+{
+    int ret;
+    char *buf;
+    std::string str;
+    msgpack_object *root;
+    msgpack_sbuffer out;
+    msgpack_unpacked result;
+    struct flb_time tm;
+
+    ret = pack_unpack(json, &result, &buf);
+    EXPECT_EQ(ret, 0);
+    if (ret != 0) {
+        return str;
+    }
+
+    root = result.data.via.array.ptr;
+    msgpack_sbuffer_init(&out);
+    flb_time_pop_from_msgpack(&tm, &root[0]);
+    ret = flb_msgpack_record_to_json(&out, &tm, &root[1], fmt);
+    EXPECT_EQ(ret, 0);
+
+    str.assign(out.data, out.size);
+    msgpack_sbuffer_destroy(&out);
+    msgpack_unpacked_destroy(&result);
+    free(buf);
+
+    return str;
+}
+
+TEST(Pack, record_to_json) {
+    std::string json;
+    struct flb_pack_json_fmt fmt;
+
+    flb_pack_json_fmt_init(&fmt);
+    json = record_to_json(JSON_ES, &fmt);
+    EXPECT_EQ(json, "{\"date\":1448403340,\"key_0\":false,\"key_1\":true,"
+              "\"key_2\":\"some string\",\"key_3\":0.12345678,"
+              "\"key_4\":5000,\"END_KEY\":\"JSON_END\"}");
+
+    /* escapes, nested values and numbers */
+    json = record_to_json("[0, {\"a\\\"b\": \"x\\ny\\u0001\\u00e9\\\\\", "
+                          "\"n\": [1, -2, 1.5, null, {\"k\": {}}], "
+                          "\"big\": 18446744073709551615}]", &fmt);
+    EXPECT_EQ(json, "{\"date\":0,\"a\\\"b\":\"x\\ny\\u0001\xc3\xa9\\\\\","
+              "\"n\":[1,-2,1.5,null,{\"k\":{}}],"
+              "\"big\":18446744073709551615}");
+}
+
+TEST(Pack, record_to_json_fmt) {
+    std::string json;
+    struct flb_pack_json_fmt fmt;
+
+    /* Elasticsearch style: sanitized keys and ISO8601 dates */
+    flb_pack_json_fmt_init(&fmt);
+    fmt.sanitize_keys = FLB_TRUE;
+    fmt.date_key = (char *) "@timestamp";
+    fmt.date_format = FLB_PACK_JSON_DATE_ISO8601;
+
+    json = record_to_json("[1448403340, {\"a.b.c\": {\"d.e\": 1}}]", &fmt);
+    EXPECT_EQ(json, "{\"@timestamp\":\"2015-11-24T22:15:40Z\","
+              "\"a_b_c\":{\"d.e\":1}}");
+
+    /* no date, tag field */
+    flb_pack_json_fmt_init(&fmt);
+    fmt.date_key = NULL;
+    fmt.tag_key = (char *) "tag";
+    fmt.tag = (char *) "app.log";
+    fmt.tag_len = 7;
+
+    json = record_to_json("[1, {\"x\": true}]", &fmt);
+    EXPECT_EQ(json, "{\"tag\":\"app.log\",\"x\":true}");
+}
+
+TEST(Pack, record_to_json_precision) {
+    std::string json;
+    struct flb_pack_json_fmt fmt;
+
+    /* float timestamps keep the fraction */
+    const char *rec = "[1448403340.25, {\"x\": 1}]";
+
+    flb_pack_json_fmt_init(&fmt);
+    fmt.date_precision = 3;
+    json = record_to_json(rec, &fmt);
+    EXPECT_EQ(json, "{\"date\":1448403340.250,\"x\":1}");
+
+    fmt.date_format = FLB_PACK_JSON_DATE_ISO8601;
+    fmt.date_precision = 6;
+    json = record_to_json(rec, &fmt);
+    EXPECT_EQ(json, "{\"date\":\"2015-11-24T22:15:40.250000Z\",\"x\":1}");
+
+    /* same second, the cached prefix is reused */
+    fmt.date_precision = 0;
+    json = record_to_json(rec, &fmt);
+    EXPECT_EQ(json, "{\"date\":\"2015-11-24T22:15:40Z\",\"x\":1}");
+}
+
+TEST(Pack, time_eventtime) {
+    int ret;
+    size_t off = 0;
+    msgpack_sbuffer sbuf;
+    msgpack_packer pck;
+    msgpack_unpacked result;
+    msgpack_sbuffer out;
+    struct flb_time t;
+    struct flb_time t2;
+
+    msgpack_sbuffer_init(&sbuf);
+    msgpack_packer_init(&pck, &sbuf, msgpack_sbuffer_write);
+
+    flb_time_set(&t, 1448403340, 12345678);
+    flb_time_append_to_msgpack(&t, &pck, FLB_TIME_FMT_EVENTTIME);
+    flb_time_append_to_msgpack(&t, &pck, FLB_TIME_FMT_INT);
+    msgpack_pack_str(&pck, 3);
+    msgpack_pack_str_body(&pck, "abc", 3);
+
+    /* ext type 0: 0xd7 0x00 + big endian seconds and nanoseconds */
+    ASSERT_EQ(sbuf.size, 10 + 5 + 4);
+    EXPECT_EQ(memcmp(sbuf.data, "\xd7\x00\x56\x54\xe1\x8c\x00\xbc\x61\x4e",
+                     10), 0);
+
+    msgpack_unpacked_init(&result);
+    ASSERT_TRUE(msgpack_unpack_next(&result, sbuf.data, sbuf.size, &off));
+    ret = flb_time_pop_from_msgpack(&t2, &result.data);
+    EXPECT_EQ(ret, 0);
+    EXPECT_EQ(t2.tm.tv_sec, 1448403340);
+    EXPECT_EQ(t2.tm.tv_nsec, 12345678);
+    EXPECT_EQ(flb_time_to_nanosec(&t2), 1448403340012345678ULL);
+
+    /* EventTime values inside a record are written with nanoseconds */
+    msgpack_sbuffer_init(&out);
+    flb_msgpack_to_json(&out, &result.data);
+    EXPECT_EQ(std::string(out.data, out.size), "1448403340.012345678");
+    msgpack_sbuffer_destroy(&out);
+
+    ASSERT_TRUE(msgpack_unpack_next(&result, sbuf.data, sbuf.size, &off));
+    ret = flb_time_pop_from_msgpack(&t2, &result.data);
+    EXPECT_EQ(ret, 0);
+    EXPECT_EQ(t2.tm.tv_sec, 1448403340);
+    EXPECT_EQ(t2.tm.tv_nsec, 0);
+
+    /* Not a timestamp */
+    ASSERT_TRUE(msgpack_unpack_next(&result, sbuf.data, sbuf.size, &off));
+    ret = flb_time_pop_from_msgpack(&t2, &result.data);
+    EXPECT_EQ(ret, -1);
+    EXPECT_EQ(t2.tm.tv_sec, 0);
+
+    msgpack_unpacked_destroy(&result);
+    msgpack_sbuffer_destroy(&sbuf);
+
+    EXPECT_EQ(flb_time_precision((char *) "ms"), 3);
+    EXPECT_EQ(flb_time_precision((char *) "NS"), 9);
+    EXPECT_EQ(flb_time_precision((char *) "minutes"), -1);
+}
+
+TEST(Pack, mp_count) {
+    int i;
+    size_t full;
+    msgpack_sbuffer sbuf;
+    msgpack_packer pck;
+
+    msgpack_sbuffer_init(&sbuf);
+    msgpack_packer_init(&pck, &sbuf, msgpack_sbuffer_write);
+
+    /* Records with nested containers, strings, binaries and extensions */
+    for (i = 0; i < 100; i++) {
+        msgpack_pack_array(&pck, 2);
+        msgpack_pack_uint64(&pck, 1448403340ULL + i);
+        msgpack_pack_map(&pck, 4);
+        msgpack_pack_str(&pck, 3);
+        msgpack_pack_str_body(&pck, "key", 3);
+        msgpack_pack_str(&pck, 300);
+        msgpack_pack_str_body(&pck, std::string(300, 'x').c_str(), 300);
+        msgpack_pack_str(&pck, 1);
+        msgpack_pack_str_body(&pck, "n", 1);
+        msgpack_pack_array(&pck, 3);
+        msgpack_pack_int(&pck, -1);
+        msgpack_pack_double(&pck, 1.5);
+        msgpack_pack_nil(&pck);
+        msgpack_pack_str(&pck, 1);
+        msgpack_pack_str_body(&pck, "b", 1);
+        msgpack_pack_bin(&pck, 4);
+        msgpack_pack_bin_body(&pck, "abcd", 4);
+        msgpack_pack_str(&pck, 1);
+        msgpack_pack_str_body(&pck, "e", 1);
+        msgpack_pack_ext(&pck, 8, 0);
+        msgpack_pack_ext_body(&pck, "\0\0\0\1\0\0\0\2", 8);
+    }
+    full = sbuf.size;
+    EXPECT_EQ(flb_mp_count(sbuf.data, full), 100);
+
+    /* A truncated record at the end is not counted */
+    EXPECT_EQ(flb_mp_count(sbuf.data, full - 1), 99);
+    EXPECT_EQ(flb_mp_count(sbuf.data, 0), 0);
+
+    /* Empty containers and scalars at the top level */
+    msgpack_sbuffer_clear(&sbuf);
+    msgpack_pack_array(&pck, 0);
+    msgpack_pack_map(&pck, 0);
+    msgpack_pack_true(&pck);
+    msgpack_pack_uint32(&pck, 70000);
+    EXPECT_EQ(flb_mp_count(sbuf.data, sbuf.size), 4);
+
+    /* Reserved format byte */
+    EXPECT_EQ(flb_mp_count("\xc1", 1), -1);
+
+    msgpack_sbuffer_destroy(&sbuf);
+}
@@ -0,0 +1,253 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#include <gtest/gtest.h>
+#include <fluent-bit.h>
+
+#include <stdio.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <thread>
+
+extern "C" {
+#include <fluent-bit/flb_log.h>
+#include <fluent-bit/flb_config.h>
+#include <fluent-bit/flb_io.h>
+#include <fluent-bit/flb_io_tls.h>
+#include <fluent-bit/flb_upstream.h>
+
+#include <mbedtls/certs.h>
+#include <mbedtls/net.h>
+#include <mbedtls/ssl.h>
+#include <mbedtls/ssl_cache.h>
+#include <mbedtls/ssl_ticket.h>
+#include <mbedtls/entropy.h>
+#include <mbedtls/ctr_drbg.h>
+}
+
+/*
+ * A local mbedTLS server using the library test certificates, it resumes
+ * sessions from its cache (session ID) or from tickets.
+ */
+class TLS : public ::testing::Test {
+protected:
+    int port;
+    char ca_file[64];
+    struct flb_config config;
+    struct flb_tls tls;
+    std::thread server;
+
+    mbedtls_net_context listen_fd;
+    mbedtls_entropy_context entropy;
+    mbedtls_ctr_drbg_context ctr_drbg;
+    mbedtls_x509_crt srvcert;
+    mbedtls_pk_context pkey;
+    mbedtls_ssl_config conf;
+    mbedtls_ssl_cache_context cache;
+    mbedtls_ssl_ticket_context ticket;
+
+    virtual void SetUp() {
+        int fd;
+        struct sockaddr_in addr;
+        socklen_t len = sizeof(addr);
+
+        flb_log_init(FLB_LOG_STDERR, FLB_LOG_ERROR, NULL);
+
+        memset(&config, 0, sizeof(config));
+        config.flush_method = FLB_FLUSH_PTHREADS;
+
+        /* CA of the test certificates */
+        strcpy(ca_file, "/tmp/flb_test_tls.XXXXXX");
+        fd = mkstemp(ca_file);
+        ASSERT_NE(fd, -1);
+        ASSERT_EQ(write(fd, mbedtls_test_ca_crt, strlen(mbedtls_test_ca_crt)),
+                  (ssize_t) strlen(mbedtls_test_ca_crt));
+        close(fd);
+
+        tls.context = flb_tls_context_new(FLB_FALSE, ca_file, NULL, NULL,
+                                          NULL);
+        ASSERT_TRUE(tls.context != NULL);
+
+        mbedtls_net_init(&listen_fd);
+        mbedtls_entropy_init(&entropy);
+        mbedtls_ctr_drbg_init(&ctr_drbg);
+        mbedtls_x509_crt_init(&srvcert);
+        mbedtls_pk_init(&pkey);
+        mbedtls_ssl_config_init(&conf);
+        mbedtls_ssl_cache_init(&cache);
+        mbedtls_ssl_ticket_init(&ticket);
+
+        ASSERT_EQ(mbedtls_ctr_drbg_seed(&ctr_drbg, mbedtls_entropy_func,
+                                        &entropy, NULL, 0), 0);
+        ASSERT_EQ(mbedtls_x509_crt_parse(&srvcert,
+                                         (const unsigned char *) mbedtls_test_srv_crt,
+                                         mbedtls_test_srv_crt_len), 0);
+        ASSERT_EQ(mbedtls_pk_parse_key(&pkey,
+                                       (const unsigned char *) mbedtls_test_srv_key,
+                                       mbedtls_test_srv_key_len, NULL, 0), 0);
+        ASSERT_EQ(mbedtls_net_bind(&listen_fd, "127.0.0.1", "0",
+                                   MBEDTLS_NET_PROTO_TCP), 0);
+        getsockname(listen_fd.fd, (struct sockaddr *) &addr, &len);
+        port = ntohs(addr.sin_port);
+
+        ASSERT_EQ(mbedtls_ssl_config_defaults(&conf, MBEDTLS_SSL_IS_SERVER,
+                                              MBEDTLS_SSL_TRANSPORT_STREAM,
+                                              MBEDTLS_SSL_PRESET_DEFAULT), 0);
+        mbedtls_ssl_conf_rng(&conf, mbedtls_ctr_drbg_random, &ctr_drbg);
+        ASSERT_EQ(mbedtls_ssl_conf_own_cert(&conf, &srvcert, &pkey), 0);
+    }
+
+    virtual void TearDown() {
+        if (server.joinable()) {
+            server.join();
+        }
+        flb_tls_context_destroy(tls.context);
+        unlink(ca_file);
+
+        mbedtls_net_free(&listen_fd);
+        mbedtls_ssl_ticket_free(&ticket);
+        mbedtls_ssl_cache_free(&cache);
+        mbedtls_ssl_config_free(&conf);
+        mbedtls_pk_free(&pkey);
+        mbedtls_x509_crt_free(&srvcert);
+        mbedtls_ctr_drbg_free(&ctr_drbg);
+        mbedtls_entropy_free(&entropy);
+    }
+
+    void use_cache() {
+        mbedtls_ssl_conf_session_cache(&conf, &cache,
+                                       mbedtls_ssl_cache_get,
+                                       mbedtls_ssl_cache_set);
+    }
+
+    void use_tickets() {
+        ASSERT_EQ(mbedtls_ssl_ticket_setup(&ticket, mbedtls_ctr_drbg_random,
+                                           &ctr_drbg, MBEDTLS_CIPHER_AES_256_GCM,
+                                           300), 0);
+        mbedtls_ssl_conf_session_tickets_cb(&conf,
+                                            mbedtls_ssl_ticket_write,
+                                            mbedtls_ssl_ticket_parse,
+                                            &ticket);
+    }
+
+    /* Accept 'count' connections, complete the handshake and close them */
+    void serve(int count) {
+        server = std::thread([this, count]() {
+            int i;
+            int ret;
+            mbedtls_net_context client;
+            mbedtls_ssl_context ssl;
+
+            for (i = 0; i < count; i++) {
+                mbedtls_net_init(&client);
+                mbedtls_ssl_init(&ssl);
+                mbedtls_ssl_setup(&ssl, &conf);
+
+                if (mbedtls_net_accept(&listen_fd, &client,
+                                       NULL, 0, NULL) != 0) {
+                    break;
+                }
+                mbedtls_ssl_set_bio(&ssl, &client,
+                                    mbedtls_net_send, mbedtls_net_recv, NULL);
+                do {
+                    ret = mbedtls_ssl_handshake(&ssl);
+                } while (ret == MBEDTLS_ERR_SSL_WANT_READ ||
+                         ret == MBEDTLS_ERR_SSL_WANT_WRITE);
+
+                mbedtls_ssl_close_notify(&ssl);
+                mbedtls_net_free(&client);
+                mbedtls_ssl_free(&ssl);
+            }
+        });
+    }
+
+    /* Connect and close, the handshake happens on connect */
+    void connect(struct flb_upstream *u) {
+        struct flb_upstream_conn *conn;
+
+        conn = flb_upstream_conn_get(u);
+        ASSERT_TRUE(conn != NULL);
+        ASSERT_TRUE(conn->tls_session != NULL);
+        conn->recycle = FLB_FALSE;
+        flb_upstream_conn_release(conn);
+    }
+};
+
+TEST_F(TLS, context_shared) {
+    struct flb_tls_context *ctx;
+    struct flb_tls_context *other;
+
+    /* same files and verification mode, same context */
+    ctx = flb_tls_context_new(FLB_FALSE, ca_file, NULL, NULL, NULL);
+    EXPECT_EQ(ctx, tls.context);
+    EXPECT_EQ(tls.context->users, 2);
+
+    other = flb_tls_context_new(FLB_TRUE, ca_file, NULL, NULL, NULL);
+    ASSERT_TRUE(other != NULL);
+    EXPECT_NE(other, tls.context);
+
+    flb_tls_context_destroy(other);
+    flb_tls_context_destroy(ctx);
+    EXPECT_EQ(tls.context->users, 1);
+
+    /* invalid files are not registered */
+    EXPECT_TRUE(flb_tls_context_new(FLB_FALSE, (char *) "/nonexistent",
+                                    NULL, NULL, NULL) == NULL);
+}
+
+TEST_F(TLS, resume_session_id) {
+    struct flb_upstream *u;
+
+    use_cache();
+    serve(3);
+
+    u = flb_upstream_create(&config, (char *) "127.0.0.1", port,
+                            FLB_IO_TCP | FLB_IO_TLS, &tls);
+    ASSERT_TRUE(u != NULL);
+
+    connect(u);
+    connect(u);
+    connect(u);
+
+    EXPECT_EQ(u->stats.tls_full, 1);
+    EXPECT_EQ(u->stats.tls_resumed, 2);
+    flb_upstream_destroy(u);
+}
+
+TEST_F(TLS, resume_ticket) {
+    struct flb_upstream *u;
+
+    use_tickets();
+    serve(2);
+
+    u = flb_upstream_create(&config, (char *) "127.0.0.1", port,
+                            FLB_IO_TCP | FLB_IO_TLS, &tls);
+    ASSERT_TRUE(u != NULL);
+
+    connect(u);
+    ASSERT_TRUE(u->tls_resume != NULL);
+    EXPECT_GT(u->tls_resume->ticket_len, 0);
+    connect(u);
+
+    EXPECT_EQ(u->stats.tls_full, 1);
+    EXPECT_EQ(u->stats.tls_resumed, 1);
+    flb_upstream_destroy(u);
+}
+
+TEST_F(TLS, no_resumption) {
+    struct flb_upstream *u;
+
+    /* server without cache nor tickets, every handshake is a full one */
+    serve(2);
+
+    u = flb_upstream_create(&config, (char *) "127.0.0.1", port,
+                            FLB_IO_TCP | FLB_IO_TLS, &tls);
+    ASSERT_TRUE(u != NULL);
+
+    connect(u);
+    connect(u);
+
+    EXPECT_EQ(u->stats.tls_full, 2);
+    EXPECT_EQ(u->stats.tls_resumed, 0);
+    flb_upstream_destroy(u);
+}
@@ -0,0 +1,316 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#include <gtest/gtest.h>
+#include <fluent-bit.h>
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <thread>
+
+extern "C" {
+#include <fluent-bit/flb_log.h>
+#include <fluent-bit/flb_config.h>
+#include <fluent-bit/flb_upstream.h>
+#include <fluent-bit/flb_io.h>
+}
+
+/*
+ * The upstream runs in blocking mode (no event loop) against a local
+ * listener, connections are accepted by the test as needed.
+ */
+class Upstream : public ::testing::Test {
+protected:
+    int lfd;
+    int port;
+    struct flb_config config;
+    struct flb_upstream *u;
+
+    virtual void SetUp() {
+        int on = 1;
+        struct sockaddr_in addr;
+        socklen_t len = sizeof(addr);
+
+        flb_log_init(FLB_LOG_STDERR, FLB_LOG_ERROR, NULL);
+
+        lfd = socket(AF_INET, SOCK_STREAM, 0);
+        ASSERT_NE(lfd, -1);
+        setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = 0;
+        ASSERT_EQ(bind(lfd, (struct sockaddr *) &addr, sizeof(addr)), 0);
+        ASSERT_EQ(listen(lfd, 16), 0);
+        getsockname(lfd, (struct sockaddr *) &addr, &len);
+        port = ntohs(addr.sin_port);
+
+        memset(&config, 0, sizeof(config));
+        config.flush_method = FLB_FLUSH_PTHREADS;
+        u = flb_upstream_create(&config, (char *) "127.0.0.1", port,
+                                FLB_IO_TCP, NULL);
+        ASSERT_TRUE(u != NULL);
+    }
+
+    virtual void TearDown() {
+        flb_upstream_destroy(u);
+        close(lfd);
+    }
+};
+
+TEST_F(Upstream, keepalive_reuse) {
+    int fd;
+    struct flb_upstream_conn *conn;
+
+    conn = flb_upstream_conn_get(u);
+    ASSERT_TRUE(conn != NULL);
+    fd = conn->fd;
+    flb_upstream_conn_release(conn);
+    EXPECT_EQ(u->n_connections, 1);
+
+    conn = flb_upstream_conn_get(u);
+    ASSERT_TRUE(conn != NULL);
+    EXPECT_EQ(conn->fd, fd);
+    EXPECT_EQ(u->stats.hits, 1);
+    EXPECT_EQ(u->stats.misses, 1);
+    flb_upstream_conn_release(conn);
+}
+
+TEST_F(Upstream, keepalive_off) {
+    struct flb_upstream_conn *conn;
+
+    u->keepalive = FLB_FALSE;
+
+    conn = flb_upstream_conn_get(u);
+    ASSERT_TRUE(conn != NULL);
+    flb_upstream_conn_release(conn);
+    EXPECT_EQ(u->n_connections, 0);
+
+    conn = flb_upstream_conn_get(u);
+    ASSERT_TRUE(conn != NULL);
+    EXPECT_EQ(u->stats.hits, 0);
+    EXPECT_EQ(u->stats.misses, 2);
+    flb_upstream_conn_release(conn);
+}
+
+TEST_F(Upstream, peer_closed) {
+    int cfd;
+    struct flb_upstream_conn *conn;
+
+    conn = flb_upstream_conn_get(u);
+    ASSERT_TRUE(conn != NULL);
+    flb_upstream_conn_release(conn);
+
+    /* the server drops the idle connection */
+    cfd = accept(lfd, NULL, NULL);
+    ASSERT_NE(cfd, -1);
+    close(cfd);
+    usleep(50000);
+
+    conn = flb_upstream_conn_get(u);
+    ASSERT_TRUE(conn != NULL);
+    EXPECT_EQ(u->stats.hits, 0);
+    EXPECT_EQ(u->stats.misses, 2);
+    EXPECT_EQ(u->stats.evictions, 1);
+    EXPECT_EQ(u->n_connections, 1);
+    flb_upstream_conn_release(conn);
+}
+
+TEST_F(Upstream, no_recycle) {
+    struct flb_upstream_conn *conn;
+
+    /* e.g: a response was not fully read */
+    conn = flb_upstream_conn_get(u);
+    ASSERT_TRUE(conn != NULL);
+    conn->recycle = FLB_FALSE;
+    flb_upstream_conn_release(conn);
+    EXPECT_EQ(u->n_connections, 0);
+    EXPECT_EQ(mk_list_is_empty(&u->av_queue), 0);
+}
+
+TEST_F(Upstream, idle_timeout) {
+    struct flb_upstream_conn *conn;
+
+    u->keepalive_idle_timeout = 1;
+
+    conn = flb_upstream_conn_get(u);
+    ASSERT_TRUE(conn != NULL);
+    flb_upstream_conn_release(conn);
+    sleep(2);
+
+    conn = flb_upstream_conn_get(u);
+    ASSERT_TRUE(conn != NULL);
+    EXPECT_EQ(u->stats.hits, 0);
+    EXPECT_EQ(u->stats.evictions, 1);
+    EXPECT_EQ(u->n_connections, 1);
+    flb_upstream_conn_release(conn);
+}
+
+TEST_F(Upstream, max_connections) {
+    struct flb_upstream_conn *c1;
+    struct flb_upstream_conn *c2;
+
+    u->max_connections = 1;
+
+    c1 = flb_upstream_conn_get(u);
+    ASSERT_TRUE(c1 != NULL);
+
+    /* not running in a co-routine, the caller cannot wait */
+    c2 = flb_upstream_conn_get(u);
+    EXPECT_TRUE(c2 == NULL);
+    EXPECT_EQ(u->n_connections, 1);
+
+    flb_upstream_conn_release(c1);
+    c2 = flb_upstream_conn_get(u);
+    ASSERT_TRUE(c2 != NULL);
+    EXPECT_EQ(c2, c1);
+    flb_upstream_conn_release(c2);
+}
+
+TEST_F(Upstream, writev) {
+    int ret;
+    int cfd;
+    size_t len = 0;
+    size_t total = 0;
+    char buf[64];
+    struct iovec iov[3];
+    struct flb_upstream_conn *conn;
+
+    conn = flb_upstream_conn_get(u);
+    ASSERT_TRUE(conn != NULL);
+
+    iov[0].iov_base = (void *) "head|";
+    iov[0].iov_len  = 5;
+    iov[1].iov_base = (void *) "";
+    iov[1].iov_len  = 0;
+    iov[2].iov_base = (void *) "body";
+    iov[2].iov_len  = 4;
+
+    ret = flb_io_net_writev(conn, iov, 3, &len);
+    EXPECT_EQ(ret, 0);
+    EXPECT_EQ(len, 9);
+    EXPECT_EQ(iov[0].iov_len, 5);
+
+    cfd = accept(lfd, NULL, NULL);
+    ASSERT_NE(cfd, -1);
+    while (total < 9) {
+        ret = read(cfd, buf + total, sizeof(buf) - total);
+        ASSERT_GT(ret, 0);
+        total += ret;
+    }
+    EXPECT_EQ(memcmp(buf, "head|body", 9), 0);
+
+    close(cfd);
+    flb_upstream_conn_release(conn);
+}
+
+/* Many entries and more data than the socket buffers, partial writes */
+TEST_F(Upstream, writev_large) {
+    int i;
+    int ret;
+    int cfd;
+    int count = 2048;
+    size_t len = 0;
+    size_t total = 0;
+    size_t entry = 4096;
+    char *data;
+    char *out;
+    struct iovec *iov;
+    std::thread reader;
+    struct flb_upstream_conn *conn;
+
+    data = (char *) malloc(entry * count);
+    out  = (char *) malloc(entry * count);
+    iov  = (struct iovec *) malloc(sizeof(struct iovec) * count);
+    for (i = 0; i < count; i++) {
+        memset(data + (i * entry), 'a' + (i % 26), entry);
+        iov[i].iov_base = data + (i * entry);
+        iov[i].iov_len  = entry;
+    }
+
+    conn = flb_upstream_conn_get(u);
+    ASSERT_TRUE(conn != NULL);
+
+    cfd = accept(lfd, NULL, NULL);
+    ASSERT_NE(cfd, -1);
+    reader = std::thread([&]() {
+        ssize_t r;
+        while (total < entry * count) {
+            r = read(cfd, out + total, (entry * count) - total);
+            if (r <= 0) {
+                break;
+            }
+            total += r;
+        }
+    });
+
+    ret = flb_io_net_writev(conn, iov, count, &len);
+    reader.join();
+
+    EXPECT_EQ(ret, 0);
+    EXPECT_EQ(len, entry * count);
+    EXPECT_EQ(total, entry * count);
+    EXPECT_EQ(memcmp(data, out, entry * count), 0);
+
+    close(cfd);
+    flb_upstream_conn_release(conn);
+    free(iov);
+    free(out);
+    free(data);
+}
+
+/* The peer never answers, the read fails once the timeout expires */
+TEST_F(Upstream, read_timeout) {
+    int cfd;
+    ssize_t ret;
+    char buf[64];
+    time_t start;
+    struct flb_upstream_conn *conn;
+
+    u->read_timeout = 1;
+    conn = flb_upstream_conn_get(u);
+    ASSERT_TRUE(conn != NULL);
+    cfd = accept(lfd, NULL, NULL);
+    ASSERT_NE(cfd, -1);
+
+    start = time(NULL);
+    ret = flb_io_net_read(conn, buf, sizeof(buf));
+    EXPECT_EQ(ret, -1);
+    EXPECT_LE(time(NULL) - start, 3);
+    EXPECT_EQ(conn->recycle, FLB_FALSE);
+    EXPECT_EQ(u->stats.timeouts, 1);
+
+    close(cfd);
+    flb_upstream_conn_release(conn);
+    EXPECT_EQ(u->n_connections, 0);
+}
+
+/* The peer never reads, the write fails once the socket buffers are full */
+TEST_F(Upstream, write_timeout) {
+    int ret;
+    int cfd;
+    size_t len = 0;
+    size_t size = 64 * 1024 * 1024;
+    char *data;
+    struct flb_upstream_conn *conn;
+
+    data = (char *) calloc(1, size);
+    ASSERT_TRUE(data != NULL);
+
+    u->write_timeout = 1;
+    conn = flb_upstream_conn_get(u);
+    ASSERT_TRUE(conn != NULL);
+    cfd = accept(lfd, NULL, NULL);
+    ASSERT_NE(cfd, -1);
+
+    ret = flb_io_net_write(conn, data, size, &len);
+    EXPECT_EQ(ret, -1);
+    EXPECT_EQ(conn->recycle, FLB_FALSE);
+    EXPECT_EQ(u->stats.timeouts, 1);
+
+    close(cfd);
+    flb_upstream_conn_release(conn);
+    free(data);
+}
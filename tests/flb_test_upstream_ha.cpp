@@ -0,0 +1,233 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#include <gtest/gtest.h>
+#include <fluent-bit.h>
+
+#include <stdio.h>
+#include <unistd.h>
+
+extern "C" {
+#include <fluent-bit/flb_log.h>
+#include <fluent-bit/flb_config.h>
+#include <fluent-bit/flb_io.h>
+#include <fluent-bit/flb_upstream_ha.h>
+}
+
+class UpstreamHA : public ::testing::Test {
+protected:
+    struct flb_config config;
+    struct flb_upstream_ha *ha;
+
+    virtual void SetUp() {
+        flb_log_init(FLB_LOG_STDERR, FLB_LOG_ERROR, NULL);
+
+        memset(&config, 0, sizeof(config));
+        config.flush_method = FLB_FLUSH_PTHREADS;
+        ha = flb_upstream_ha_create((char *) "test");
+        ASSERT_TRUE(ha != NULL);
+    }
+
+    virtual void TearDown() {
+        flb_upstream_ha_destroy(ha);
+    }
+
+    void add_nodes(int count, const int *weights) {
+        int i;
+        char name[16];
+        struct flb_upstream_node *node;
+
+        for (i = 0; i < count; i++) {
+            snprintf(name, sizeof(name), "node-%i", i);
+            node = flb_upstream_node_create(name, (char *) "127.0.0.1",
+                                            24224 + i,
+                                            weights ? weights[i] : 1,
+                                            &config, FLB_IO_TCP, NULL);
+            ASSERT_TRUE(node != NULL);
+            ASSERT_EQ(flb_upstream_ha_node_add(ha, node), 0);
+        }
+    }
+
+    /* Get a node for a new flush and report success right away */
+    int next_id() {
+        uint64_t tried = 0;
+        struct flb_upstream_node *node;
+
+        node = flb_upstream_ha_node_get(ha, &tried);
+        if (!node) {
+            return -1;
+        }
+        flb_upstream_ha_node_done(ha, node, FLB_TRUE);
+        return node->id;
+    }
+};
+
+TEST_F(UpstreamHA, round_robin) {
+    add_nodes(3, NULL);
+
+    EXPECT_EQ(next_id(), 0);
+    EXPECT_EQ(next_id(), 1);
+    EXPECT_EQ(next_id(), 2);
+    EXPECT_EQ(next_id(), 0);
+}
+
+TEST_F(UpstreamHA, failover) {
+    uint64_t tried = 0;
+    struct flb_upstream_node *a;
+    struct flb_upstream_node *b;
+    struct flb_upstream_node *c;
+
+    add_nodes(3, NULL);
+    ha->max_failures = 3;
+
+    /* the same data goes to every node once */
+    a = flb_upstream_ha_node_get(ha, &tried);
+    flb_upstream_ha_node_done(ha, a, FLB_FALSE);
+    b = flb_upstream_ha_node_get(ha, &tried);
+    flb_upstream_ha_node_done(ha, b, FLB_FALSE);
+    c = flb_upstream_ha_node_get(ha, &tried);
+    flb_upstream_ha_node_done(ha, c, FLB_FALSE);
+
+    ASSERT_TRUE(a && b && c);
+    EXPECT_NE(a, b);
+    EXPECT_NE(b, c);
+    EXPECT_NE(a, c);
+    EXPECT_TRUE(flb_upstream_ha_node_get(ha, &tried) == NULL);
+    EXPECT_EQ(tried, 7);
+
+    /* not ejected yet, available for new data */
+    EXPECT_NE(next_id(), -1);
+}
+
+TEST_F(UpstreamHA, ejection) {
+    time_t now;
+    uint64_t tried = 0;
+    struct flb_upstream_node *node;
+
+    add_nodes(2, NULL);
+    ha->max_failures = 2;
+    ha->backoff_base = 10;
+
+    node = flb_upstream_ha_node_get(ha, &tried);
+    ASSERT_EQ(node->id, 0);
+    flb_upstream_ha_node_done(ha, node, FLB_FALSE);
+    EXPECT_EQ(node->ejections, 0);
+
+    tried = 0;
+    ha->index = 0;
+    node = flb_upstream_ha_node_get(ha, &tried);
+    ASSERT_EQ(node->id, 0);
+    flb_upstream_ha_node_done(ha, node, FLB_FALSE);
+    EXPECT_EQ(node->ejections, 1);
+
+    /* only node-1 is healthy */
+    EXPECT_EQ(next_id(), 1);
+    EXPECT_EQ(next_id(), 1);
+
+    /* back after the backoff, a single error doubles the ejection */
+    node->ejected_until = 0;
+    tried = 0;
+    ha->index = 0;
+    node = flb_upstream_ha_node_get(ha, &tried);
+    ASSERT_EQ(node->id, 0);
+    now = time(NULL);
+    flb_upstream_ha_node_done(ha, node, FLB_FALSE);
+    EXPECT_EQ(node->ejections, 2);
+    EXPECT_GE(node->ejected_until, now + 20);
+
+    /* success clears the health state */
+    node->ejected_until = 0;
+    ha->index = 0;
+    EXPECT_EQ(next_id(), 0);
+    EXPECT_EQ(node->ejections, 0);
+    EXPECT_EQ(node->failures, 0);
+}
+
+TEST_F(UpstreamHA, least_inflight) {
+    uint64_t t1 = 0;
+    uint64_t t2 = 0;
+    uint64_t t3 = 0;
+    struct flb_upstream_node *a;
+    struct flb_upstream_node *b;
+    struct flb_upstream_node *c;
+
+    add_nodes(2, NULL);
+    ha->policy = FLB_UPSTREAM_HA_LEAST_INFLIGHT;
+
+    /* node-0 is slow, keeps the flush in progress */
+    a = flb_upstream_ha_node_get(ha, &t1);
+    ASSERT_EQ(a->id, 0);
+    b = flb_upstream_ha_node_get(ha, &t2);
+    ASSERT_EQ(b->id, 1);
+    flb_upstream_ha_node_done(ha, b, FLB_TRUE);
+
+    c = flb_upstream_ha_node_get(ha, &t3);
+    EXPECT_EQ(c->id, 1);
+    EXPECT_EQ(a->inflight, 1);
+    EXPECT_EQ(c->inflight, 1);
+
+    flb_upstream_ha_node_done(ha, c, FLB_TRUE);
+    flb_upstream_ha_node_done(ha, a, FLB_TRUE);
+}
+
+TEST_F(UpstreamHA, weighted) {
+    int i;
+    int hits[3] = {0, 0, 0};
+    const int weights[3] = {5, 1, 1};
+
+    add_nodes(3, weights);
+    ha->policy = FLB_UPSTREAM_HA_WEIGHTED;
+
+    for (i = 0; i < 70; i++) {
+        hits[next_id()]++;
+    }
+    EXPECT_EQ(hits[0], 50);
+    EXPECT_EQ(hits[1], 10);
+    EXPECT_EQ(hits[2], 10);
+}
+
+TEST_F(UpstreamHA, from_file) {
+    FILE *fp;
+    char path[] = "/tmp/flb_test_upstream_ha.XXXXXX";
+    struct flb_upstream_ha *f;
+    struct flb_upstream_node *node;
+
+    ASSERT_NE(mkstemp(path), -1);
+    fp = fopen(path, "w");
+    ASSERT_TRUE(fp != NULL);
+    fprintf(fp,
+            "[UPSTREAM]\n"
+            "    Name   aggregators\n"
+            "    Policy weighted\n"
+            "    Max_Failures 3\n"
+            "\n"
+            "[NODE]\n"
+            "    Name   agg-1\n"
+            "    Host   127.0.0.1\n"
+            "    Port   24224\n"
+            "    Weight 3\n"
+            "\n"
+            "[NODE]\n"
+            "    Host   127.0.0.2\n"
+            "    Port   24225\n");
+    fclose(fp);
+
+    f = flb_upstream_ha_from_file(path, &config, FLB_IO_TCP, NULL);
+    unlink(path);
+    ASSERT_TRUE(f != NULL);
+
+    EXPECT_STREQ(f->name, "aggregators");
+    EXPECT_EQ(f->policy, FLB_UPSTREAM_HA_WEIGHTED);
+    EXPECT_EQ(f->max_failures, 3);
+    ASSERT_EQ(f->count, 2);
+
+    node = mk_list_entry_first(&f->nodes, struct flb_upstream_node, _head);
+    EXPECT_STREQ(node->name, "agg-1");
+    EXPECT_EQ(node->weight, 3);
+    EXPECT_EQ(node->u->tcp_port, 24224);
+
+    node = mk_list_entry_last(&f->nodes, struct flb_upstream_node, _head);
+    EXPECT_STREQ(node->name, "127.0.0.2");
+    EXPECT_EQ(node->weight, 1);
+
+    flb_upstream_ha_destroy(f);
+}